@@ -9,6 +9,17 @@ int main(int argc, const char** argv) {
                return true;
              });
 
+  // Built with `-Dalloc_accounting=true`, GET /allocations reports what the
+  // requests of every route allocated
+  if (eagle::allocation_accounting::available()) {
+    auto& allocations = app.enable_allocation_accounting();
+    app.handle(eagle::verb::get, "/allocations",
+               [&allocations](const auto& req, auto& resp) -> bool {
+                 resp.html() << allocations.report();
+                 return true;
+               });
+  }
+
   app.start();
 
   return 0;
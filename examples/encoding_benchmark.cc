@@ -0,0 +1,139 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <value_encoding.hpp>
+
+// Compares the cost and the size of a body encoded as JSON through the
+// ostream writer, as handlers do it today, to the value encoder in JSON,
+// MessagePack and CBOR, and the cost of reading the binary ones back.
+//
+// Usage: eagle_encoding_benchmark [iterations]
+
+namespace {
+
+struct user {
+  int64_t id_;
+  std::string name_;
+  std::string email_;
+  double score_;
+  bool active_;
+  std::vector<std::string> tags_;
+};
+
+std::vector<user> make_users(size_t count) {
+  std::vector<user> users;
+  for (size_t idx = 0; idx < count; idx++) {
+    users.push_back({static_cast<int64_t>(100000 + idx * 7919),
+                     "user " + std::to_string(idx),
+                     "user" + std::to_string(idx) + "@example.com",
+                     idx * 0.37, idx % 3 != 0,
+                     {"mobile", "beta", "tier-" + std::to_string(idx % 4)}});
+  }
+  return users;
+}
+
+void write_ostream(std::ostream& out, const std::vector<user>& users) {
+  out << "[";
+  for (size_t idx = 0; idx < users.size(); idx++) {
+    const auto& u = users[idx];
+    out << (idx ? "," : "") << "{\"id\":" << u.id_ << ",\"name\":\""
+        << u.name_ << "\",\"email\":\"" << u.email_
+        << "\",\"score\":" << u.score_
+        << ",\"active\":" << (u.active_ ? "true" : "false") << ",\"tags\":[";
+    for (size_t tag = 0; tag < u.tags_.size(); tag++) {
+      out << (tag ? "," : "") << "\"" << u.tags_[tag] << "\"";
+    }
+    out << "]}";
+  }
+  out << "]";
+}
+
+void write_encoder(eagle::value_encoder& out, const std::vector<user>& users) {
+  out << eagle::array_of{users.size()};
+  for (const auto& u : users) {
+    out << eagle::map_of{6} << "id" << u.id_ << "name" << u.name_ << "email"
+        << u.email_ << "score" << u.score_ << "active" << u.active_ << "tags"
+        << eagle::array_of{u.tags_.size()};
+    for (const auto& tag : u.tags_) {
+      out << tag;
+    }
+  }
+}
+
+template <typename Fn>
+double ns_per_run(size_t iterations, Fn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t idx = 0; idx < iterations; idx++) {
+    fn();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+void report(std::string_view name,
+            double ns,
+            size_t count,
+            std::string_view unit = "bytes") {
+  std::cout << "  " << std::left << std::setw(20) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(0) << ns
+            << " ns" << std::setw(10) << count << " " << unit << std::endl;
+}
+
+void compare(std::string_view payload,
+             const std::vector<user>& users,
+             size_t iterations) {
+  std::cout << payload << std::endl;
+
+  // One stream reused, as the writer of a response
+  std::ostringstream text;
+  auto ostream_ns = ns_per_run(iterations, [&] {
+    text.str({});
+    write_ostream(text, users);
+  });
+  report("json (ostream)", ostream_ns, text.str().size());
+
+  for (auto format : {eagle::body_format::json, eagle::body_format::msgpack,
+                      eagle::body_format::cbor}) {
+    std::ostringstream body;
+    auto encode_ns = ns_per_run(iterations, [&] {
+      body.str({});
+      eagle::value_encoder encoder{format, *body.rdbuf()};
+      write_encoder(encoder, users);
+    });
+    auto name = std::string(eagle::content_type_of(format).substr(12));
+    report(name + " (encoder)", encode_ns, body.str().size());
+
+    if (format == eagle::body_format::json) {
+      continue;
+    }
+
+    auto bytes = body.str();
+    size_t values = 0;
+    auto decode_ns = ns_per_run(iterations, [&] {
+      eagle::value_reader reader{format, bytes};
+      values = 0;
+      while (reader.next()) {
+        values++;
+      }
+    });
+    report(name + " (reader)", decode_ns, values, "values");
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+  compare("one record", make_users(1), iterations);
+  compare("page of 50 records", make_users(50), iterations / 50 + 1);
+  compare("export of 5000 records", make_users(5000), iterations / 5000 + 1);
+
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <rate_limiter.hpp>
+
+// Measures the cost the rate limiting interceptor adds to a request when the
+// limiter tracks a large number of active keys.
+//
+// Usage: eagle_rate_limiter_benchmark [keys] [requests per thread] [threads]
+
+namespace {
+
+// The text of the address of a client, made in place: a request carries its
+// peer address, reading it from a table of a million would add a cache miss
+// of the benchmark itself to every request.
+std::string_view address_of(uint32_t idx, std::array<char, 16>& text) {
+  auto length = std::snprintf(text.data(), text.size(), "10.%u.%u.%u",
+                              (idx >> 16) & 0xff, (idx >> 8) & 0xff,
+                              idx & 0xff);
+  return {text.data(), static_cast<size_t>(length)};
+}
+
+double run(size_t thread_count,
+           size_t requests,
+           const std::vector<uint32_t>& order,
+           const eagle::interceptor_type& interceptor) {
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; t++) {
+    threads.emplace_back([&, t] {
+      eagle::request req;
+      eagle::response resp;
+      std::array<char, 16> text;
+      for (size_t idx = 0; idx < requests; idx++) {
+        req.peer(address_of(order[(idx + t * 7919) % order.size()], text));
+        interceptor(req, resp);
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / requests;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t key_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  size_t requests = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000000;
+  size_t thread_count = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+
+  std::vector<uint32_t> order(1 << 22);
+  std::mt19937 rng{42};
+  for (auto& idx : order) {
+    idx = rng() % key_count;
+  }
+
+  eagle::rate_limit_options options;
+  options.rate_ = 1e9;
+  options.burst_ = 1e9;
+  auto limiter = std::make_shared<eagle::rate_limiter>(options);
+  auto interceptor =
+      eagle::rate_limit(limiter, eagle::rate_limit_key::peer());
+
+  // Every key is active before measuring
+  std::array<char, 16> text;
+  for (uint32_t idx = 0; idx < key_count; idx++) {
+    limiter->allow(address_of(idx, text));
+  }
+
+  // Best of a few interleaved runs, a noisy neighbour only slows some down
+  double baseline = 1e9;
+  double limited = 1e9;
+  for (int round = 0; round < 5; round++) {
+    baseline = std::min(
+        baseline,
+        run(thread_count, requests, order, [](const auto&, auto&) {}));
+    limited =
+        std::min(limited, run(thread_count, requests, order, interceptor));
+  }
+
+  std::cout << limiter->size() << " active keys, " << thread_count
+            << " threads" << std::endl;
+  std::cout << "empty interceptor: " << baseline << " ns/request" << std::endl;
+  std::cout << "rate limit interceptor: " << limited << " ns/request"
+            << std::endl;
+  std::cout << "added: " << limited - baseline << " ns/request" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <replay.hpp>
+
+// Replays the requests of a capture, see `app.capture`, to a server and
+// reports its latencies.
+//
+// Usage: eagle_replay <capture> <address> <port> [rate scale] [concurrency]
+//
+// A rate scale of 1 sends the requests at their original pace, 2 twice as
+// fast, 0 as fast as the server answers.
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " <capture> <address> <port> [rate scale] [concurrency]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  auto requests = eagle::load_capture(argv[1]);
+  if (!requests) {
+    std::cerr << "Can't read the capture " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  beast::error_code ec;
+  auto address = net::ip::make_address(argv[2], ec);
+  if (ec) {
+    std::cerr << "Invalid address " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  eagle::replay_options options;
+  options.rate_scale_ = argc > 4 ? std::strtod(argv[4], nullptr) : 1.0;
+  options.concurrency_ = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 4;
+
+  tcp::endpoint server{address,
+                       static_cast<uint16_t>(std::atoi(argv[3]))};
+  auto report = eagle::replay(server, *requests, options);
+  std::cout << report.summary();
+  return report.failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <eagle.hpp>
+#include <tls_connection.hpp>
+
+// Measures how many TLS handshakes per second an eagle TLS server completes
+// when every client negotiates a new session versus when clients resume a
+// cached session (session ID or ticket).
+//
+// Usage: eagle_tls_benchmark [iterations] [port]
+
+namespace {
+
+bool handshake(uint16_t port, SSL_CTX* client_ctx, SSL_SESSION** session) {
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  beast::error_code ec;
+  socket.connect({net::ip::make_address("127.0.0.1"), port}, ec);
+  if (ec) {
+    return false;
+  }
+
+  auto ssl = SSL_new(client_ctx);
+  SSL_set_fd(ssl, static_cast<int>(socket.native_handle()));
+  if (session && *session) {
+    SSL_set_session(ssl, *session);
+  }
+
+  auto ok = SSL_connect(ssl) == 1;
+  if (ok) {
+    std::string request = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    SSL_write(ssl, request.data(), static_cast<int>(request.size()));
+
+    char buffer[512];
+    while (SSL_read(ssl, buffer, sizeof(buffer)) > 0) {
+    }
+
+    if (session) {
+      if (*session) {
+        SSL_SESSION_free(*session);
+      }
+      *session = SSL_get1_session(ssl);
+    }
+
+    // OpenSSL invalidates the sessions of connections that are not shut down
+    SSL_shutdown(ssl);
+  }
+
+  SSL_free(ssl);
+  return ok;
+}
+
+void run(const char* name,
+         uint16_t port,
+         size_t iterations,
+         SSL_CTX* client_ctx,
+         bool resume) {
+  SSL_SESSION* session = nullptr;
+  if (resume) {
+    // Prime the session the rest of the handshakes resume
+    handshake(port, client_ctx, &session);
+  }
+
+  size_t completed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t idx = 0; idx < iterations; idx++) {
+    completed += handshake(port, client_ctx, resume ? &session : nullptr);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::cout << name << ": " << completed << " handshakes in "
+            << elapsed.count() << "s, " << completed / elapsed.count()
+            << " handshakes/s" << std::endl;
+
+  if (session) {
+    SSL_SESSION_free(session);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+  uint16_t port = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 3443;
+
+  // The server thread runs until the process exits
+  auto app = new eagle::app<eagle::tls_connection>();
+  app->connection_context().use_self_signed_certificate();
+  app->handle(eagle::verb::get, "/ping", [](const auto&, auto& resp) {
+    resp.html() << "pong";
+    return true;
+  });
+  std::thread([app, port] { app->start("127.0.0.1", port); }).detach();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto client_ctx = SSL_CTX_new(TLS_client_method());
+  run("full", port, iterations, client_ctx, false);
+  run("resumed", port, iterations, client_ctx, true);
+  SSL_CTX_free(client_ctx);
+
+  auto stats = app->connection_context().stats();
+  std::cout << "server: " << stats.accepted << " accepted, " << stats.resumed
+            << " session cache hits" << std::endl;
+
+  std::_Exit(0);
+}
@@ -0,0 +1,134 @@
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <eagle.hpp>
+#include <websocket.hpp>
+
+// Measures the rate at which an eagle server fans out messages published to a
+// topic with many local websocket subscribers.
+//
+// Usage: eagle_websocket_benchmark [clients] [messages] [message size]
+
+namespace {
+
+struct client {
+  explicit client(net::io_context& ioc) : ws_(ioc) {}
+
+  void read(std::atomic<size_t>& received) {
+    ws_.async_read(buffer_, [this, &received](beast::error_code ec,
+                                              std::size_t) {
+      if (ec) {
+        return;
+      }
+
+      received++;
+      buffer_.consume(buffer_.size());
+      read(received);
+    });
+  }
+
+  websocket::stream<tcp::socket> ws_;
+  beast::flat_buffer buffer_;
+};
+
+// Both ends of every connection live in this process
+void raise_descriptor_limit() {
+  rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t client_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+  size_t messages = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+  size_t message_size = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 128;
+
+  raise_descriptor_limit();
+
+  eagle::websocket_hub hub;
+  std::atomic<size_t> subscribed{0};
+
+  eagle::websocket_handler handler;
+  handler.options_.max_queue_ = messages;
+  handler.on_open_ = [&](const auto& session) {
+    hub.subscribe("bench", session);
+    subscribed++;
+  };
+
+  eagle::app app;
+  app.websocket("/bench", std::move(handler));
+
+  net::io_context listener_ioc;
+  tcp::acceptor listener{listener_ioc, {net::ip::make_address("127.0.0.1"), 0}};
+  auto port = listener.local_endpoint().port();
+  app.adopt(listener.release());
+  std::thread server([&] { app.start(); });
+
+  net::io_context client_ioc;
+  std::vector<std::unique_ptr<client>> clients;
+  std::atomic<size_t> received{0};
+  for (size_t idx = 0; idx < client_count; idx++) {
+    auto c = std::make_unique<client>(client_ioc);
+    beast::error_code ec;
+    c->ws_.next_layer().connect({net::ip::make_address("127.0.0.1"), port},
+                                ec);
+    if (!ec) {
+      c->ws_.handshake("127.0.0.1", "/bench", ec);
+    }
+
+    if (ec) {
+      std::cerr << "Client " << idx << " failed to connect: " << ec.message()
+                << std::endl;
+      break;
+    }
+
+    c->read(received);
+    clients.push_back(std::move(c));
+  }
+
+  while (subscribed < clients.size()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::thread client_thread([&] { client_ioc.run(); });
+
+  auto expected = clients.size() * messages;
+  auto payload = std::string(message_size, 'x');
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t idx = 0; idx < messages; idx++) {
+    hub.publish("bench", payload);
+  }
+  std::chrono::duration<double> published =
+      std::chrono::steady_clock::now() - start;
+
+  while (received < expected) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  std::chrono::duration<double> delivered =
+      std::chrono::steady_clock::now() - start;
+
+  std::cout << clients.size() << " clients, " << messages << " messages of "
+            << message_size << " bytes" << std::endl;
+  std::cout << "publish: " << published.count() * 1e9 / expected
+            << " ns/subscriber" << std::endl;
+  std::cout << "delivered: " << expected / delivered.count()
+            << " messages/s" << std::endl;
+
+  app.drain(std::chrono::milliseconds(0));
+  server.join();
+  client_ioc.stop();
+  client_thread.join();
+
+  return 0;
+}
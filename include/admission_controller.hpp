@@ -0,0 +1,145 @@
+#ifndef EAGLE_ADMISSION_CONTROLLER_HPP
+#define EAGLE_ADMISSION_CONTROLLER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+namespace eagle {
+
+struct admission_options {
+  // Hard limit of requests in flight, 0 means unlimited. Each connection
+  // carries one request, so this is also the connection limit.
+  size_t max_in_flight_{0};
+
+  // Adapt the concurrency limit to the observed latency. When requests start
+  // queueing their latency grows and the limit shrinks until the latency
+  // goes back to the baseline.
+  bool adaptive_{false};
+  size_t initial_limit_{256};
+  size_t min_limit_{16};
+  size_t max_limit_{16384};
+  // Latency growth accepted (relative to the long term baseline) before the
+  // limit is reduced.
+  double tolerance_{2.0};
+  // Weight given to the newly computed limit.
+  double smoothing_{0.2};
+};
+
+/// Decides whether a new request can be served or should be shed with a fast
+/// 503. On top of an optional hard limit, it implements a gradient based
+/// concurrency limit: the ratio between the long term and the recent latency
+/// tells whether requests are queueing, the limit is scaled by that ratio
+/// (clamped to [0.5, 1]) and grows by a small queue allowance otherwise.
+///
+/// `try_admit` and `release` are safe to call from any thread.
+class admission_controller final {
+ public:
+  admission_controller() : admission_controller(admission_options{}) {}
+
+  explicit admission_controller(const admission_options& options) {
+    configure(options);
+  }
+
+  ~admission_controller() = default;
+
+  void configure(const admission_options& options) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    options_ = options;
+    limit_ = static_cast<double>(options_.initial_limit_);
+    current_limit_ = options_.initial_limit_;
+  }
+
+  bool enabled() const { return options_.max_in_flight_ || options_.adaptive_; }
+
+  /// Reserves a slot for a new request. Every successful call must be matched
+  /// by a `release`.
+  bool try_admit() {
+    auto in_flight = ++in_flight_;
+    auto over_hard_limit =
+        options_.max_in_flight_ && in_flight > options_.max_in_flight_;
+    auto over_adaptive_limit = options_.adaptive_ && in_flight > current_limit_;
+
+    if (over_hard_limit || over_adaptive_limit) {
+      --in_flight_;
+      shed_++;
+      return false;
+    }
+
+    return true;
+  }
+
+  /// Frees the slot of a request which waited `latency` to be served.
+  void release(std::chrono::nanoseconds latency) {
+    auto in_flight = in_flight_--;
+    if (options_.adaptive_) {
+      sample_(std::chrono::duration<double, std::micro>(latency).count(),
+              in_flight);
+    }
+  }
+
+  /// Frees the slot of a request which was never served.
+  void release() { in_flight_--; }
+
+  size_t limit() const { return current_limit_; }
+
+  size_t in_flight() const { return in_flight_; }
+
+  uint64_t shed() const { return shed_; }
+
+ private:
+  void sample_(double latency, size_t in_flight) {
+    // Samples are only a signal, skipping some under contention is harmless
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock) {
+      return;
+    }
+
+    if (long_latency_ == 0) {
+      long_latency_ = short_latency_ = latency;
+    }
+
+    short_latency_ += (latency - short_latency_) / 10;
+    long_latency_ += (latency - long_latency_) / 600;
+
+    // After a long period of higher latency the baseline drifts up, pull it
+    // back so the limit can recover.
+    if (long_latency_ / short_latency_ > 2) {
+      long_latency_ *= 0.95;
+    }
+
+    // The limit is not probed upwards when the traffic doesn't use it
+    if (in_flight < limit_ / 2) {
+      return;
+    }
+
+    auto gradient = std::clamp(
+        options_.tolerance_ * long_latency_ / short_latency_, 0.5, 1.0);
+    auto queue_allowance = std::sqrt(limit_);
+    auto new_limit = limit_ * gradient + queue_allowance;
+
+    limit_ = std::clamp(
+        limit_ * (1 - options_.smoothing_) + new_limit * options_.smoothing_,
+        static_cast<double>(options_.min_limit_),
+        static_cast<double>(options_.max_limit_));
+    current_limit_ = static_cast<size_t>(limit_);
+  }
+
+ private:
+  admission_options options_;
+  std::atomic<size_t> in_flight_{0};
+  std::atomic<size_t> current_limit_{0};
+  std::atomic<uint64_t> shed_{0};
+
+  std::mutex mutex_;
+  double limit_{0};
+  double short_latency_{0};
+  double long_latency_{0};
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_ADMISSION_CONTROLLER_HPP
@@ -0,0 +1,160 @@
+#ifndef EAGLE_ALLOC_ACCOUNTING_HPP
+#define EAGLE_ALLOC_ACCOUNTING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "alloc_scope.hpp"
+#include "common.hpp"
+#include "per_thread.hpp"
+
+namespace eagle {
+
+/// Allocations of the requests of a route, see
+/// `allocation_accounting::by_route`.
+struct route_allocations {
+  std::string route_;
+  uint64_t requests_{0};
+  uint64_t allocations_{0};
+  uint64_t bytes_{0};
+  // Of the request which allocated the most
+  uint64_t max_allocations_{0};
+  // Requests which allocated more than the budget of the route
+  uint64_t over_budget_{0};
+};
+
+/// Totals the allocations of the requests per route pattern, from the
+/// interceptors to the serialization of the response. See
+/// `app.enable_allocation_accounting`.
+///
+/// Budgets catch regressions: a test serves the requests of a route, then
+/// expects `over_budget()` to be empty.
+class allocation_accounting final {
+ public:
+  allocation_accounting() : tables_([] { return table{}; }) {}
+
+  /// Whether the allocations are actually counted, see `alloc_scope`.
+  static constexpr bool available() {
+#ifdef EAGLE_ALLOC_ACCOUNTING
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /// Requests of `route`, its pattern e.g. "/users/{integer:id}", which
+  /// allocate more than `max_allocations` times are over budget. Set before
+  /// serving.
+  void budget(std::string_view route, uint64_t max_allocations) {
+    budgets_[std::string(route)] = max_allocations;
+  }
+
+  /// Adds the allocations of one request of `route`, empty when no route
+  /// matched the request. `counters` is a copy, recording allocates.
+  void record(std::string_view route, alloc_counters counters) const {
+    auto budget = budgets_.find(route);
+    bool over = budget != budgets_.end() && counters.count_ > budget->second;
+
+    auto& local = tables_.local();
+    std::lock_guard<std::mutex> lock{local.mutex_};
+    auto itr = local.routes_.find(route);
+    if (itr == local.routes_.end()) {
+      itr = local.routes_.emplace(std::string(route), route_allocations{})
+                .first;
+      itr->second.route_ = itr->first;
+    }
+
+    auto& totals = itr->second;
+    totals.requests_++;
+    totals.allocations_ += counters.count_;
+    totals.bytes_ += counters.bytes_;
+    totals.max_allocations_ =
+        std::max(totals.max_allocations_, counters.count_);
+    // Logged once per route and thread, not on every request
+    if (over && totals.over_budget_++ == 0) {
+      LOG(WARNING) << "A request of [" << route << "] allocated "
+                   << counters.count_ << " times, over its budget of "
+                   << budget->second << std::endl;
+    }
+  }
+
+  /// The totals of every route so far, the most allocations first.
+  std::vector<route_allocations> by_route() const {
+    std::map<std::string, route_allocations, std::less<>> merged;
+    tables_.for_each([&merged](const table& local) {
+      std::lock_guard<std::mutex> lock{local.mutex_};
+      for (const auto& [route, totals] : local.routes_) {
+        auto& sum = merged[route];
+        sum.route_ = route;
+        sum.requests_ += totals.requests_;
+        sum.allocations_ += totals.allocations_;
+        sum.bytes_ += totals.bytes_;
+        sum.max_allocations_ =
+            std::max(sum.max_allocations_, totals.max_allocations_);
+        sum.over_budget_ += totals.over_budget_;
+      }
+    });
+
+    std::vector<route_allocations> routes;
+    for (auto& [_, totals] : merged) {
+      routes.push_back(std::move(totals));
+    }
+    std::stable_sort(routes.begin(), routes.end(),
+                     [](const auto& lhs, const auto& rhs) {
+                       return lhs.allocations_ > rhs.allocations_;
+                     });
+    return routes;
+  }
+
+  /// The routes with requests over their budget.
+  std::vector<route_allocations> over_budget() const {
+    auto routes = by_route();
+    routes.erase(std::remove_if(routes.begin(), routes.end(),
+                                [](const auto& totals) {
+                                  return totals.over_budget_ == 0;
+                                }),
+                 routes.end());
+    return routes;
+  }
+
+  /// `by_route` as a text table, one route per line.
+  std::string report() const {
+    std::string text =
+        "route                            requests  allocs/req  bytes/req"
+        "   max allocs  over budget\n";
+    for (const auto& totals : by_route()) {
+      auto requests = std::max<uint64_t>(totals.requests_, 1);
+      char line[256];
+      std::snprintf(line, sizeof(line),
+                    "%-32s %8llu %11.1f %10.1f %12llu %12llu\n",
+                    totals.route_.empty() ? "(unrouted)"
+                                          : totals.route_.c_str(),
+                    static_cast<unsigned long long>(totals.requests_),
+                    static_cast<double>(totals.allocations_) / requests,
+                    static_cast<double>(totals.bytes_) / requests,
+                    static_cast<unsigned long long>(totals.max_allocations_),
+                    static_cast<unsigned long long>(totals.over_budget_));
+      text += line;
+    }
+    return text;
+  }
+
+ private:
+  struct table {
+    mutable std::mutex mutex_;
+    std::map<std::string, route_allocations, std::less<>> routes_;
+  };
+
+  std::map<std::string, uint64_t, std::less<>> budgets_;
+  per_thread<table> tables_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_ALLOC_ACCOUNTING_HPP
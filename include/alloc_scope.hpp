@@ -0,0 +1,67 @@
+#ifndef EAGLE_ALLOC_SCOPE_HPP
+#define EAGLE_ALLOC_SCOPE_HPP
+
+#include <cstdint>
+
+namespace eagle {
+
+/// Allocations made through `operator new`, see `alloc_scope`.
+struct alloc_counters {
+  uint64_t count_{0};
+  uint64_t bytes_{0};
+};
+
+namespace detail {
+
+// The counters the allocations of the thread are added to, if any. Read by
+// the replaced `operator new` of src/alloc_accounting.cc.
+inline alloc_counters*& current_alloc_counters() {
+  static thread_local alloc_counters* counters = nullptr;
+  return counters;
+}
+
+}  // namespace detail
+
+/// Adds the allocations of the thread to `counters` over a scope, nothing
+/// when `counters` is nullptr. Scopes nest, the innermost one counts.
+///
+/// Allocations are only counted when built with the `alloc_accounting`
+/// meson option (which defines EAGLE_ALLOC_ACCOUNTING and replaces the
+/// global `operator new`), the counters stay at zero otherwise.
+class alloc_scope final {
+ public:
+  explicit alloc_scope(alloc_counters* counters)
+      : previous_(detail::current_alloc_counters()), active_(counters) {
+    if (active_) {
+      detail::current_alloc_counters() = active_;
+    }
+  }
+
+  ~alloc_scope() {
+    if (active_) {
+      detail::current_alloc_counters() = previous_;
+    }
+  }
+
+  alloc_scope(const alloc_scope&) = delete;
+  alloc_scope& operator=(const alloc_scope&) = delete;
+
+ private:
+  alloc_counters* previous_;
+  alloc_counters* active_;
+};
+
+/// The allocations `fn` makes on the calling thread.
+template <typename Fn>
+alloc_counters measure_allocations(Fn&& fn) {
+  alloc_counters counters;
+  {
+    alloc_scope scope{&counters};
+    fn();
+  }
+  return counters;
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_ALLOC_SCOPE_HPP
@@ -4,15 +4,33 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string_view>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
+#include <pthread.h>
+#include <sched.h>
+
+#include "admission_controller.hpp"
+#include "batch.hpp"
+#include "capture.hpp"
 #include "common.hpp"
 #include "connection.hpp"
 #include "dispatcher.hpp"
 #include "handler.hpp"
+#include "handoff.hpp"
+#include "object_pool.hpp"
+#include "probes.hpp"
+#include "proxy.hpp"
+#include "replay.hpp"
 
 namespace eagle {
 
@@ -20,10 +38,80 @@ namespace eagle {
 template <typename ConnectionType = connection>
 class app;
 
+namespace detail {
+
+// Connections may require state shared by every connection the app accepts,
+// e.g. the TLS configuration of a `tls_connection`. The app owns that state
+// when `ConnectionType::context_type` is defined.
+template <typename ConnectionType, typename = void>
+struct connection_context {
+  struct type {};
+  static constexpr bool value = false;
+};
+
+template <typename ConnectionType>
+struct connection_context<ConnectionType,
+                          std::void_t<typename ConnectionType::context_type>> {
+  using type = typename ConnectionType::context_type;
+  static constexpr bool value = true;
+};
+
+// Whether the connection can't answer in plain text on the accepted socket.
+template <typename ConnectionType, typename = void>
+struct is_secure_connection : std::false_type {};
+
+template <typename ConnectionType>
+struct is_secure_connection<ConnectionType,
+                            std::void_t<decltype(ConnectionType::secure)>>
+    : std::bool_constant<ConnectionType::secure> {};
+
+// Whether finished connections can be reset and reused for new sockets.
+template <typename ConnectionType, typename = void>
+struct is_reusable_connection : std::false_type {};
+
+template <typename ConnectionType>
+struct is_reusable_connection<ConnectionType,
+                              std::void_t<decltype(ConnectionType::reusable)>>
+    : std::bool_constant<ConnectionType::reusable> {};
+
+// Whether the connection tells when it dispatched its request.
+template <typename ConnectionType, typename = void>
+struct tracks_dispatch : std::false_type {};
+
+template <typename ConnectionType>
+struct tracks_dispatch<ConnectionType,
+                       std::void_t<decltype(&ConnectionType::dispatched_at)>>
+    : std::true_type {};
+
+}  // namespace detail
+
 struct option {
   std::string_view address_{"0.0.0.0"};
   size_t port_{3000};
   size_t thread_count_{3};
+  // Bind with SO_REUSEPORT so a new process can bind the same address while
+  // the previous one is still draining.
+  bool reuse_port_{false};
+
+  // Share-nothing mode: one io_context, acceptor and thread per shard. The
+  // acceptors are bound with SO_REUSEPORT and the kernel spreads the
+  // connections across them.
+  bool shard_per_core_{false};
+  // Number of shards, 0 means one per CPU the process is allowed to run on.
+  size_t shards_{0};
+  // Pin each shard's thread to its CPU.
+  bool pin_threads_{true};
+  // Steer connections to the shard running on the CPU that processed their
+  // packets (SO_INCOMING_CPU), requires `pin_threads_`.
+  bool incoming_cpu_{false};
+};
+
+/// Counters of a shard, see `app::shard_stats`.
+struct shard_stats {
+  size_t index_;
+  int cpu_;
+  uint64_t accepted_;
+  size_t active_connections_;
 };
 
 // Template deduction guide for the initialization. This tells the compiler,
@@ -57,59 +145,694 @@ class app {
   // TODO: Return a system error code here so that cleints can write:
   // int main() { return app.start(); }
   void start(const option app_options) {
-    start(app_options.address_, app_options.port_);
+    reuse_port_ = app_options.reuse_port_;
+    if (app_options.shard_per_core_) {
+      configure_shards_(app_options);
+    }
+
+    start(std::string(app_options.address_),
+          static_cast<uint16_t>(app_options.port_));
   }
 
   void start(std::optional<std::string> address = {},
              std::optional<uint16_t> port = {}) {
-    server_address_ = address.value_or("0.0.0.0");
-    server_port_ = port.value_or(3000);
+    auto& primary = *shards_.front();
+    if (!primary.acceptor_.is_open()) {
+      server_address_ = address.value_or("0.0.0.0");
+      server_port_ = port.value_or(3000);
+      bind_(primary, {net::ip::make_address(server_address_), server_port_});
+    }
 
-    tcp::acceptor acceptor{
-        ioc_, {net::ip::make_address(server_address_), server_port_}};
+    // The other shards listen on the same address, they are bound only now
+    // to pick the port the primary acceptor actually got.
+    for (size_t idx = 1; idx < shards_.size(); idx++) {
+      bind_(*shards_[idx], primary.acceptor_.local_endpoint());
+    }
 
-    accept_connection(acceptor);
     LOG(INFO) << "Serving HTTP on " << server_address_ << " @ " << server_port_
-              << " ..." << std::endl;
-    ioc_.run();
+              << " with " << shards_.size() << " shard(s) ..." << std::endl;
+
+    std::vector<std::thread> threads;
+    for (size_t idx = 1; idx < shards_.size(); idx++) {
+      threads.emplace_back([this, idx] { run_(*shards_[idx]); });
+    }
+
+    run_(primary);
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  /// Serves on an already listening socket instead of binding one, e.g. the
+  /// descriptor returned by `eagle::receive_listener` or inherited from the
+  /// parent process. The app takes ownership of `fd`.
+  bool adopt(int fd) {
+    sockaddr_storage addr{};
+    socklen_t length = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+      LOG(ERROR) << "Cannot adopt descriptor " << fd << std::endl;
+      return false;
+    }
+
+    beast::error_code ec;
+    auto& acceptor = shards_.front()->acceptor_;
+    acceptor.assign(addr.ss_family == AF_INET6 ? tcp::v6() : tcp::v4(), fd,
+                    ec);
+    if (ec) {
+      LOG(ERROR) << "Cannot adopt descriptor " << fd << ": " << ec.message()
+                 << std::endl;
+      return false;
+    }
+
+    auto endpoint = acceptor.local_endpoint();
+    server_address_ = endpoint.address().to_string();
+    server_port_ = endpoint.port();
+    return true;
+  }
+
+  /// Hands the listening socket to the next process asking for it on the Unix
+  /// socket `path` (see `eagle::receive_listener`). Once the socket is handed
+  /// off the app stops accepting and drains its in-flight requests for up to
+  /// `deadline`, then `start()` returns.
+  bool enable_handoff(const std::string& path,
+                      std::chrono::milliseconds deadline) {
+    beast::error_code ec;
+    unlink(path.c_str());
+    handoff_acceptor_.open(net::local::stream_protocol(), ec);
+    if (!ec) {
+      handoff_acceptor_.bind({path}, ec);
+    }
+    if (!ec) {
+      handoff_acceptor_.listen(net::socket_base::max_listen_connections, ec);
+    }
+
+    if (ec) {
+      LOG(ERROR) << "Cannot serve handoffs on " << path << ": " << ec.message()
+                 << std::endl;
+      return false;
+    }
+
+    accept_handoff_(path, deadline);
+    return true;
+  }
+
+  /// Stops accepting connections and lets the accepted ones finish for up to
+  /// `deadline`. `start()` returns once they are done or the deadline expires.
+  /// It is safe to call from any thread.
+  void drain(std::chrono::milliseconds deadline) {
+    auto expires_at = std::chrono::steady_clock::now() + deadline;
+    for (auto& s : shards_) {
+      net::post(s->ioc_, [this, &s = *s, expires_at] {
+        beast::error_code ec;
+        s.acceptor_.close(ec);
+        if (s.index_ == 0) {
+          handoff_acceptor_.close(ec);
+        }
+        wait_for_connections_(s, expires_at);
+      });
+    }
+  }
+
+  /// Number of connections accepted and not yet finished.
+  size_t active_connections() const {
+    size_t active = 0;
+    for (const auto& s : shards_) {
+      active += s->active_connections_;
+    }
+
+    return active;
+  }
+
+  /// Counters of every shard, a single one unless started in share-nothing
+  /// mode.
+  std::vector<eagle::shard_stats> shard_stats() const {
+    std::vector<eagle::shard_stats> stats;
+    for (const auto& s : shards_) {
+      stats.push_back({s->index_, s->cpu_, s->accepted_,
+                       s->active_connections_});
+    }
+
+    return stats;
+  }
+
+  /// Load shedding configuration. Requests over the limit are answered with a
+  /// pre-serialized 503 right after the accept, before reading anything.
+  admission_controller& admission() { return admission_; }
+
+  /// Callables of up to 48 bytes, e.g. lambdas capturing a few references,
+  /// are stored inline in the dispatch table.
+  template <typename Handler>
+  void handle(http::verb method, std::string_view endpoint, Handler&& h_fn) {
+    dispatcher_.add_handler(method, endpoint,
+                            handler_fn_type(std::forward<Handler>(h_fn)));
   }
 
-  void handle(http::verb method,
-              std::string_view endpoint,
-              handler_fn_type h_fn) {
-    dispatcher_.add_handler(method, endpoint, h_fn);
+  /// Only the methods `h_obj` implements are routed, they are called
+  /// directly, without going through `handler_interface` when the type
+  /// doesn't derive from it or is final. The other methods are answered 405
+  /// with a precomputed Allow header.
+  template <typename Handler,
+            typename = std::enable_if_t<is_static_handler_v<Handler>>>
+  void handle(std::string_view endpoint, Handler& h_obj) {
+    dispatcher_.add_static_handler(endpoint, h_obj);
   }
 
   void handle(std::string_view endpoint, handler_type& h_obj) {
     dispatcher_.add_handler(endpoint, h_obj);
   }
 
+  /// Routes `endpoint` to handler objects made by `factory`, one per thread
+  /// serving requests, so that their state needs no lock. The returned
+  /// object reads the instances, e.g. to sum their counters.
+  template <typename Factory>
+  auto handle_per_thread(std::string_view endpoint, Factory factory) {
+    per_thread handlers{std::move(factory)};
+    dispatcher_.add_per_thread_handler(endpoint, handlers);
+    return handlers;
+  }
+
+  /// Answers GET and HEAD `endpoint` with a pre-serialized `200 OK`, e.g.
+  /// for the health checks of a load balancer.
+  void health_check(std::string_view endpoint) {
+    handle(http::verb::get, endpoint, [](const request&, response& resp) {
+      resp.canned(canned_responses::health_ok());
+      return true;
+    });
+  }
+
+  /// Answers GET `endpoint?seconds=N` with a CPU profile of the process over
+  /// the next N seconds, as folded stacks tagged with the route pattern of
+  /// the request being handled. Meant for a debug listener or a protected
+  /// route.
+  void profiler(std::string_view endpoint = "/debug/pprof/profile",
+                profiler_options options = {}) {
+    // Routes don't match a query string, prefixes do
+    dispatcher_.add_prefix_handler(
+        endpoint, profile_handler{endpoint, std::move(options)});
+  }
+
+  /// The pattern of the route serving `target`, e.g.
+  /// "/users/{integer:id}", empty when none does.
+  std::string_view route_of(std::string_view target) const {
+    return dispatcher_.route_of(target);
+  }
+
+  /// Serves websocket upgrades of `endpoint`. The query string is ignored
+  /// when matching the endpoint.
+  void websocket(std::string_view endpoint, websocket_handler handler) {
+    dispatcher_.add_websocket(endpoint, std::move(handler));
+  }
+
+  /// Streams the request bodies of `endpoint` into the reader `factory`
+  /// makes from their header, as they are read. The handler of the endpoint
+  /// then runs with an empty body and finds the reader with
+  /// `req.body_reader<Reader>()`. Once an endpoint has a body reader, every
+  /// request has its header read on its own first.
+  void body_reader(std::string_view endpoint, body_reader_factory factory) {
+    dispatcher_.add_body_reader(endpoint, std::move(factory));
+  }
+
+  /// Answers `413 Payload Too Large` to the requests of `endpoint`, a route
+  /// pattern, with a body over `limit` bytes, before reading it. Bodies are
+  /// limited to 1MB by default.
+  void body_limit(std::string_view endpoint, uint64_t limit) {
+    dispatcher_.add_body_limit(endpoint, limit);
+  }
+
+  /// Closes the connections which didn't send the header of their request
+  /// within `timeout`, 10s by default. Their admission slot is freed.
+  void header_timeout(std::chrono::milliseconds timeout) {
+    dispatcher_.header_timeout(timeout);
+  }
+
+  /// Closes the connections which didn't send any of the body of their
+  /// request within `timeout` of the previous read, 10s by default.
+  void body_timeout(std::chrono::milliseconds timeout) {
+    dispatcher_.body_timeout(timeout);
+  }
+
+  /// Forwards the requests of `prefix`, and of the paths under it, to the
+  /// upstream servers of `options`. The upstream connections are kept alive
+  /// and reused by the thread which opened them, an upstream failing
+  /// repeatedly is skipped for a while.
+  ///
+  ///   app.proxy("/legacy", {{"10.0.0.1:8080", "10.0.0.2:8080"}});
+  void proxy(std::string_view prefix, proxy_options options) {
+    dispatcher_.add_prefix_handler(prefix, reverse_proxy(std::move(options)));
+  }
+
+  /// Answers POST `endpoint` by running the sub-requests listed in its JSON
+  /// body through the routes of the app, without a round trip each, see
+  /// `batch_handler`. The sub-requests run on the thread of the connection,
+  /// `max_in_flight_` of them at once when their handlers defer.
+  void batch(std::string_view endpoint = "/batch", batch_options options = {}) {
+    handle(http::verb::post, endpoint,
+           batch_handler{dispatcher_, endpoint, std::move(options)});
+  }
+
+  /// Traces the phases of the requests, from the accept to the write of the
+  /// response, see `trace_options`. Called before `start()`.
+  tracer& enable_tracing(trace_options options = {}) {
+    tracer_ = std::make_unique<tracer>(std::move(options));
+    dispatcher_.request_tracer(tracer_.get());
+    return *tracer_;
+  }
+
+  /// Counts the allocations of every request per route, from the before
+  /// interceptors to the serialization of the response. Requires the
+  /// `alloc_accounting` build option, called before `start()`.
+  ///
+  ///   auto& allocations = app.enable_allocation_accounting();
+  ///   allocations.budget("/users/{integer:id}", 20);
+  allocation_accounting& enable_allocation_accounting() {
+    if (!allocation_accounting::available()) {
+      LOG(WARNING) << "Built without alloc_accounting, allocations are not "
+                      "counted"
+                   << std::endl;
+    }
+
+    allocations_ = std::make_unique<allocation_accounting>();
+    dispatcher_.allocations(allocations_.get());
+    return *allocations_;
+  }
+
+  /// Records a sample of the requests, before their handler, into the file
+  /// of `options` for `replay`. Called before `start()`.
+  traffic_capture& capture(capture_options options) {
+    capture_ = std::make_unique<traffic_capture>(std::move(options));
+    intercept(capture_->interceptor());
+    return *capture_;
+  }
+
+  /// Replays captured requests in process, through the routes and the
+  /// interceptors of the app, and reports their latencies. See the
+  /// `eagle_replay` tool to replay them to a server.
+  replay_report replay(const std::vector<captured_request>& requests,
+                       replay_options options = {}) {
+    return eagle::replay(dispatcher_, requests, options);
+  }
+
+  /// Shared state handed to every accepted connection, e.g. the
+  /// `eagle::tls_context` of an `app<tls_connection>`. It should be
+  /// configured before calling `start()`.
+  auto& connection_context() { return connection_context_; }
+
+  /// Interceptors run before the handler, after it, or with
+  /// `intercept_policy_header` as soon as the header of the request is read.
+  /// Those can reject the request before its body is read by finishing the
+  /// response, an `Expect: 100-continue` is answered only once they all
+  /// accepted it.
   template <typename Policy = intercept_policy_before>
   void intercept(interceptor_type inter) {
     dispatcher_.add_interceptor(Policy::value, inter);
   }
 
  private:
-  void accept_connection(tcp::acceptor& acceptor) {
-    acceptor.async_accept(socket_, [this, &acceptor](beast::error_code ec) {
+  // Everything a shard's thread touches while serving requests. Shards share
+  // nothing but the connection context and the admission controller.
+  struct alignas(64) shard {
+    shard(size_t index, dispatcher& dispt)
+        : index_(index), dispatcher_(dispt) {}
+
+    // Shards other than the primary serve from their own copy of the routes,
+    // made when the app starts.
+    shard(size_t index, const dispatcher& routes, int cpu)
+        : index_(index),
+          cpu_(cpu),
+          routes_(std::make_unique<dispatcher>(routes)),
+          dispatcher_(*routes_) {}
+
+    // Pooled connections own timers of the io_context, they are deleted
+    // while it is alive. The connections still pending in it are deleted
+    // when it is destroyed.
+    ~shard() {
+      connections_.close();
+      control_blocks_.close();
+    }
+
+    size_t index_;
+    int cpu_{-1};
+
+    // Connections still pending in the io_context are destroyed along with
+    // it, everything they use must outlive it.
+    std::unique_ptr<dispatcher> routes_;
+    dispatcher& dispatcher_;
+    std::atomic<size_t> active_connections_{0};
+    std::atomic<uint64_t> accepted_{0};
+    object_pool<ConnectionType> connections_;
+    block_cache control_blocks_;
+    handler_memory accept_memory_;
+
+    net::io_context ioc_{1};
+    tcp::acceptor acceptor_{ioc_};
+    tcp::socket socket_{ioc_};
+    net::steady_timer drain_timer_{ioc_};
+    net::steady_timer accept_timer_{ioc_};
+    std::chrono::milliseconds accept_backoff_{0};
+  };
+
+  // Connections release their slot in the in-flight count and in the
+  // admission controller when destroyed. The latency the controller adapts
+  // to runs from the accept to the dispatch of the request, which is where
+  // requests queue, rather than up to a client reading its response slowly.
+  struct connection_deleter {
+    app* app_;
+    shard* shard_;
+    std::chrono::steady_clock::time_point accepted_at_;
+    bool admitted_;
+
+    void operator()(ConnectionType* conn) const {
+      EAGLE_PROBE(connection_closed, reinterpret_cast<uintptr_t>(conn));
+      auto dispatched_at = std::chrono::steady_clock::now();
+      if constexpr (detail::tracks_dispatch<ConnectionType>::value) {
+        dispatched_at = conn->dispatched_at();
+      }
+
+      if constexpr (detail::is_reusable_connection<ConnectionType>::value) {
+        shard_->connections_.release(conn);
+      } else {
+        delete conn;
+      }
+      shard_->active_connections_--;
+      if (!admitted_) {
+        return;
+      }
+
+      // A request never dispatched, e.g. whose header didn't come in time,
+      // says nothing of the latency
+      if (dispatched_at == std::chrono::steady_clock::time_point{}) {
+        app_->admission_.release();
+      } else {
+        app_->admission_.release(dispatched_at - accepted_at_);
+      }
+    }
+  };
+
+  // The primary shard serves from the app's routes, it is the only one unless
+  // started in share-nothing mode.
+  static std::vector<std::unique_ptr<shard>> primary_shard_(dispatcher& dispt) {
+    std::vector<std::unique_ptr<shard>> shards;
+    shards.push_back(std::make_unique<shard>(0, dispt));
+    return shards;
+  }
+
+  // Shards are spread over the CPUs the process may run on, which respects
+  // taskset and cpusets.
+  void configure_shards_(const option& app_options) {
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+
+    if (cpus.empty()) {
+      cpus.push_back(0);
+    }
+
+    auto count = app_options.shards_ ? app_options.shards_ : cpus.size();
+    pin_threads_ = app_options.pin_threads_;
+    incoming_cpu_ = app_options.pin_threads_ && app_options.incoming_cpu_;
+    // Every shard binds the same address
+    reuse_port_ = reuse_port_ || count > 1;
+
+    shards_.front()->cpu_ = cpus.front();
+    for (size_t idx = shards_.size(); idx < count; idx++) {
+      shards_.push_back(std::make_unique<shard>(idx, dispatcher_,
+                                                cpus[idx % cpus.size()]));
+    }
+  }
+
+  void run_(shard& s) {
+    if (pin_threads_ && s.cpu_ >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(s.cpu_, &cpus);
+      if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        LOG(WARNING) << "Cannot pin shard " << s.index_ << " to CPU "
+                     << s.cpu_ << std::endl;
+      }
+    }
+
+    accept_connection(s);
+    s.ioc_.run();
+  }
+
+  void bind_(shard& s, const tcp::endpoint& endpoint) {
+    s.acceptor_.open(endpoint.protocol());
+    s.acceptor_.set_option(net::socket_base::reuse_address(true));
+    if (reuse_port_) {
+      s.acceptor_.set_option(
+          net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+    }
+    if (incoming_cpu_ && s.cpu_ >= 0) {
+      s.acceptor_.set_option(
+          net::detail::socket_option::integer<SOL_SOCKET, SO_INCOMING_CPU>(
+              s.cpu_));
+    }
+    s.acceptor_.bind(endpoint);
+    s.acceptor_.listen(net::socket_base::max_listen_connections);
+  }
+
+  void accept_connection(shard& s) {
+    s.acceptor_.async_accept(s.socket_, bind_handler_memory(
+                                            s.accept_memory_,
+                                            [this, &s](beast::error_code ec) {
+      if (ec == net::error::operation_aborted) {
+        // The acceptor was closed by `drain()`
+        return;
+      }
+
+      if (is_resource_exhaustion_(ec)) {
+        return back_off_accept_(s, ec);
+      }
+
+      if (ec == net::error::connection_aborted) {
+        return accept_connection(s);
+      }
+
       if (ec) {
         LOG(ERROR) << "Error: " << ec.message() << std::endl;
         exit(ec.value());
       }
 
-      std::make_shared<ConnectionType>(dispatcher_, std::move(socket_))
-          ->handle_data();
+      s.accept_backoff_ = std::chrono::milliseconds(0);
+      s.accepted_.store(s.accepted_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+
+      auto admitted = admission_.enabled() && admission_.try_admit();
+      if (admission_.enabled() && !admitted) {
+        shed_connection_(s);
+      } else {
+        make_connection_(s, admitted)->handle_data();
+      }
+
+      accept_connection(s);
+    }));
+  }
 
-      accept_connection(acceptor);
+  static bool is_resource_exhaustion_(const beast::error_code& ec) {
+    return ec == net::error::no_descriptors ||
+           ec == beast::errc::too_many_files_open_in_system ||
+           ec == net::error::no_buffer_space || ec == net::error::no_memory;
+  }
+
+  // Out of descriptors or memory, the pending connections stay in the kernel
+  // backlog until in-flight connections finish and free their resources.
+  void back_off_accept_(shard& s, const beast::error_code& ec) {
+    s.accept_backoff_ = std::clamp(s.accept_backoff_ * 2,
+                                   std::chrono::milliseconds(10),
+                                   std::chrono::milliseconds(1000));
+    LOG(WARNING) << "Accept failed: " << ec.message() << ", retrying in "
+                 << s.accept_backoff_.count() << "ms" << std::endl;
+
+    s.accept_timer_.expires_after(s.accept_backoff_);
+    s.accept_timer_.async_wait([this, &s](beast::error_code ec) {
+      if (!ec) {
+        accept_connection(s);
+      }
+    });
+  }
+
+  // A failed handoff leaves the socket with this process, which keeps
+  // serving and waits for the next process to ask for it
+  void accept_handoff_(const std::string& path,
+                       std::chrono::milliseconds deadline) {
+    handoff_acceptor_.async_accept(
+        [this, path, deadline](beast::error_code ec,
+                               net::local::stream_protocol::socket channel) {
+          if (ec == net::error::operation_aborted) {
+            // Closed by `drain`
+            return;
+          }
+
+          if (ec) {
+            LOG(ERROR) << "Stopped serving handoffs on " << path << ": "
+                       << ec.message() << std::endl;
+            unlink(path.c_str());
+            return;
+          }
+
+          auto listener = shards_.front()->acceptor_.native_handle();
+          if (!send_fds(channel.native_handle(), {listener})) {
+            LOG(ERROR) << "Failed to hand off the listening socket"
+                       << std::endl;
+            return accept_handoff_(path, deadline);
+          }
+
+          LOG(INFO) << "Listening socket handed off, draining" << std::endl;
+          unlink(path.c_str());
+          drain(deadline);
+        });
+  }
+
+  void shed_connection_(shard& s) {
+    if constexpr (!detail::is_secure_connection<ConnectionType>::value) {
+      // The Date line of the thread changes every second, the write keeps a
+      // copy of it next to the socket.
+      struct shed_state {
+        explicit shed_state(tcp::socket socket)
+            : socket_(std::move(socket)), timer_(socket_.get_executor()) {}
+
+        tcp::socket socket_;
+        std::array<char, 37> date_;
+        net::steady_timer timer_;
+        std::array<char, 512> discarded_;
+      };
+
+      auto state = std::make_shared<shed_state>(std::move(s.socket_));
+      auto date = http_date::now().line();
+      std::copy(date.begin(), date.end(), state->date_.begin());
+
+      const auto& canned = canned_responses::service_unavailable();
+      std::array<net::const_buffer, 3> buffers{
+          net::buffer(canned.head().data(), canned.head().size()),
+          net::buffer(state->date_),
+          net::buffer(canned.tail().data(), canned.tail().size())};
+
+      net::async_write(state->socket_, buffers,
+                       [state](beast::error_code ec, std::size_t) {
+                         if (ec) {
+                           return;
+                         }
+
+                         linger_(state);
+                       });
+    } else {
+      // Answering requires a TLS handshake, which is exactly the work the
+      // server can't afford right now.
+      beast::error_code ec;
+      s.socket_.close(ec);
+    }
+  }
+
+  // Closing with the request still unread would reset the connection, and
+  // the client could lose the 503 before reading it. The request is read
+  // and dropped until the client closes, for a second at most.
+  template <typename State>
+  static void linger_(const std::shared_ptr<State>& state) {
+    beast::error_code ec;
+    state->socket_.shutdown(tcp::socket::shutdown_send, ec);
+    state->timer_.expires_after(std::chrono::seconds(1));
+    state->timer_.async_wait([state](beast::error_code ec) {
+      if (!ec) {
+        state->socket_.close(ec);
+      }
+    });
+    discard_(state);
+  }
+
+  template <typename State>
+  static void discard_(const std::shared_ptr<State>& state) {
+    state->socket_.async_read_some(
+        net::buffer(state->discarded_),
+        [state](beast::error_code ec, std::size_t) {
+          if (ec) {
+            state->timer_.cancel();
+            return;
+          }
+
+          discard_(state);
+        });
+  }
+
+  // Finished connections of the shard are reset and reused when possible,
+  // as are the control blocks of their shared pointers, so that accepting a
+  // connection allocates close to nothing.
+  std::shared_ptr<ConnectionType> make_connection_(shard& s, bool admitted) {
+    s.active_connections_++;
+    connection_deleter deleter{this, &s, std::chrono::steady_clock::now(),
+                               admitted};
+
+    ConnectionType* conn = nullptr;
+    if constexpr (detail::is_reusable_connection<ConnectionType>::value) {
+      conn = s.connections_.acquire();
+    }
+
+    if constexpr (detail::connection_context<ConnectionType>::value) {
+      if (conn) {
+        conn->reset(std::move(s.socket_), connection_context_);
+      } else {
+        conn = new ConnectionType(s.dispatcher_, std::move(s.socket_),
+                                  connection_context_);
+      }
+    } else {
+      if (conn) {
+        conn->reset(std::move(s.socket_));
+      } else {
+        conn = new ConnectionType(s.dispatcher_, std::move(s.socket_));
+      }
+    }
+
+    EAGLE_PROBE(connection_accepted, reinterpret_cast<uintptr_t>(conn),
+                s.index_);
+    return std::shared_ptr<ConnectionType>(
+        conn, deleter, recycling_allocator<ConnectionType>(s.control_blocks_));
+  }
+
+  void wait_for_connections_(shard& s,
+                             std::chrono::steady_clock::time_point deadline) {
+    if (s.active_connections_ == 0 ||
+        std::chrono::steady_clock::now() >= deadline) {
+      if (s.active_connections_ > 0) {
+        LOG(WARNING) << "Drain deadline expired with " << s.active_connections_
+                     << " connections in flight" << std::endl;
+      }
+      s.ioc_.stop();
+      return;
+    }
+
+    s.drain_timer_.expires_after(std::chrono::milliseconds(10));
+    s.drain_timer_.async_wait([this, &s, deadline](beast::error_code ec) {
+      if (!ec) {
+        wait_for_connections_(s, deadline);
+      }
     });
   }
 
  private:
-  net::io_context ioc_{1};
-  tcp::socket socket_{ioc_};
+  // Shards are destroyed first, connections pending in their io_context use
+  // everything declared before them.
+  std::unique_ptr<tracer> tracer_;
+  std::unique_ptr<allocation_accounting> allocations_;
+  std::unique_ptr<traffic_capture> capture_;
   dispatcher dispatcher_;
+  typename detail::connection_context<ConnectionType>::type connection_context_;
+  admission_controller admission_;
+
+  std::vector<std::unique_ptr<shard>> shards_ = primary_shard_(dispatcher_);
+  net::local::stream_protocol::acceptor handoff_acceptor_{
+      shards_.front()->ioc_};
   std::string server_address_;
   uint16_t server_port_;
+  bool reuse_port_{false};
+  bool pin_threads_{false};
+  bool incoming_cpu_{false};
 };
 
 }  // namespace eagle
@@ -0,0 +1,701 @@
+#ifndef EAGLE_BATCH_HPP
+#define EAGLE_BATCH_HPP
+
+#include <boost/asio/post.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+#include "dispatcher.hpp"
+
+namespace eagle {
+
+struct batch_options {
+  // Sub-requests of a batch, more are answered 413
+  size_t max_items_{50};
+  // Sub-requests of a batch in flight at once, a deferred one letting the
+  // next ones start. They all run on the thread of the connection, 0 runs
+  // them one after the other
+  size_t max_in_flight_{0};
+  // Results are written as soon as they and the ones before them are done,
+  // with chunked transfer encoding, instead of in one body
+  bool stream_{false};
+};
+
+/// A sub-request of a batch.
+struct batch_item {
+  http::verb method_{http::verb::get};
+  std::string path_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string body_;
+};
+
+namespace detail {
+
+// Just enough JSON for the batches: strings, objects and arrays.
+class batch_json_reader {
+ public:
+  explicit batch_json_reader(std::string_view text) : text_(text) {}
+
+  /// `[{"method": "GET", "path": "/a", "headers": {..}, "body": ".."}, ..]`,
+  /// std::nullopt if the text isn't one.
+  std::optional<std::vector<batch_item>> items() {
+    std::vector<batch_item> items;
+    if (!consume_('[')) {
+      return std::nullopt;
+    }
+
+    if (!consume_(']')) {
+      do {
+        auto item = item_();
+        if (!item) {
+          return std::nullopt;
+        }
+        items.push_back(std::move(*item));
+      } while (consume_(','));
+
+      if (!consume_(']')) {
+        return std::nullopt;
+      }
+    }
+
+    skip_space_();
+    if (pos_ != text_.size()) {
+      return std::nullopt;
+    }
+    return items;
+  }
+
+ private:
+  std::optional<batch_item> item_() {
+    batch_item item;
+    bool has_path = false;
+    bool ok = object_([&](const std::string& key) {
+      if (key == "headers") {
+        return object_([&](const std::string& name) {
+          auto value = string_();
+          if (value) {
+            item.headers_.emplace_back(name, std::move(*value));
+          }
+          return value.has_value();
+        });
+      }
+
+      auto value = string_();
+      if (!value) {
+        return false;
+      }
+
+      if (key == "method") {
+        item.method_ = http::string_to_verb(*value);
+        return item.method_ != http::verb::unknown;
+      }
+
+      if (key == "path") {
+        item.path_ = std::move(*value);
+        has_path = !item.path_.empty() && item.path_.front() == '/';
+        return has_path;
+      }
+
+      if (key == "body") {
+        item.body_ = std::move(*value);
+      }
+      return true;
+    });
+
+    if (!ok || !has_path) {
+      return std::nullopt;
+    }
+    return item;
+  }
+
+  // Calls `member` with the key of every member, positioned on its value
+  template <typename Member>
+  bool object_(Member&& member) {
+    if (!consume_('{')) {
+      return false;
+    }
+
+    if (consume_('}')) {
+      return true;
+    }
+
+    do {
+      auto key = string_();
+      if (!key || !consume_(':') || !member(*key)) {
+        return false;
+      }
+    } while (consume_(','));
+
+    return consume_('}');
+  }
+
+  std::optional<std::string> string_() {
+    if (!consume_('"')) {
+      return std::nullopt;
+    }
+
+    std::string value;
+    while (pos_ < text_.size()) {
+      char c = text_[pos_++];
+      if (c == '"') {
+        return value;
+      }
+
+      if (static_cast<unsigned char>(c) < 0x20) {
+        return std::nullopt;
+      }
+
+      if (c != '\\') {
+        value += c;
+        continue;
+      }
+
+      if (pos_ == text_.size()) {
+        return std::nullopt;
+      }
+
+      switch (text_[pos_++]) {
+        case '"':
+          value += '"';
+          break;
+        case '\\':
+          value += '\\';
+          break;
+        case '/':
+          value += '/';
+          break;
+        case 'b':
+          value += '\b';
+          break;
+        case 'f':
+          value += '\f';
+          break;
+        case 'n':
+          value += '\n';
+          break;
+        case 'r':
+          value += '\r';
+          break;
+        case 't':
+          value += '\t';
+          break;
+        case 'u':
+          if (!code_point_(value)) {
+            return std::nullopt;
+          }
+          break;
+        default:
+          return std::nullopt;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  // \uXXXX, or a surrogate pair of them, appended in UTF-8
+  bool code_point_(std::string& value) {
+    auto unit = hex_unit_();
+    if (!unit) {
+      return false;
+    }
+
+    uint32_t code = *unit;
+    if (code >= 0xd800 && code <= 0xdbff) {
+      if (text_.substr(pos_, 2) != "\\u") {
+        return false;
+      }
+      pos_ += 2;
+      auto low = hex_unit_();
+      if (!low || *low < 0xdc00 || *low > 0xdfff) {
+        return false;
+      }
+      code = 0x10000 + ((code - 0xd800) << 10) + (*low - 0xdc00);
+    } else if (code >= 0xdc00 && code <= 0xdfff) {
+      return false;
+    }
+
+    if (code < 0x80) {
+      value += static_cast<char>(code);
+    } else if (code < 0x800) {
+      value += static_cast<char>(0xc0 | (code >> 6));
+      value += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+      value += static_cast<char>(0xe0 | (code >> 12));
+      value += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      value += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+      value += static_cast<char>(0xf0 | (code >> 18));
+      value += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+      value += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      value += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    return true;
+  }
+
+  std::optional<uint32_t> hex_unit_() {
+    if (text_.size() - pos_ < 4) {
+      return std::nullopt;
+    }
+
+    uint32_t unit = 0;
+    for (size_t idx = 0; idx < 4; idx++) {
+      char c = text_[pos_++];
+      unit <<= 4;
+      if (c >= '0' && c <= '9') {
+        unit |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        unit |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        unit |= c - 'A' + 10;
+      } else {
+        return std::nullopt;
+      }
+    }
+    return unit;
+  }
+
+  bool consume_(char expected) {
+    skip_space_();
+    if (pos_ < text_.size() && text_[pos_] == expected) {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  void skip_space_() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' ||
+            text_[pos_] == '\r')) {
+      pos_++;
+    }
+  }
+
+  std::string_view text_;
+  size_t pos_{0};
+};
+
+inline void append_json_string(std::string& json, std::string_view text) {
+  json += '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[7];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json += escaped;
+    } else {
+      json += c;
+    }
+  }
+  json += '"';
+}
+
+// Whether `text` is well-formed UTF-8, without overlong forms or surrogates
+inline bool is_utf8(std::string_view text) {
+  for (size_t pos = 0; pos < text.size();) {
+    auto lead = static_cast<unsigned char>(text[pos]);
+    size_t length = lead < 0x80 ? 1 : lead >> 5 == 0x6 ? 2
+                                    : lead >> 4 == 0xe ? 3
+                                    : lead >> 3 == 0x1e ? 4
+                                                        : 0;
+    if (length == 0 || pos + length > text.size()) {
+      return false;
+    }
+
+    uint32_t code = length == 1 ? lead : lead & (0x7f >> length);
+    for (size_t idx = 1; idx < length; idx++) {
+      auto next = static_cast<unsigned char>(text[pos + idx]);
+      if (next >> 6 != 0x2) {
+        return false;
+      }
+      code = code << 6 | (next & 0x3f);
+    }
+
+    static constexpr uint32_t smallest[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (code < smallest[length] || code > 0x10ffff ||
+        (code >= 0xd800 && code <= 0xdfff)) {
+      return false;
+    }
+    pos += length;
+  }
+  return true;
+}
+
+inline void append_base64_string(std::string& json, std::string_view data) {
+  static constexpr char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  json += '"';
+  for (size_t pos = 0; pos < data.size(); pos += 3) {
+    uint32_t group = static_cast<unsigned char>(data[pos]) << 16;
+    if (pos + 1 < data.size()) {
+      group |= static_cast<unsigned char>(data[pos + 1]) << 8;
+    }
+    if (pos + 2 < data.size()) {
+      group |= static_cast<unsigned char>(data[pos + 2]);
+    }
+
+    json += digits[group >> 18];
+    json += digits[group >> 12 & 0x3f];
+    json += pos + 1 < data.size() ? digits[group >> 6 & 0x3f] : '=';
+    json += pos + 2 < data.size() ? digits[group & 0x3f] : '=';
+  }
+  json += '"';
+}
+
+// Headers of a sub-response which describe the batch rather than it
+inline bool is_framing_header(http::field name) {
+  switch (name) {
+    case http::field::content_length:
+    case http::field::transfer_encoding:
+    case http::field::connection:
+    case http::field::date:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// One sub-request of a batch being served, and its response
+struct batch_call {
+  request request_;
+  response response_;
+  std::string result_;
+  bool done_{false};
+};
+
+// The results of a batch, handed out in order as they complete: all at
+// once, or as the chunks of a streamed body.
+class batch_results final : public response_stream {
+ public:
+  explicit batch_results(size_t count) : calls_(count) {}
+
+  std::vector<std::unique_ptr<batch_call>>& calls() { return calls_; }
+
+  /// The result of the call `idx` is ready. True once every call is.
+  bool finish(size_t idx) {
+    std::function<void()> waker;
+    bool all_done = false;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      calls_[idx]->done_ = true;
+      all_done = ++done_ == calls_.size();
+      if (waiting_) {
+        waiting_ = false;
+        waker = waker_;
+      }
+    }
+
+    if (waker) {
+      waker();
+    }
+    return all_done;
+  }
+
+  /// The whole JSON array, once every call is done.
+  std::string body() {
+    std::string json = "[";
+    for (size_t idx = 0; idx < calls_.size(); idx++) {
+      json += idx ? "," : "";
+      json += calls_[idx]->result_;
+    }
+    return json += "]";
+  }
+
+  status next(std::string& chunk) override {
+    std::lock_guard<std::mutex> lock{mutex_};
+    chunk.clear();
+    if (next_ == 0 && !opened_) {
+      opened_ = true;
+      chunk = "[";
+    }
+
+    while (next_ < calls_.size() && calls_[next_]->done_) {
+      chunk += next_ ? "," : "";
+      chunk += calls_[next_]->result_;
+      next_++;
+    }
+
+    if (next_ == calls_.size() && !closed_) {
+      closed_ = true;
+      chunk += "]";
+    }
+
+    if (!chunk.empty()) {
+      return status::ready;
+    }
+
+    if (closed_ || cancelled_) {
+      return status::done;
+    }
+
+    waiting_ = true;
+    return status::pending;
+  }
+
+  void on_ready(std::function<void()> waker) override {
+    std::lock_guard<std::mutex> lock{mutex_};
+    waker_ = std::move(waker);
+  }
+
+  void cancel() override {
+    std::lock_guard<std::mutex> lock{mutex_};
+    cancelled_ = true;
+  }
+
+ private:
+  std::vector<std::unique_ptr<batch_call>> calls_;
+  std::mutex mutex_;
+  size_t done_{0};
+  size_t next_{0};
+  bool opened_{false};
+  bool closed_{false};
+  bool cancelled_{false};
+  bool waiting_{false};
+  std::function<void()> waker_;
+};
+
+}  // namespace detail
+
+/// Handler of `app.batch`: runs the sub-requests of a JSON array through
+/// the dispatcher, in process, and answers their results in the same order:
+///
+///   [{"method": "GET", "path": "/users/1"},
+///    {"method": "POST", "path": "/likes", "body": "{\"post\": 7}"}]
+///
+///   [{"status": 200, "headers": {..}, "body": "{\"id\": 1}"},
+///    {"status": 201, "headers": {..}, "body": ""}]
+///
+/// The sub-requests inherit the headers of the batch, e.g. its
+/// Authorization, and can add their own.
+class batch_handler final {
+ public:
+  batch_handler(dispatcher_interface& dispt,
+                std::string_view endpoint,
+                batch_options options)
+      : state_(std::make_shared<state>(dispt, endpoint, std::move(options))) {}
+
+  bool operator()(const request& req, response& resp) const {
+    auto body = beast::buffers_to_string(req.body());
+    auto items = detail::batch_json_reader{body}.items();
+    if (!items) {
+      resp.result(http::status::bad_request);
+      resp.html() << "The body must be a JSON array of sub-requests\n";
+      return true;
+    }
+
+    if (items->size() > state_->options_.max_items_) {
+      resp.result(http::status::payload_too_large);
+      resp.html() << "At most " << state_->options_.max_items_
+                  << " sub-requests per batch\n";
+      return true;
+    }
+
+    auto results = std::make_shared<detail::batch_results>(items->size());
+    for (size_t idx = 0; idx < items->size(); idx++) {
+      results->calls()[idx] = make_call_(req, (*items)[idx]);
+    }
+
+    if (state_->options_.stream_) {
+      resp.set(http::field::content_type, "application/json");
+      resp.stream(results);
+    }
+
+    if (results->calls().empty()) {
+      if (!state_->options_.stream_) {
+        resp.json() << results->body();
+      }
+      return true;
+    }
+
+    auto completion = state_->options_.stream_ ? nullptr : resp.defer();
+
+    auto done = [results, completion, &resp, executor = req.executor()] {
+      if (!completion) {
+        return;
+      }
+
+      auto respond = [results, completion, &resp] {
+        resp.json() << results->body();
+        completion->complete();
+      };
+
+      // Posted, not to answer from within the handler of the last
+      // sub-request, unless the batch has no executor to post to
+      if (!executor) {
+        return respond();
+      }
+      net::post(executor, std::move(respond));
+    };
+
+    auto count = results->calls().size();
+    auto next = std::make_shared<size_t>(0);
+    auto width = std::clamp<size_t>(state_->options_.max_in_flight_, 1, count);
+    for (size_t started = 0; started < width && *next < count; started++) {
+      run_next_(state_, results, next, done);
+    }
+
+    return true;
+  }
+
+ private:
+  struct state {
+    state(dispatcher_interface& dispt,
+          std::string_view endpoint,
+          batch_options options)
+        : dispatcher_(dispt),
+          endpoint_(endpoint),
+          options_(std::move(options)) {}
+
+    dispatcher_interface& dispatcher_;
+    std::string endpoint_;
+    batch_options options_;
+  };
+
+  std::unique_ptr<detail::batch_call> make_call_(const request& batch,
+                                                 batch_item& item) const {
+    auto call = std::make_unique<detail::batch_call>();
+    auto& sub = call->request_;
+    auto& message = sub.buffer();
+    for (const auto& field : batch.buffer()) {
+      auto name = field.name();
+      if (name != http::field::content_length &&
+          name != http::field::content_type &&
+          name != http::field::transfer_encoding &&
+          name != http::field::expect) {
+        message.insert(field.name_string(), field.value());
+      }
+    }
+    for (const auto& [name, value] : item.headers_) {
+      message.set(name, value);
+    }
+
+    message.method(item.method_);
+    message.target(item.path_);
+    message.version(batch.version());
+    if (!item.body_.empty()) {
+      beast::ostream(message.body()) << item.body_;
+    }
+    message.prepare_payload();
+
+    sub.executor(batch.executor());
+    sub.connection_id(batch.connection_id());
+    sub.peer(batch.peer_address());
+    return call;
+  }
+
+  // Runs the sub-request `next` then, once it is done, the next one not
+  // started yet. Every sub-request runs on the executor of the batch, as its
+  // handlers expect, `max_in_flight_` of these chains keeping that many in
+  // flight.
+  template <typename Done>
+  static void run_next_(std::shared_ptr<state> self,
+                        std::shared_ptr<detail::batch_results> results,
+                        std::shared_ptr<size_t> next,
+                        Done done) {
+    auto idx = (*next)++;
+    run_(*self, results, idx, [self, results, next, idx, done] {
+      if (results->finish(idx)) {
+        return done();
+      }
+      if (*next < results->calls().size()) {
+        run_next_(self, results, next, done);
+      }
+    });
+  }
+
+  template <typename Finished>
+  static void run_(state& self,
+                   const std::shared_ptr<detail::batch_results>& results,
+                   size_t idx,
+                   Finished finished) {
+    auto& call = *results->calls()[idx];
+    auto path = call.request_.target().substr(
+        0, call.request_.target().find('?'));
+    if (path == self.endpoint_) {
+      call.result_ = "{\"status\":400,\"headers\":{},\"body\":"
+                     "\"Batches can't be nested\"}";
+      return finished();
+    }
+
+    self.dispatcher_.dispatch(call.request_, call.response_);
+    if (!call.response_.deferred()) {
+      call.result_ = result_of_(call.response_);
+      return finished();
+    }
+
+    call.response_.deferred()->on_complete(
+        [&self, results, idx, finished = std::move(finished)] {
+          auto& call = *results->calls()[idx];
+          self.dispatcher_.complete(call.request_, call.response_);
+          call.result_ = result_of_(call.response_);
+          finished();
+        });
+  }
+
+  // {"status": 200, "headers": {"Content-Type": ".."}, "body": ".."}, with
+  // "encoding": "base64" when the body isn't UTF-8 text
+  static std::string result_of_(const response& resp) {
+    std::string json = "{\"status\":";
+    json += std::to_string(static_cast<unsigned>(resp.result()));
+    json += ",\"headers\":{";
+
+    std::string body;
+    if (const auto* canned = resp.canned()) {
+      if (!canned->content_type().empty()) {
+        json += "\"Content-Type\":";
+        detail::append_json_string(json, canned->content_type());
+      }
+      body = canned->body();
+    } else if (resp.body_stream()) {
+      json = "{\"status\":501,\"headers\":{},\"body\":"
+             "\"Streamed responses can't be batched\"}";
+      return json;
+    } else {
+      body = beast::buffers_to_string(resp.buffer().body().data());
+    }
+
+    if (!resp.canned()) {
+      bool first = true;
+      for (const auto& field : resp.buffer()) {
+        if (detail::is_framing_header(field.name())) {
+          continue;
+        }
+        json += first ? "" : ",";
+        first = false;
+        auto name = field.name_string();
+        auto value = field.value();
+        detail::append_json_string(json, {name.data(), name.size()});
+        json += ':';
+        detail::append_json_string(json, {value.data(), value.size()});
+      }
+    }
+
+    json += "},\"body\":";
+    if (detail::is_utf8(body)) {
+      detail::append_json_string(json, body);
+    } else {
+      detail::append_base64_string(json, body);
+      json += ",\"encoding\":\"base64\"";
+    }
+    json += '}';
+    return json;
+  }
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_BATCH_HPP
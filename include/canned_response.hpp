@@ -0,0 +1,223 @@
+#ifndef EAGLE_CANNED_RESPONSE_HPP
+#define EAGLE_CANNED_RESPONSE_HPP
+
+#include <algorithm>
+#include <array>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <boost/beast.hpp>
+
+namespace beast = boost::beast;  // from <boost/beast.hpp>
+namespace http = beast::http;    // from <boost/beast/http.hpp>
+
+namespace eagle {
+
+/// Value of the Date header, formatted at most once per second per thread.
+class http_date final {
+ public:
+  /// The date of the calling thread, valid until its next call in another
+  /// second.
+  static const http_date& now() {
+    thread_local http_date date;
+    date.refresh_(std::time(nullptr));
+    return date;
+  }
+
+  /// e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+  std::string_view value() const { return {line_.data() + 6, 29}; }
+
+  /// The header line, "Date: <value>\r\n".
+  std::string_view line() const { return {line_.data(), line_.size()}; }
+
+ private:
+  void refresh_(std::time_t second) {
+    if (second == second_) {
+      return;
+    }
+
+    static constexpr std::string_view days[] = {"Sun", "Mon", "Tue", "Wed",
+                                                "Thu", "Fri", "Sat"};
+    static constexpr std::string_view months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    std::tm tm{};
+    gmtime_r(&second, &tm);
+    second_ = second;
+
+    // Not strftime, the names must not depend on the locale
+    auto* out = line_.data() + 6;
+    auto put = [&out](std::string_view text) {
+      for (auto c : text) {
+        *out++ = c;
+      }
+    };
+    auto put_digits = [&out](int value, int width) {
+      for (int idx = width - 1; idx >= 0; idx--, value /= 10) {
+        out[idx] = static_cast<char>('0' + value % 10);
+      }
+      out += width;
+    };
+
+    put(days[tm.tm_wday]);
+    put(", ");
+    put_digits(tm.tm_mday, 2);
+    put(" ");
+    put(months[tm.tm_mon]);
+    put(" ");
+    put_digits(tm.tm_year + 1900, 4);
+    put(" ");
+    put_digits(tm.tm_hour, 2);
+    put(":");
+    put_digits(tm.tm_min, 2);
+    put(":");
+    put_digits(tm.tm_sec, 2);
+    put(" GMT\r\n");
+  }
+
+ private:
+  std::time_t second_{-1};
+  std::array<char, 37> line_{'D', 'a', 't', 'e', ':', ' '};
+};
+
+/// Immutable response serialized once. The connection writes it as a few
+/// constant buffers around the Date line of its thread, with an optional
+/// header completed per response, e.g. the Allow of a 405.
+class canned_response final {
+ public:
+  canned_response(http::status status,
+                  std::string_view content_type,
+                  std::string_view body,
+                  std::string_view constant_headers = {},
+                  http::field extra_field = http::field::unknown)
+      : status_(status), extra_field_(extra_field) {
+    auto reason = http::obsolete_reason(status);
+    head_.append("HTTP/1.1 ")
+        .append(std::to_string(static_cast<unsigned>(status)))
+        .append(" ")
+        .append(reason.data(), reason.size())
+        .append("\r\n");
+
+    if (!content_type.empty()) {
+      head_.append("Content-Type: ").append(content_type).append("\r\n");
+    }
+    head_.append("Content-Length: ")
+        .append(std::to_string(body.size()))
+        .append("\r\n")
+        .append(constant_headers);
+    tail_.append("\r\n").append(body);
+
+    content_type_ = content_type;
+    // "Name: value\r\n" lines, split for the regular response it may become
+    while (!constant_headers.empty()) {
+      auto end = constant_headers.find("\r\n");
+      auto line = constant_headers.substr(0, end);
+      auto colon = line.find(':');
+      auto value = line.substr(colon + 1);
+      value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+      constant_fields_.emplace_back(line.substr(0, colon), value);
+      constant_headers.remove_prefix(
+          end == std::string_view::npos ? constant_headers.size() : end + 2);
+    }
+
+    if (extra_field_ != http::field::unknown) {
+      auto name = http::to_string(extra_field_);
+      extra_name_.append(name.data(), name.size()).append(": ");
+    }
+  }
+
+  canned_response(const canned_response&) = delete;
+  canned_response& operator=(const canned_response&) = delete;
+
+  http::status status() const { return status_; }
+
+  std::string_view content_type() const { return content_type_; }
+
+  std::string_view body() const { return std::string_view(tail_).substr(2); }
+
+  /// The constant headers besides the Content-Type and Content-Length, e.g.
+  /// the Connection: close of a 413.
+  const std::vector<std::pair<std::string, std::string>>& constant_fields()
+      const {
+    return constant_fields_;
+  }
+
+  /// The header completed per response, `http::field::unknown` if none.
+  http::field extra_field() const { return extra_field_; }
+
+  /// Status line and constant headers.
+  std::string_view head() const { return head_; }
+
+  /// End of the header and body.
+  std::string_view tail() const { return tail_; }
+
+  /// "<extra field>: ", empty if there is no extra field.
+  std::string_view extra_name() const { return extra_name_; }
+
+ private:
+  http::status status_;
+  http::field extra_field_;
+  std::string head_;
+  std::string tail_;
+  std::string content_type_;
+  std::vector<std::pair<std::string, std::string>> constant_fields_;
+  std::string extra_name_;
+};
+
+/// The canned responses of eagle, built on first use.
+struct canned_responses {
+  static const canned_response& not_found() {
+    static const canned_response response{
+        http::status::not_found, "text/html", "<h2>404 - Not Found</h2>"};
+    return response;
+  }
+
+  /// Completed with the Allow of the route.
+  static const canned_response& method_not_allowed() {
+    static const canned_response response{http::status::method_not_allowed,
+                                          {},
+                                          {},
+                                          {},
+                                          http::field::allow};
+    return response;
+  }
+
+  static const canned_response& payload_too_large() {
+    static const canned_response response{http::status::payload_too_large,
+                                          {},
+                                          {},
+                                          "Connection: close\r\n"};
+    return response;
+  }
+
+  /// Completed with the Retry-After in seconds.
+  static const canned_response& too_many_requests() {
+    static const canned_response response{http::status::too_many_requests,
+                                          {},
+                                          {},
+                                          {},
+                                          http::field::retry_after};
+    return response;
+  }
+
+  static const canned_response& service_unavailable() {
+    static const canned_response response{
+        http::status::service_unavailable, {}, {},
+        "Retry-After: 1\r\nConnection: close\r\n"};
+    return response;
+  }
+
+  static const canned_response& health_ok() {
+    static const canned_response response{http::status::ok, "text/plain",
+                                          "OK"};
+    return response;
+  }
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_CANNED_RESPONSE_HPP
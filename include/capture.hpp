@@ -0,0 +1,282 @@
+#ifndef EAGLE_CAPTURE_HPP
+#define EAGLE_CAPTURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+#include "value_encoding.hpp"
+
+namespace eagle {
+
+struct capture_options {
+  // File the captured requests are appended to
+  std::string path_;
+  // Fraction of the requests captured
+  double sample_rate_{1.0};
+  // Bodies are cut to this many bytes
+  size_t max_body_{64 * 1024};
+  // Records waiting for the writer, more are dropped rather than waited for
+  size_t queue_size_{4096};
+  // Headers whose values are replaced by "[redacted]", compared
+  // case-insensitively
+  std::vector<std::string> redacted_headers_{"Authorization", "Cookie",
+                                             "Proxy-Authorization"};
+};
+
+/// A request as captured, `offset_` after the capture started.
+struct captured_request {
+  std::chrono::microseconds offset_{0};
+  http::verb method_{http::verb::get};
+  std::string target_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string body_;
+};
+
+/// Records a sample of the requests into a file, see `app.capture`.
+///
+/// A record is a MessagePack array `[offset in µs, method, target,
+/// {header: value, ..}, body]`, the file their sequence. Requests are only
+/// encoded on the thread serving them, a thread of its own writes them.
+class traffic_capture final {
+ public:
+  explicit traffic_capture(capture_options options)
+      : options_(std::move(options)),
+        file_(options_.path_, std::ios::binary | std::ios::app),
+        start_(std::chrono::steady_clock::now()),
+        writer_([this] { write_(); }) {
+    if (!file_) {
+      LOG(ERROR) << "Can't open the capture file " << options_.path_
+                 << std::endl;
+    }
+  }
+
+  ~traffic_capture() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      stopped_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+  }
+
+  traffic_capture(const traffic_capture&) = delete;
+  traffic_capture& operator=(const traffic_capture&) = delete;
+
+  /// Interceptor capturing the requests it samples, before their handler.
+  interceptor_type interceptor() {
+    return [this](const request& req, response&) {
+      if (sampled_()) {
+        record(req);
+      }
+    };
+  }
+
+  /// Queues `req` for the writer.
+  void record(const request& req) {
+    auto offset = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_);
+
+    const auto& message = req.buffer();
+    size_t header_count = std::distance(message.begin(), message.end());
+    auto body = beast::buffers_to_string(req.body());
+    if (body.size() > options_.max_body_) {
+      body.resize(options_.max_body_);
+    }
+
+    auto view = [](beast::string_view text) {
+      return std::string_view{text.data(), text.size()};
+    };
+
+    std::stringbuf record;
+    value_encoder encoder{body_format::msgpack, record};
+    encoder << array_of{5} << offset.count()
+            << view(message.method_string()) << req.target()
+            << map_of{header_count};
+    for (const auto& field : message) {
+      encoder << view(field.name_string())
+              << (redacted_(field.name_string()) ? "[redacted]"
+                                                 : view(field.value()));
+    }
+    encoder << bytes_of{body};
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (queue_.size() >= options_.queue_size_) {
+        dropped_++;
+        return;
+      }
+      queue_.push_back(std::move(record).str());
+    }
+    wake_.notify_one();
+  }
+
+  /// Writes what is queued.
+  void flush() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    flush_requested_ = true;
+    wake_.notify_one();
+    flushed_.wait(lock, [this] { return !flush_requested_; });
+  }
+
+  /// Records written to the file.
+  size_t captured() const { return captured_; }
+
+  /// Records dropped because the writer was behind.
+  size_t dropped() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return dropped_;
+  }
+
+  const capture_options& options() const { return options_; }
+
+ private:
+  bool redacted_(beast::string_view name) const {
+    for (const auto& redacted : options_.redacted_headers_) {
+      if (beast::iequals(name, redacted)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool sampled_() const {
+    if (options_.sample_rate_ >= 1) {
+      return true;
+    }
+
+    thread_local std::minstd_rand rng{std::random_device{}()};
+    return std::uniform_real_distribution<double>{0, 1}(rng) <
+           options_.sample_rate_;
+  }
+
+  void write_() {
+    std::deque<std::string> records;
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+      wake_.wait(lock, [this] {
+        return stopped_ || flush_requested_ || !queue_.empty();
+      });
+      records.swap(queue_);
+      bool flush = std::exchange(flush_requested_, false);
+      bool stopped = stopped_;
+      lock.unlock();
+
+      for (const auto& record : records) {
+        file_.write(record.data(),
+                    static_cast<std::streamsize>(record.size()));
+      }
+      captured_ += records.size();
+      records.clear();
+      if (flush || stopped) {
+        file_.flush();
+      }
+
+      lock.lock();
+      if (flush) {
+        flushed_.notify_all();
+      }
+      if (stopped && queue_.empty()) {
+        return;
+      }
+    }
+  }
+
+  capture_options options_;
+  std::ofstream file_;
+  std::chrono::steady_clock::time_point start_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable flushed_;
+  std::deque<std::string> queue_;
+  size_t dropped_{0};
+  std::atomic<size_t> captured_{0};
+  bool flush_requested_{false};
+  bool stopped_{false};
+  // Last, it runs once everything else is constructed
+  std::thread writer_;
+};
+
+/// The requests of a capture file, std::nullopt if it can't be read. A
+/// malformed record, e.g. the last one of a capture cut short, ends it: the
+/// requests before it are returned.
+inline std::optional<std::vector<captured_request>> load_capture(
+    const std::string& path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    return std::nullopt;
+  }
+
+  std::ostringstream content;
+  content << file.rdbuf();
+  auto bytes = std::move(content).str();
+
+  using kind = decoded_value::kind;
+  auto text = [](const std::optional<decoded_value>& value)
+      -> std::optional<std::string_view> {
+    if (!value ||
+        (value->kind_ != kind::string && value->kind_ != kind::bytes)) {
+      return std::nullopt;
+    }
+    return value->string_;
+  };
+
+  std::vector<captured_request> requests;
+  value_reader reader{body_format::msgpack, bytes};
+  while (!reader.done()) {
+    auto record = reader.next();
+    auto offset = reader.next();
+    auto method = text(reader.next());
+    auto target = text(reader.next());
+    auto headers = reader.next();
+    if (!record || record->kind_ != kind::array || record->size_ != 5 ||
+        !offset || offset->kind_ != kind::integer || !method || !target ||
+        !headers || headers->kind_ != kind::map) {
+      break;
+    }
+
+    captured_request captured;
+    captured.offset_ = std::chrono::microseconds{offset->integer_};
+    captured.method_ = http::string_to_verb({method->data(), method->size()});
+    captured.target_ = *target;
+    for (size_t idx = 0; idx < headers->size_; idx++) {
+      auto name = text(reader.next());
+      auto value = text(reader.next());
+      if (!name || !value) {
+        break;
+      }
+      captured.headers_.emplace_back(*name, *value);
+    }
+
+    auto body = text(reader.next());
+    if (!body || captured.headers_.size() != headers->size_) {
+      break;
+    }
+    captured.body_ = *body;
+    requests.push_back(std::move(captured));
+  }
+
+  if (!reader.done()) {
+    LOG(WARNING) << "Malformed record after " << requests.size()
+                 << " requests of the capture " << path << std::endl;
+  }
+
+  return requests;
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_CAPTURE_HPP
@@ -21,7 +21,7 @@ namespace eagle {
 
 using interceptor_type = std::function<void(const request&, response&)>;
 
-enum class interception_policy { after = 0, before = 1 };
+enum class interception_policy { after = 0, before = 1, header = 2 };
 
 struct intercept_policy_after {
   static const interception_policy value = interception_policy::after;
@@ -31,6 +31,12 @@ struct intercept_policy_before {
   static const interception_policy value = interception_policy::before;
 };
 
+// Runs once the header of a request is read, before its body. Finishing the
+// response rejects the request, its body is then never read.
+struct intercept_policy_header {
+  static const interception_policy value = interception_policy::header;
+};
+
 }  // namespace eagle
 
 #endif  // EAGLE_COMMON_HPP
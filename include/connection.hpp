@@ -1,10 +1,20 @@
 #ifndef EAGLE_CONNECTION_HPP
 #define EAGLE_CONNECTION_HPP
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <type_traits>
 
 #include "common.hpp"
 #include "dispatcher.hpp"
+#include "object_pool.hpp"
+#include "probes.hpp"
+#include "websocket.hpp"
 
 namespace eagle {
 
@@ -17,57 +27,643 @@ class connection_interface {
   virtual void send_data() = 0;
 };
 
-class connection final : public connection_interface,
-                         public std::enable_shared_from_this<connection> {
+/// Describes how a `basic_connection` drives the stream it owns: how the
+/// stream is built from an accepted socket, which shared context it needs
+/// (e.g. the TLS configuration) and how the session is opened and closed.
+/// Specializations must provide `secure`, `context_type`, `make`,
+/// `async_handshake` and `async_shutdown`. See `tls_connection.hpp` for the
+/// TLS specialization.
+template <typename Stream>
+struct stream_traits;
+
+template <>
+struct stream_traits<tcp::socket> {
+  static constexpr bool secure = false;
+
+  // Plain TCP connections don't share any state between them.
+  struct context_type {};
+
+  static context_type& default_context() {
+    static context_type ctx;
+    return ctx;
+  }
+
+  static tcp::socket make(tcp::socket socket, context_type&) {
+    return socket;
+  }
+
+  template <typename Handler>
+  static void async_handshake(tcp::socket&, Handler&& handler) {
+    handler(beast::error_code{});
+  }
+
+  template <typename Handler>
+  static void async_shutdown(tcp::socket& socket, Handler&& handler) {
+    beast::error_code ec;
+    socket.shutdown(tcp::socket::shutdown_send, ec);
+    handler(ec);
+  }
+};
+
+template <typename Stream>
+class basic_connection final
+    : public connection_interface,
+      public std::enable_shared_from_this<basic_connection<Stream>> {
  public:
-  connection(dispatcher_interface& dispt, tcp::socket socket)
-      : dispatcher_(dispt), socket_(std::move(socket)) {}
-  ~connection() = default;
+  using traits = stream_traits<Stream>;
+  using context_type = typename traits::context_type;
+
+  static constexpr bool secure = traits::secure;
+
+  basic_connection(dispatcher_interface& dispt, tcp::socket socket)
+      : basic_connection(dispt, std::move(socket), traits::default_context()) {
+  }
+
+  basic_connection(dispatcher_interface& dispt,
+                   tcp::socket socket,
+                   context_type& ctx)
+      : dispatcher_(dispt), stream_(traits::make(std::move(socket), ctx)) {
+    request_.executor(stream_.get_executor());
+    request_.connection_id(reinterpret_cast<uintptr_t>(this));
+    record_peer_();
+  }
+
+  ~basic_connection() = default;
+
+  /// Whether a finished connection can be reset to serve another socket,
+  /// see `reset`.
+  static constexpr bool reusable = std::is_move_assignable_v<Stream>;
+
+  /// Serves `socket` with the buffers, timers and messages of a finished
+  /// connection, as if it had just been constructed.
+  void reset(tcp::socket socket) {
+    reset(std::move(socket), traits::default_context());
+  }
+
+  void reset(tcp::socket socket, context_type& ctx) {
+    static_assert(reusable, "The stream of this connection can't be reset");
+
+    stream_ = traits::make(std::move(socket), ctx);
+    buffer_.clear();
+    request_.reset();
+    parser_.reset();
+    response_.reset();
+    chunked_.reset();
+    dispatched_at_ = {};
+    request_.executor(stream_.get_executor());
+    request_.connection_id(reinterpret_cast<uintptr_t>(this));
+    record_peer_();
+  }
 
-  void handle_data() override { handle_request_(); }
+  void handle_data() override {
+    // The only cost of tracing when it is off, or the request not sampled
+    if (auto* tracer = dispatcher_.request_tracer();
+        tracer && tracer->start(trace_)) {
+      request_.trace(&trace_);
+      trace_.begin(trace_phase::accept);
+    }
+
+    arm_deadline_(dispatcher_.header_timeout());
+    handshake_();
+  }
 
   void send_data() override { send_response_(); }
 
+  /// When the request was handed to the dispatcher, the epoch if it wasn't.
+  std::chrono::steady_clock::time_point dispatched_at() const {
+    return dispatched_at_;
+  }
+
  private:
-  void handle_request_() {
-    http::async_read(
-        socket_, buffer_, request_.buffer(),
-        [conn = shared_from_this()](beast::error_code ec,
-                                    std::size_t bytes_transferred) {
-          auto peer_addrs =
-              conn->socket_.remote_endpoint().address().to_string();
-          conn->request_.peer(peer_addrs);
-          // TODO: The dispatcher could fail, what do we do?
-          conn->dispatcher_.dispatch(conn->request_, conn->response_);
-          conn->send_data();
+  void handshake_() {
+    traits::async_handshake(
+        stream_, [conn = this->shared_from_this()](beast::error_code ec) {
+          if (ec) {
+            conn->disarm_deadline_();
+            LOG(ERROR) << "Handshake failed: " << ec.message() << std::endl;
+            return;
+          }
+
+          conn->trace_end_(trace_phase::accept);
+          conn->handle_request_();
         });
   }
 
+  void handle_request_() {
+    trace_begin_(trace_phase::read_header);
+    read_header_();
+  }
+
+  void serve_request_() {
+    if (websocket::is_upgrade(request_.buffer())) {
+      if (auto* handler =
+              dispatcher_.websocket_handler_for(request_.target())) {
+        // Authenticated, rate limited and accounted for like any request
+        dispatched_at_ = std::chrono::steady_clock::now();
+        if (!dispatcher_.intercept_upgrade(request_, response_)) {
+          return send_data();
+        }
+        return upgrade_(*handler, std::string(request_.peer()));
+      }
+    }
+
+    dispatch_();
+  }
+
+  void dispatch_() {
+    dispatched_at_ = std::chrono::steady_clock::now();
+    EAGLE_PROBE(request_parsed, request_.connection_id(),
+                request_.buffer().method_string().data(),
+                request_.target().data(), request_.target().size(),
+                request_.body_size());
+    if (auto* trace = request_.trace()) {
+      dispatcher_.request_tracer()->identify(
+          *trace,
+          request_.header(
+              dispatcher_.request_tracer()->options().request_id_header_));
+    }
+
+    // TODO: The dispatcher could fail, what do we do?
+    dispatcher_.dispatch(request_, response_);
+    respond_();
+  }
+
+  // A deferred response is sent once its handler completes it
+  void respond_() {
+    if (!response_.deferred()) {
+      return send_data();
+    }
+
+    response_.deferred()->on_complete([conn = this->shared_from_this()] {
+      conn->dispatcher_.complete(conn->request_, conn->response_);
+      conn->send_data();
+    });
+  }
+
+  // The header alone first, so that its deadline doesn't cover the body,
+  // the header interceptors can reject the request before its body is sent
+  // and a body reader can take the body
+  void read_header_() {
+    // Parses into the fields and body of the previous request, like Beast
+    // does when reading a whole message
+    parser_.emplace(std::move(request_.buffer()));
+    // Beast checks the Content-Length as soon as the header is parsed, the
+    // limit is restored if the body is buffered. Not boost::none, which
+    // Beast 1.74 compares as lower than any length.
+    parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+    http::async_read_header(
+        stream_, buffer_, *parser_,
+        bind_handler_memory(handler_memory_, [conn = this->shared_from_this()](
+                                                 beast::error_code ec,
+                                                 std::size_t) {
+          conn->disarm_deadline_();
+          if (ec) {
+            // The peer went away (or failed the TLS record layer) before
+            // sending a full header, there is nobody to answer to.
+            return;
+          }
+
+          conn->trace_end_(trace_phase::read_header);
+          conn->header_read_();
+        }));
+  }
+
+  void header_read_() {
+    std::shared_ptr<body_reader> reader;
+    auto limit = dispatcher_interface::default_body_limit;
+    if (dispatcher_.reads_headers_first()) {
+      auto& req = request_;
+      req.buffer().base() = parser_->get().base();
+      if (!dispatcher_.intercept_header(req, response_)) {
+        // Rejected, the connection closes once the answer is written
+        return send_data();
+      }
+
+      // The size of the body is up to the reader
+      reader = dispatcher_.body_reader_for(req);
+      limit = dispatcher_.body_limit_for(req);
+    }
+
+    trace_begin_(trace_phase::read_body);
+    if (!reader) {
+      auto length = parser_->content_length();
+      if (length && *length > limit) {
+        return reject_body_();
+      }
+      parser_->body_limit(limit);
+    }
+
+    if (expects_continue_()) {
+      return send_continue_(std::move(reader));
+    }
+    read_body_or_rest_(std::move(reader));
+  }
+
+  bool expects_continue_() const {
+    const auto& header = parser_->get();
+    return header.version() == 11 &&
+           beast::iequals(header[http::field::expect], "100-continue");
+  }
+
+  // The client sends the body it announced with `Expect: 100-continue`
+  // only once it is told to, i.e. after the header interceptors accepted it
+  void send_continue_(std::shared_ptr<body_reader> reader) {
+    static constexpr std::string_view interim =
+        "HTTP/1.1 100 Continue\r\n\r\n";
+    net::async_write(
+        stream_, net::buffer(interim.data(), interim.size()),
+        bind_handler_memory(handler_memory_, [conn = this->shared_from_this(),
+                                              reader = std::move(reader)](
+                                                 beast::error_code ec,
+                                                 std::size_t) mutable {
+          if (ec) {
+            return;
+          }
+
+          conn->read_body_or_rest_(std::move(reader));
+        }));
+  }
+
+  void read_body_or_rest_(std::shared_ptr<body_reader> reader) {
+    if (reader) {
+      return read_body_(std::move(reader));
+    }
+
+    read_rest_();
+  }
+
+  // Over the limit of its route, the body is not read and the connection
+  // closes once the answer is written
+  void reject_body_() {
+    response_.canned(canned_responses::payload_too_large());
+    dispatcher_.complete(request_, response_);
+    send_data();
+  }
+
+  // Read by pieces, each of which has the body timeout
+  void read_rest_() {
+    if (parser_->is_done()) {
+      return rest_read_();
+    }
+
+    arm_deadline_(dispatcher_.body_timeout());
+    http::async_read_some(
+        stream_, buffer_, *parser_,
+        bind_handler_memory(handler_memory_, [conn = this->shared_from_this()](
+                                                 beast::error_code ec,
+                                                 std::size_t) {
+          if (ec == http::error::body_limit) {
+            // A chunked body, its length is only known as it is read
+            conn->disarm_deadline_();
+            return conn->reject_body_();
+          }
+
+          if (ec) {
+            conn->disarm_deadline_();
+            return;
+          }
+
+          conn->read_rest_();
+        }));
+  }
+
+  void rest_read_() {
+    disarm_deadline_();
+    request_.buffer() = parser_->release();
+    trace_end_(trace_phase::read_body);
+    serve_request_();
+  }
+
+  // Each piece is handed to the reader and dropped, the memory used doesn't
+  // grow with the body.
+  void read_body_(std::shared_ptr<body_reader> reader) {
+    if (parser_->is_done()) {
+      return body_read_(std::move(reader), true);
+    }
+
+    arm_deadline_(dispatcher_.body_timeout());
+    http::async_read_some(
+        stream_, buffer_, *parser_,
+        bind_handler_memory(handler_memory_, [conn = this->shared_from_this(),
+                                              reader = std::move(reader)](
+                                                 beast::error_code ec,
+                                                 std::size_t) mutable {
+          if (ec) {
+            conn->disarm_deadline_();
+            return;
+          }
+
+          auto& body = conn->parser_->get().body();
+          bool accepted = true;
+          for (auto buffer : beast::buffers_range_ref(body.data())) {
+            accepted = reader->write(
+                {static_cast<const char*>(buffer.data()), buffer.size()});
+            if (!accepted) {
+              break;
+            }
+          }
+          body.consume(body.size());
+
+          if (accepted) {
+            return conn->read_body_(std::move(reader));
+          }
+
+          conn->body_read_(std::move(reader), false);
+        }));
+  }
+
+  // Not `accepted` when the reader stopped the body early
+  void body_read_(std::shared_ptr<body_reader> reader, bool accepted) {
+    disarm_deadline_();
+    if (accepted) {
+      reader->finish();
+    }
+
+    request_.buffer() = parser_->release();
+    request_.body_reader(std::move(reader));
+    trace_end_(trace_phase::read_body);
+    dispatch_();
+  }
+
+  // The address is kept in binary form, the request formats it if asked to
+  void record_peer_() {
+    beast::error_code ec;
+    auto endpoint = beast::get_lowest_layer(stream_).remote_endpoint(ec);
+    if (!ec) {
+      request_.peer(endpoint.address());
+    }
+  }
+
+  // The stream moves to a websocket session, this connection ends here.
+  void upgrade_(const websocket_handler& handler, std::string peer) {
+    if constexpr (std::is_move_constructible_v<Stream>) {
+      auto session = std::make_shared<basic_websocket_session<Stream>>(
+          std::move(stream_), handler, std::move(peer),
+          std::string(request_.target()));
+      session->accept(std::move(request_.buffer()));
+    } else {
+      response_.result(http::status::not_implemented);
+      response_.prepare_response();
+      send_data();
+    }
+  }
+
   void send_response_() {
+    trace_begin_(trace_phase::write);
+    if (response_.canned()) {
+      return send_canned_();
+    }
+
+    if (response_.body_stream()) {
+      return send_stream_();
+    }
+
     http::async_write(
-        socket_, response_.buffer(),
-        [conn = shared_from_this()](beast::error_code ec, std::size_t) {
-          conn->socket_.shutdown(tcp::socket::shutdown_send, ec);
-          conn->deadline_.cancel();
+        stream_, response_.buffer(),
+        bind_handler_memory(
+            handler_memory_, [conn = this->shared_from_this()](
+                                 beast::error_code ec, std::size_t bytes) {
+              conn->response_written_(bytes);
+              traits::async_shutdown(conn->stream_, [conn](beast::error_code) {
+                conn->deadline_.cancel();
+              });
+            }));
+  }
+
+  // Pre-serialized response, nothing to serialize but the Date line which is
+  // copied since the one of the thread changes every second.
+  void send_canned_() {
+    const auto& canned = *response_.canned();
+    auto date = http_date::now().line();
+    std::copy(date.begin(), date.end(), date_line_.begin());
+
+    auto extra = response_.canned_extra();
+    auto has_extra = !canned.extra_name().empty();
+    std::array<net::const_buffer, 6> buffers{
+        net::buffer(canned.head().data(), canned.head().size()),
+        net::buffer(canned.extra_name().data(), canned.extra_name().size()),
+        net::buffer(extra.data(), has_extra ? extra.size() : 0),
+        net::buffer("\r\n", has_extra ? 2 : 0),
+        net::buffer(date_line_),
+        net::buffer(canned.tail().data(), canned.tail().size())};
+
+    net::async_write(
+        stream_, buffers,
+        bind_handler_memory(
+            handler_memory_, [conn = this->shared_from_this()](
+                                 beast::error_code ec, std::size_t bytes) {
+              conn->response_written_(bytes);
+              traits::async_shutdown(conn->stream_, [conn](beast::error_code) {
+                conn->deadline_.cancel();
+              });
+            }));
+  }
+
+  // Chunked body: the header goes first, then each chunk as soon as the
+  // stream produces it and the previous one is written.
+  void send_stream_() {
+    chunked_ = std::make_unique<chunked_state>(response_.buffer().base());
+    response_.body_stream()->on_ready([conn = this->shared_from_this()] {
+      net::post(conn->stream_.get_executor(), [conn] { conn->chunk_ready_(); });
+    });
+
+    http::async_write_header(
+        stream_, chunked_->serializer_,
+        [conn = this->shared_from_this()](beast::error_code ec,
+                                          std::size_t bytes) {
+          conn->chunked_->written_ += bytes;
+          if (ec) {
+            return conn->end_stream_(false);
+          }
+
+          conn->next_chunk_();
+        });
+  }
+
+  void next_chunk_() {
+    using status = response_stream::status;
+    auto& body = response_.body_stream();
+
+    auto state = status::ready;
+    do {
+      state = body->next(chunked_->chunk_);
+    } while (state == status::ready && chunked_->chunk_.empty());
+
+    switch (state) {
+      case status::ready:
+        return write_chunk_(net::buffer(chunked_->chunk_));
+      case status::pending:
+        return wait_for_chunk_();
+      case status::failed: {
+        end_stream_(false);
+        beast::error_code ec;
+        beast::get_lowest_layer(stream_).close(ec);
+        return;
+      }
+      case status::done:
+        net::async_write(stream_, http::make_chunk_last(),
+                         [conn = this->shared_from_this()](
+                             beast::error_code ec, std::size_t bytes) {
+                           conn->chunked_->written_ += bytes;
+                           conn->end_stream_(!ec);
+                         });
+        return;
+    }
+  }
+
+  void write_chunk_(net::const_buffer data) {
+    net::async_write(
+        stream_, http::make_chunk(data),
+        [conn = this->shared_from_this()](beast::error_code ec,
+                                          std::size_t bytes) {
+          conn->chunked_->written_ += bytes;
+          if (ec) {
+            return conn->end_stream_(false);
+          }
+
+          conn->next_chunk_();
         });
   }
 
-  void initiate_connection_deadline() {
-    deadline_.async_wait([conn = shared_from_this()](beast::error_code ec) {
-      conn->socket_.close(ec);
+  // The stream wakes the connection up when it has data. Until then the
+  // heartbeat, if any, keeps idle intermediaries from closing the connection
+  // and detects clients that went away.
+  void wait_for_chunk_() {
+    chunked_->waiting_ = true;
+
+    auto interval = response_.body_stream()->heartbeat_interval();
+    if (interval.count() == 0) {
+      return;
+    }
+
+    heartbeat_.expires_after(interval);
+    heartbeat_.async_wait([conn = this->shared_from_this()](
+                              beast::error_code ec) {
+      if (ec || !conn->chunked_->waiting_) {
+        return;
+      }
+
+      conn->chunked_->waiting_ = false;
+      auto heartbeat = conn->response_.body_stream()->heartbeat();
+      conn->write_chunk_(net::buffer(heartbeat.data(), heartbeat.size()));
+    });
+  }
+
+  void chunk_ready_() {
+    if (!chunked_->waiting_) {
+      // A chunk is being written, the next one is pulled right after
+      return;
+    }
+
+    chunked_->waiting_ = false;
+    heartbeat_.cancel();
+    next_chunk_();
+  }
+
+  void end_stream_(bool complete) {
+    response_written_(chunked_->written_);
+    auto& body = response_.body_stream();
+    // The waker owns a reference to the connection
+    body->on_ready({});
+
+    if (!complete) {
+      body->cancel();
+      return;
+    }
+
+    traits::async_shutdown(stream_,
+                           [conn = this->shared_from_this()](
+                               beast::error_code) { conn->deadline_.cancel(); });
+  }
+
+  void trace_begin_(trace_phase phase) {
+    if (auto* trace = request_.trace()) {
+      trace->begin(phase);
+    }
+  }
+
+  void trace_end_(trace_phase phase) {
+    if (auto* trace = request_.trace()) {
+      trace->end(phase);
+    }
+  }
+
+  // The response is written, or the stream ended
+  void response_written_(uint64_t bytes) {
+    EAGLE_PROBE(response_written, request_.connection_id(),
+                static_cast<unsigned>(response_.result()), bytes);
+
+    auto* trace = request_.trace();
+    if (!trace) {
+      return;
+    }
+
+    trace->end(trace_phase::write);
+    auto method = request_.buffer().method_string();
+    dispatcher_.request_tracer()->finish(
+        *trace, {method.data(), method.size()}, request_.target(),
+        static_cast<unsigned>(response_.result()));
+    request_.trace(nullptr);
+  }
+
+  // A connection which doesn't send its header or the next piece of its body
+  // in time, e.g. idle or trickling it, is closed: its read fails and it
+  // ends, freeing its slot. Arming it again replaces the pending wait.
+  void arm_deadline_(std::chrono::milliseconds timeout) {
+    deadline_.expires_after(timeout);
+    deadline_.async_wait([conn = this->shared_from_this()](
+                             beast::error_code ec) {
+      // Disarmed once its wait had already completed
+      if (ec || conn->deadline_.expiry() > std::chrono::steady_clock::now()) {
+        return;
+      }
+
+      beast::get_lowest_layer(conn->stream_).close(ec);
     });
   }
 
+  // The pending wait completes right away and drops its connection
+  void disarm_deadline_() {
+    deadline_.expires_at(std::chrono::steady_clock::time_point::max());
+  }
+
  private:
   dispatcher_interface& dispatcher_;
+  // Reused by the read and the write, which never run at the same time
+  handler_memory handler_memory_;
 
-  tcp::socket socket_;
+  Stream stream_;
   beast::flat_buffer buffer_{8192};
   request request_;
+  // The header is read on its own, then the body, see `read_header_`
+  std::optional<http::request_parser<http::dynamic_body>> parser_;
 
   response response_;
-  net::steady_timer deadline_{socket_.get_executor(), std::chrono::seconds(10)};
+  std::array<char, 37> date_line_;
+  // Pointed to by the request when it is sampled
+  request_trace trace_;
+  net::steady_timer deadline_{stream_.get_executor(),
+                              std::chrono::seconds(10)};
+
+  struct chunked_state {
+    explicit chunked_state(const http::response_header<>& header)
+        : header_(header), serializer_(header_) {}
+
+    http::response<http::empty_body> header_;
+    http::response_serializer<http::empty_body> serializer_;
+    std::string chunk_;
+    bool waiting_{false};
+    // Header and chunks, for the probes
+    uint64_t written_{0};
+  };
+
+  std::unique_ptr<chunked_state> chunked_;
+  std::chrono::steady_clock::time_point dispatched_at_{};
+  net::steady_timer heartbeat_{stream_.get_executor()};
 };
+
+/// Plain HTTP connection over TCP.
+using connection = basic_connection<tcp::socket>;
 };  // namespace eagle
 
 #endif  // EAGLE_CONNECTION_HPP
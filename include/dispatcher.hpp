@@ -6,15 +6,25 @@
 #include <boost/range/adaptors.hpp>
 #include <boost/range/algorithm.hpp>
 #include <chrono>
+#include <cstdint>
 #include <forward_list>
 #include <functional>
+#include <map>
 #include <optional>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "alloc_accounting.hpp"
 #include "common.hpp"
 #include "handler.hpp"
 #include "handler_registry.hpp"
+#include "per_thread.hpp"
+#include "probes.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "websocket.hpp"
 
 using namespace boost::adaptors;
 using namespace boost::range;
@@ -33,83 +43,476 @@ class dispatcher_interface {
   virtual bool add_handler(std::string_view endpoint, handler_type& h_obj) = 0;
 
   virtual bool dispatch(request& request, response& response) = 0;
+
+  /// Ends a response its handler deferred, once it is complete.
+  virtual void complete(request& request, response& response) {
+    response.prepare_response();
+  }
+
+  /// The websocket endpoint serving `target`, if any.
+  virtual const websocket_handler* websocket_handler_for(
+      std::string_view target) const {
+    return nullptr;
+  }
+
+  /// Traces the phases of the requests it samples, if any.
+  virtual const tracer* request_tracer() const { return nullptr; }
+
+  /// Whether connections read the header of every request on its own first,
+  /// for the header interceptors, body limits or body readers.
+  virtual bool reads_headers_first() const { return false; }
+
+  /// Runs the header interceptors on `req`, of which only the header was
+  /// read. False when one of them answered the request, which is then
+  /// complete and its body not read.
+  virtual bool intercept_header(request& req, response& resp) { return true; }
+
+  /// Runs the before interceptors on `req`, which asks for a websocket
+  /// upgrade. False when one of them answered the request, which is then
+  /// complete and not upgraded.
+  virtual bool intercept_upgrade(request& /*req*/, response& /*resp*/) {
+    return true;
+  }
+
+  /// The largest body `req` may buffer, of which only the header was read.
+  virtual uint64_t body_limit_for(const request& req) const {
+    return default_body_limit;
+  }
+
+  // The default of Beast
+  static constexpr uint64_t default_body_limit = 1024 * 1024;
+
+  /// The reader for the body of `req`, of which only the header was read.
+  /// nullptr to read the body as usual.
+  virtual std::shared_ptr<body_reader> body_reader_for(const request& req) {
+    return nullptr;
+  }
+
+  /// Time a connection has to send the header of its request. Past it the
+  /// connection is closed.
+  virtual std::chrono::milliseconds header_timeout() const {
+    return default_header_timeout;
+  }
+
+  static constexpr std::chrono::milliseconds default_header_timeout{10000};
+
+  /// Time a connection has for each read of the body of its request, so
+  /// that a large body sent steadily is read whatever its size. Past it the
+  /// connection is closed.
+  virtual std::chrono::milliseconds body_timeout() const {
+    return default_body_timeout;
+  }
+
+  static constexpr std::chrono::milliseconds default_body_timeout{10000};
 };
 
+/// Makes the reader of a request body from the request header, or nullptr
+/// to buffer the body as usual.
+using body_reader_factory =
+    std::function<std::shared_ptr<body_reader>(const request&)>;
+
 class dispatcher : public dispatcher_interface {
  public:
   dispatcher() {}
   ~dispatcher() = default;
 
   void add_interceptor(interception_policy policy, interceptor_type inter) {
+    intercepts_headers_ |= policy == interception_policy::header;
     interceptors_.push_front({policy, inter});
   }
 
   bool add_handler(http::verb method,
                    std::string_view endpoint,
                    handler_fn_type h_fn) override {
-    return install_fn_handler_(method, endpoint, h_fn);
+    return install_fn_handler_(method, endpoint, std::move(h_fn));
   }
 
   bool add_handler(std::string_view endpoint, handler_type& h_obj) override {
     return install_object_handler_(endpoint, h_obj);
   }
 
+  /// Registers the methods `h_obj` implements as function handlers calling it
+  /// directly, see `is_static_handler_v`. The other methods are answered 405.
+  template <typename Handler>
+  bool add_static_handler(std::string_view endpoint, Handler& h_obj) {
+    return install_static_handler_<Handler>(
+        endpoint, [&h_obj]() -> Handler& { return h_obj; });
+  }
+
+  /// Same as `add_static_handler`, calling the instance of the thread serving
+  /// the request.
+  template <typename Handler>
+  bool add_per_thread_handler(std::string_view endpoint,
+                              per_thread<Handler> handlers) {
+    return install_static_handler_<Handler>(
+        endpoint, [handlers]() -> Handler& { return handlers.local(); });
+  }
+
+  bool add_websocket(std::string_view endpoint, websocket_handler handler) {
+    auto [_, inserted] = websocket_handlers_.emplace(std::string(endpoint),
+                                                     std::move(handler));
+    if (!inserted) {
+      return emit_overwrite_error_(http::verb::get, endpoint);
+    }
+
+    return true;
+  }
+
+  const websocket_handler* websocket_handler_for(
+      std::string_view target) const override {
+    if (websocket_handlers_.empty()) {
+      return nullptr;
+    }
+
+    auto path = target.substr(0, target.find('?'));
+    auto itr = websocket_handlers_.find(std::string(path));
+    return itr == websocket_handlers_.end() ? nullptr : &itr->second;
+  }
+
+  bool add_body_reader(std::string_view endpoint, body_reader_factory factory) {
+    auto [_, inserted] =
+        body_readers_.emplace(std::string(endpoint), std::move(factory));
+    if (!inserted) {
+      return emit_overwrite_error_(std::nullopt, endpoint);
+    }
+
+    return true;
+  }
+
+  /// Bodies of `endpoint` (a route pattern) over `limit` bytes are
+  /// answered `413 Payload Too Large` without being read. The body readers
+  /// are not limited, the size of the body is up to them.
+  bool add_body_limit(std::string_view endpoint, uint64_t limit) {
+    auto [_, inserted] = body_limits_.emplace(std::string(endpoint), limit);
+    if (!inserted) {
+      return emit_overwrite_error_(std::nullopt, endpoint);
+    }
+
+    return true;
+  }
+
+  bool reads_headers_first() const override {
+    return intercepts_headers_ || !body_readers_.empty() ||
+           !body_limits_.empty();
+  }
+
+  bool intercept_header(request& req, response& resp) override {
+    {
+      trace_scope scope{req.trace(), trace_phase::interceptors};
+      execute_interceptors_with_(intercept_policy_header::value, req, resp);
+    }
+
+    if (!resp.finished()) {
+      return true;
+    }
+
+    complete(req, resp);
+    return false;
+  }
+
+  bool intercept_upgrade(request& req, response& resp) override {
+    {
+      trace_scope scope{req.trace(), trace_phase::interceptors};
+      execute_interceptors_with_(intercept_policy_before::value, req, resp);
+    }
+
+    if (!resp.finished()) {
+      return true;
+    }
+
+    complete(req, resp);
+    return false;
+  }
+
+  uint64_t body_limit_for(const request& req) const override {
+    if (body_limits_.empty()) {
+      return default_body_limit;
+    }
+
+    auto itr = body_limits_.find(route_of(req.target()));
+    return itr == body_limits_.end() ? default_body_limit : itr->second;
+  }
+
+  void header_timeout(std::chrono::milliseconds timeout) {
+    header_timeout_ = timeout;
+  }
+
+  std::chrono::milliseconds header_timeout() const override {
+    return header_timeout_;
+  }
+
+  void body_timeout(std::chrono::milliseconds timeout) {
+    body_timeout_ = timeout;
+  }
+
+  std::chrono::milliseconds body_timeout() const override {
+    return body_timeout_;
+  }
+
+  void request_tracer(const tracer* tracer) { tracer_ = tracer; }
+
+  const tracer* request_tracer() const override { return tracer_; }
+
+  /// Counts the allocations of every request into `accounting`.
+  void allocations(const allocation_accounting* accounting) {
+    allocations_ = accounting;
+  }
+
+  const allocation_accounting* allocations() const { return allocations_; }
+
+  std::shared_ptr<body_reader> body_reader_for(const request& req) override {
+    auto path = req.target().substr(0, req.target().find('?'));
+    auto itr = body_readers_.find(std::string(path));
+    return itr == body_readers_.end() ? nullptr : itr->second(req);
+  }
+
   bool dispatch(request& req, response& resp) override {
-    execute_interceptors_with_(intercept_policy_before::value, req, resp);
+    if (allocations_) {
+      req.allocations() = {};
+    }
+    alloc_scope counted{allocations_ ? &req.allocations() : nullptr};
+
+    {
+      trace_scope scope{req.trace(), trace_phase::interceptors};
+      execute_interceptors_with_(intercept_policy_before::value, req, resp);
+    }
+
+    // A before interceptor can answer the request itself (e.g. a rate
+    // limiter) by finishing the response, the handler is then skipped.
+    bool status = resp.finished() ? true : dispatch_to_handler_(req, resp);
+    // No handler ended the routing
+    if (auto* trace = req.trace()) {
+      trace->end(trace_phase::route);
+    }
+
+    if (!status) {
+      resp.result(500);
+    }
+
+    // Ended by `complete` once the handler completes it
+    if (status && resp.deferred()) {
+      return status;
+    }
+
+    complete(req, resp);
+    return status;
+  }
+
+  void complete(request& req, response& resp) override {
+    if (!allocations_) {
+      return complete_(req, resp);
+    }
+
+    {
+      alloc_scope counted{&req.allocations()};
+      complete_(req, resp);
+    }
+    allocations_->record(route_of(req.target()), req.allocations());
+  }
+
+  /// The pattern of the route serving `target`, e.g.
+  /// "/users/{integer:id}", empty when none does.
+  std::string_view route_of(std::string_view target) const {
+    if (auto route = handler_object_registry_.route_for(target)) {
+      return *route;
+    }
+
+    if (auto route = handler_fn_registry_.route_for(target)) {
+      return *route;
+    }
+
+    auto* prefix = prefix_route_for_(target);
+    return prefix ? std::string_view(prefix->first) : std::string_view();
+  }
+
+  /// Handles every method of `prefix` and of the paths under it, e.g.
+  /// "/legacy" handles "/legacy" and "/legacy/users/1". Routes registered
+  /// for a path take precedence.
+  bool add_prefix_handler(std::string_view prefix, handler_fn_type h_fn) {
+    for (const auto& [registered, _] : prefix_handlers_) {
+      if (registered == prefix) {
+        return emit_overwrite_error_(std::nullopt, prefix);
+      }
+    }
+
+    prefix_handlers_.emplace_back(std::string(prefix), std::move(h_fn));
+    return true;
+  }
+
+ private:
+  void complete_(request& req, response& resp) {
+    auto* trace = req.trace();
+    {
+      trace_scope scope{trace, trace_phase::interceptors};
+      execute_interceptors_with_(intercept_policy_after::value, req, resp);
+    }
+
+    {
+      trace_scope scope{trace, trace_phase::log};
+      write_log_for_(req, resp);
+    }
+
+    if (trace && tracer_) {
+      resp.set(tracer_->options().request_id_header_, trace->request_id());
+    }
+
+    trace_scope scope{trace, trace_phase::prepare};
+    resp.prepare_response();
+  }
+
+  bool dispatch_to_handler_(request& req, response& resp) {
+    if (auto* trace = req.trace()) {
+      trace->begin(trace_phase::route);
+    }
 
-    bool status = true;
     auto target_endpoint =
         std::string_view(req.target().data(), req.target().size());
 
-    if (has_object_handler_for_(target_endpoint)) {
-      request_arguments args;
-      auto [opt_handler, _] = handler_object_registry_.get_handler_for(
-          all_method, target_endpoint, args);
+    auto method = req.method();
+    if (method == http::verb::options) {
+      return dispatch_options_(req, resp);
+    }
+
+    // HEAD runs the GET handler, which can check `resp.omits_body()`
+    if (method == http::verb::head) {
+      method = http::verb::get;
+      resp.omit_body();
+    }
+
+    request_arguments args;
+    if (auto [opt_object, found] = handler_object_registry_.get_handler_for(
+            all_method, target_endpoint, args);
+        found) {
       req.args(std::move(args));
+      return dispatch_with_(opt_object->get(), method, req, resp);
+    }
 
-      status = dispatch_with_(opt_handler.value().get(), req, resp);
-    } else if (has_function_handler_for_endpoint_and_method_(target_endpoint,
-                                                             req.method())) {
-      request_arguments args;
-      auto [opt_handler, _] = handler_fn_registry_.get_handler_for(
-          req.method(), target_endpoint, args);
+    if (auto [opt_handler, found] = handler_fn_registry_.get_handler_for(
+            method, target_endpoint, args);
+        found) {
       req.args(std::move(args));
+      return dispatch_with_(*opt_handler, req, resp);
+    }
 
-      status = dispatch_with_(opt_handler.value(), req, resp);
-    } else if (has_at_least_one_function_handler_for_(target_endpoint)) {
+    if (auto allow = handler_fn_registry_.allowed_methods(target_endpoint)) {
       // If we are here it means that there isn't a object handler nor a
       // function handler for the (method, endpoint) pair, but there at least
       // one handler installed for the endpoint; therefore we dispatch a method
       // not allow error.
-      status = dispatch_method_not_allow_(resp);
-    } else {
-      status = dispatch_not_found_(resp);
+      return dispatch_method_not_allow_(*allow, resp);
     }
 
-    if (!status) {
-      resp.result(500);
+    if (auto* h_fn = prefix_handler_for_(target_endpoint)) {
+      return dispatch_with_(h_fn->ref(), req, resp);
     }
 
-    execute_interceptors_with_(intercept_policy_after::value, req, resp);
+    return dispatch_not_found_(resp);
+  }
 
-    write_log_for_(req, resp);
+  // Answered from the routes, no handler runs but the one of a prefix
+  bool dispatch_options_(const request& req, response& resp) {
+    auto endpoint = req.target();
+    auto allow = handler_object_registry_.allowed_methods(endpoint);
+    if (!allow) {
+      allow = handler_fn_registry_.allowed_methods(endpoint);
+    }
 
-    resp.prepare_response();
-    return status;
+    if (!allow) {
+      if (auto* h_fn = prefix_handler_for_(endpoint)) {
+        return dispatch_with_(h_fn->ref(), req, resp);
+      }
+      return dispatch_not_found_(resp);
+    }
+
+    resp.result(http::status::ok);
+    resp.set(http::field::allow, *allow);
+    return true;
+  }
+
+  const handler_fn_type* prefix_handler_for_(std::string_view target) const {
+    auto* prefix = prefix_route_for_(target);
+    return prefix ? &prefix->second : nullptr;
+  }
+
+  const std::pair<std::string, handler_fn_type>* prefix_route_for_(
+      std::string_view target) const {
+    auto path = target.substr(0, target.find('?'));
+    for (const auto& prefix_route : prefix_handlers_) {
+      const auto& prefix = prefix_route.first;
+      if (path.substr(0, prefix.size()) != prefix) {
+        continue;
+      }
+
+      if (path.size() == prefix.size() || prefix.back() == '/' ||
+          path[prefix.size()] == '/') {
+        return &prefix_route;
+      }
+    }
+
+    return nullptr;
   }
 
- private:
   bool dispatch_not_found_(response& resp) {
-    resp.result(http::status::not_found);
-    resp.html() << "<h2>404 - Not Found</h2>";
+    resp.canned(canned_responses::not_found());
     return true;
   }
 
-  bool dispatch_method_not_allow_(response& resp) {
-    resp.result(http::status::method_not_allowed);
+  bool dispatch_method_not_allow_(std::string_view allow, response& resp) {
+    resp.canned(canned_responses::method_not_allowed(), allow);
     return true;
   }
 
+  // `instance` returns the handler object to call
+  template <typename Handler, typename Instance>
+  bool install_static_handler_(std::string_view endpoint, Instance instance) {
+    static_assert(is_static_handler_v<Handler>,
+                  "The handler implements none of get, post, put, del and "
+                  "patch");
+
+    bool installed = true;
+    if constexpr (detail::implements_get<Handler>::value) {
+      installed &= install_fn_handler_(
+          http::verb::get, endpoint,
+          [instance](const request& req, response& resp) {
+            return instance().get(req, resp);
+          });
+    }
+
+    if constexpr (detail::implements_post<Handler>::value) {
+      installed &= install_fn_handler_(
+          http::verb::post, endpoint,
+          [instance](const request& req, response& resp) {
+            return instance().post(req, resp);
+          });
+    }
+
+    if constexpr (detail::implements_put<Handler>::value) {
+      installed &= install_fn_handler_(
+          http::verb::put, endpoint,
+          [instance](const request& req, response& resp) {
+            return instance().put(req, resp);
+          });
+    }
+
+    if constexpr (detail::implements_del<Handler>::value) {
+      installed &= install_fn_handler_(
+          http::verb::delete_, endpoint,
+          [instance](const request& req, response& resp) {
+            return instance().del(req, resp);
+          });
+    }
+
+    if constexpr (detail::implements_patch<Handler>::value) {
+      installed &= install_fn_handler_(
+          http::verb::patch, endpoint,
+          [instance](const request& req, response& resp) {
+            return instance().patch(req, resp);
+          });
+    }
+
+    return installed;
+  }
+
   bool install_fn_handler_(http::verb method,
                            std::string_view endpoint,
                            handler_fn_type h_fn) {
@@ -119,7 +522,8 @@ class dispatcher : public dispatcher_interface {
       return false;
     }
 
-    return handler_fn_registry_.register_handler(method, endpoint, h_fn);
+    return handler_fn_registry_.register_handler(method, endpoint,
+                                                 std::move(h_fn));
   }
 
   bool install_object_handler_(std::string_view endpoint, handler_type& h_obj) {
@@ -148,15 +552,7 @@ class dispatcher : public dispatcher_interface {
   }
 
   bool has_at_least_one_function_handler_for_(std::string_view endpoint) const {
-    return handler_fn_registry_.has(http::verb::get, endpoint) ||
-           handler_fn_registry_.has(http::verb::post, endpoint) ||
-           handler_fn_registry_.has(http::verb::put, endpoint) ||
-           handler_fn_registry_.has(http::verb::delete_, endpoint);
-  }
-
-  bool has_function_handler_for_endpoint_and_method_(std::string_view endpoint,
-                                                     http::verb method) {
-    return handler_fn_registry_.has(method, endpoint);
+    return handler_fn_registry_.allowed_methods(endpoint).has_value();
   }
 
   bool has_object_handler_for_(std::string_view endpoint) const {
@@ -196,29 +592,75 @@ class dispatcher : public dispatcher_interface {
   }
 
   bool dispatch_with_(handler_type& object,
+                      http::verb method,
                       const request& req,
                       response& resp) {
-    auto method = req.method();
+    auto* trace = req.trace();
+    if (trace) {
+      trace->end(trace_phase::route);
+    }
+
+    trace_scope scope{trace, trace_phase::handler};
+    detail::route_scope route{profiled_route_(req)};
+    probe_route_(req);
+    bool status = false;
     switch (method) {
       case http::verb::get:
-        return object.get(req, resp);
+        status = object.get(req, resp);
+        break;
       case http::verb::post:
-        return object.post(req, resp);
+        status = object.post(req, resp);
+        break;
       case http::verb::put:
-        return object.put(req, resp);
+        status = object.put(req, resp);
+        break;
       case http::verb::delete_:
-        return object.del(req, resp);
+        status = object.del(req, resp);
+        break;
+      case http::verb::patch:
+        status = object.patch(req, resp);
+        break;
       default:
         LOG(ERROR) << "Unsupported method " << method << std::endl;
-        return false;
+        break;
     }
+    EAGLE_PROBE(handler_exited, req.connection_id(),
+                static_cast<unsigned>(resp.result()));
+    return status;
   }
 
-  bool dispatch_with_(handler_fn_type h_fn,
+  bool dispatch_with_(handler_fn_ref h_fn,
                       const request& req,
                       response& resp) {
+    auto* trace = req.trace();
+    if (trace) {
+      trace->end(trace_phase::route);
+    }
+
     // TODO: We can do some post processing here instead of return
-    return h_fn(req, resp);
+    trace_scope scope{trace, trace_phase::handler};
+    detail::route_scope route{profiled_route_(req)};
+    probe_route_(req);
+    bool status = h_fn(req, resp);
+    EAGLE_PROBE(handler_exited, req.connection_id(),
+                static_cast<unsigned>(resp.result()));
+    return status;
+  }
+
+  // Looked up only while a profile is taken, the samples are tagged with it
+  std::string_view profiled_route_(const request& req) const {
+    if (!sampling_profiler::instance().sampling()) {
+      return {};
+    }
+
+    return route_of(req.target());
+  }
+
+  void probe_route_(const request& req) {
+    EAGLE_PROBE(route_resolved, req.connection_id(),
+                req.buffer().method_string().data(), req.target().data(),
+                req.target().size());
+    EAGLE_PROBE(handler_entered, req.connection_id());
   }
 
   void write_log_for_(const request& req, const response& resp) {
@@ -243,6 +685,19 @@ class dispatcher : public dispatcher_interface {
 
   std::forward_list<std::pair<interception_policy, interceptor_type>>
       interceptors_;
+
+  // Node based, sessions keep a reference to their handler
+  std::unordered_map<std::string, websocket_handler> websocket_handlers_;
+  std::unordered_map<std::string, body_reader_factory> body_readers_;
+  // Looked up by the route of every request, without a copy
+  std::map<std::string, uint64_t, std::less<>> body_limits_;
+  bool intercepts_headers_{false};
+  std::chrono::milliseconds header_timeout_{default_header_timeout};
+  std::chrono::milliseconds body_timeout_{default_body_timeout};
+  std::vector<std::pair<std::string, handler_fn_type>> prefix_handlers_;
+  // Owned by the app, the copies of the shards share it
+  const tracer* tracer_{nullptr};
+  const allocation_accounting* allocations_{nullptr};
 };
 };  // namespace eagle
 
@@ -0,0 +1,54 @@
+#ifndef EAGLE_ETAG_HPP
+#define EAGLE_ETAG_HPP
+
+#include <string_view>
+#include <utility>
+
+#include "common.hpp"
+
+namespace eagle {
+
+/// Wraps a GET handler so that its body is hashed into a strong ETag (XXH64)
+/// once rendered. Clients sending the same tag in `If-None-Match` get a 304
+/// without body:
+///
+///   app.handle(http::verb::get, "/users", eagle::etag(list_users));
+template <typename Handler>
+auto etag(Handler handler) {
+  return [handler = std::move(handler)](const request& req,
+                                        response& resp) mutable -> bool {
+    resp.hash_etag(req.header(http::field::if_none_match));
+    return handler(req, resp);
+  };
+}
+
+/// For handlers knowing the version of what they serve up front, e.g. the
+/// version of a row: sets the ETag to `version` and returns true when the
+/// client already has it, the response is then a 304 and the body doesn't
+/// need to be rendered.
+///
+///   if (eagle::fresh(req, resp, std::to_string(user.version))) {
+///     return true;
+///   }
+inline bool fresh(const request& req,
+                  response& resp,
+                  std::string_view version) {
+  resp.etag(version);
+
+  auto if_none_match = req.header(http::field::if_none_match);
+  if (if_none_match.empty()) {
+    return false;
+  }
+
+  auto tag = resp.buffer()[http::field::etag];
+  if (!etag_matches(if_none_match, std::string_view(tag.data(), tag.size()))) {
+    return false;
+  }
+
+  resp.result(http::status::not_modified);
+  return true;
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_ETAG_HPP
@@ -0,0 +1,209 @@
+#ifndef EAGLE_FUNCTION_REF_HPP
+#define EAGLE_FUNCTION_REF_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace eagle {
+
+template <typename Signature>
+class function_ref;
+
+/// Non-owning reference to a callable, two pointers wide. The callable must
+/// outlive the reference.
+template <typename R, typename... Args>
+class function_ref<R(Args...)> final {
+ public:
+  template <typename F,
+            typename = std::enable_if_t<
+                !std::is_same_v<std::decay_t<F>, function_ref> &&
+                std::is_invocable_r_v<R, F&, Args...>>>
+  function_ref(F& callable) noexcept
+      : object_(const_cast<void*>(static_cast<const void*>(
+            std::addressof(callable)))),
+        invoke_([](void* object, Args... args) -> R {
+          return (*static_cast<F*>(object))(std::forward<Args>(args)...);
+        }) {}
+
+  function_ref(void* object, R (*invoke)(void*, Args...)) noexcept
+      : object_(object), invoke_(invoke) {}
+
+  R operator()(Args... args) const {
+    return invoke_(object_, std::forward<Args>(args)...);
+  }
+
+ private:
+  void* object_;
+  R (*invoke_)(void*, Args...);
+};
+
+template <typename Signature, size_t Capacity = 48>
+class small_function;
+
+/// Owning, copyable callable like `std::function`, storing callables of up to
+/// `Capacity` bytes inline instead of on the heap. A `function_ref` to the
+/// stored callable skips the indirection through the wrapper.
+template <typename R, typename... Args, size_t Capacity>
+class small_function<R(Args...), Capacity> final {
+ public:
+  small_function() noexcept = default;
+
+  small_function(std::nullptr_t) noexcept {}
+
+  template <typename F,
+            typename = std::enable_if_t<
+                !std::is_same_v<std::decay_t<F>, small_function> &&
+                std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+  small_function(F&& callable) {
+    using callable_type = std::decay_t<F>;
+
+    if constexpr (std::is_same_v<callable_type, std::function<R(Args...)>> ||
+                  std::is_pointer_v<callable_type>) {
+      if (!callable) {
+        return;
+      }
+    }
+
+    if constexpr (stored_inline<callable_type>) {
+      new (&storage_) callable_type(std::forward<F>(callable));
+    } else {
+      heap_ = new callable_type(std::forward<F>(callable));
+    }
+    vtable_ = &vtable_for<callable_type>;
+  }
+
+  small_function(const small_function& other) {
+    if (other.vtable_) {
+      other.vtable_->copy(other, *this);
+      vtable_ = other.vtable_;
+    }
+  }
+
+  small_function(small_function&& other) noexcept {
+    if (other.vtable_) {
+      other.vtable_->move(other, *this);
+      vtable_ = std::exchange(other.vtable_, nullptr);
+    }
+  }
+
+  small_function& operator=(const small_function& other) {
+    if (this != &other) {
+      small_function copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+
+  small_function& operator=(small_function&& other) noexcept {
+    if (this != &other) {
+      reset_();
+      if (other.vtable_) {
+        other.vtable_->move(other, *this);
+        vtable_ = std::exchange(other.vtable_, nullptr);
+      }
+    }
+    return *this;
+  }
+
+  ~small_function() { reset_(); }
+
+  explicit operator bool() const noexcept { return vtable_ != nullptr; }
+
+  R operator()(Args... args) const {
+    if (!vtable_) {
+      throw std::bad_function_call();
+    }
+
+    return vtable_->invoke(target_(), std::forward<Args>(args)...);
+  }
+
+  /// Reference to the stored callable, valid while this object is alive and
+  /// not modified.
+  function_ref<R(Args...)> ref() const noexcept {
+    return function_ref<R(Args...)>(target_(), vtable_->invoke);
+  }
+
+  void swap(small_function& other) noexcept {
+    small_function tmp(std::move(other));
+    other = std::move(*this);
+    *this = std::move(tmp);
+  }
+
+ private:
+  struct vtable {
+    R (*invoke)(void*, Args...);
+    void (*copy)(const small_function&, small_function&);
+    void (*move)(small_function&, small_function&);
+    void (*destroy)(small_function&);
+  };
+
+  template <typename F>
+  static constexpr bool stored_inline =
+      sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible_v<F>;
+
+  template <typename F>
+  static F* target_of_(const small_function& f) {
+    if constexpr (stored_inline<F>) {
+      return const_cast<F*>(reinterpret_cast<const F*>(&f.storage_));
+    } else {
+      return static_cast<F*>(f.heap_);
+    }
+  }
+
+  template <typename F>
+  static inline const vtable vtable_for = {
+      [](void* object, Args... args) -> R {
+        return (*static_cast<F*>(object))(std::forward<Args>(args)...);
+      },
+      [](const small_function& from, small_function& to) {
+        if constexpr (stored_inline<F>) {
+          new (&to.storage_) F(*target_of_<F>(from));
+        } else {
+          to.heap_ = new F(*target_of_<F>(from));
+        }
+      },
+      [](small_function& from, small_function& to) {
+        if constexpr (stored_inline<F>) {
+          new (&to.storage_) F(std::move(*target_of_<F>(from)));
+          target_of_<F>(from)->~F();
+        } else {
+          to.heap_ = std::exchange(from.heap_, nullptr);
+        }
+      },
+      [](small_function& f) {
+        if constexpr (stored_inline<F>) {
+          target_of_<F>(f)->~F();
+        } else {
+          delete target_of_<F>(f);
+        }
+      }};
+
+  void* target_() const {
+    return const_cast<void*>(vtable_ == nullptr ? nullptr
+                                                : static_cast<const void*>(
+                                                      heap_ ? heap_
+                                                            : &storage_));
+  }
+
+  void reset_() {
+    if (vtable_) {
+      vtable_->destroy(*this);
+      vtable_ = nullptr;
+      heap_ = nullptr;
+    }
+  }
+
+ private:
+  std::aligned_storage_t<Capacity, alignof(std::max_align_t)> storage_;
+  void* heap_{nullptr};
+  const vtable* vtable_{nullptr};
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_FUNCTION_REF_HPP
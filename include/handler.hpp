@@ -2,19 +2,25 @@
 #define EAGLE_HANDLER_HPP
 
 #include <functional>
+#include <type_traits>
 #include <typeinfo>
 
 #include "common.hpp"
+#include "function_ref.hpp"
 
 namespace eagle {
 
 class handler_interface;
 
 using handler_type = handler_interface;
-using handler_fn_type = std::function<bool(const request&, response&)>;
-
-/// Handler interface for objects implementing the GET, POST, PUT, and DELETE
-/// HTTP method. For a base implementation, see `eagle::stateful_handler_base`.
+/// Handler functions are stored once, small callables inline, and invoked
+/// through a `handler_fn_ref` to the stored copy.
+using handler_fn_type = small_function<bool(const request&, response&)>;
+using handler_fn_ref = function_ref<bool(const request&, response&)>;
+
+/// Handler interface for objects implementing the GET, POST, PUT, DELETE and
+/// PATCH HTTP method. For a base implementation, see
+/// `eagle::stateful_handler_base`.
 ///
 /// Note: if an object is implementing all HTTP method, it is recommended to
 /// inherit directly from this pure virtual class.
@@ -31,6 +37,13 @@ class handler_interface {
   virtual bool put(const request& req, response& resp) = 0;
 
   virtual bool del(const request& req, response& resp) = 0;
+
+  /// Not pure to keep the existing handlers valid, answers 405 by default.
+  virtual bool patch(const request& /*req*/, response& resp) {
+    resp.result(http::status::method_not_allowed);
+    resp.set(http::field::allow, "GET, HEAD, POST, PUT, DELETE, OPTIONS");
+    return true;
+  }
 };
 
 /// Base implementation of the `eagle::handler_interface` pure virtual class.
@@ -71,6 +84,94 @@ class stateful_handler_base : public handler_interface {
     return true;
   }
 };
+
+namespace detail {
+
+// A handler object method is implemented if it is callable and is not one of
+// the stateful_handler_base defaults answering 405.
+template <typename Handler, typename = void>
+struct implements_get : std::false_type {};
+
+template <typename Handler>
+struct implements_get<Handler, std::void_t<decltype(&Handler::get)>>
+    : std::bool_constant<
+          std::is_invocable_r_v<bool,
+                                decltype(&Handler::get),
+                                Handler&,
+                                const request&,
+                                response&> &&
+          !std::is_same_v<decltype(&Handler::get),
+                          decltype(&stateful_handler_base::get)>> {};
+
+template <typename Handler, typename = void>
+struct implements_post : std::false_type {};
+
+template <typename Handler>
+struct implements_post<Handler, std::void_t<decltype(&Handler::post)>>
+    : std::bool_constant<
+          std::is_invocable_r_v<bool,
+                                decltype(&Handler::post),
+                                Handler&,
+                                const request&,
+                                response&> &&
+          !std::is_same_v<decltype(&Handler::post),
+                          decltype(&stateful_handler_base::post)>> {};
+
+template <typename Handler, typename = void>
+struct implements_put : std::false_type {};
+
+template <typename Handler>
+struct implements_put<Handler, std::void_t<decltype(&Handler::put)>>
+    : std::bool_constant<
+          std::is_invocable_r_v<bool,
+                                decltype(&Handler::put),
+                                Handler&,
+                                const request&,
+                                response&> &&
+          !std::is_same_v<decltype(&Handler::put),
+                          decltype(&stateful_handler_base::put)>> {};
+
+template <typename Handler, typename = void>
+struct implements_del : std::false_type {};
+
+template <typename Handler>
+struct implements_del<Handler, std::void_t<decltype(&Handler::del)>>
+    : std::bool_constant<
+          std::is_invocable_r_v<bool,
+                                decltype(&Handler::del),
+                                Handler&,
+                                const request&,
+                                response&> &&
+          !std::is_same_v<decltype(&Handler::del),
+                          decltype(&stateful_handler_base::del)>> {};
+
+template <typename Handler, typename = void>
+struct implements_patch : std::false_type {};
+
+template <typename Handler>
+struct implements_patch<Handler, std::void_t<decltype(&Handler::patch)>>
+    : std::bool_constant<
+          std::is_invocable_r_v<bool,
+                                decltype(&Handler::patch),
+                                Handler&,
+                                const request&,
+                                response&> &&
+          !std::is_same_v<decltype(&Handler::patch),
+                          decltype(&handler_interface::patch)>> {};
+
+}  // namespace detail
+
+/// True for the handler objects whose methods can be registered one by one,
+/// any concrete type with at least one of get, post, put, del and patch,
+/// deriving from `handler_interface` or not.
+template <typename Handler>
+inline constexpr bool is_static_handler_v =
+    !std::is_abstract_v<Handler> && (detail::implements_get<Handler>::value ||
+                                     detail::implements_post<Handler>::value ||
+                                     detail::implements_put<Handler>::value ||
+                                     detail::implements_del<Handler>::value ||
+                                     detail::implements_patch<Handler>::value);
+
 }  // namespace eagle
 
 #endif  // EAGLE_HANDLER_HPP
@@ -1,13 +1,19 @@
 #ifndef EAGLE_HANDLER_REGISTRY_HPP
 #define EAGLE_HANDLER_REGISTRY_HPP
 
+#include <algorithm>
+#include <array>
 #include <boost/beast.hpp>
+#include <charconv>
+#include <cstdint>
 #include <forward_list>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include "handler.hpp"
 #include "request_arguments.hpp"
@@ -21,8 +27,17 @@ using std::string_view;
 
 inline constexpr std::nullopt_t all_method{std::nullopt};
 
-// Allow allow  (GET, POST, PUT, and DELETE)
-enum supported_method : size_t { get = 0, post, put, del, count, invalid };
+// Methods routed to handlers (GET, POST, PUT, DELETE and PATCH). HEAD and
+// OPTIONS are derived by the dispatcher.
+enum supported_method : size_t {
+  get = 0,
+  post,
+  put,
+  del,
+  patch,
+  count,
+  invalid
+};
 
 namespace detail {
 
@@ -35,20 +50,51 @@ struct is_handler<handler_type> : std::true_type {};
 template <>
 struct is_handler<handler_fn_type> : std::true_type {};
 
+// Handler slot of every verb, indexed by the verb
+inline constexpr auto verb_indexes = [] {
+  std::array<supported_method, static_cast<size_t>(http::verb::unlink) + 1>
+      indexes{};
+  for (auto& idx : indexes) {
+    idx = supported_method::invalid;
+  }
+
+  indexes[static_cast<size_t>(http::verb::get)] = supported_method::get;
+  indexes[static_cast<size_t>(http::verb::post)] = supported_method::post;
+  indexes[static_cast<size_t>(http::verb::put)] = supported_method::put;
+  indexes[static_cast<size_t>(http::verb::delete_)] = supported_method::del;
+  indexes[static_cast<size_t>(http::verb::patch)] = supported_method::patch;
+  return indexes;
+}();
+
 inline constexpr supported_method get_index_for_verb(http::verb method) {
-  switch (method) {
-    case http::verb::get:
-      return supported_method::get;
-    case http::verb::post:
-      return supported_method::post;
-    case http::verb::put:
-      return supported_method::put;
-    case http::verb::delete_:
-      return supported_method::del;
-    default:
-      LOG(ERROR) << "Unsupported method index " << method << std::endl;
-      return supported_method::invalid;
+  auto verb = static_cast<size_t>(method);
+  return verb < verb_indexes.size() ? verb_indexes[verb]
+                                    : supported_method::invalid;
+}
+
+inline constexpr uint8_t method_bit(supported_method idx) {
+  return static_cast<uint8_t>(1u << idx);
+}
+
+inline constexpr uint8_t all_methods_mask = (1u << supported_method::count) - 1;
+
+/// Allow header value for the methods in `mask`, HEAD comes with GET and
+/// OPTIONS is always answered.
+inline std::string allow_header_for(uint8_t mask) {
+  static constexpr std::array<std::string_view, supported_method::count> names{
+      "GET", "POST", "PUT", "DELETE", "PATCH"};
+
+  std::string allow;
+  for (size_t idx = 0; idx < supported_method::count; idx++) {
+    if (mask & method_bit(static_cast<supported_method>(idx))) {
+      allow.append(names[idx]).append(", ");
+      if (idx == supported_method::get) {
+        allow.append("HEAD, ");
+      }
+    }
   }
+
+  return allow.append("OPTIONS");
 }
 
 inline bool emit_overwrite_error(std::optional<http::verb> method,
@@ -71,88 +117,158 @@ inline bool emit_emplace_error(std::optional<http::verb> method,
   return false;
 }
 
-namespace {
-std::tuple<request_arguments, std::string, bool> match_resource_descriptors(
-    const descriptor_list& ts,
-    const std::vector<std::string_view>& partials) {
-  request_arguments parameters;
-  if (ts.size() != partials.size()) {
-    return std::make_tuple(parameters, "", false);
-  }
+/// Matches the path segments of `endpoint` against the descriptors of a
+/// dynamic route, the static segments must be equal and the integer ones fully
+/// numeric. The arguments are only written on a match.
+inline bool match_resource_descriptors(const descriptor_list& descriptors,
+                                       std::string_view endpoint,
+                                       request_arguments* parameters) {
+  size_t idx = 0;
+  size_t start = endpoint.empty() ? 0 : 1;
+  while (start < endpoint.size()) {
+    auto end = std::min(endpoint.find('/', start), endpoint.size());
+    if (idx == descriptors.size()) {
+      return false;
+    }
 
-  for (size_t idx = 0; idx < ts.size(); idx++) {
-    auto tkn = ts.at(idx);
-    if (tkn.type == resource_descriptor_type::kdynamic) {
-      if (tkn.value_type == resource_descriptor_value_type::kinteger) {
-        try {
-          auto value = std::stoi(partials[idx].data());
-          parameters.set<int>(tkn.identifier, value);
-        } catch (...) {
-          return std::make_tuple(parameters, "", false);
-        }
-      } else if (tkn.value_type == resource_descriptor_value_type::kstring) {
-        parameters.set<std::string_view>(tkn.identifier, partials[idx]);
+    const auto& tkn = descriptors.at(idx++);
+    auto partial = endpoint.substr(start, end - start);
+    if (tkn.type == resource_descriptor_type::kstatic) {
+      if (partial != tkn.identifier) {
+        return false;
+      }
+    } else if (tkn.value_type == resource_descriptor_value_type::kinteger) {
+      int value;
+      auto [last, ec] =
+          std::from_chars(partial.data(), partial.data() + partial.size(),
+                          value);
+      if (ec != std::errc() || last != partial.data() + partial.size()) {
+        return false;
       }
     }
+
+    start = end + 1;
+  }
+
+  if (idx != descriptors.size()) {
+    return false;
+  }
+
+  if (!parameters) {
+    return true;
+  }
+
+  // Second pass once matched, most lookups don't need the arguments
+  request_arguments arguments;
+  idx = 0;
+  for (start = 1; start < endpoint.size(); idx++) {
+    auto end = std::min(endpoint.find('/', start), endpoint.size());
+    const auto& tkn = descriptors.at(idx);
+    auto partial = endpoint.substr(start, end - start);
+    if (tkn.value_type == resource_descriptor_value_type::kinteger) {
+      int value = 0;
+      std::from_chars(partial.data(), partial.data() + partial.size(), value);
+      arguments.set<int>(tkn.identifier, value);
+    } else if (tkn.value_type == resource_descriptor_value_type::kstring) {
+      arguments.set<std::string_view>(tkn.identifier, partial);
+    }
+
+    start = end + 1;
   }
 
-  return std::make_tuple(
-      parameters, std::string(ts.path_view().data(), ts.path_view().size()),
-      true);
+  *parameters = std::move(arguments);
+  return true;
 }
 
-std::vector<std::string_view> split_endpoint(std::string_view endpoint) {
-  std::vector<std::string_view> partials;
+/// Routes of a registry. The endpoints are copied and scanned once when
+/// registered and the routes never move, lookups hand out references to the
+/// stored values. Static endpoints are found with one hash lookup, the
+/// dynamic ones are then tried in registration order.
+template <typename Value>
+class route_table final {
+ public:
+  struct route {
+    // Shared by the copies of the table, the keys point into it
+    std::shared_ptr<const std::string> endpoint_;
+    descriptor_list descriptors_;
+    Value value_;
+  };
 
-  size_t start = 1;
-  for (size_t end = start; end < endpoint.size(); end++) {
-    if (endpoint.at(end) == '/') {
-      partials.push_back(endpoint.substr(start, end - 1));
-      start = end + 1;
+  route_table() = default;
+
+  route_table(const route_table& other) : routes_(other.routes_) {
+    for (const auto* dynamic_route : other.dynamic_routes_) {
+      dynamic_routes_.push_back(find(*dynamic_route->endpoint_));
     }
   }
 
-  if (start != endpoint.size()) {
-    partials.push_back(endpoint.substr(start, endpoint.size()));
+  route_table(route_table&&) = default;
+
+  route_table& operator=(route_table other) {
+    routes_ = std::move(other.routes_);
+    dynamic_routes_ = std::move(other.dynamic_routes_);
+    return *this;
   }
 
-  return partials;
-}
-template <typename ContainerType>
-std::tuple<request_arguments, std::string, bool> match_endpoint(
-    std::string_view endpoint,
-    const ContainerType& dispatch_table) {
-  auto path_partials = split_endpoint(endpoint);
-  for (const auto& [key, value] : dispatch_table) {
-    path_scanner scanner{key};
-    auto descriptors = scanner.scan();
-
-    if (descriptors.has_dynamic_descriptor()) {
-      auto [parameters, actual_endpoint, matched] =
-          match_resource_descriptors(descriptors, path_partials);
-      if (matched) {
-        return std::make_tuple(parameters, actual_endpoint, matched);
+  route* find(std::string_view endpoint) {
+    auto itr = routes_.find(endpoint);
+    return itr == routes_.end() ? nullptr : &itr->second;
+  }
+
+  const route* find(std::string_view endpoint) const {
+    auto itr = routes_.find(endpoint);
+    return itr == routes_.end() ? nullptr : &itr->second;
+  }
+
+  /// The new route, or nullptr if `endpoint` is already routed.
+  route* emplace(std::string_view endpoint,
+                 descriptor_list descriptors,
+                 Value value) {
+    auto owned = std::make_shared<const std::string>(endpoint);
+    std::string_view key = *owned;
+    auto [itr, emplaced] = routes_.try_emplace(
+        key, route{std::move(owned), std::move(descriptors), std::move(value)});
+    if (!emplaced) {
+      return nullptr;
+    }
+
+    if (itr->second.descriptors_.has_dynamic_descriptor()) {
+      dynamic_routes_.push_back(&itr->second);
+    }
+
+    return &itr->second;
+  }
+
+  const route* match(std::string_view endpoint,
+                     request_arguments* parameters) const {
+    if (auto* static_route = find(endpoint)) {
+      return static_route;
+    }
+
+    for (const auto* dynamic_route : dynamic_routes_) {
+      if (match_resource_descriptors(dynamic_route->descriptors_, endpoint,
+                                     parameters)) {
+        return dynamic_route;
       }
     }
+
+    return nullptr;
   }
 
-  return std::make_tuple(request_arguments(),
-                         std::string(endpoint.data(), endpoint.size()), false);
-}
-}  // namespace
+ private:
+  std::unordered_map<std::string_view, route> routes_;
+  std::vector<const route*> dynamic_routes_;
+};
 
 template <typename H>
 struct handler_trait {};
 
 template <>
 struct handler_trait<handler_type> {
-  using container_type =
-      std::unordered_map<std::string_view,
-                         std::reference_wrapper<handler_type>>;
-  using value_type = container_type::mapped_type;
+  using value_type = std::reference_wrapper<handler_type>;
 
   struct impl {
-    container_type dispatch_table_;
+    route_table<value_type> dispatch_table_;
 
     bool register_handler(std::string_view endpoint,
                           std::reference_wrapper<handler_type> handler_ref) {
@@ -163,16 +279,14 @@ struct handler_trait<handler_type> {
         return false;
       }
 
-      auto itr = dispatch_table_.find(endpoint);
-      if (itr != dispatch_table_.end()) {
+      if (dispatch_table_.find(endpoint)) {
         // The handler is set and overwriting a handler is likely and error log
         // the error and fail.
         return emit_overwrite_error(std::nullopt, endpoint);
       }
 
-      auto [_, emplaced] = dispatch_table_.try_emplace(endpoint, handler_ref);
-
-      if (!emplaced) {
+      if (!dispatch_table_.emplace(endpoint, std::move(descriptors),
+                                   handler_ref)) {
         return emit_emplace_error(std::nullopt, endpoint);
       }
 
@@ -183,36 +297,54 @@ struct handler_trait<handler_type> {
         optional<http::verb> method,
         std::string_view endpoint,
         request_arguments* pParams) const {
-      auto [parameters, actual_endpoint, matched] =
-          match_endpoint(endpoint, dispatch_table_);
-
-      auto itr = dispatch_table_.find(actual_endpoint);
-      if (itr != dispatch_table_.end()) {
-        if (pParams) {
-          *pParams = parameters;
-        }
-
-        return std::make_pair(itr->second, true);
+      if (auto* route = dispatch_table_.match(endpoint, pParams)) {
+        return std::make_pair(route->value_, true);
       }
+
       return std::make_pair(std::nullopt, false);
     }
 
     bool has(optional<http::verb> method, std::string_view endpoint) const {
-      auto [_, found_handler] = get_handler_for(method, endpoint, nullptr);
-      return found_handler;
+      return dispatch_table_.match(endpoint, nullptr) != nullptr;
+    }
+
+    // An object handler takes every method
+    optional<std::string_view> allowed_methods(
+        std::string_view endpoint) const {
+      static const std::string allow = allow_header_for(all_methods_mask);
+      if (has(all_method, endpoint)) {
+        return std::string_view(allow);
+      }
+
+      return std::nullopt;
     }
   };
 };
 
 template <>
 struct handler_trait<handler_fn_type> {
-  using container_type =
-      std::unordered_map<std::string_view,
-                         std::array<handler_fn_type, supported_method::count>>;
-  using value_type = container_type::mapped_type::value_type;
+  using handler_list = std::array<handler_fn_type, supported_method::count>;
+  // Lookups hand out references to the stored handlers, nothing is copied
+  using value_type = handler_fn_ref;
+
+  struct method_handlers {
+    handler_list handlers_;
+    // One bit per registered slot of handlers_
+    uint8_t methods_{0};
+    // Value of the Allow header answering OPTIONS and the other methods
+    std::string allow_;
+
+    bool has(supported_method idx) const { return methods_ & method_bit(idx); }
+
+    void set(supported_method idx, handler_fn_type handler) {
+      handlers_[idx] = std::move(handler);
+      methods_ |= method_bit(idx);
+      allow_ = allow_header_for(methods_);
+    }
+  };
 
   struct impl {
-    container_type dispatch_table_;
+    route_table<method_handlers> dispatch_table_;
 
     bool register_handler(http::verb method,
                           std::string_view endpoint,
@@ -224,28 +356,31 @@ struct handler_trait<handler_fn_type> {
         return false;
       }
 
-      auto itr = dispatch_table_.find(endpoint);
       auto method_idx = get_index_for_verb(method);
+      if (method_idx == invalid) {
+        LOG(ERROR) << "Unsupported method " << method << " for [" << endpoint
+                   << "]" << std::endl;
+        return false;
+      }
 
-      if (itr != dispatch_table_.end()) {
-        if (itr->second[method_idx]) {
+      if (auto* route = dispatch_table_.find(endpoint)) {
+        if (route->value_.has(method_idx)) {
           // The handler is set and overwriting a handler is likely an error by
           // policy log the error and fail.
           return emit_overwrite_error(method, endpoint);
         }
 
-        itr->second[method_idx] = handler;
+        route->value_.set(method_idx, std::move(handler));
       } else {
         // Create a list of handler and insert it in the map. The list of
         // handler has at most supported_method::count default-initialized
         // handlers which are in a invalid state allowing for
         // handler_fn_type::operator bool() semantics
-        std::array<handler_fn_type, supported_method::count> handler_list;
-        handler_list[method_idx].swap(handler);
-        auto [_, emplaced] =
-            dispatch_table_.try_emplace(endpoint, std::move(handler_list));
+        method_handlers handlers;
+        handlers.set(method_idx, std::move(handler));
 
-        if (!emplaced) {
+        if (!dispatch_table_.emplace(endpoint, std::move(descriptors),
+                                     std::move(handlers))) {
           return emit_emplace_error(method, endpoint);
         }
       }
@@ -257,18 +392,6 @@ struct handler_trait<handler_fn_type> {
         optional<http::verb> method,
         std::string_view endpoint,
         request_arguments* pParams) const {
-      auto [parameters, actual_endpoint, matched] =
-          match_endpoint(endpoint, dispatch_table_);
-
-      auto itr = dispatch_table_.find(actual_endpoint);
-      if (itr == dispatch_table_.end()) {
-        return std::make_pair(std::nullopt, false);
-      }
-
-      if (pParams) {
-        *pParams = parameters;
-      }
-
       auto handler_idx =
           get_index_for_verb(method.value_or(http::verb::unknown));
 
@@ -276,29 +399,29 @@ struct handler_trait<handler_fn_type> {
         return std::make_pair(std::nullopt, false);
       }
 
-      auto handler = itr->second[handler_idx];
-
-      if (!handler) {
+      auto* route = dispatch_table_.match(endpoint, pParams);
+      if (!route || !route->value_.has(handler_idx)) {
         return std::make_pair(std::nullopt, false);
       }
 
-      return std::make_pair(handler, true);
+      return std::make_pair(route->value_.handlers_[handler_idx].ref(), true);
+    }
+
+    optional<std::string_view> allowed_methods(
+        std::string_view endpoint) const {
+      if (auto* route = dispatch_table_.match(endpoint, nullptr)) {
+        return std::string_view(route->value_.allow_);
+      }
+
+      return std::nullopt;
     }
 
     bool has(optional<http::verb> method, std::string_view endpoint) const {
       // If we are looking for all_method, we need to iterate over the
-      // supported_method::count handlers. This could be simplified is a
-      // std::multimap is used.
-      if (method == all_method && dispatch_table_.count(endpoint) > 0) {
-        auto handler_list = dispatch_table_.find(endpoint)->second;
-
-        for (const auto& handler : handler_list) {
-          if (!handler) {
-            return false;
-          }
-        }
-
-        return true;
+      // supported_method::count handlers.
+      if (method == all_method) {
+        auto* route = dispatch_table_.find(endpoint);
+        return route && route->value_.methods_ == all_methods_mask;
       }
 
       // We are looking for one particular handler (method, endpoint)
@@ -327,7 +450,7 @@ class handler_registry {
   bool register_handler(http::verb method,
                         std::string_view endpoint,
                         Handler handler) {
-    return impl_.register_handler(method, endpoint, handler);
+    return impl_.register_handler(method, endpoint, std::move(handler));
   }
 
   bool register_handler(std::string_view endpoint,
@@ -346,6 +469,21 @@ class handler_registry {
     return impl_.has(method, endpoint);
   }
 
+  /// The Allow header value of `endpoint`, if it is routed
+  optional<std::string_view> allowed_methods(std::string_view endpoint) const {
+    return impl_.allowed_methods(endpoint);
+  }
+
+  /// The pattern of the route matching `endpoint`, e.g.
+  /// "/users/{integer:id}".
+  optional<std::string_view> route_for(std::string_view endpoint) const {
+    if (auto* route = impl_.dispatch_table_.match(endpoint, nullptr)) {
+      return std::string_view(*route->endpoint_);
+    }
+
+    return std::nullopt;
+  }
+
  private:
   impl impl_;
 };
@@ -0,0 +1,105 @@
+#ifndef EAGLE_HANDOFF_HPP
+#define EAGLE_HANDOFF_HPP
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace eagle {
+
+/// Sends `fds` as `SCM_RIGHTS` ancillary data over the connected Unix socket
+/// `channel`. The receiving process gets its own duplicates of the
+/// descriptors, the sender keeps (and should eventually close) its copies.
+inline bool send_fds(int channel, const std::vector<int>& fds) {
+  char tag = 'E';
+  iovec iov{&tag, sizeof(tag)};
+
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+  return sendmsg(channel, &msg, MSG_NOSIGNAL) == sizeof(tag);
+}
+
+/// Receives up to `max_fds` descriptors sent with `eagle::send_fds`. The
+/// descriptors are created with `FD_CLOEXEC`.
+inline std::vector<int> receive_fds(int channel, size_t max_fds) {
+  char tag = 0;
+  iovec iov{&tag, sizeof(tag)};
+
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * max_fds));
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  std::vector<int> fds;
+  if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != sizeof(tag)) {
+    return fds;
+  }
+
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+
+    auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    fds.resize(fds.size() + count);
+    std::memcpy(fds.data() + fds.size() - count, CMSG_DATA(cmsg),
+                count * sizeof(int));
+  }
+
+  return fds;
+}
+
+/// Asks the process serving handoffs on the Unix socket `path` (see
+/// `app::enable_handoff`) for its listening socket. On success the caller owns
+/// the returned descriptor and should hand it to `app::adopt`. The previous
+/// process stops accepting as soon as the descriptor is sent and drains its
+/// in-flight requests.
+inline std::optional<int> receive_listener(const std::string& path) {
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return std::nullopt;
+  }
+
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  auto channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (channel < 0) {
+    return std::nullopt;
+  }
+
+  std::vector<int> fds;
+  if (connect(channel, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ==
+      0) {
+    fds = receive_fds(channel, 1);
+  }
+  close(channel);
+
+  if (fds.empty()) {
+    return std::nullopt;
+  }
+
+  return fds.front();
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_HANDOFF_HPP
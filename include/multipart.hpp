@@ -0,0 +1,587 @@
+#ifndef EAGLE_MULTIPART_HPP
+#define EAGLE_MULTIPART_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "request.hpp"
+
+namespace eagle {
+
+namespace detail {
+
+inline bool iequals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+inline std::string_view trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+/// Value of the `name` parameter of a header value such as
+/// `form-data; name="field"; filename="a.txt"`, unquoted.
+inline std::optional<std::string_view> header_parameter(std::string_view value,
+                                                        std::string_view name) {
+  while (!value.empty()) {
+    auto semicolon = value.find(';');
+    if (semicolon == std::string_view::npos) {
+      return std::nullopt;
+    }
+    value.remove_prefix(semicolon + 1);
+
+    auto equal = value.find('=');
+    if (equal == std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    auto key = trim(value.substr(0, equal));
+    value.remove_prefix(equal + 1);
+    value = trim(value);
+
+    std::string_view parameter;
+    if (!value.empty() && value.front() == '"') {
+      auto quote = value.find('"', 1);
+      parameter = value.substr(1, quote == std::string_view::npos
+                                      ? std::string_view::npos
+                                      : quote - 1);
+      value.remove_prefix(std::min(value.size(), parameter.size() + 2));
+    } else {
+      parameter = trim(value.substr(0, value.find(';')));
+      value.remove_prefix(parameter.size());
+    }
+
+    if (iequals(key, name)) {
+      return parameter;
+    }
+  }
+
+  return std::nullopt;
+}
+
+}  // namespace detail
+
+/// Boundary of a `multipart/form-data` content type, if it is one.
+inline std::optional<std::string_view> multipart_boundary(
+    std::string_view content_type) {
+  auto type = detail::trim(content_type.substr(0, content_type.find(';')));
+  if (!detail::iequals(type, "multipart/form-data")) {
+    return std::nullopt;
+  }
+
+  auto boundary = detail::header_parameter(content_type, "boundary");
+  // RFC 2046 limits the boundary to 70 characters
+  if (!boundary || boundary->empty() || boundary->size() > 70) {
+    return std::nullopt;
+  }
+
+  return boundary;
+}
+
+/// Headers of a part, the views are valid until the part ends.
+struct multipart_part {
+  std::string_view name_;
+  // Empty for fields, set for files
+  std::string_view filename_;
+  std::string_view content_type_;
+  // Every header line, "Name: value\r\n"...
+  std::string_view headers_;
+
+  bool is_file() const { return !filename_.empty(); }
+};
+
+/// Callbacks of a `multipart_parser`. Any of them can return false to stop
+/// the parsing.
+class multipart_handler {
+ public:
+  virtual ~multipart_handler() = default;
+
+  virtual bool on_part_begin(const multipart_part& part) { return true; }
+
+  /// A piece of the body of the current part, pieces are as large as the
+  /// input allows.
+  virtual bool on_part_data(std::string_view data) { return true; }
+
+  virtual bool on_part_end() { return true; }
+};
+
+struct multipart_limits {
+  // Size of the headers of one part
+  size_t max_header_size_{8192};
+  size_t max_parts_{1024};
+};
+
+/// Incremental `multipart/form-data` parser (RFC 7578). Input is pushed in
+/// pieces of any size as it arrives and the part bodies are handed out
+/// without copies; the delimiter is searched with Boyer-Moore-Horspool.
+/// Only the headers of the current part and less than a delimiter of input
+/// are kept, so the memory used doesn't depend on the size of the body.
+class multipart_parser final {
+ public:
+  enum class state { preamble, delimiter, headers, body, done, error };
+
+  multipart_parser(std::string_view boundary,
+                   multipart_handler& handler,
+                   const multipart_limits& limits = {})
+      : handler_(handler), limits_(limits) {
+    delimiter_.append("\r\n--").append(boundary);
+    skip_.fill(delimiter_.size());
+    for (size_t idx = 0; idx + 1 < delimiter_.size(); idx++) {
+      skip_[static_cast<unsigned char>(delimiter_[idx])] =
+          delimiter_.size() - 1 - idx;
+    }
+
+    // The first delimiter may start the body, without the line break
+    carry_ = "\r\n";
+  }
+
+  multipart_parser(const multipart_parser&) = delete;
+  multipart_parser& operator=(const multipart_parser&) = delete;
+
+  /// Parses the next piece of the body, false once the body is invalid or
+  /// a callback stopped the parsing.
+  bool feed(std::string_view data) {
+    while (!data.empty()) {
+      switch (state_) {
+        case state::preamble:
+        case state::body:
+          data = body_(data);
+          break;
+        case state::delimiter:
+          data = delimiter_end_(data);
+          break;
+        case state::headers:
+          data = headers_(data);
+          break;
+        case state::done:
+          // The epilogue is ignored
+          return true;
+        case state::error:
+          return false;
+      }
+    }
+
+    return state_ != state::error;
+  }
+
+  /// Whether the closing delimiter was parsed.
+  bool done() const { return state_ == state::done; }
+
+  bool failed() const { return state_ == state::error; }
+
+  size_t parts() const { return parts_; }
+
+ private:
+  std::string_view body_(std::string_view data) {
+    // The carried bytes may be the start of a delimiter
+    if (!carry_.empty()) {
+      auto take = std::min(data.size(), delimiter_.size() - 1);
+      auto carried = carry_.size();
+      carry_.append(data.substr(0, take));
+
+      auto pos = search_(carry_);
+      if (pos != std::string_view::npos && pos < carried) {
+        auto consumed = pos + delimiter_.size() - carried;
+        if (!emit_(std::string_view(carry_).substr(0, pos))) {
+          return {};
+        }
+        carry_.clear();
+        return delimiter_found_(data.substr(consumed));
+      }
+
+      if (take == data.size()) {
+        // Not enough input to decide, keep what may still be a delimiter
+        auto keep = partial_delimiter_(carry_);
+        auto emitted = carry_.size() - keep;
+        if (!emit_(std::string_view(carry_).substr(0, emitted))) {
+          return {};
+        }
+        carry_.erase(0, emitted);
+        return {};
+      }
+
+      carry_.resize(carried);
+      if (!emit_(carry_)) {
+        return {};
+      }
+      carry_.clear();
+    }
+
+    auto pos = search_(data);
+    if (pos != std::string_view::npos) {
+      if (!emit_(data.substr(0, pos))) {
+        return {};
+      }
+      return delimiter_found_(data.substr(pos + delimiter_.size()));
+    }
+
+    auto keep = partial_delimiter_(data);
+    if (!emit_(data.substr(0, data.size() - keep))) {
+      return {};
+    }
+    carry_.assign(data.substr(data.size() - keep));
+    return {};
+  }
+
+  std::string_view delimiter_found_(std::string_view rest) {
+    if (state_ == state::body && !handler_.on_part_end()) {
+      return fail_();
+    }
+
+    state_ = state::delimiter;
+    return rest;
+  }
+
+  // After a delimiter: "--" closes the body, a line break starts a part.
+  // Transport padding (spaces and tabs) is ignored.
+  std::string_view delimiter_end_(std::string_view data) {
+    while (!data.empty()) {
+      auto c = data.front();
+      if (delimiter_tail_.empty() && (c == ' ' || c == '\t')) {
+        data.remove_prefix(1);
+        continue;
+      }
+
+      delimiter_tail_.push_back(c);
+      data.remove_prefix(1);
+      if (delimiter_tail_.size() < 2) {
+        continue;
+      }
+
+      if (delimiter_tail_ == "--") {
+        state_ = state::done;
+        return {};
+      }
+
+      if (delimiter_tail_ != "\r\n") {
+        return fail_();
+      }
+
+      delimiter_tail_.clear();
+      // The line break ending the delimiter also starts the headers, which
+      // makes the empty header block "\r\n\r\n"
+      header_ = "\r\n";
+      state_ = state::headers;
+      return data;
+    }
+
+    return data;
+  }
+
+  std::string_view headers_(std::string_view data) {
+    // The end of the headers can straddle two pieces
+    auto searched_from = header_.size() < 3 ? 0 : header_.size() - 3;
+    auto room = limits_.max_header_size_ + 2 - header_.size();
+    header_.append(data.substr(0, std::min(data.size(), room)));
+
+    auto end = header_.find("\r\n\r\n", searched_from);
+    if (end == std::string::npos) {
+      if (header_.size() >= limits_.max_header_size_ + 2) {
+        return fail_();
+      }
+      return {};
+    }
+
+    auto used = end + 4 - (header_.size() - std::min(data.size(), room));
+    header_.resize(end + 2);
+
+    if (++parts_ > limits_.max_parts_ || !begin_part_()) {
+      return fail_();
+    }
+
+    state_ = state::body;
+    return data.substr(used);
+  }
+
+  bool begin_part_() {
+    multipart_part part;
+    part.headers_ = std::string_view(header_).substr(2);
+
+    auto lines = part.headers_;
+    while (!lines.empty()) {
+      auto eol = lines.find("\r\n");
+      auto line = lines.substr(0, eol);
+      lines.remove_prefix(std::min(lines.size(), eol + 2));
+
+      auto colon = line.find(':');
+      if (colon == std::string_view::npos) {
+        return false;
+      }
+
+      auto name = detail::trim(line.substr(0, colon));
+      auto value = detail::trim(line.substr(colon + 1));
+      if (detail::iequals(name, "Content-Disposition")) {
+        part.name_ = detail::header_parameter(value, "name").value_or("");
+        part.filename_ =
+            detail::header_parameter(value, "filename").value_or("");
+      } else if (detail::iequals(name, "Content-Type")) {
+        part.content_type_ = value;
+      }
+    }
+
+    return handler_.on_part_begin(part);
+  }
+
+  bool emit_(std::string_view data) {
+    if (state_ == state::preamble || data.empty()) {
+      return true;
+    }
+
+    if (!handler_.on_part_data(data)) {
+      fail_();
+      return false;
+    }
+
+    return true;
+  }
+
+  std::string_view fail_() {
+    state_ = state::error;
+    carry_.clear();
+    return {};
+  }
+
+  // Boyer-Moore-Horspool
+  size_t search_(std::string_view text) const {
+    auto length = delimiter_.size();
+    auto last = length - 1;
+    for (size_t pos = 0; pos + length <= text.size();) {
+      if (text[pos + last] == delimiter_[last] &&
+          std::memcmp(text.data() + pos, delimiter_.data(), last) == 0) {
+        return pos;
+      }
+      pos += skip_[static_cast<unsigned char>(text[pos + last])];
+    }
+
+    return std::string_view::npos;
+  }
+
+  // Length of the longest end of `text` that starts the delimiter
+  size_t partial_delimiter_(std::string_view text) const {
+    auto longest = std::min(text.size(), delimiter_.size() - 1);
+    for (auto length = longest; length > 0; length--) {
+      auto tail = text.substr(text.size() - length);
+      if (tail.front() == '\r' &&
+          std::memcmp(tail.data(), delimiter_.data(), length) == 0) {
+        return length;
+      }
+    }
+
+    return 0;
+  }
+
+ private:
+  multipart_handler& handler_;
+  multipart_limits limits_;
+  std::string delimiter_;
+  std::array<size_t, 256> skip_;
+  state state_{state::preamble};
+  std::string carry_;
+  std::string delimiter_tail_;
+  std::string header_;
+  size_t parts_{0};
+};
+
+/// Parses a buffered `multipart/form-data` request body, piece by piece
+/// without gathering it. False if the request isn't a multipart form or
+/// the body is invalid.
+inline bool parse_multipart(const request& req,
+                            multipart_handler& handler,
+                            const multipart_limits& limits = {}) {
+  auto boundary = multipart_boundary(req.header(http::field::content_type));
+  if (!boundary) {
+    return false;
+  }
+
+  multipart_parser parser{*boundary, handler, limits};
+  for (auto buffer : beast::buffers_range_ref(req.body())) {
+    if (!parser.feed({static_cast<const char*>(buffer.data()),
+                      buffer.size()})) {
+      return false;
+    }
+  }
+
+  return parser.done();
+}
+
+struct multipart_upload_options {
+  // Files are written there, under generated names
+  std::string directory_{"/tmp"};
+  // Parts without a filename are kept in memory up to this size
+  size_t max_field_size_{64 * 1024};
+  // Sum of the file sizes, 0 means unlimited
+  size_t max_file_size_{0};
+  multipart_limits limits_;
+};
+
+/// Reads a `multipart/form-data` upload while it arrives: file parts are
+/// written straight to disk and the other fields kept in memory. Register
+/// it with `app.body_reader(endpoint, eagle::multipart_upload::open)`, the
+/// handler of the endpoint then finds it with
+/// `req.body_reader<eagle::multipart_upload>()`.
+///
+/// The files are deleted with the upload unless `keep()` was called, e.g.
+/// after moving them somewhere else.
+class multipart_upload final : public body_reader, multipart_handler {
+ public:
+  struct field {
+    std::string name_;
+    std::string value_;
+  };
+
+  struct file {
+    std::string name_;
+    std::string filename_;
+    std::string content_type_;
+    // Where the content was written
+    std::string path_;
+    size_t size_{0};
+  };
+
+  multipart_upload(std::string_view boundary,
+                   multipart_upload_options options = {})
+      : options_(std::move(options)),
+        parser_(boundary, *this, options_.limits_) {}
+
+  ~multipart_upload() override {
+    close_file_();
+    if (!kept_) {
+      for (const auto& f : files_) {
+        ::unlink(f.path_.c_str());
+      }
+    }
+  }
+
+  /// Factory for `app.body_reader`, nullptr for other content types so that
+  /// their body is read as usual.
+  static std::shared_ptr<body_reader> open(const request& req) {
+    return open_with(req, {});
+  }
+
+  static std::shared_ptr<body_reader> open_with(
+      const request& req,
+      multipart_upload_options options) {
+    auto boundary = multipart_boundary(req.header(http::field::content_type));
+    if (!boundary) {
+      return nullptr;
+    }
+
+    return std::make_shared<multipart_upload>(*boundary, std::move(options));
+  }
+
+  bool write(std::string_view data) override { return parser_.feed(data); }
+
+  void finish() override { finished_ = true; }
+
+  /// The whole body was read and is valid.
+  bool complete() const { return finished_ && parser_.done(); }
+
+  const std::vector<field>& fields() const { return fields_; }
+
+  const std::vector<file>& files() const { return files_; }
+
+  const field* find(std::string_view name) const {
+    for (const auto& f : fields_) {
+      if (f.name_ == name) {
+        return &f;
+      }
+    }
+    return nullptr;
+  }
+
+  void keep() { kept_ = true; }
+
+ private:
+  bool on_part_begin(const multipart_part& part) override {
+    if (!part.is_file()) {
+      fields_.push_back({std::string(part.name_), {}});
+      return true;
+    }
+
+    auto path = options_.directory_ + "/eagle-upload-XXXXXX";
+    fd_ = ::mkstemp(path.data());
+    if (fd_ < 0) {
+      return false;
+    }
+
+    files_.push_back({std::string(part.name_), std::string(part.filename_),
+                      std::string(part.content_type_), std::move(path), 0});
+    return true;
+  }
+
+  bool on_part_data(std::string_view data) override {
+    if (fd_ < 0) {
+      auto& value = fields_.back().value_;
+      if (value.size() + data.size() > options_.max_field_size_) {
+        return false;
+      }
+      value.append(data);
+      return true;
+    }
+
+    files_.back().size_ += data.size();
+    file_bytes_ += data.size();
+    if (options_.max_file_size_ && file_bytes_ > options_.max_file_size_) {
+      return false;
+    }
+
+    while (!data.empty()) {
+      auto written = ::write(fd_, data.data(), data.size());
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data.remove_prefix(static_cast<size_t>(written));
+    }
+
+    return true;
+  }
+
+  bool on_part_end() override {
+    close_file_();
+    return true;
+  }
+
+  void close_file_() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+ private:
+  multipart_upload_options options_;
+  multipart_parser parser_;
+  std::vector<field> fields_;
+  std::vector<file> files_;
+  size_t file_bytes_{0};
+  int fd_{-1};
+  bool finished_{false};
+  bool kept_{false};
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_MULTIPART_HPP
@@ -0,0 +1,248 @@
+#ifndef EAGLE_OBJECT_POOL_HPP
+#define EAGLE_OBJECT_POOL_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace eagle {
+
+/// Free list of objects owned by a single thread. Released objects are kept,
+/// up to `capacity`, and handed out again instead of allocating new ones;
+/// the caller resets their state. Once closed the pool deletes what it holds
+/// and everything released afterwards.
+template <typename T>
+class object_pool final {
+ public:
+  explicit object_pool(size_t capacity = 1024) : capacity_(capacity) {}
+
+  object_pool(const object_pool&) = delete;
+  object_pool& operator=(const object_pool&) = delete;
+
+  ~object_pool() { close(); }
+
+  /// A released object, or nullptr if there is none.
+  T* acquire() {
+    if (free_.empty()) {
+      return nullptr;
+    }
+
+    auto* object = free_.back();
+    free_.pop_back();
+    return object;
+  }
+
+  void release(T* object) {
+    if (!open_ || free_.size() >= capacity_) {
+      delete object;
+      return;
+    }
+
+    free_.push_back(object);
+  }
+
+  void close() {
+    open_ = false;
+    for (auto* object : free_) {
+      delete object;
+    }
+    free_.clear();
+  }
+
+  size_t size() const { return free_.size(); }
+
+ private:
+  size_t capacity_;
+  bool open_{true};
+  std::vector<T*> free_;
+};
+
+/// Free list of memory blocks of one size, e.g. the control blocks of the
+/// `shared_ptr`s handed out by a pool. Blocks of another size go straight to
+/// the global allocator.
+class block_cache final {
+ public:
+  explicit block_cache(size_t capacity = 1024) : capacity_(capacity) {}
+
+  block_cache(const block_cache&) = delete;
+  block_cache& operator=(const block_cache&) = delete;
+
+  ~block_cache() { close(); }
+
+  void* allocate(size_t size) {
+    if (size == block_size_ && !free_.empty()) {
+      auto* block = free_.back();
+      free_.pop_back();
+      return block;
+    }
+
+    return ::operator new(size);
+  }
+
+  void deallocate(void* block, size_t size) {
+    if (block_size_ == 0) {
+      block_size_ = size;
+    }
+
+    if (!open_ || size != block_size_ || free_.size() >= capacity_) {
+      ::operator delete(block);
+      return;
+    }
+
+    free_.push_back(block);
+  }
+
+  void close() {
+    open_ = false;
+    for (auto* block : free_) {
+      ::operator delete(block);
+    }
+    free_.clear();
+  }
+
+  size_t size() const { return free_.size(); }
+
+ private:
+  size_t capacity_;
+  size_t block_size_{0};
+  bool open_{true};
+  std::vector<void*> free_;
+};
+
+/// Allocator drawing from a `block_cache`, which must outlive it.
+template <typename T>
+struct recycling_allocator {
+  using value_type = T;
+
+  explicit recycling_allocator(block_cache& cache) : cache_(&cache) {}
+
+  template <typename U>
+  recycling_allocator(const recycling_allocator<U>& other)
+      : cache_(other.cache_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(cache_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) { cache_->deallocate(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const recycling_allocator<U>& other) const {
+    return cache_ == other.cache_;
+  }
+
+  template <typename U>
+  bool operator!=(const recycling_allocator<U>& other) const {
+    return cache_ != other.cache_;
+  }
+
+  block_cache* cache_;
+};
+
+/// Storage for the state of the asynchronous operations of one object, e.g.
+/// the read then the write of a connection and the operations they compose.
+/// Asio allocates the operations of a handler wrapped with
+/// `bind_handler_memory` from it, the ones that don't fit fall back to the
+/// global allocator.
+class handler_memory final {
+ public:
+  handler_memory() = default;
+
+  handler_memory(const handler_memory&) = delete;
+  handler_memory& operator=(const handler_memory&) = delete;
+
+  void* allocate(size_t size) {
+    if (size <= slot_size) {
+      for (size_t idx = 0; idx < slot_count; idx++) {
+        if (!in_use_[idx]) {
+          in_use_[idx] = true;
+          return &slots_[idx];
+        }
+      }
+    }
+
+    return ::operator new(size);
+  }
+
+  void deallocate(void* pointer) {
+    for (size_t idx = 0; idx < slot_count; idx++) {
+      if (pointer == &slots_[idx]) {
+        in_use_[idx] = false;
+        return;
+      }
+    }
+
+    ::operator delete(pointer);
+  }
+
+ private:
+  static constexpr size_t slot_size = 512;
+  static constexpr size_t slot_count = 4;
+
+  std::aligned_storage_t<slot_size> slots_[slot_count];
+  bool in_use_[slot_count]{};
+};
+
+template <typename T>
+struct handler_allocator {
+  using value_type = T;
+
+  explicit handler_allocator(handler_memory& memory) : memory_(&memory) {}
+
+  template <typename U>
+  handler_allocator(const handler_allocator<U>& other)
+      : memory_(other.memory_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(memory_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t) { memory_->deallocate(p); }
+
+  template <typename U>
+  bool operator==(const handler_allocator<U>& other) const {
+    return memory_ == other.memory_;
+  }
+
+  template <typename U>
+  bool operator!=(const handler_allocator<U>& other) const {
+    return memory_ != other.memory_;
+  }
+
+  handler_memory* memory_;
+};
+
+template <typename Handler>
+class memory_bound_handler {
+ public:
+  using allocator_type = handler_allocator<Handler>;
+
+  memory_bound_handler(handler_memory& memory, Handler handler)
+      : memory_(memory), handler_(std::move(handler)) {}
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(memory_);
+  }
+
+  template <typename... Args>
+  void operator()(Args&&... args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+ private:
+  handler_memory& memory_;
+  Handler handler_;
+};
+
+template <typename Handler>
+memory_bound_handler<std::decay_t<Handler>> bind_handler_memory(
+    handler_memory& memory,
+    Handler&& handler) {
+  return {memory, std::forward<Handler>(handler)};
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_OBJECT_POOL_HPP
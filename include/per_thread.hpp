@@ -0,0 +1,106 @@
+#ifndef EAGLE_PER_THREAD_HPP
+#define EAGLE_PER_THREAD_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace eagle {
+
+namespace detail {
+
+// Identifies a `per_thread` object in the slots of the threads, never reused
+// so that the slot of a destroyed one is never read again.
+inline std::atomic<size_t> next_per_thread_id{0};
+
+inline std::vector<void*>& per_thread_slots() {
+  thread_local std::vector<void*> slots;
+  return slots;
+}
+
+}  // namespace detail
+
+/// One instance of `T` per thread, made by the factory the first time the
+/// thread asks for it. Copies share the instances, e.g. the copies of a
+/// handler in the routes of every shard.
+///
+/// The instances can be read from any thread with `for_each` and
+/// `aggregate` while their own threads update them, the members read that
+/// way should be atomics updated with relaxed stores.
+template <typename T>
+class per_thread final {
+ public:
+  template <typename Factory,
+            typename = std::enable_if_t<
+                !std::is_same_v<std::decay_t<Factory>, per_thread>>>
+  explicit per_thread(Factory factory)
+      : state_(std::make_shared<state>(std::move(factory))) {}
+
+  /// The instance of the calling thread.
+  T& local() const {
+    auto& slots = detail::per_thread_slots();
+    if (slots.size() <= state_->id_) {
+      slots.resize(state_->id_ + 1, nullptr);
+    }
+
+    auto& slot = slots[state_->id_];
+    if (!slot) {
+      // Built in place, T may be neither copyable nor movable
+      std::unique_ptr<T> instance{new T(state_->factory_())};
+      slot = instance.get();
+      std::lock_guard<std::mutex> lock{state_->mutex_};
+      state_->instances_.push_back(std::move(instance));
+    }
+
+    return *static_cast<T*>(slot);
+  }
+
+  /// Calls `visit` with every instance made so far.
+  template <typename Visitor>
+  void for_each(Visitor&& visit) const {
+    std::lock_guard<std::mutex> lock{state_->mutex_};
+    for (const auto& instance : state_->instances_) {
+      visit(static_cast<const T&>(*instance));
+    }
+  }
+
+  /// Folds the instances into `init` with `merge(accumulated, instance)`.
+  template <typename Result, typename Merge>
+  Result aggregate(Result init, Merge&& merge) const {
+    for_each([&](const T& instance) {
+      init = merge(std::move(init), instance);
+    });
+    return init;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock{state_->mutex_};
+    return state_->instances_.size();
+  }
+
+ private:
+  struct state {
+    template <typename Factory>
+    explicit state(Factory&& factory)
+        : factory_(std::forward<Factory>(factory)) {}
+
+    const size_t id_{detail::next_per_thread_id++};
+    std::function<T()> factory_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<T>> instances_;
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+template <typename Factory>
+per_thread(Factory) -> per_thread<std::invoke_result_t<Factory&>>;
+
+}  // namespace eagle
+
+#endif  // EAGLE_PER_THREAD_HPP
@@ -0,0 +1,31 @@
+#ifndef EAGLE_PROBES_HPP
+#define EAGLE_PROBES_HPP
+
+/// USDT probes of the request lifecycle, for bpftrace or perf, built with the
+/// `usdt` meson option (which defines EAGLE_USDT). A probe is a nop until a
+/// tracer attaches to it. All of them are in the `eagle` provider, the first
+/// argument is the connection id:
+///
+///   connection_accepted(conn, shard)
+///   request_parsed(conn, method, target, target_length, body_bytes)
+///   route_resolved(conn, method, target, target_length)
+///   handler_entered(conn)
+///   handler_exited(conn, status)
+///   response_written(conn, status, bytes)
+///   connection_closed(conn)
+///
+/// `method` is a NUL terminated string, `target` is not, e.g.
+///
+///   bpftrace -e 'usdt:./app:eagle:request_parsed
+///                { printf("%s %s\n", str(arg1), str(arg2, arg3)); }'
+#ifdef EAGLE_USDT
+#include <sys/sdt.h>
+
+#define EAGLE_PROBE(name, ...) STAP_PROBEV(eagle, name, __VA_ARGS__)
+#else
+#define EAGLE_PROBE(name, ...) \
+  do {                         \
+  } while (0)
+#endif
+
+#endif  // EAGLE_PROBES_HPP
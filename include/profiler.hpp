@@ -0,0 +1,352 @@
+#ifndef EAGLE_PROFILER_HPP
+#define EAGLE_PROFILER_HPP
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "canned_response.hpp"
+#include "common.hpp"
+#include "urlencoded.hpp"
+
+namespace eagle {
+
+struct profiler_options {
+  // Samples per second of CPU time used by the process
+  unsigned frequency_{99};
+  // Samples kept per profile, the buffer is allocated once
+  size_t max_samples_{10000};
+  // Without `seconds` in the query
+  std::chrono::seconds default_duration_{10};
+  std::chrono::seconds max_duration_{60};
+};
+
+namespace detail {
+
+// The route pattern of the handler the thread runs, if any. The signal
+// handler interrupts the thread between any two stores: it reads the size
+// first, and a size is only stored once the data it goes with is.
+struct route_tag {
+  std::atomic<const char*> data_{nullptr};
+  std::atomic<size_t> size_{0};
+};
+
+inline route_tag& current_route() {
+  static thread_local route_tag tag;
+  return tag;
+}
+
+// Tags the samples taken while a handler runs with its route
+class route_scope final {
+ public:
+  explicit route_scope(std::string_view route) {
+    auto& tag = current_route();
+    tag.size_.store(0, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_release);
+    tag.data_.store(route.data(), std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_release);
+    tag.size_.store(route.size(), std::memory_order_relaxed);
+  }
+
+  ~route_scope() {
+    current_route().size_.store(0, std::memory_order_relaxed);
+  }
+
+  route_scope(const route_scope&) = delete;
+  route_scope& operator=(const route_scope&) = delete;
+};
+
+}  // namespace detail
+
+/// Samples the stacks of the threads using CPU with SIGPROF, one profile at
+/// a time since the timer is process wide. Samples go to a buffer allocated
+/// before sampling starts, the signal handler only copies the frames.
+class sampling_profiler final {
+ public:
+  static constexpr size_t max_depth = 32;
+  static constexpr size_t max_tag = 64;
+
+  static sampling_profiler& instance() {
+    static sampling_profiler profiler;
+    return profiler;
+  }
+
+  /// False if a profile is already running, or the timer can't be set.
+  bool start(const profiler_options& options) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (running_) {
+      return false;
+    }
+
+    if (!samples_ || capacity_ != options.max_samples_) {
+      samples_ = std::make_unique<sample[]>(options.max_samples_);
+      capacity_ = options.max_samples_;
+    }
+    for (size_t idx = 0; idx < capacity_; idx++) {
+      samples_[idx].ready_.store(false, std::memory_order_relaxed);
+    }
+    next_.store(0, std::memory_order_relaxed);
+
+    // The first call loads the unwinder, which isn't safe in the handler
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    // Installed once and for all: restoring the default action would kill
+    // the process on a SIGPROF still pending.
+    if (!installed_) {
+      struct sigaction action {};
+      action.sa_handler = &sampling_profiler::on_signal_;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      if (sigaction(SIGPROF, &action, nullptr) != 0) {
+        return false;
+      }
+      installed_ = true;
+    }
+
+    sampling_.store(true, std::memory_order_release);
+    auto interval = 1000000 / std::max(options.frequency_, 1u);
+    itimerval timer{};
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+      sampling_.store(false, std::memory_order_release);
+      return false;
+    }
+
+    running_ = true;
+    return true;
+  }
+
+  bool running() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return running_;
+  }
+
+  /// Whether samples are being taken, without a lock.
+  bool sampling() const { return sampling_.load(std::memory_order_relaxed); }
+
+  /// Stops sampling and returns the stacks in the folded format of
+  /// flamegraph.pl and speedscope: "route;outer;...;inner count" per line.
+  std::string stop() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (!running_) {
+      return {};
+    }
+
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sampling_.store(false, std::memory_order_release);
+    running_ = false;
+
+    std::map<std::string, size_t> stacks;
+    std::unordered_map<void*, std::string> symbols;
+    auto taken = std::min(next_.load(std::memory_order_relaxed), capacity_);
+    for (size_t idx = 0; idx < taken; idx++) {
+      const auto& s = samples_[idx];
+      if (!s.ready_.load(std::memory_order_acquire)) {
+        continue;
+      }
+
+      std::string stack{s.tag_, s.tag_size_};
+      // The two innermost frames are the handler and the signal trampoline
+      for (size_t frame = s.depth_; frame > 2; frame--) {
+        auto* address = s.frames_[frame - 1];
+        auto itr = symbols.find(address);
+        if (itr == symbols.end()) {
+          itr = symbols.emplace(address, symbolize_(address)).first;
+        }
+
+        if (!stack.empty()) {
+          stack += ';';
+        }
+        stack += itr->second;
+      }
+      stacks[std::move(stack)]++;
+    }
+
+    std::string folded;
+    for (const auto& [stack, count] : stacks) {
+      folded.append(stack).append(" ").append(std::to_string(count));
+      folded += '\n';
+    }
+
+    auto dropped = next_.load(std::memory_order_relaxed);
+    if (dropped > capacity_) {
+      LOG(WARNING) << "Profile buffer full, " << dropped - capacity_
+                   << " samples dropped" << std::endl;
+    }
+    return folded;
+  }
+
+ private:
+  struct sample {
+    std::atomic<bool> ready_{false};
+    int depth_{0};
+    void* frames_[max_depth];
+    size_t tag_size_{0};
+    char tag_[max_tag];
+  };
+
+  sampling_profiler() = default;
+
+  // Async-signal-safe: claims a slot and copies the frames and the route
+  static void on_signal_(int) {
+    auto& self = instance();
+    if (!self.sampling_.load(std::memory_order_acquire)) {
+      return;
+    }
+
+    auto idx = self.next_.fetch_add(1, std::memory_order_relaxed);
+    if (idx >= self.capacity_) {
+      return;
+    }
+
+    auto saved_errno = errno;
+    auto& s = self.samples_[idx];
+    s.depth_ = backtrace(s.frames_, max_depth);
+
+    auto& route = detail::current_route();
+    auto size = std::min(route.size_.load(std::memory_order_relaxed), max_tag);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    std::copy_n(route.data_.load(std::memory_order_relaxed), size, s.tag_);
+    s.tag_size_ = size;
+
+    s.ready_.store(true, std::memory_order_release);
+    errno = saved_errno;
+  }
+
+  // Return addresses point after the call, hence the - 1
+  static std::string symbolize_(void* address) {
+    auto* pc = static_cast<char*>(address) - 1;
+    Dl_info info{};
+    if (dladdr(pc, &info) && info.dli_sname) {
+      int status = 0;
+      char* demangled =
+          abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+      std::string name = status == 0 ? demangled : info.dli_sname;
+      std::free(demangled);
+      return name;
+    }
+
+    char text[256];
+    if (info.dli_fname) {
+      const char* base = std::strrchr(info.dli_fname, '/');
+      auto offset = pc - static_cast<char*>(info.dli_fbase);
+      std::snprintf(text, sizeof(text), "%s+0x%zx",
+                    base ? base + 1 : info.dli_fname,
+                    static_cast<size_t>(offset));
+    } else {
+      std::snprintf(text, sizeof(text), "0x%zx", reinterpret_cast<size_t>(pc));
+    }
+    return text;
+  }
+
+  mutable std::mutex mutex_;
+  bool running_{false};
+  bool installed_{false};
+  std::atomic<bool> sampling_{false};
+  std::unique_ptr<sample[]> samples_;
+  size_t capacity_{0};
+  std::atomic<size_t> next_{0};
+};
+
+/// Handler of `app.profiler`: profiles for `seconds` of the query, then
+/// answers the folded stacks. The response is deferred meanwhile, the thread
+/// keeps serving requests.
+class profile_handler final {
+ public:
+  profile_handler(std::string_view endpoint, profiler_options options)
+      : endpoint_(endpoint), options_(std::move(options)) {}
+
+  bool operator()(const request& req, response& resp) const {
+    auto target = req.target();
+    auto query = target.find('?');
+    if (target.substr(0, query) != endpoint_) {
+      resp.canned(canned_responses::not_found());
+      return true;
+    }
+
+    if (req.method() != http::verb::get) {
+      resp.canned(canned_responses::method_not_allowed(), "GET");
+      return true;
+    }
+
+    auto duration = options_.default_duration_;
+    if (query != std::string_view::npos) {
+      url_form form{std::string(target.substr(query + 1))};
+      if (auto seconds = form.get("seconds")) {
+        long value = 0;
+        auto [end, ec] = std::from_chars(
+            seconds->data(), seconds->data() + seconds->size(), value);
+        if (ec != std::errc{} || end != seconds->data() + seconds->size() ||
+            value <= 0 || value > options_.max_duration_.count()) {
+          resp.result(http::status::bad_request);
+          resp.html() << "seconds must be between 1 and "
+                      << options_.max_duration_.count() << "\n";
+          return true;
+        }
+        duration = std::chrono::seconds(value);
+      }
+    }
+
+    if (!sampling_profiler::instance().start(options_)) {
+      resp.result(http::status::conflict);
+      resp.html() << "A profile is already running\n";
+      return true;
+    }
+
+    auto session = std::make_shared<profile_session>();
+    auto completion = resp.defer();
+    auto timer = std::make_shared<net::steady_timer>(req.executor(), duration);
+    timer->async_wait(
+        [timer, session, completion, &resp](beast::error_code) {
+          resp.html() << session->finish();
+          resp.set(http::field::content_type, "text/plain");
+          completion->complete();
+        });
+    return true;
+  }
+
+ private:
+  // Stops the profile even if the timer never fires, e.g. on shutdown
+  struct profile_session {
+    ~profile_session() {
+      if (!finished_) {
+        sampling_profiler::instance().stop();
+      }
+    }
+
+    std::string finish() {
+      finished_ = true;
+      return sampling_profiler::instance().stop();
+    }
+
+    bool finished_{false};
+  };
+
+  std::string endpoint_;
+  profiler_options options_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_PROFILER_HPP
@@ -0,0 +1,641 @@
+#ifndef EAGLE_PROXY_HPP
+#define EAGLE_PROXY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+
+namespace eagle {
+
+enum class load_balancing { round_robin, least_outstanding };
+
+struct proxy_options {
+  // "host:port", resolved once when the proxy is created
+  std::vector<std::string> upstreams_;
+  load_balancing balancing_{load_balancing::round_robin};
+  std::chrono::milliseconds connect_timeout_{1000};
+  // Until the response header, then for every piece of the body
+  std::chrono::milliseconds response_timeout_{10000};
+  // Kept alive per upstream, in every thread
+  size_t max_idle_connections_{16};
+  // Consecutive failures opening the circuit of an upstream
+  size_t failure_threshold_{5};
+  // How long an open circuit skips its upstream before trying it again
+  std::chrono::milliseconds open_interval_{5000};
+  // Removed from the target before forwarding, e.g. "/legacy"
+  std::string strip_prefix_;
+};
+
+namespace detail {
+
+// RFC 7230 section 6.1
+inline bool is_hop_by_hop(http::field name) {
+  switch (name) {
+    case http::field::connection:
+    case http::field::keep_alive:
+    case http::field::proxy_authenticate:
+    case http::field::proxy_authorization:
+    case http::field::proxy_connection:
+    case http::field::te:
+    case http::field::trailer:
+    case http::field::transfer_encoding:
+    case http::field::upgrade:
+      return true;
+    default:
+      return false;
+  }
+}
+
+inline std::string_view to_string_view(beast::string_view sv) {
+  return {sv.data(), sv.size()};
+}
+
+struct upstream_connection {
+  explicit upstream_connection(const net::any_io_executor& executor)
+      : socket_(executor) {}
+
+  tcp::socket socket_;
+  beast::flat_buffer buffer_;
+};
+
+}  // namespace detail
+
+/// Circuit breaker of an upstream, shared by the threads proxying to it.
+struct circuit_breaker {
+  // Consecutive failures, of any thread
+  std::atomic<size_t> failures_{0};
+  // Ticks of the steady clock
+  std::atomic<std::chrono::steady_clock::rep> open_until_{0};
+  // A request is trying the upstream whose circuit was open
+  std::atomic<bool> probing_{false};
+};
+
+namespace detail {
+
+struct upstream_state {
+  tcp::endpoint endpoint_;
+  circuit_breaker* breaker_{nullptr};
+  std::vector<std::unique_ptr<upstream_connection>> idle_;
+  size_t outstanding_{0};
+  // This thread's request is the one trying the upstream
+  bool probing_{false};
+};
+
+}  // namespace detail
+
+/// What the threads serving a proxy share: its configuration, immutable,
+/// and the circuit breakers of its upstreams.
+struct proxy_config {
+  proxy_options options_;
+  std::vector<tcp::endpoint> endpoints_;
+  // One per endpoint
+  std::unique_ptr<circuit_breaker[]> breakers_;
+};
+
+/// The upstreams of a proxy as seen by one thread: their idle keep-alive
+/// connections and the requests in flight. The circuit breakers are the
+/// ones of the config, a failing upstream is skipped by every thread.
+class upstream_pool final {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  explicit upstream_pool(std::shared_ptr<const proxy_config> config)
+      : config_(std::move(config)), upstreams_(config_->endpoints_.size()) {
+    for (size_t idx = 0; idx < upstreams_.size(); idx++) {
+      upstreams_[idx].endpoint_ = config_->endpoints_[idx];
+      upstreams_[idx].breaker_ = &config_->breakers_[idx];
+    }
+  }
+
+  const proxy_options& options() const { return config_->options_; }
+
+  /// The upstream for the next request, nullptr when every circuit is open.
+  detail::upstream_state* pick() {
+    auto now = clock::now();
+    auto count = upstreams_.size();
+    detail::upstream_state* picked = nullptr;
+    size_t picked_idx = 0;
+
+    for (size_t n = 0; n < count; n++) {
+      auto idx = (next_ + n) % count;
+      auto& upstream = upstreams_[idx];
+      auto& breaker = *upstream.breaker_;
+      if (breaker.failures_ >= options().failure_threshold_) {
+        // Half open: once the interval is over a single request, of any
+        // thread, tries it
+        if (now.time_since_epoch().count() < breaker.open_until_ ||
+            breaker.probing_.exchange(true)) {
+          continue;
+        }
+
+        next_ = idx + 1;
+        upstream.probing_ = true;
+        return &upstream;
+      }
+
+      if (!picked || upstream.outstanding_ < picked->outstanding_) {
+        picked = &upstream;
+        picked_idx = idx;
+      }
+
+      if (options().balancing_ == load_balancing::round_robin) {
+        break;
+      }
+    }
+
+    if (!picked) {
+      return nullptr;
+    }
+
+    next_ = picked_idx + 1;
+    return picked;
+  }
+
+  void succeeded(detail::upstream_state& upstream) {
+    upstream.breaker_->failures_ = 0;
+    end_probe_(upstream);
+  }
+
+  void failed(detail::upstream_state& upstream) {
+    auto& breaker = *upstream.breaker_;
+    if (++breaker.failures_ >= options().failure_threshold_) {
+      auto open_until = clock::now() + options().open_interval_;
+      breaker.open_until_ = open_until.time_since_epoch().count();
+    }
+    end_probe_(upstream);
+  }
+
+  /// The most recently used idle connection, nullptr if there is none.
+  std::unique_ptr<detail::upstream_connection> take_idle(
+      detail::upstream_state& upstream) {
+    if (upstream.idle_.empty()) {
+      return nullptr;
+    }
+
+    auto connection = std::move(upstream.idle_.back());
+    upstream.idle_.pop_back();
+    return connection;
+  }
+
+  void release(detail::upstream_state& upstream,
+               std::unique_ptr<detail::upstream_connection> connection) {
+    if (upstream.idle_.size() < options().max_idle_connections_ &&
+        connection->socket_.is_open()) {
+      upstream.idle_.push_back(std::move(connection));
+    }
+  }
+
+  /// Closes the idle connections, before their io_context goes away.
+  void close() {
+    for (auto& upstream : upstreams_) {
+      upstream.idle_.clear();
+    }
+  }
+
+ private:
+  void end_probe_(detail::upstream_state& upstream) {
+    if (std::exchange(upstream.probing_, false)) {
+      upstream.breaker_->probing_ = false;
+    }
+  }
+
+ private:
+  std::shared_ptr<const proxy_config> config_;
+  std::vector<detail::upstream_state> upstreams_;
+  size_t next_{0};
+};
+
+/// The upstream pools of an io_context, i.e. of a shard's thread. They are
+/// closed along with it.
+class upstream_pools final : public net::execution_context::service {
+ public:
+  using key_type = upstream_pools;
+
+  static inline net::execution_context::id id;
+
+  explicit upstream_pools(net::execution_context& context)
+      : net::execution_context::service(context) {}
+
+  std::shared_ptr<upstream_pool> pool_for(
+      const std::shared_ptr<const proxy_config>& config) {
+    auto& pool = pools_[config.get()];
+    if (!pool) {
+      pool = std::make_shared<upstream_pool>(config);
+    }
+    return pool;
+  }
+
+ private:
+  void shutdown() override {
+    for (auto& [_, pool] : pools_) {
+      pool->close();
+    }
+    pools_.clear();
+  }
+
+ private:
+  std::unordered_map<const proxy_config*, std::shared_ptr<upstream_pool>>
+      pools_;
+};
+
+/// One request forwarded to an upstream. The response is deferred until the
+/// upstream header arrives, then its body is relayed as the response stream:
+/// the next piece is read once the connection took the previous one, which
+/// it swaps with the buffer it wrote.
+class proxy_exchange final
+    : public response_stream,
+      public std::enable_shared_from_this<proxy_exchange> {
+ public:
+  proxy_exchange(std::shared_ptr<upstream_pool> pool,
+                 const request& req,
+                 response& resp)
+      : pool_(std::move(pool)),
+        req_(req),
+        resp_(resp),
+        timer_(req.executor()) {}
+
+  ~proxy_exchange() override {
+    if (upstream_) {
+      upstream_->outstanding_--;
+    }
+  }
+
+  void start() {
+    completion_ = resp_.defer();
+
+    upstream_ = pool_->pick();
+    if (!upstream_) {
+      resp_.canned(canned_responses::service_unavailable());
+      return completion_->complete();
+    }
+
+    upstream_->outstanding_++;
+    build_head_();
+
+    connection_ = pool_->take_idle(*upstream_);
+    reused_ = connection_ != nullptr;
+    if (reused_) {
+      return send_();
+    }
+
+    connect_();
+  }
+
+  status next(std::string& chunk) override {
+    if (!pending_.empty()) {
+      chunk.swap(pending_);
+      pending_.clear();
+      read_body_();
+      return status::ready;
+    }
+
+    if (failed_) {
+      return status::failed;
+    }
+
+    if (eof_) {
+      return status::done;
+    }
+
+    read_body_();
+    return status::pending;
+  }
+
+  void on_ready(std::function<void()> waker) override {
+    waker_ = std::move(waker);
+  }
+
+  void cancel() override {
+    eof_ = true;
+    cancelled_ = true;
+    disarm_timer_();
+    close_();
+  }
+
+ private:
+  static constexpr size_t read_size = 16 * 1024;
+
+  void connect_() {
+    connection_ =
+        std::make_unique<detail::upstream_connection>(req_.executor());
+    arm_timer_(pool_->options().connect_timeout_);
+    connection_->socket_.async_connect(
+        upstream_->endpoint_,
+        [self = shared_from_this()](beast::error_code ec) {
+          if (ec) {
+            return self->fail_();
+          }
+
+          beast::error_code ignored;
+          self->connection_->socket_.set_option(tcp::no_delay(true), ignored);
+          self->send_();
+        });
+  }
+
+  // The body goes out from the buffers the request was read into
+  void send_() {
+    arm_timer_(pool_->options().response_timeout_);
+    net::async_write(
+        connection_->socket_,
+        beast::buffers_cat(net::buffer(head_), req_.body()),
+        [self = shared_from_this()](beast::error_code ec, std::size_t) {
+          if (ec) {
+            return self->retry_or_fail_();
+          }
+
+          self->read_header_();
+        });
+  }
+
+  void read_header_() {
+    parser_.emplace();
+    parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+    parser_->skip(req_.method() == http::verb::head);
+
+    http::async_read_header(
+        connection_->socket_, connection_->buffer_, *parser_,
+        [self = shared_from_this()](beast::error_code ec, std::size_t) {
+          if (ec) {
+            return self->retry_or_fail_();
+          }
+
+          // Interim answers, e.g. 100 Continue, precede the final one
+          auto status = self->parser_->get().result_int();
+          if (status / 100 == 1 &&
+              status != static_cast<unsigned>(
+                            http::status::switching_protocols)) {
+            return self->read_header_();
+          }
+
+          self->disarm_timer_();
+          self->pool_->succeeded(*self->upstream_);
+          self->respond_();
+        });
+  }
+
+  // A kept alive connection may have been closed by the upstream in the
+  // meantime, idempotent requests are then sent again on a new one.
+  void retry_or_fail_() {
+    auto method = req_.method();
+    auto idempotent = method == http::verb::get ||
+                      method == http::verb::head ||
+                      method == http::verb::put ||
+                      method == http::verb::delete_ ||
+                      method == http::verb::options;
+    if (reused_ && idempotent && !timed_out_) {
+      reused_ = false;
+      disarm_timer_();
+      return connect_();
+    }
+
+    fail_();
+  }
+
+  void fail_() {
+    disarm_timer_();
+    pool_->failed(*upstream_);
+    close_();
+
+    resp_.result(timed_out_ ? http::status::gateway_timeout
+                            : http::status::bad_gateway);
+    completion_->complete();
+  }
+
+  void respond_() {
+    const auto& head = parser_->get();
+    resp_.result(head.result_int());
+
+    // The body is relayed chunked, its length is the one of a HEAD answer
+    for (const auto& field : head) {
+      if (detail::is_hop_by_hop(field.name()) ||
+          (field.name() == http::field::content_length &&
+           !resp_.omits_body())) {
+        continue;
+      }
+      resp_.insert(detail::to_string_view(field.name_string()),
+                   detail::to_string_view(field.value()));
+    }
+
+    if (parser_->is_done()) {
+      eof_ = true;
+      release_();
+    } else {
+      resp_.stream(shared_from_this());
+    }
+
+    completion_->complete();
+  }
+
+  void read_body_() {
+    if (reading_ || eof_) {
+      return;
+    }
+
+    reading_ = true;
+    pending_.resize(read_size);
+    auto& body = parser_->get().body();
+    body.data = pending_.data();
+    body.size = pending_.size();
+
+    arm_timer_(pool_->options().response_timeout_);
+    http::async_read_some(
+        connection_->socket_, connection_->buffer_, *parser_,
+        [self = shared_from_this()](beast::error_code ec, std::size_t) {
+          self->reading_ = false;
+          self->disarm_timer_();
+          if (ec == http::error::need_buffer) {
+            ec = {};
+          }
+
+          if (self->cancelled_) {
+            self->pending_.clear();
+            return;
+          }
+
+          auto left = self->parser_->get().body().size;
+          self->pending_.resize(self->pending_.size() - left);
+
+          if (ec) {
+            self->pending_.clear();
+            self->eof_ = true;
+            self->failed_ = true;
+            self->close_();
+          } else if (self->parser_->is_done()) {
+            self->eof_ = true;
+            self->release_();
+          }
+
+          if (self->waker_) {
+            self->waker_();
+          }
+        });
+  }
+
+  void build_head_() {
+    auto target = req_.target();
+    const auto& prefix = pool_->options().strip_prefix_;
+    if (!prefix.empty() && target.substr(0, prefix.size()) == prefix) {
+      target.remove_prefix(prefix.size());
+    }
+
+    const auto& message = req_.buffer();
+    head_.append(detail::to_string_view(message.method_string()))
+        .append(" ")
+        .append(target.empty() || target.front() == '?' ? "/" : "")
+        .append(target)
+        .append(" HTTP/1.1\r\n");
+
+    std::string_view forwarded_for;
+    for (const auto& field : message) {
+      auto name = detail::to_string_view(field.name_string());
+      // The body was read already, the upstream mustn't wait to be asked
+      // for it
+      if (detail::is_hop_by_hop(field.name()) ||
+          field.name() == http::field::content_length ||
+          field.name() == http::field::expect) {
+        continue;
+      }
+
+      if (beast::iequals(field.name_string(), "X-Forwarded-For")) {
+        forwarded_for = detail::to_string_view(field.value());
+        continue;
+      }
+
+      head_.append(name).append(": ");
+      head_.append(detail::to_string_view(field.value())).append("\r\n");
+    }
+
+    head_.append("X-Forwarded-For: ").append(forwarded_for);
+    head_.append(forwarded_for.empty() ? "" : ", ")
+        .append(req_.peer())
+        .append("\r\n");
+
+    if (req_.body_size() > 0 ||
+        message.find(http::field::content_length) != message.end()) {
+      head_.append("Content-Length: ")
+          .append(std::to_string(req_.body_size()))
+          .append("\r\n");
+    }
+    head_.append("\r\n");
+  }
+
+  // An expiry can already be queued when the timer is cancelled or armed
+  // again, it is then ignored by its generation
+  void arm_timer_(std::chrono::milliseconds timeout) {
+    timer_.expires_after(timeout);
+    timer_.async_wait([self = shared_from_this(),
+                       generation = ++timer_generation_](beast::error_code ec) {
+      if (ec || generation != self->timer_generation_ ||
+          !self->connection_) {
+        return;
+      }
+
+      self->timed_out_ = true;
+      self->connection_->socket_.close(ec);
+    });
+  }
+
+  void disarm_timer_() {
+    timer_generation_++;
+    timer_.cancel();
+  }
+
+  // Back to the pool if the upstream keeps the connection alive
+  void release_() {
+    if (connection_ && parser_->keep_alive()) {
+      pool_->release(*upstream_, std::move(connection_));
+    }
+    close_();
+  }
+
+  // The connection itself lives as long as the exchange, a pending read
+  // still uses its buffer
+  void close_() {
+    if (connection_) {
+      beast::error_code ec;
+      connection_->socket_.close(ec);
+    }
+  }
+
+ private:
+  std::shared_ptr<upstream_pool> pool_;
+  const request& req_;
+  response& resp_;
+  std::shared_ptr<deferred_response> completion_;
+  detail::upstream_state* upstream_{nullptr};
+  std::unique_ptr<detail::upstream_connection> connection_;
+  std::string head_;
+  std::optional<http::response_parser<http::buffer_body>> parser_;
+  net::steady_timer timer_;
+  size_t timer_generation_{0};
+  std::string pending_;
+  std::function<void()> waker_;
+  bool reused_{false};
+  bool reading_{false};
+  bool timed_out_{false};
+  bool eof_{false};
+  bool failed_{false};
+  bool cancelled_{false};
+};
+
+/// Handler forwarding the requests to upstream servers, see `app.proxy`.
+/// Every thread keeps its own keep-alive connections, the upstream
+/// connections use the executor of the client connection. The circuit
+/// breakers are shared by the threads.
+class reverse_proxy final {
+ public:
+  explicit reverse_proxy(proxy_options options) {
+    auto config = std::make_shared<proxy_config>();
+    config->options_ = std::move(options);
+
+    // Once, when the route is installed
+    net::io_context ioc;
+    tcp::resolver resolver{ioc};
+    for (const auto& upstream : config->options_.upstreams_) {
+      auto colon = upstream.rfind(':');
+      beast::error_code ec;
+      auto results = resolver.resolve(
+          upstream.substr(0, colon),
+          colon == std::string::npos ? "80" : upstream.substr(colon + 1), ec);
+      if (ec || results.empty()) {
+        LOG(ERROR) << "Cannot resolve upstream " << upstream << ": "
+                   << ec.message() << std::endl;
+        continue;
+      }
+
+      config->endpoints_.push_back(results.begin()->endpoint());
+    }
+    config->breakers_ =
+        std::make_unique<circuit_breaker[]>(config->endpoints_.size());
+
+    config_ = std::move(config);
+  }
+
+  bool operator()(const request& req, response& resp) const {
+    if (!req.executor()) {
+      LOG(ERROR) << "The request has no executor to proxy it" << std::endl;
+      return false;
+    }
+
+    auto& context = net::query(req.executor(), net::execution::context);
+    auto pool = net::use_service<upstream_pools>(context).pool_for(config_);
+    std::make_shared<proxy_exchange>(std::move(pool), req, resp)->start();
+    return true;
+  }
+
+ private:
+  std::shared_ptr<const proxy_config> config_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_PROXY_HPP
@@ -0,0 +1,390 @@
+#ifndef EAGLE_RATE_LIMITER_HPP
+#define EAGLE_RATE_LIMITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "common.hpp"
+
+namespace eagle {
+
+struct rate_limit_options {
+  // Sustained number of requests per second allowed for each key, positive.
+  double rate_{100};
+  // Number of requests a key can make at once after being idle.
+  double burst_{100};
+  // Rounded up to a power of two.
+  size_t shards_{64};
+  // Keys whose bucket has been full for this long are dropped. A dropped key
+  // starts again with a full bucket, exactly as if it had been kept.
+  std::chrono::seconds idle_timeout_{60};
+  // How often the background thread drops idle keys, zero disables it.
+  std::chrono::seconds eviction_interval_{10};
+};
+
+namespace detail {
+
+// Monotonic clock read from the vDSO without touching the TSC. Its resolution
+// is the scheduler tick (1-4ms), plenty for rate limits, at a fraction of the
+// cost of `steady_clock`.
+struct coarse_steady_clock {
+  using duration = std::chrono::nanoseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<coarse_steady_clock>;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return time_point(std::chrono::seconds(ts.tv_sec) +
+                      std::chrono::nanoseconds(ts.tv_nsec));
+  }
+};
+
+// Test-and-test-and-set lock, the critical sections it guards are a handful
+// of instructions long.
+class spin_lock {
+ public:
+  void lock() {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+      while (locked_.load(std::memory_order_relaxed)) {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+      }
+    }
+  }
+
+  void unlock() { locked_.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> locked_{false};
+};
+
+}  // namespace detail
+
+/// Per-key rate limiter implementing the Generic Cell Rate Algorithm: a key
+/// is a single timestamp, its theoretical arrival time (TAT), which makes the
+/// refill lazy and the state 16 bytes per key. Keys are hashed into shards
+/// aligned on cache lines, each one an open addressing table guarded by its
+/// own spin lock, so threads only contend when they hit the same shard.
+///
+/// Keys are identified by their 64-bit hash; two keys colliding share their
+/// budget, which is harmless at this hash width.
+///
+/// With many active keys the cost of a request is that of one cache miss in
+/// its shard's table, tables are kept dense to keep them small: they grow by
+/// half when they are 85% full, which the multiply-shift mapping of the
+/// hashes to slots allows.
+class rate_limiter final {
+ public:
+  using clock = detail::coarse_steady_clock;
+
+  struct decision {
+    bool allowed;
+    // When the request would have been allowed, meaningful if `!allowed`.
+    std::chrono::nanoseconds retry_after;
+  };
+
+ public:
+  /// Throws std::invalid_argument if `rate_` isn't positive.
+  explicit rate_limiter(const rate_limit_options& options)
+      : options_(checked_(options)),
+        interval_(static_cast<int64_t>(1e9 / options.rate_)),
+        burst_offset_(static_cast<int64_t>(options.burst_ * 1e9 /
+                                           options.rate_)) {
+    size_t shard_count = 1;
+    while (shard_count < options_.shards_) {
+      shard_count <<= 1;
+    }
+    shards_ = std::vector<shard>(shard_count);
+    shard_mask_ = shard_count - 1;
+
+    if (options_.eviction_interval_.count() > 0) {
+      evictor_ = std::thread([this] { run_evictor_(); });
+    }
+  }
+
+  rate_limiter(const rate_limiter&) = delete;
+  rate_limiter& operator=(const rate_limiter&) = delete;
+
+  ~rate_limiter() {
+    {
+      std::lock_guard<std::mutex> guard(evictor_mutex_);
+      stopping_ = true;
+    }
+    evictor_cv_.notify_one();
+
+    if (evictor_.joinable()) {
+      evictor_.join();
+    }
+  }
+
+  decision allow(std::string_view key, clock::time_point now = clock::now()) {
+    return allow_hash(std::hash<std::string_view>{}(key), now);
+  }
+
+  decision allow_hash(uint64_t hash, clock::time_point now = clock::now()) {
+    // Zero marks the empty slots
+    hash = hash ? hash : 1;
+    auto now_ns = now.time_since_epoch().count();
+
+    auto& s = shards_[(hash >> 48) & shard_mask_];
+    std::lock_guard<detail::spin_lock> guard(s.lock_);
+
+    auto& tat = s.find_or_insert(hash, now_ns);
+    auto new_tat = std::max(tat, now_ns) + interval_;
+    auto allowed_at = new_tat - burst_offset_;
+
+    if (now_ns < allowed_at) {
+      return {false, std::chrono::nanoseconds(allowed_at - now_ns)};
+    }
+
+    tat = new_tat;
+    return {true, std::chrono::nanoseconds(0)};
+  }
+
+  /// Drops the keys that have been idle for longer than `idle_timeout_`. The
+  /// background thread calls it every `eviction_interval_`.
+  ///
+  /// The keys are erased in place, a chunk of slots per hold of the lock of
+  /// their shard: requests wait for a chunk at most, not for the table.
+  size_t evict_idle(clock::time_point now = clock::now()) {
+    auto expired_before = (now - options_.idle_timeout_).time_since_epoch();
+    size_t evicted = 0;
+
+    for (auto& s : shards_) {
+      for (size_t from = 0;; from += eviction_chunk_) {
+        std::lock_guard<detail::spin_lock> guard(s.lock_);
+        if (from >= s.slots_.size()) {
+          break;
+        }
+        evicted +=
+            s.evict_before(expired_before.count(), from, eviction_chunk_);
+      }
+    }
+
+    return evicted;
+  }
+
+  size_t size() {
+    size_t keys = 0;
+    for (auto& s : shards_) {
+      std::lock_guard<detail::spin_lock> guard(s.lock_);
+      keys += s.size_;
+    }
+
+    return keys;
+  }
+
+  const rate_limit_options& options() const { return options_; }
+
+ private:
+  struct entry {
+    uint64_t hash_;
+    int64_t tat_;
+  };
+
+  // 16KB of slots
+  static constexpr size_t eviction_chunk_ = 1024;
+
+  struct alignas(64) shard {
+    detail::spin_lock lock_;
+    size_t size_{0};
+    std::vector<entry> slots_;
+
+    int64_t& find_or_insert(uint64_t hash, int64_t now) {
+      if ((size_ + 1) * 20 > slots_.size() * 17) {
+        grow_();
+      }
+
+      for (auto idx = home_(hash);; idx = next_(idx)) {
+        auto& slot = slots_[idx];
+        if (slot.hash_ == hash) {
+          return slot.tat_;
+        }
+
+        if (slot.hash_ == 0) {
+          size_++;
+          slot = entry{hash, now};
+          return slot.tat_;
+        }
+      }
+    }
+
+    // Erases the keys of the slots [from, from + count) idle since before
+    // `expired_before`
+    size_t evict_before(int64_t expired_before, size_t from, size_t count) {
+      size_t evicted = 0;
+      auto end = std::min(from + count, slots_.size());
+      for (auto idx = from; idx < end;) {
+        const auto& slot = slots_[idx];
+        if (slot.hash_ != 0 && slot.tat_ < expired_before) {
+          // The entry shifted into the slot, if any, is looked at next
+          erase_(idx);
+          evicted++;
+        } else {
+          idx++;
+        }
+      }
+
+      return evicted;
+    }
+
+    // Multiply-shift, the table size doesn't need to be a power of two. The
+    // top 16 bits of the hash pick the shard, they are the same for all of
+    // its keys.
+    size_t home_(uint64_t hash) const {
+      return static_cast<size_t>(
+          (static_cast<unsigned __int128>(hash << 16) * slots_.size()) >> 64);
+    }
+
+    size_t next_(size_t idx) const {
+      return idx + 1 == slots_.size() ? 0 : idx + 1;
+    }
+
+    size_t distance_(size_t from, size_t to) const {
+      return to >= from ? to - from : to + slots_.size() - from;
+    }
+
+    // Backward shift deletion: the entries of the cluster after the hole
+    // which may live in it move back, lookups don't need tombstones
+    void erase_(size_t hole) {
+      for (auto idx = next_(hole); slots_[idx].hash_ != 0; idx = next_(idx)) {
+        if (distance_(home_(slots_[idx].hash_), idx) >=
+            distance_(hole, idx)) {
+          slots_[hole] = slots_[idx];
+          hole = idx;
+        }
+      }
+
+      slots_[hole] = entry{0, 0};
+      size_--;
+    }
+
+    void grow_() {
+      std::vector<entry> live;
+      live.reserve(size_);
+      for (const auto& slot : slots_) {
+        if (slot.hash_ != 0) {
+          live.push_back(slot);
+        }
+      }
+
+      slots_.assign(slots_.empty() ? 64 : slots_.size() * 3 / 2, entry{0, 0});
+      for (const auto& e : live) {
+        auto idx = home_(e.hash_);
+        while (slots_[idx].hash_ != 0) {
+          idx = next_(idx);
+        }
+        slots_[idx] = e;
+      }
+    }
+  };
+
+  static const rate_limit_options& checked_(
+      const rate_limit_options& options) {
+    if (!(options.rate_ > 0)) {
+      throw std::invalid_argument("rate_limit_options::rate_ must be positive");
+    }
+
+    return options;
+  }
+
+  void run_evictor_() {
+    std::unique_lock<std::mutex> lock(evictor_mutex_);
+    while (!evictor_cv_.wait_for(lock, options_.eviction_interval_,
+                                 [this] { return stopping_; })) {
+      evict_idle();
+    }
+  }
+
+ private:
+  rate_limit_options options_;
+  int64_t interval_;
+  int64_t burst_offset_;
+  std::vector<shard> shards_;
+  size_t shard_mask_{0};
+
+  std::thread evictor_;
+  std::mutex evictor_mutex_;
+  std::condition_variable evictor_cv_;
+  bool stopping_{false};
+};
+
+/// Selects the key a request is rate limited by.
+using rate_limit_key_type = std::function<std::string_view(const request&)>;
+
+namespace rate_limit_key {
+
+inline rate_limit_key_type peer() {
+  return [](const request& req) { return req.peer(); };
+}
+
+inline rate_limit_key_type header(http::field name) {
+  return [name](const request& req) { return req.header(name); };
+}
+
+inline rate_limit_key_type header(std::string name) {
+  return [name = std::move(name)](const request& req) {
+    return req.header(name);
+  };
+}
+
+/// The pattern of the route serving the request, so that every target of a
+/// route shares its budget, or its path when no route does. `routes` is the
+/// app or the dispatcher, it must outlive the key.
+template <typename Routes>
+rate_limit_key_type route(const Routes& routes) {
+  return [&routes](const request& req) {
+    auto path = req.target().substr(0, req.target().find('?'));
+    auto route = routes.route_of(path);
+    return route.empty() ? path : route;
+  };
+}
+
+}  // namespace rate_limit_key
+
+/// Builds an interceptor answering `429 Too Many Requests`, with the
+/// `Retry-After` header set, to the requests over their key's budget. Install
+/// it with `app.intercept(eagle::rate_limit(limiter, key))`.
+inline interceptor_type rate_limit(std::shared_ptr<rate_limiter> limiter,
+                                   rate_limit_key_type key) {
+  return [limiter = std::move(limiter), key = std::move(key)](
+             const request& req, response& resp) {
+    auto [allowed, retry_after] = limiter->allow(key(req));
+    if (allowed) {
+      return;
+    }
+
+    // Retry-After is in whole seconds, round up so the client doesn't come
+    // back too early.
+    auto seconds =
+        std::chrono::ceil<std::chrono::seconds>(retry_after).count();
+    resp.canned(canned_responses::too_many_requests(),
+                std::to_string(seconds));
+    resp.finish();
+  };
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_RATE_LIMITER_HPP
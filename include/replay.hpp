@@ -0,0 +1,292 @@
+#ifndef EAGLE_REPLAY_HPP
+#define EAGLE_REPLAY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.hpp"
+#include "common.hpp"
+#include "dispatcher.hpp"
+
+namespace eagle {
+
+struct replay_options {
+  // Speed against the capture: 2 replays it twice as fast, 0 sends every
+  // request as soon as the previous one of its worker is answered
+  double rate_scale_{1.0};
+  // Workers replaying the requests, each one is sent by worker
+  // `index % concurrency_`
+  size_t concurrency_{4};
+};
+
+/// Statuses and latencies of a replay. Latencies are measured from when the
+/// requests were due, a server falling behind delays the following ones
+/// and shows in them.
+class replay_report {
+ public:
+  /// Status 0 is a request which got no response.
+  void add(std::chrono::nanoseconds latency, unsigned status) {
+    latencies_.push_back(latency);
+    statuses_[status]++;
+    sorted_ = false;
+  }
+
+  void merge(const replay_report& other) {
+    latencies_.insert(latencies_.end(), other.latencies_.begin(),
+                      other.latencies_.end());
+    for (const auto& [status, count] : other.statuses_) {
+      statuses_[status] += count;
+    }
+    sorted_ = false;
+  }
+
+  size_t requests() const { return latencies_.size(); }
+
+  /// Requests without response or answered 5xx.
+  size_t failures() const {
+    size_t failed = 0;
+    for (const auto& [status, count] : statuses_) {
+      failed += status == 0 || status >= 500 ? count : 0;
+    }
+    return failed;
+  }
+
+  const std::map<unsigned, size_t>& statuses() const { return statuses_; }
+
+  /// The latency `fraction` of the requests are under, e.g. 0.99.
+  std::chrono::nanoseconds percentile(double fraction) const {
+    if (latencies_.empty()) {
+      return {};
+    }
+
+    if (!sorted_) {
+      std::sort(latencies_.begin(), latencies_.end());
+      sorted_ = true;
+    }
+
+    auto rank = static_cast<size_t>(fraction * (latencies_.size() - 1) + 0.5);
+    return latencies_[std::min(rank, latencies_.size() - 1)];
+  }
+
+  std::chrono::nanoseconds duration() const { return duration_; }
+
+  void duration(std::chrono::nanoseconds duration) { duration_ = duration; }
+
+  /// e.g.
+  ///   1000 requests in 10.003s, 2 failed
+  ///     200: 990
+  ///     404: 8
+  ///     503: 2
+  ///   latency p50 0.412ms p90 0.951ms p99 4.210ms p99.9 12.004ms
+  ///   max 13.520ms
+  std::string summary() const {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%zu requests in %.3fs, %zu failed\n",
+                  requests(), duration_.count() / 1e9, failures());
+    std::string text = line;
+    for (const auto& [status, count] : statuses_) {
+      std::snprintf(line, sizeof(line), "  %s: %zu\n",
+                    status ? std::to_string(status).c_str() : "no response",
+                    count);
+      text += line;
+    }
+
+    auto ms = [this](double fraction) {
+      return percentile(fraction).count() / 1e6;
+    };
+    std::snprintf(line, sizeof(line),
+                  "latency p50 %.3fms p90 %.3fms p99 %.3fms p99.9 %.3fms\n"
+                  "max %.3fms\n",
+                  ms(0.5), ms(0.9), ms(0.99), ms(0.999), ms(1));
+    return text += line;
+  }
+
+ private:
+  mutable std::vector<std::chrono::nanoseconds> latencies_;
+  mutable bool sorted_{true};
+  std::map<unsigned, size_t> statuses_;
+  std::chrono::nanoseconds duration_{0};
+};
+
+namespace detail {
+
+// Runs `send` for every request when it is due, on the workers. `Send` is
+// made once per worker and returns the status of the response.
+template <typename MakeSend>
+replay_report replay_schedule(const std::vector<captured_request>& requests,
+                              const replay_options& options,
+                              MakeSend make_send) {
+  replay_report report;
+  if (requests.empty()) {
+    return report;
+  }
+
+  auto first = std::min_element(requests.begin(), requests.end(),
+                                [](const auto& lhs, const auto& rhs) {
+                                  return lhs.offset_ < rhs.offset_;
+                                })
+                   ->offset_;
+  auto workers = std::max<size_t>(options.concurrency_, 1);
+  std::vector<replay_report> reports(workers);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t worker = 0; worker < workers; worker++) {
+    threads.emplace_back([&, worker] {
+      auto send = make_send();
+      for (size_t idx = worker; idx < requests.size(); idx += workers) {
+        const auto& captured = requests[idx];
+        auto due = std::chrono::steady_clock::now();
+        if (options.rate_scale_ > 0) {
+          due = start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            (captured.offset_ - first) / options.rate_scale_);
+          std::this_thread::sleep_until(due);
+        }
+
+        auto status = send(captured);
+        reports[worker].add(std::chrono::steady_clock::now() - due, status);
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (const auto& worker_report : reports) {
+    report.merge(worker_report);
+  }
+  report.duration(std::chrono::steady_clock::now() - start);
+  return report;
+}
+
+// Sending it twice has the effect of sending it once, RFC 7231 section 4.2.2
+inline bool is_idempotent(http::verb method) {
+  switch (method) {
+    case http::verb::get:
+    case http::verb::head:
+    case http::verb::options:
+    case http::verb::trace:
+    case http::verb::put:
+    case http::verb::delete_:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// The captured request, but its framing: the body was captured decoded
+template <typename Message>
+void fill_replayed(Message& message, const captured_request& captured) {
+  for (const auto& [name, value] : captured.headers_) {
+    auto field = http::string_to_field(name);
+    if (field != http::field::content_length &&
+        field != http::field::transfer_encoding) {
+      message.insert(name, value);
+    }
+  }
+  message.method(captured.method_);
+  message.target(captured.target_);
+  message.version(11);
+}
+
+}  // namespace detail
+
+/// Replays `requests` in process, through the routes and interceptors of
+/// `dispt`, without sockets or parsing.
+inline replay_report replay(dispatcher_interface& dispt,
+                            const std::vector<captured_request>& requests,
+                            replay_options options = {}) {
+  return detail::replay_schedule(requests, options, [&dispt] {
+    // Deferred responses are completed on the executor of their request
+    return [&dispt, ioc = std::make_shared<net::io_context>()](
+               const captured_request& captured) -> unsigned {
+      request req;
+      response resp;
+      detail::fill_replayed(req.buffer(), captured);
+      if (!captured.body_.empty()) {
+        beast::ostream(req.buffer().body()) << captured.body_;
+      }
+      req.buffer().prepare_payload();
+      req.executor(ioc->get_executor());
+
+      dispt.dispatch(req, resp);
+      if (resp.deferred()) {
+        bool done = false;
+        resp.deferred()->on_complete([&] {
+          dispt.complete(req, resp);
+          done = true;
+        });
+
+        auto work = net::make_work_guard(*ioc);
+        while (!done) {
+          ioc->run_one();
+        }
+      }
+      return resp.buffer().result_int();
+    };
+  });
+}
+
+/// Replays `requests` to the server listening on `server`, one keep-alive
+/// connection per worker.
+inline replay_report replay(const tcp::endpoint& server,
+                            const std::vector<captured_request>& requests,
+                            replay_options options = {}) {
+  return detail::replay_schedule(requests, options, [server] {
+    return [server, ioc = std::make_shared<net::io_context>(),
+            socket = std::shared_ptr<tcp::socket>(), keep_alive = true](
+               const captured_request& captured) mutable -> unsigned {
+      http::request<http::string_body> req;
+      detail::fill_replayed(req, captured);
+      req.body() = captured.body_;
+      req.prepare_payload();
+
+      while (true) {
+        beast::error_code ec;
+        bool reused = socket != nullptr;
+        if (!reused) {
+          socket = std::make_shared<tcp::socket>(*ioc);
+          socket->connect(server, ec);
+          if (ec) {
+            socket.reset();
+            return 0;
+          }
+        }
+
+        beast::flat_buffer buffer;
+        http::response<http::string_body> resp;
+        http::write(*socket, req, ec);
+        bool written = !ec;
+        if (written) {
+          http::read(*socket, buffer, resp, ec);
+        }
+
+        // The server closed the connection it answered before: it doesn't
+        // keep them alive, the next requests get one of their own. A request
+        // it may have received is only sent again if that is harmless.
+        if (ec && reused &&
+            (!written || detail::is_idempotent(captured.method_))) {
+          socket.reset();
+          keep_alive = false;
+          continue;
+        }
+
+        if (ec || !keep_alive || !resp.keep_alive()) {
+          socket.reset();
+        }
+        return ec ? 0 : resp.result_int();
+      }
+    };
+  });
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_REPLAY_HPP
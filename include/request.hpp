@@ -1,9 +1,21 @@
 #ifndef EAGLE_REQUEST_HPP
 #define EAGLE_REQUEST_HPP
 
+#include <arpa/inet.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/ip/address.hpp>
 #include <boost/beast.hpp>
 
+#include "alloc_scope.hpp"
 #include "request_arguments.hpp"
+#include "value_encoding.hpp"
 
 namespace beast = boost::beast;  // from <boost/beast.hpp>
 namespace http = beast::http;    // from <boost/beast/http.hpp>
@@ -12,6 +24,23 @@ namespace eagle {
 
 using verb = http::verb;
 
+class request_trace;
+
+/// Consumes the body of a request while it is read from the socket, instead
+/// of the body being buffered, e.g. to write an upload straight to disk. See
+/// `app.body_reader`.
+class body_reader {
+ public:
+  virtual ~body_reader() = default;
+
+  /// The next piece of the body. Returning false stops reading it, the
+  /// handler still runs and the connection is closed after the response.
+  virtual bool write(std::string_view data) = 0;
+
+  /// The whole body was read.
+  virtual void finish() {}
+};
+
 /// This class encapsulates a eagle request based on the Boost.Beast request
 /// class implementation. The goal is to hide the implementation detail from
 /// the handler and do heavy lifting work for the user in this object. For
@@ -36,22 +65,174 @@ class request final {
 
   void method(verb v) { request_.method(v); }
 
-  std::string_view peer() const { return peer_; }
+  /// Address of the client. It is formatted on first use, without
+  /// allocating, from the address the connection recorded.
+  std::string_view peer() const {
+    if (!peer_.empty() || peer_address_.is_unspecified()) {
+      return peer_;
+    }
+
+    if (peer_length_ == 0) {
+      format_peer_();
+    }
+
+    return std::string_view{peer_text_.data(), peer_length_};
+  }
 
   void peer(std::string_view p) { peer_ = p; }
 
+  void peer(const boost::asio::ip::address& address) {
+    peer_.clear();
+    peer_address_ = address;
+    peer_length_ = 0;
+  }
+
+  const boost::asio::ip::address& peer_address() const {
+    return peer_address_;
+  }
+
   unsigned int version() const { return request_.version(); }
 
+  /// Value of the header `name`, empty when the request doesn't have it.
+  std::string_view header(http::field name) const {
+    auto itr = request_.find(name);
+    if (itr == request_.end()) {
+      return {};
+    }
+
+    return std::string_view{itr->value().data(), itr->value().size()};
+  }
+
+  std::string_view header(std::string_view name) const {
+    auto itr = request_.find(beast::string_view{name.data(), name.size()});
+    if (itr == request_.end()) {
+      return {};
+    }
+
+    return std::string_view{itr->value().data(), itr->value().size()};
+  }
+
   auto& buffer() { return request_; }
 
+  const auto& buffer() const { return request_; }
+
+  /// Executor of the connection, for handlers starting asynchronous work.
+  const boost::asio::any_io_executor& executor() const { return executor_; }
+
+  void executor(boost::asio::any_io_executor executor) {
+    executor_ = std::move(executor);
+  }
+
+  /// Identifies the connection in the USDT probes, see `probes.hpp`.
+  uintptr_t connection_id() const { return connection_id_; }
+
+  void connection_id(uintptr_t id) { connection_id_ = id; }
+
+  /// The trace of the request when it is sampled, see `app.enable_tracing`.
+  request_trace* trace() const { return trace_; }
+
+  void trace(request_trace* trace) { trace_ = trace; }
+
+  /// What the request allocated so far, see
+  /// `app.enable_allocation_accounting`.
+  alloc_counters& allocations() { return allocations_; }
+
+  const alloc_counters& allocations() const { return allocations_; }
+
+  /// The body as read, a sequence of buffers. Empty when a `body_reader`
+  /// consumed it.
+  auto body() const { return request_.body().data(); }
+
+  size_t body_size() const { return request_.body().size(); }
+
+  /// Reads a MessagePack body. Its strings view the body, which is only
+  /// copied when it was read in more than one piece.
+  value_reader msgpack() const {
+    return {body_format::msgpack, contiguous_body_()};
+  }
+
+  /// Reads a CBOR body, as `msgpack()`.
+  value_reader cbor() const { return {body_format::cbor, contiguous_body_()}; }
+
+  /// The reader which consumed the body, if it is a `Reader`.
+  template <typename Reader>
+  Reader* body_reader() const {
+    return dynamic_cast<Reader*>(body_reader_.get());
+  }
+
+  void body_reader(std::shared_ptr<eagle::body_reader> reader) {
+    body_reader_ = std::move(reader);
+  }
+
   const request_arguments& args() const { return arguments_; }
 
   void args(request_arguments&& req_args) { arguments_ = std::move(req_args); }
 
+  /// Back to a default constructed request, for reuse by another connection.
+  void reset() {
+    // Cleared in place, the next request reuses the storage of this one
+    arguments_.clear();
+    request_.clear();
+    request_.method_string({});
+    request_.target({});
+    request_.version(11);
+    request_.body().clear();
+    body_reader_.reset();
+    body_copy_.clear();
+    executor_ = {};
+    trace_ = nullptr;
+    allocations_ = {};
+    connection_id_ = 0;
+    peer_.clear();
+    peer_address_ = boost::asio::ip::address();
+    peer_length_ = 0;
+  }
+
+ private:
+  std::string_view contiguous_body_() const {
+    auto data = request_.body().data();
+    auto first = boost::asio::buffer_sequence_begin(data);
+    if (first == boost::asio::buffer_sequence_end(data)) {
+      return {};
+    }
+
+    if (std::next(first) == boost::asio::buffer_sequence_end(data)) {
+      auto buffer = boost::asio::const_buffer(*first);
+      return {static_cast<const char*>(buffer.data()), buffer.size()};
+    }
+
+    body_copy_ = beast::buffers_to_string(data);
+    return body_copy_;
+  }
+
+  void format_peer_() const {
+    const char* text = nullptr;
+    if (peer_address_.is_v4()) {
+      auto bytes = peer_address_.to_v4().to_bytes();
+      text = inet_ntop(AF_INET, bytes.data(), peer_text_.data(),
+                       peer_text_.size());
+    } else {
+      auto bytes = peer_address_.to_v6().to_bytes();
+      text = inet_ntop(AF_INET6, bytes.data(), peer_text_.data(),
+                       peer_text_.size());
+    }
+
+    peer_length_ = text ? std::char_traits<char>::length(text) : 0;
+  }
+
  private:
   request_arguments arguments_;
   http::request<http::dynamic_body> request_;
-  std::string_view peer_;
+  std::shared_ptr<eagle::body_reader> body_reader_;
+  mutable std::string body_copy_;
+  boost::asio::any_io_executor executor_;
+  request_trace* trace_{nullptr};
+  alloc_counters allocations_;
+  uintptr_t connection_id_{0};
+  std::string peer_;
+  boost::asio::ip::address peer_address_;
+  mutable std::array<char, INET6_ADDRSTRLEN> peer_text_;
+  mutable size_t peer_length_{0};
 };
 
 }  // namespace eagle
@@ -58,6 +58,8 @@ class request_arguments final {
     arguments_.insert({key, value});
   }
 
+  void clear() noexcept { arguments_.clear(); }
+
  private:
   std::unordered_map<std::string, std::variant<int, std::string_view>>
       arguments_;
@@ -175,7 +175,7 @@ inline bool operator!=(const descriptor_list& a, const descriptor_list& b) {
 
 class path_scanner final {
  public:
-  path_scanner(const std::string_view& stream) : stream_(stream) {}
+  path_scanner(std::string_view stream) : stream_(stream) {}
 
   ~path_scanner() = default;
 
@@ -297,7 +297,7 @@ class path_scanner final {
   }
 
  private:
-  const std::string_view& stream_;
+  std::string_view stream_;
   descriptor_list descriptors_;
   size_t start_{0};
   size_t current_{0};
@@ -1,11 +1,24 @@
 #ifndef EAGLE_RESPONSE_HPP
 #define EAGLE_RESPONSE_HPP
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <memory>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include <boost/beast.hpp>
 
+#include "canned_response.hpp"
+#include "value_encoding.hpp"
+#include "xxhash.hpp"
+
 namespace beast = boost::beast;  // from <boost/beast.hpp>
 namespace http = beast::http;    // from <boost/beast/http.hpp>
 
@@ -15,7 +28,7 @@ namespace http = beast::http;    // from <boost/beast/http.hpp>
 /// providing a JSON writer, setting the correct content type and more.
 namespace eagle {
 
-enum class writer_type { khtml = 0, kjson, knone };
+enum class writer_type { khtml = 0, kjson, knone, kstream, kmsgpack, kcbor };
 
 class invalid_writer_operation final : public std::exception {
  public:
@@ -27,6 +40,139 @@ class invalid_writer_operation final : public std::exception {
   const char* reason_;
 };
 
+/// Strong entity tag of a body hash, quoted.
+inline std::string format_etag(uint64_t hash) {
+  static constexpr char digits[] = "0123456789abcdef";
+
+  std::string tag(18, '"');
+  for (size_t idx = 16; idx > 0; idx--, hash >>= 4) {
+    tag[idx] = digits[hash & 0xf];
+  }
+
+  return tag;
+}
+
+/// Whether the quoted `etag` is in the `If-None-Match` list, comparing the
+/// tags weakly as RFC 7232 asks for this header.
+inline bool etag_matches(std::string_view if_none_match,
+                         std::string_view etag) {
+  auto opaque = [](std::string_view tag) {
+    return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag;
+  };
+
+  while (!if_none_match.empty()) {
+    auto comma = std::min(if_none_match.find(','), if_none_match.size());
+    auto candidate = if_none_match.substr(0, comma);
+    if_none_match.remove_prefix(std::min(comma + 1, if_none_match.size()));
+
+    while (!candidate.empty() && candidate.front() == ' ') {
+      candidate.remove_prefix(1);
+    }
+    while (!candidate.empty() && candidate.back() == ' ') {
+      candidate.remove_suffix(1);
+    }
+
+    if (candidate == "*" || opaque(candidate) == opaque(etag)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Body produced while it is being sent, with chunked transfer encoding. The
+/// connection asks for the next chunk once the previous one has been written
+/// to the socket, so a slow client slows the producer down instead of making
+/// the body pile up in memory.
+class response_stream {
+ public:
+  enum class status { ready, pending, done, failed };
+
+  response_stream() = default;
+  virtual ~response_stream() = default;
+
+  /// Replaces `chunk` with the next piece of the body. Returns `pending` when
+  /// nothing is available yet: the stream then calls the waker registered
+  /// with `on_ready` once there is. `failed` closes the connection without
+  /// ending the body, so that the client sees it is incomplete.
+  virtual status next(std::string& chunk) = 0;
+
+  virtual void on_ready(std::function<void()> /*waker*/) {}
+
+  /// Called when the connection ends before the stream is done.
+  virtual void cancel() {}
+
+  /// Sent when the stream stays pending for `heartbeat_interval`, zero
+  /// disables it.
+  virtual std::chrono::milliseconds heartbeat_interval() const {
+    return std::chrono::milliseconds(0);
+  }
+
+  virtual std::string_view heartbeat() const { return {}; }
+};
+
+/// Stream pulling the body out of a function. `produce` appends the next
+/// chunk and returns false once it has written the last one.
+class generator_stream final : public response_stream {
+ public:
+  explicit generator_stream(std::function<bool(std::string&)> produce)
+      : produce_(std::move(produce)) {}
+
+  status next(std::string& chunk) override {
+    chunk.clear();
+    if (done_) {
+      return status::done;
+    }
+
+    done_ = !produce_(chunk);
+    return done_ && chunk.empty() ? status::done : status::ready;
+  }
+
+ private:
+  std::function<bool(std::string&)> produce_;
+  bool done_{false};
+};
+
+/// Lets a handler answer after it returned, e.g. once an upstream server
+/// answered. See `response::defer`.
+class deferred_response final {
+ public:
+  /// The response is complete and can be sent. Called once, from the thread
+  /// of the connection.
+  void complete() {
+    if (std::exchange(completed_, true) || !on_complete_) {
+      return;
+    }
+
+    // The connection waiting for it may be kept alive by the callback
+    auto on_complete = std::move(on_complete_);
+    on_complete();
+  }
+
+  bool completed() const { return completed_; }
+
+  /// Called by the connection, right away if the response is complete.
+  void on_complete(std::function<void()> callback) {
+    if (completed_) {
+      return callback();
+    }
+
+    on_complete_ = std::move(callback);
+  }
+
+ private:
+  std::function<void()> on_complete_;
+  bool completed_{false};
+};
+
+/// The status, body and representation headers of a response, shared
+/// between the responses of identical requests, see `single_flight`.
+struct shared_response {
+  http::status status_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string body_;
+};
+
 class response final {
  public:
   response() = default;
@@ -35,21 +181,214 @@ class response final {
 
   http::status result() const { return response_.result(); }
 
-  void result(http::status v) { response_.result(v); }
+  void result(http::status v) {
+    materialize_canned_();
+    response_.result(v);
+  }
+
+  void result(unsigned int v) {
+    materialize_canned_();
+    response_.result(v);
+  }
+
+  void set(http::field name, std::string_view value) {
+    materialize_canned_();
+    response_.set(name, beast::string_view{value.data(), value.size()});
+  }
+
+  void set(std::string_view name, std::string_view value) {
+    materialize_canned_();
+    response_.set(beast::string_view{name.data(), name.size()},
+                  beast::string_view{value.data(), value.size()});
+  }
+
+  /// Adds a header, keeping the ones with the same name, e.g. Set-Cookie.
+  void insert(std::string_view name, std::string_view value) {
+    materialize_canned_();
+    response_.insert(beast::string_view{name.data(), name.size()},
+                     beast::string_view{value.data(), value.size()});
+  }
+
+  /// Value of the header `name`, empty when the response doesn't have it.
+  std::string_view header(http::field name) const {
+    if (canned_) {
+      if (name == canned_->extra_field()) {
+        return canned_extra_;
+      }
+      if (name == http::field::content_type) {
+        return canned_->content_type();
+      }
+      for (const auto& [field, value] : canned_->constant_fields()) {
+        if (beast::iequals(field, http::to_string(name))) {
+          return value;
+        }
+      }
+    }
+
+    auto itr = response_.find(name);
+    if (itr == response_.end()) {
+      return {};
+    }
+
+    return std::string_view{itr->value().data(), itr->value().size()};
+  }
+
+  /// Answers with a pre-serialized response, written as is by the
+  /// connection. `extra_value` completes its extra header, e.g. the Allow of
+  /// a 405. Changing the response afterwards turns it into a regular one.
+  void canned(const canned_response& canned,
+              std::string_view extra_value = {}) {
+    materialize_canned_();
+    canned_ = &canned;
+    canned_extra_.assign(extra_value.data(), extra_value.size());
+    response_.result(canned.status());
+
+    // A HEAD answer is only the head of it, which prepare_response handles
+    if (omit_body_) {
+      materialize_canned_();
+    }
+  }
+
+  const canned_response* canned() const { return canned_; }
+
+  std::string_view canned_extra() const { return canned_extra_; }
+
+  /// Marks the response as complete. When done from an interceptor running
+  /// before the handler, the handler is not called.
+  void finish() { finished_ = true; }
+
+  bool finished() const { return finished_; }
 
-  void result(unsigned int v) { response_.result(v); }
+  /// Answering a HEAD request: the head of the GET response is sent without
+  /// its body. Handlers can check it to skip generating the body, the
+  /// Content-Length is then omitted.
+  bool omits_body() const { return omit_body_; }
+
+  void omit_body() {
+    materialize_canned_();
+    omit_body_ = true;
+  }
+
+  /// Sets a strong ETag, `tag` is quoted here.
+  void etag(std::string_view tag) {
+    std::string quoted;
+    quoted.reserve(tag.size() + 2);
+    quoted.append("\"").append(tag).append("\"");
+    set(http::field::etag, quoted);
+  }
+
+  /// The body of a 200 is hashed into a strong ETag when the response is
+  /// prepared. If the client already has it, per its `If-None-Match`, the
+  /// response becomes a 304 without body.
+  void hash_etag(std::string_view if_none_match) {
+    materialize_canned_();
+    hash_etag_ = true;
+    if_none_match_.assign(if_none_match.data(), if_none_match.size());
+  }
 
   void prepare_response() {
-    beast::ostream(response_.body()) << out_stream_.str();
-    response_.content_length(response_.body().size());
+    prepare_();
+    prepared_ = true;
+
+    if (on_prepared_) {
+      auto on_prepared = std::move(on_prepared_);
+      on_prepared(*this);
+    }
+  }
+
+  /// Called once the response is prepared, ready to be written.
+  void on_prepared(std::function<void(const response&)> callback) {
+    on_prepared_ = std::move(callback);
+  }
+
+  /// Answers with the status, headers and body of the response to another
+  /// request. The response is then prepared as any other.
+  void shared(const shared_response& shared) {
+    materialize_canned_();
+    response_.result(shared.status_);
+    for (const auto& [name, value] : shared.headers_) {
+      response_.set(name, value);
+    }
+
+    auto content_type = header(http::field::content_type);
+    wrt_type_ = content_type == "application/json" ? writer_type::kjson
+                                                   : writer_type::khtml;
+    out_stream_ << shared.body_;
+  }
+
+  /// Sends the body produced by `stream` instead of the html or json writer.
+  void stream(std::shared_ptr<response_stream> stream) {
+    materialize_canned_();
+    check_writer_none_or_throw(writer_type::kstream);
+
+    wrt_type_ = writer_type::kstream;
+    stream_ = std::move(stream);
+  }
+
+  void stream(std::function<bool(std::string&)> produce) {
+    stream(std::make_shared<generator_stream>(std::move(produce)));
+  }
+
+  const std::shared_ptr<response_stream>& body_stream() const {
+    return stream_;
+  }
+
+  /// The handler answers later: the response is sent once `complete()` is
+  /// called on the returned object. The request and the response stay valid
+  /// until then.
+  std::shared_ptr<deferred_response> defer() {
+    deferred_ = std::make_shared<deferred_response>();
+    return deferred_;
+  }
+
+  const std::shared_ptr<deferred_response>& deferred() const {
+    return deferred_;
+  }
+
+  /// The message, a canned response turned into a regular one first.
+  auto& buffer() {
+    if (canned_) {
+      materialize_canned_();
+      if (prepared_) {
+        prepare_();
+      }
+    }
+    return response_;
   }
 
+  /// The message, without the status line, headers and body of a canned
+  /// response, see `canned()`.
   const auto& buffer() const { return response_; }
 
+  /// Back to a default constructed response, for reuse by another
+  /// connection.
+  void reset() {
+    // Cleared in place, the next response reuses the storage of this one
+    response_.clear();
+    response_.result(http::status::ok);
+    response_.reason({});
+    response_.version(11);
+    response_.body().clear();
+    out_stream_.str({});
+    out_stream_.clear();
+    wrt_type_ = writer_type::knone;
+    finished_ = false;
+    prepared_ = false;
+    omit_body_ = false;
+    hash_etag_ = false;
+    if_none_match_.clear();
+    canned_ = nullptr;
+    canned_extra_.clear();
+    stream_.reset();
+    deferred_.reset();
+    on_prepared_ = nullptr;
+  }
+
   /// Writers
   enum writer_type writer_type() const { return wrt_type_; }
 
   std::ostream& html() {
+    materialize_canned_();
     check_writer_none_or_throw(writer_type::khtml);
 
     wrt_type_ = writer_type::khtml;
@@ -58,6 +397,7 @@ class response final {
   }
 
   std::ostream& json() {
+    materialize_canned_();
     check_writer_none_or_throw(writer_type::kjson);
 
     wrt_type_ = writer_type::kjson;
@@ -65,7 +405,107 @@ class response final {
     return out_stream_;
   }
 
+  /// Encodes a MessagePack body into the buffer of the text writers, which
+  /// is copied into the message once the response is prepared, see
+  /// `value_encoder`.
+  value_encoder msgpack() { return encoder(body_format::msgpack); }
+
+  value_encoder cbor() { return encoder(body_format::cbor); }
+
+  /// The encoder of the format `accept`, the Accept header of the request,
+  /// prefers among JSON, MessagePack and CBOR.
+  value_encoder encoder(std::string_view accept) {
+    auto encoder = this->encoder(negotiate_format(accept));
+    response_.set(http::field::vary, "Accept");
+    return encoder;
+  }
+
+  value_encoder encoder(body_format format) {
+    materialize_canned_();
+    auto type = format == body_format::msgpack ? writer_type::kmsgpack
+                : format == body_format::cbor  ? writer_type::kcbor
+                                               : writer_type::kjson;
+    check_writer_none_or_throw(type);
+
+    wrt_type_ = type;
+    auto content_type = content_type_of(format);
+    response_.set(http::field::content_type,
+                  beast::string_view{content_type.data(), content_type.size()});
+    return {format, *out_stream_.rdbuf()};
+  }
+
  private:
+  void prepare_() {
+    if (canned_) {
+      return;
+    }
+
+    auto date = http_date::now().value();
+    response_.set(http::field::date,
+                  beast::string_view{date.data(), date.size()});
+
+    if (omit_body_ && stream_) {
+      stream_->cancel();
+      stream_.reset();
+    }
+
+    if (stream_) {
+      response_.chunked(true);
+      return;
+    }
+
+    auto body = out_stream_.str();
+    if (hash_etag_ && response_.result() == http::status::ok) {
+      auto tag = format_etag(xxh64(body));
+      response_.set(http::field::etag, tag);
+      if (etag_matches(if_none_match_, tag)) {
+        response_.result(http::status::not_modified);
+      }
+    }
+
+    // A 304 has no body and its length would be the one of the 200
+    if (response_.result() == http::status::not_modified) {
+      return;
+    }
+
+    // Whatever was written is only measured
+    if (omit_body_) {
+      if (!body.empty()) {
+        response_.content_length(body.size());
+      }
+      return;
+    }
+
+    beast::ostream(response_.body()) << body;
+    response_.content_length(response_.body().size());
+  }
+
+  // Back to a regular response with the same status, headers and body
+  void materialize_canned_() {
+    if (!canned_) {
+      return;
+    }
+
+    auto* canned = std::exchange(canned_, nullptr);
+    if (!canned->content_type().empty()) {
+      auto content_type = canned->content_type();
+      response_.set(http::field::content_type,
+                    beast::string_view{content_type.data(),
+                                       content_type.size()});
+      wrt_type_ = content_type == "application/json" ? writer_type::kjson
+                                                     : writer_type::khtml;
+    }
+    if (canned->extra_field() != http::field::unknown) {
+      response_.set(canned->extra_field(),
+                    beast::string_view{canned_extra_.data(),
+                                       canned_extra_.size()});
+    }
+    for (const auto& [name, value] : canned->constant_fields()) {
+      response_.set(name, value);
+    }
+    out_stream_ << canned->body();
+  }
+
   void check_writer_none_or_throw(enum writer_type wrt_type) const {
     if (!(wrt_type_ == writer_type::knone || wrt_type == wrt_type_)) {
       throw invalid_writer_operation("Only one writer can be used per request");
@@ -76,6 +516,16 @@ class response final {
   http::response<http::dynamic_body> response_;
   std::ostringstream out_stream_;
   enum writer_type wrt_type_ { writer_type::knone };
+  bool finished_{false};
+  bool prepared_{false};
+  bool omit_body_{false};
+  bool hash_etag_{false};
+  std::string if_none_match_;
+  const canned_response* canned_{nullptr};
+  std::string canned_extra_;
+  std::shared_ptr<response_stream> stream_;
+  std::shared_ptr<deferred_response> deferred_;
+  std::function<void(const response&)> on_prepared_;
 };
 
 }  // namespace eagle
@@ -0,0 +1,279 @@
+#ifndef EAGLE_SINGLE_FLIGHT_HPP
+#define EAGLE_SINGLE_FLIGHT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+
+namespace eagle {
+
+struct single_flight_options {
+  // Request headers which are part of the key along with the method and the
+  // target, e.g. "Accept-Encoding"
+  std::vector<std::string> vary_;
+  // Waiting longer, a request runs the handler itself
+  std::chrono::milliseconds timeout_{5000};
+};
+
+namespace detail {
+
+// A request waiting for the response of an identical one, its response is
+// deferred meanwhile
+struct flight_waiter {
+  flight_waiter(const request& req,
+                response& resp,
+                std::function<void(flight_waiter&)> fallback)
+      : req_(req),
+        resp_(resp),
+        completion_(resp.defer()),
+        fallback_(std::move(fallback)),
+        timer_(req.executor()) {}
+
+  const request& req_;
+  response& resp_;
+  std::shared_ptr<deferred_response> completion_;
+  // Runs the handler for this request, on its thread
+  std::function<void(flight_waiter&)> fallback_;
+  net::steady_timer timer_;
+  // Whichever of the first request and the timeout ends the wait
+  std::atomic<bool> done_{false};
+};
+
+using flight_waiters = std::vector<std::shared_ptr<flight_waiter>>;
+
+// Shared by the threads serving the route
+struct flight_table {
+  std::mutex mutex_;
+  std::unordered_map<std::string, flight_waiters> flights_;
+};
+
+// Headers describing the body, the same for every client. The others, e.g.
+// Set-Cookie or the X-Request-Id of an interceptor, are the first request's.
+inline bool is_shared_header(http::field name) {
+  switch (name) {
+    case http::field::cache_control:
+    case http::field::content_encoding:
+    case http::field::content_language:
+    case http::field::content_location:
+    case http::field::content_type:
+    case http::field::etag:
+    case http::field::expires:
+    case http::field::last_modified:
+    case http::field::location:
+    case http::field::vary:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Ends the flight of `key`: its waiters get `prepared`, or run the handler
+// themselves when it is null or can't be shared. Only successful, fully
+// buffered responses are shared.
+inline void end_flight(flight_table& table,
+                       const std::string& key,
+                       const response* prepared) {
+  flight_waiters waiters;
+  {
+    std::lock_guard<std::mutex> lock{table.mutex_};
+    auto itr = table.flights_.find(key);
+    if (itr == table.flights_.end()) {
+      return;
+    }
+    waiters.swap(itr->second);
+    table.flights_.erase(itr);
+  }
+
+  if (waiters.empty()) {
+    return;
+  }
+
+  std::shared_ptr<shared_response> shared;
+  auto status = prepared ? static_cast<unsigned>(prepared->result()) : 500;
+  if (status < 400 && status != 304 && !prepared->body_stream() &&
+      !prepared->canned() && !prepared->omits_body()) {
+    const auto& message = prepared->buffer();
+    shared = std::make_shared<shared_response>();
+    shared->status_ = message.result();
+    for (const auto& field : message) {
+      if (is_shared_header(field.name())) {
+        auto name = field.name_string();
+        auto value = field.value();
+        shared->headers_.emplace_back(std::string{name.data(), name.size()},
+                                      std::string{value.data(), value.size()});
+      }
+    }
+    shared->body_ = beast::buffers_to_string(message.body().data());
+  }
+
+  for (auto& waiter : waiters) {
+    net::post(waiter->req_.executor(), [waiter, shared] {
+      if (waiter->done_.exchange(true)) {
+        return;
+      }
+
+      waiter->timer_.cancel();
+      if (!shared) {
+        return waiter->fallback_(*waiter);
+      }
+
+      // Prepared by its own connection, after its own interceptors
+      waiter->resp_.shared(*shared);
+      waiter->completion_->complete();
+    });
+  }
+}
+
+// Held by the first request of a flight until its response is prepared.
+// Should the response be reset or destroyed before, e.g. with its
+// connection, the waiters don't wait for it any longer.
+class flight_leader final {
+ public:
+  flight_leader(std::shared_ptr<flight_table> table, std::string key)
+      : table_(std::move(table)), key_(std::move(key)) {}
+
+  ~flight_leader() {
+    if (table_) {
+      end_flight(*table_, key_, nullptr);
+    }
+  }
+
+  flight_leader(const flight_leader&) = delete;
+  flight_leader& operator=(const flight_leader&) = delete;
+
+  void prepared(const response& resp) {
+    end_flight(*std::exchange(table_, nullptr), key_, &resp);
+  }
+
+ private:
+  std::shared_ptr<flight_table> table_;
+  std::string key_;
+};
+
+}  // namespace detail
+
+/// See `single_flight`.
+template <typename Handler>
+class single_flight_handler final {
+ public:
+  single_flight_handler(Handler handler, single_flight_options options)
+      : handler_(std::move(handler)),
+        options_(std::make_shared<const single_flight_options>(
+            std::move(options))),
+        table_(std::make_shared<detail::flight_table>()) {}
+
+  bool operator()(const request& req, response& resp) {
+    // Waiting needs the executor of a connection
+    if (!req.executor()) {
+      return handler_(req, resp);
+    }
+
+    auto key = key_for_(req);
+    {
+      std::lock_guard<std::mutex> lock{table_->mutex_};
+      auto [itr, first] = table_->flights_.try_emplace(key);
+      if (!first) {
+        itr->second.push_back(wait_(req, resp, key));
+        return true;
+      }
+    }
+
+    auto leader =
+        std::make_shared<detail::flight_leader>(table_, std::move(key));
+    resp.on_prepared([leader](const response& prepared) {
+      leader->prepared(prepared);
+    });
+    return handler_(req, resp);
+  }
+
+ private:
+  std::string key_for_(const request& req) const {
+    auto method = req.buffer().method_string();
+    std::string key{method.data(), method.size()};
+    key.append(" ").append(req.target());
+    for (const auto& name : options_->vary_) {
+      key.append("\n").append(req.header(name));
+    }
+    return key;
+  }
+
+  std::shared_ptr<detail::flight_waiter> wait_(const request& req,
+                                               response& resp,
+                                               const std::string& key) {
+    auto waiter = std::make_shared<detail::flight_waiter>(
+        req, resp, [this](detail::flight_waiter& w) { run_(w); });
+
+    waiter->timer_.expires_after(options_->timeout_);
+    waiter->timer_.async_wait([waiter, table = table_,
+                               key](beast::error_code ec) {
+      if (ec || waiter->done_.exchange(true)) {
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock{table->mutex_};
+        auto itr = table->flights_.find(key);
+        if (itr != table->flights_.end()) {
+          auto& waiters = itr->second;
+          waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter),
+                        waiters.end());
+        }
+      }
+
+      waiter->fallback_(*waiter);
+    });
+
+    return waiter;
+  }
+
+  // The waiter runs the request on its own, after a timeout or an error
+  void run_(detail::flight_waiter& waiter) {
+    auto completion = waiter.completion_;
+    if (!handler_(waiter.req_, waiter.resp_)) {
+      waiter.resp_.result(500);
+    }
+
+    // The handler deferred the response too
+    const auto& deferred = waiter.resp_.deferred();
+    if (deferred && deferred != completion) {
+      return deferred->on_complete([completion] { completion->complete(); });
+    }
+
+    completion->complete();
+  }
+
+ private:
+  Handler handler_;
+  std::shared_ptr<const single_flight_options> options_;
+  std::shared_ptr<detail::flight_table> table_;
+};
+
+/// Coalesces identical concurrent requests: while `handler` runs for a
+/// request, possibly deferring its response, the requests with the same
+/// method, target and `vary_` headers wait for it instead of running it
+/// too. They then answer with its status, body and the headers describing
+/// the body, e.g. Content-Type or ETag, and go through their own after
+/// interceptors. An error response isn't shared, the waiters run the
+/// handler themselves, as they do after waiting for `timeout_` or when the
+/// first request goes away unanswered.
+///
+///   app.handle(http::verb::get, "/popular",
+///              eagle::single_flight(render_popular));
+template <typename Handler>
+auto single_flight(Handler handler, single_flight_options options = {}) {
+  return single_flight_handler<Handler>(std::move(handler),
+                                        std::move(options));
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_SINGLE_FLIGHT_HPP
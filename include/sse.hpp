@@ -0,0 +1,200 @@
+#ifndef EAGLE_SSE_HPP
+#define EAGLE_SSE_HPP
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "response.hpp"
+
+namespace eagle {
+
+struct sse_options {
+  // A comment is sent when no event was sent for this long, zero disables it.
+  std::chrono::milliseconds heartbeat_{15000};
+  // Reconnection delay advertised to the client, zero leaves the browser's.
+  std::chrono::milliseconds retry_{0};
+  // Events not yet written to the socket, `send` fails past this.
+  size_t max_buffered_{1 << 20};
+};
+
+/// Server-Sent Events (`text/event-stream`) response. Events sent while the
+/// previous ones are being written are coalesced into the next chunk.
+///
+/// `send`, `comment` and `close` are safe to call from any thread, and fail
+/// once the client went away.
+class sse_channel final : public response_stream {
+ public:
+  sse_channel() : sse_channel(sse_options{}) {}
+
+  explicit sse_channel(const sse_options& options) : options_(options) {
+    if (options_.retry_.count() > 0) {
+      pending_ = "retry: " + std::to_string(options_.retry_.count()) + "\n\n";
+    }
+  }
+
+  /// False once the channel is closed, when the buffer is full, or when
+  /// `event` or `id` span more than one line.
+  bool send(std::string_view data,
+            std::string_view event = {},
+            std::string_view id = {}) {
+    // A line break would end the field, and start another one
+    if (event.find_first_of("\r\n") != std::string_view::npos ||
+        id.find_first_of("\r\n") != std::string_view::npos) {
+      return false;
+    }
+
+    std::string message;
+    if (!event.empty()) {
+      message.append("event: ").append(event).append("\n");
+    }
+    if (!id.empty()) {
+      message.append("id: ").append(id).append("\n");
+    }
+
+    append_lines_(message, "data: ", data);
+    message.append("\n");
+    return append_(message);
+  }
+
+  bool comment(std::string_view text) {
+    std::string message;
+    append_lines_(message, ": ", text);
+    message.append("\n");
+    return append_(message);
+  }
+
+  /// Ends the response once the events already sent are written.
+  void close() {
+    std::function<void()> waker;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      closing_ = true;
+      waker = take_waker_();
+    }
+
+    if (waker) {
+      waker();
+    }
+  }
+
+  /// Whether the channel was closed or the client went away.
+  bool closed() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return closing_ || cancelled_;
+  }
+
+  status next(std::string& chunk) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    chunk.clear();
+    if (!pending_.empty()) {
+      chunk.swap(pending_);
+      return status::ready;
+    }
+
+    if (closing_ || cancelled_) {
+      return status::done;
+    }
+
+    waiting_ = true;
+    return status::pending;
+  }
+
+  void on_ready(std::function<void()> waker) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    waker_ = std::move(waker);
+  }
+
+  void cancel() override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    cancelled_ = true;
+    pending_.clear();
+  }
+
+  std::chrono::milliseconds heartbeat_interval() const override {
+    return options_.heartbeat_;
+  }
+
+  std::string_view heartbeat() const override { return ":\n\n"; }
+
+ private:
+  // Each line of `text`, ended by CR, LF or CRLF as in the event stream
+  // itself, is a field of its own
+  static void append_lines_(std::string& message,
+                            std::string_view prefix,
+                            std::string_view text) {
+    size_t start = 0;
+    do {
+      auto end = text.find_first_of("\r\n", start);
+      message.append(prefix)
+          .append(text.substr(start, end - start))
+          .append("\n");
+      if (end != std::string_view::npos && text[end] == '\r' &&
+          end + 1 < text.size() && text[end + 1] == '\n') {
+        end++;
+      }
+      start = end == std::string_view::npos ? end : end + 1;
+    } while (start != std::string_view::npos);
+  }
+
+  bool append_(const std::string& message) {
+    std::function<void()> waker;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (closing_ || cancelled_ ||
+          pending_.size() + message.size() > options_.max_buffered_) {
+        return false;
+      }
+
+      pending_.append(message);
+      waker = take_waker_();
+    }
+
+    if (waker) {
+      waker();
+    }
+
+    return true;
+  }
+
+  // The connection is only woken up when it waits for data, the waker is
+  // called outside of the lock.
+  std::function<void()> take_waker_() {
+    if (!waiting_) {
+      return {};
+    }
+
+    waiting_ = false;
+    return waker_;
+  }
+
+ private:
+  sse_options options_;
+
+  mutable std::mutex mutex_;
+  std::string pending_;
+  std::function<void()> waker_;
+  bool waiting_{false};
+  bool closing_{false};
+  bool cancelled_{false};
+};
+
+/// Turns `resp` into an event stream and returns the channel to send the
+/// events through. The channel can be kept and used after the handler
+/// returns.
+inline std::shared_ptr<sse_channel> event_stream(
+    response& resp,
+    const sse_options& options = {}) {
+  auto channel = std::make_shared<sse_channel>(options);
+  resp.set(http::field::content_type, "text/event-stream");
+  resp.set(http::field::cache_control, "no-cache");
+  resp.stream(channel);
+  return channel;
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_SSE_HPP
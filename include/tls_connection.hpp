@@ -0,0 +1,464 @@
+#ifndef EAGLE_TLS_CONNECTION_HPP
+#define EAGLE_TLS_CONNECTION_HPP
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common.hpp"
+#include "connection.hpp"
+
+namespace eagle {
+
+namespace ssl = net::ssl;  // from <boost/asio/ssl.hpp>
+
+struct tls_options {
+  // Number of sessions kept in the server side cache shared by every
+  // connection (and every thread) using the same `tls_context`.
+  size_t session_cache_size_{20480};
+  std::chrono::seconds session_timeout_{300};
+  // Stateless resumption through RFC 5077 session tickets.
+  bool session_tickets_{true};
+  // ALPN protocols in order of preference.
+  std::vector<std::string> alpn_{"http/1.1"};
+};
+
+/// Picks the first protocol of `supported` the client offered in its ALPN
+/// extension. `in` is the wire format list sent by the client: a sequence of
+/// length-prefixed protocol names.
+inline bool select_alpn_protocol(const std::vector<std::string>& supported,
+                                 const unsigned char* in,
+                                 unsigned int inlen,
+                                 const unsigned char** out,
+                                 unsigned char* outlen) {
+  for (const auto& protocol : supported) {
+    for (unsigned int idx = 0; idx < inlen;) {
+      unsigned int length = in[idx];
+      if (idx + 1 + length > inlen) {
+        break;
+      }
+
+      std::string_view offered{reinterpret_cast<const char*>(in + idx + 1),
+                               length};
+      if (offered == protocol) {
+        *out = in + idx + 1;
+        *outlen = static_cast<unsigned char>(length);
+        return true;
+      }
+
+      idx += 1 + length;
+    }
+  }
+
+  return false;
+}
+
+/// Server side TLS configuration shared by all the TLS connections of an app.
+/// The underlying `SSL_CTX` owns the session cache so resumed handshakes are
+/// cheap regardless of which connection created the session.
+class tls_context final {
+ public:
+  struct session_stats {
+    long accepted;
+    long resumed;
+    long cache_misses;
+  };
+
+ public:
+  tls_context() : tls_context(tls_options{}) {}
+
+  explicit tls_context(const tls_options& options)
+      : ctx_(ssl::context::tls_server) {
+    ctx_.set_options(ssl::context::default_workarounds | ssl::context::no_sslv2 |
+                     ssl::context::no_sslv3 | ssl::context::no_tlsv1 |
+                     ssl::context::no_tlsv1_1 | ssl::context::single_dh_use);
+    configure(options);
+  }
+
+  tls_context(const tls_context&) = delete;
+  tls_context& operator=(const tls_context&) = delete;
+
+  ~tls_context() = default;
+
+  void configure(const tls_options& options) {
+    options_ = options;
+    auto native = native_handle();
+
+    static const unsigned char session_id_context[] = "eagle";
+    SSL_CTX_set_session_id_context(native, session_id_context,
+                                   sizeof(session_id_context) - 1);
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(native, options_.session_cache_size_);
+    SSL_CTX_set_timeout(native, options_.session_timeout_.count());
+
+    if (options_.session_tickets_) {
+      SSL_CTX_clear_options(native, SSL_OP_NO_TICKET);
+    } else {
+      SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+    }
+
+    SSL_CTX_set_alpn_select_cb(native, &tls_context::on_alpn_select_, this);
+  }
+
+  void use_certificate_chain_file(const std::string& path) {
+    ctx_.use_certificate_chain_file(path);
+  }
+
+  void use_private_key_file(const std::string& path) {
+    ctx_.use_private_key_file(path, ssl::context::pem);
+  }
+
+  void use_certificate_chain(std::string_view pem) {
+    ctx_.use_certificate_chain(net::buffer(pem.data(), pem.size()));
+  }
+
+  void use_private_key(std::string_view pem) {
+    ctx_.use_private_key(net::buffer(pem.data(), pem.size()),
+                         ssl::context::pem);
+  }
+
+  /// Installs a freshly generated P-256 key and a self-signed certificate for
+  /// `common_name`. Meant for tests, benchmarks and local development only.
+  bool use_self_signed_certificate(
+      const std::string& common_name = "localhost") {
+    EVP_PKEY* pkey = nullptr;
+    auto pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    auto generated =
+        pkey_ctx && EVP_PKEY_keygen_init(pkey_ctx) > 0 &&
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pkey_ctx,
+                                               NID_X9_62_prime256v1) > 0 &&
+        EVP_PKEY_keygen(pkey_ctx, &pkey) > 0;
+    EVP_PKEY_CTX_free(pkey_ctx);
+
+    if (!generated) {
+      LOG(ERROR) << "Failed to generate the TLS key" << std::endl;
+      return false;
+    }
+
+    auto x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 365L * 24 * 60 * 60);
+    X509_set_pubkey(x509, pkey);
+
+    auto name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(
+        name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>(common_name.c_str()), -1, -1,
+        0);
+    X509_set_issuer_name(x509, name);
+
+    auto installed = X509_sign(x509, pkey, EVP_sha256()) > 0 &&
+                     SSL_CTX_use_certificate(native_handle(), x509) == 1 &&
+                     SSL_CTX_use_PrivateKey(native_handle(), pkey) == 1;
+
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+
+    if (!installed) {
+      LOG(ERROR) << "Failed to install the self-signed certificate"
+                 << std::endl;
+    }
+
+    return installed;
+  }
+
+  /// Sets the keys used to encrypt session tickets. Processes sharing the keys
+  /// (e.g. the old and new binaries during a restart) can resume each other's
+  /// sessions. The key size is defined by OpenSSL, see `ticket_keys_size()`.
+  bool set_ticket_keys(std::string_view keys) {
+    if (keys.size() != ticket_keys_size()) {
+      LOG(ERROR) << "Invalid session ticket keys size " << keys.size()
+                 << ", expected " << ticket_keys_size() << std::endl;
+      return false;
+    }
+
+    return SSL_CTX_set_tlsext_ticket_keys(
+               native_handle(), const_cast<char*>(keys.data()),
+               static_cast<long>(keys.size())) == 1;
+  }
+
+  size_t ticket_keys_size() {
+    return static_cast<size_t>(
+        SSL_CTX_get_tlsext_ticket_keys(native_handle(), nullptr, 0));
+  }
+
+  session_stats stats() {
+    auto native = native_handle();
+    return {SSL_CTX_sess_accept_good(native), SSL_CTX_sess_hits(native),
+            SSL_CTX_sess_misses(native)};
+  }
+
+  const tls_options& options() const { return options_; }
+
+  ssl::context& native() { return ctx_; }
+
+  SSL_CTX* native_handle() { return ctx_.native_handle(); }
+
+ private:
+  static int on_alpn_select_(SSL*,
+                             const unsigned char** out,
+                             unsigned char* outlen,
+                             const unsigned char* in,
+                             unsigned int inlen,
+                             void* arg) {
+    auto self = static_cast<tls_context*>(arg);
+    if (select_alpn_protocol(self->options_.alpn_, in, inlen, out, outlen)) {
+      return SSL_TLSEXT_ERR_OK;
+    }
+
+    // Clients that don't speak any of our protocols still get HTTP/1.1
+    // without a negotiated protocol.
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+
+ private:
+  ssl::context ctx_;
+  tls_options options_;
+};
+
+/// TLS stream doing the record layer through a socket BIO rather than the
+/// memory BIO pair used by `ssl::stream`. Because OpenSSL owns the file
+/// descriptor, it can switch the socket to kernel TLS (kTLS) once the
+/// handshake is done: the kernel then encrypts every write, including
+/// `sendfile`, and userspace only sees plain text. When the kernel or OpenSSL
+/// lack kTLS support, the stream transparently stays in userspace.
+class ktls_stream {
+ public:
+  using executor_type = tcp::socket::executor_type;
+  using next_layer_type = tcp::socket;
+  using lowest_layer_type = tcp::socket;
+
+  ktls_stream(tcp::socket socket, ssl::context& ctx)
+      : socket_(std::move(socket)), ssl_(SSL_new(ctx.native_handle())) {
+    beast::error_code ec;
+    socket_.non_blocking(true, ec);
+    SSL_set_fd(ssl_, static_cast<int>(socket_.native_handle()));
+    SSL_set_accept_state(ssl_);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_set_options(ssl_, SSL_OP_ENABLE_KTLS);
+#endif
+  }
+
+  ktls_stream(const ktls_stream&) = delete;
+  ktls_stream& operator=(const ktls_stream&) = delete;
+
+  ~ktls_stream() { SSL_free(ssl_); }
+
+  executor_type get_executor() { return socket_.get_executor(); }
+
+  tcp::socket& next_layer() { return socket_; }
+
+  tcp::socket& lowest_layer() { return socket_; }
+
+  SSL* native_handle() { return ssl_; }
+
+  /// Whether writes are encrypted by the kernel.
+  bool ktls_send_active() const {
+#ifdef SSL_OP_ENABLE_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#else
+    return false;
+#endif
+  }
+
+  template <typename Handler>
+  auto async_handshake(Handler&& handler) {
+    return net::async_compose<Handler, void(beast::error_code)>(
+        make_io_op<false>(
+            [](SSL* ssl, size_t&) { return SSL_do_handshake(ssl); }),
+        handler, socket_);
+  }
+
+  template <typename Handler>
+  auto async_shutdown(Handler&& handler) {
+    return net::async_compose<Handler, void(beast::error_code)>(
+        make_io_op<false>([](SSL* ssl, size_t&) {
+          // Zero means our close_notify is sent, we don't wait for the
+          // peer's one.
+          auto ret = SSL_shutdown(ssl);
+          return ret == 0 ? 1 : ret;
+        }),
+        handler, socket_);
+  }
+
+  template <typename MutableBufferSequence, typename Handler>
+  auto async_read_some(const MutableBufferSequence& buffers,
+                       Handler&& handler) {
+    net::mutable_buffer buffer = beast::buffers_front(buffers);
+    return net::async_compose<Handler, void(beast::error_code, size_t)>(
+        make_io_op<true>([buffer](SSL* ssl, size_t& bytes) {
+          return buffer.size() == 0
+                     ? 1
+                     : SSL_read_ex(ssl, buffer.data(), buffer.size(), &bytes);
+        }),
+        handler, socket_);
+  }
+
+  template <typename ConstBufferSequence, typename Handler>
+  auto async_write_some(const ConstBufferSequence& buffers,
+                        Handler&& handler) {
+    net::const_buffer buffer = beast::buffers_front(buffers);
+    return net::async_compose<Handler, void(beast::error_code, size_t)>(
+        make_io_op<true>([buffer](SSL* ssl, size_t& bytes) {
+          return buffer.size() == 0
+                     ? 1
+                     : SSL_write_ex(ssl, buffer.data(), buffer.size(), &bytes);
+        }),
+        handler, socket_);
+  }
+
+ private:
+  // Retries an OpenSSL operation each time the socket becomes ready in the
+  // direction OpenSSL is waiting for. Completion is always deferred to the
+  // executor so handlers never run inside the initiating function.
+  template <bool WithBytes, typename Operation>
+  struct io_op {
+    ktls_stream& stream_;
+    Operation operation_;
+    bool started_{false};
+    bool done_{false};
+    beast::error_code result_{};
+    size_t bytes_{0};
+
+    template <typename Self>
+    void operator()(Self& self, beast::error_code ec = {}) {
+      if (!done_ && !ec) {
+        ERR_clear_error();
+        auto ret = operation_(stream_.ssl_, bytes_);
+        if (ret <= 0) {
+          switch (SSL_get_error(stream_.ssl_, ret)) {
+            case SSL_ERROR_WANT_READ:
+              started_ = true;
+              return stream_.socket_.async_wait(tcp::socket::wait_read,
+                                                std::move(self));
+            case SSL_ERROR_WANT_WRITE:
+              started_ = true;
+              return stream_.socket_.async_wait(tcp::socket::wait_write,
+                                                std::move(self));
+            case SSL_ERROR_ZERO_RETURN:
+              result_ = net::error::eof;
+              break;
+            case SSL_ERROR_SYSCALL:
+              result_ = errno ? beast::error_code(errno, beast::system_category())
+                              : beast::error_code(net::error::eof);
+              break;
+            default:
+              result_ = beast::error_code(static_cast<int>(ERR_get_error()),
+                                          net::error::get_ssl_category());
+              break;
+          }
+        }
+
+        done_ = true;
+        if (!started_) {
+          started_ = true;
+          return net::post(stream_.get_executor(), std::move(self));
+        }
+      }
+
+      if (!ec) {
+        ec = result_;
+      }
+
+      if constexpr (WithBytes) {
+        self.complete(ec, bytes_);
+      } else {
+        self.complete(ec);
+      }
+    }
+  };
+
+  template <bool WithBytes, typename Operation>
+  io_op<WithBytes, Operation> make_io_op(Operation operation) {
+    return {*this, std::move(operation)};
+  }
+
+ private:
+  tcp::socket socket_;
+  SSL* ssl_;
+};
+
+// TLS records and the close_notify alert are small writes following each
+// other, Nagle's algorithm would hold them until the peer's delayed ACK.
+inline void set_no_delay(tcp::socket& socket) {
+  beast::error_code ec;
+  socket.set_option(tcp::no_delay(true), ec);
+}
+
+template <>
+struct stream_traits<beast::ssl_stream<tcp::socket>> {
+  static constexpr bool secure = true;
+
+  using context_type = tls_context;
+
+  static beast::ssl_stream<tcp::socket> make(tcp::socket socket,
+                                             context_type& ctx) {
+    set_no_delay(socket);
+    return beast::ssl_stream<tcp::socket>(std::move(socket), ctx.native());
+  }
+
+  template <typename Handler>
+  static void async_handshake(beast::ssl_stream<tcp::socket>& stream,
+                              Handler&& handler) {
+    stream.async_handshake(ssl::stream_base::server,
+                           std::forward<Handler>(handler));
+  }
+
+  template <typename Handler>
+  static void async_shutdown(beast::ssl_stream<tcp::socket>& stream,
+                             Handler&& handler) {
+    stream.async_shutdown(std::forward<Handler>(handler));
+  }
+};
+
+template <>
+struct stream_traits<ktls_stream> {
+  static constexpr bool secure = true;
+
+  using context_type = tls_context;
+
+  static ktls_stream make(tcp::socket socket, context_type& ctx) {
+    set_no_delay(socket);
+    return ktls_stream(std::move(socket), ctx.native());
+  }
+
+  template <typename Handler>
+  static void async_handshake(ktls_stream& stream, Handler&& handler) {
+    stream.async_handshake(std::forward<Handler>(handler));
+  }
+
+  template <typename Handler>
+  static void async_shutdown(ktls_stream& stream, Handler&& handler) {
+    stream.async_shutdown(
+        [&stream, handler = std::forward<Handler>(handler)](
+            beast::error_code ec) mutable {
+          beast::error_code ignored;
+          stream.next_layer().shutdown(tcp::socket::shutdown_send, ignored);
+          handler(ec);
+        });
+  }
+};
+
+/// HTTPS connection built on Beast's `ssl_stream`. Use it as
+/// `eagle::app<eagle::tls_connection>` and configure the certificate through
+/// `app.connection_context()` before starting the app.
+using tls_connection = basic_connection<beast::ssl_stream<tcp::socket>>;
+
+/// HTTPS connection that lets the kernel encrypt the bulk of the traffic when
+/// kTLS is available. See `eagle::ktls_stream`.
+using ktls_connection = basic_connection<ktls_stream>;
+
+}  // namespace eagle
+
+#endif  // EAGLE_TLS_CONNECTION_HPP
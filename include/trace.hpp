@@ -0,0 +1,295 @@
+#ifndef EAGLE_TRACE_HPP
+#define EAGLE_TRACE_HPP
+
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "per_thread.hpp"
+
+namespace eagle {
+
+/// The phases of a request, in the order they happen.
+enum class trace_phase : uint8_t {
+  accept,
+  read_header,
+  read_body,
+  interceptors,
+  route,
+  handler,
+  log,
+  prepare,
+  write,
+  count
+};
+
+inline const char* trace_phase_name(trace_phase phase) {
+  static constexpr std::array<const char*,
+                              static_cast<size_t>(trace_phase::count)>
+      names{"accept",  "read_header", "read_body", "interceptors", "route",
+            "handler", "log",         "prepare",   "write"};
+  return names[static_cast<size_t>(phase)];
+}
+
+struct trace_options {
+  // One request in `sample_every_` is traced
+  size_t sample_every_{1};
+  // Traced requests faster than this are dropped, 0 keeps them all
+  std::chrono::microseconds slow_threshold_{0};
+  // Traces kept per thread, the oldest are dropped first
+  size_t capacity_{1024};
+  // Taken from the request when present, else generated, and set on the
+  // response
+  std::string request_id_header_{"X-Request-Id"};
+};
+
+/// The phases of one request, stamped with `steady_clock` as it is served.
+/// Phases may repeat, e.g. the interceptors before and after the handler.
+class request_trace {
+ public:
+  struct span {
+    trace_phase phase_;
+    int64_t begin_;
+    int64_t end_;
+  };
+
+  static constexpr size_t max_spans = 16;
+
+  void begin(trace_phase phase) {
+    open_[static_cast<size_t>(phase)] = now_();
+  }
+
+  /// Ends the span of `phase`, if it began.
+  void end(trace_phase phase) {
+    auto& begin = open_[static_cast<size_t>(phase)];
+    if (begin == 0) {
+      return;
+    }
+
+    if (span_count_ < max_spans) {
+      spans_[span_count_++] = {phase, begin, now_()};
+    }
+    begin = 0;
+  }
+
+  const std::string& request_id() const { return request_id_; }
+
+  const span* begin() const { return spans_.data(); }
+  const span* end() const { return spans_.data() + span_count_; }
+
+  int64_t started_at() const { return started_at_; }
+  int64_t finished_at() const { return finished_at_; }
+  const std::string& method() const { return method_; }
+  const std::string& target() const { return target_; }
+  unsigned status() const { return status_; }
+
+ private:
+  friend class tracer;
+
+  static int64_t now_() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  int64_t started_at_{0};
+  int64_t finished_at_{0};
+  std::array<int64_t, static_cast<size_t>(trace_phase::count)> open_{};
+  std::array<span, max_spans> spans_{};
+  size_t span_count_{0};
+  std::string request_id_;
+  std::string method_;
+  std::string target_;
+  unsigned status_{0};
+};
+
+/// Spans `phase` of `trace` over a scope, nothing when `trace` is nullptr.
+class trace_scope final {
+ public:
+  trace_scope(request_trace* trace, trace_phase phase)
+      : trace_(trace), phase_(phase) {
+    if (trace_) {
+      trace_->begin(phase_);
+    }
+  }
+
+  ~trace_scope() {
+    if (trace_) {
+      trace_->end(phase_);
+    }
+  }
+
+  trace_scope(const trace_scope&) = delete;
+  trace_scope& operator=(const trace_scope&) = delete;
+
+ private:
+  request_trace* trace_;
+  trace_phase phase_;
+};
+
+/// Traces the phases of sampled requests into per-thread buffers, exported
+/// in the Chrome trace event format which Perfetto and chrome://tracing
+/// open. See `app.enable_tracing`.
+class tracer final {
+ public:
+  explicit tracer(trace_options options)
+      : options_(std::move(options)),
+        buffers_([this] { return buffer{options_.capacity_}; }) {}
+
+  const trace_options& options() const { return options_; }
+
+  /// Starts `trace` if the request is sampled.
+  bool start(request_trace& trace) const {
+    auto& local = buffers_.local();
+    if (options_.sample_every_ > 1 &&
+        local.seen_++ % options_.sample_every_ != 0) {
+      return false;
+    }
+
+    trace = {};
+    trace.started_at_ = request_trace::now_();
+    return true;
+  }
+
+  /// The id of the request from its header, or a new one.
+  void identify(request_trace& trace, std::string_view header_value) const {
+    if (!header_value.empty()) {
+      trace.request_id_.assign(header_value.data(), header_value.size());
+      return;
+    }
+
+    auto& local = buffers_.local();
+    char id[33];
+    std::snprintf(id, sizeof(id), "%016llx%016llx",
+                  static_cast<unsigned long long>(local.id_prefix_),
+                  static_cast<unsigned long long>(++local.next_id_));
+    trace.request_id_ = id;
+  }
+
+  /// Keeps the trace unless it was faster than the threshold.
+  void finish(request_trace& trace,
+              std::string_view method,
+              std::string_view target,
+              unsigned status) const {
+    trace.finished_at_ = request_trace::now_();
+    auto elapsed = std::chrono::nanoseconds(trace.finished_at_ -
+                                            trace.started_at_);
+    if (elapsed < options_.slow_threshold_) {
+      return;
+    }
+
+    trace.method_.assign(method.data(), method.size());
+    trace.target_.assign(target.data(), target.size());
+    trace.status_ = status;
+
+    auto& local = buffers_.local();
+    std::lock_guard<std::mutex> lock{local.mutex_};
+    if (local.traces_.size() < options_.capacity_) {
+      local.traces_.push_back(trace);
+    } else if (options_.capacity_ > 0) {
+      local.traces_[local.next_ % options_.capacity_] = trace;
+    }
+    local.next_++;
+  }
+
+  /// The traces kept so far, as a Chrome trace JSON document. Every request
+  /// is a span on the row of its thread, its phases nested in it.
+  std::string chrome_trace() const {
+    std::string json = "{\"traceEvents\":[";
+    bool first = true;
+    size_t thread = 0;
+    buffers_.for_each([&](const buffer& local) {
+      thread++;
+      std::lock_guard<std::mutex> lock{local.mutex_};
+      for (const auto& trace : local.traces_) {
+        append_event_(json, first, thread, trace.method_ + " " + trace.target_,
+                      trace.started_at_, trace.finished_at_, &trace);
+        for (const auto& span : trace) {
+          append_event_(json, first, thread, trace_phase_name(span.phase_),
+                        span.begin_, span.end_, nullptr);
+        }
+      }
+    });
+    json += "],\"displayTimeUnit\":\"ms\"}";
+    return json;
+  }
+
+  bool write_chrome_trace(const std::string& path) const {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    out << chrome_trace();
+    return static_cast<bool>(out);
+  }
+
+ private:
+  struct buffer {
+    explicit buffer(size_t capacity) { traces_.reserve(capacity); }
+
+    mutable std::mutex mutex_;
+    std::vector<request_trace> traces_;
+    size_t next_{0};
+    // Only touched by the thread of the buffer
+    size_t seen_{0};
+    uint64_t id_prefix_{std::random_device{}()};
+    uint64_t next_id_{0};
+  };
+
+  static void append_escaped_(std::string& json, std::string_view text) {
+    for (char c : text) {
+      if (c == '"' || c == '\\') {
+        json += '\\';
+        json += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[7];
+        std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        json += escaped;
+      } else {
+        json += c;
+      }
+    }
+  }
+
+  static void append_event_(std::string& json,
+                            bool& first,
+                            size_t thread,
+                            std::string_view name,
+                            int64_t begin,
+                            int64_t end,
+                            const request_trace* trace) {
+    char numbers[128];
+    std::snprintf(numbers, sizeof(numbers),
+                  "\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%.3f,"
+                  "\"dur\":%.3f",
+                  static_cast<int>(::getpid()), thread, begin / 1000.0,
+                  (end - begin) / 1000.0);
+
+    json += first ? "{\"name\":\"" : ",{\"name\":\"";
+    first = false;
+    append_escaped_(json, name);
+    json += "\",\"cat\":\"";
+    json += trace ? "request" : "phase";
+    json += numbers;
+    if (trace) {
+      json += ",\"args\":{\"request_id\":\"";
+      append_escaped_(json, trace->request_id_);
+      json += "\",\"status\":" + std::to_string(trace->status_) + "}";
+    }
+    json += "}";
+  }
+
+  trace_options options_;
+  per_thread<buffer> buffers_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_TRACE_HPP
@@ -0,0 +1,130 @@
+#ifndef EAGLE_URLENCODED_HPP
+#define EAGLE_URLENCODED_HPP
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "request.hpp"
+
+namespace eagle {
+
+namespace detail {
+
+inline int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+}  // namespace detail
+
+/// Decodes `+` and `%XX` escapes of [first, last) in place and returns the
+/// new end. Invalid escapes are kept as they are.
+inline char* url_decode_in_place(char* first, char* last) {
+  auto* out = first;
+  for (auto* in = first; in != last; in++) {
+    if (*in == '+') {
+      *out++ = ' ';
+      continue;
+    }
+
+    if (*in == '%' && last - in > 2) {
+      auto high = detail::hex_digit(in[1]);
+      auto low = detail::hex_digit(in[2]);
+      if (high >= 0 && low >= 0) {
+        *out++ = static_cast<char>(high * 16 + low);
+        in += 2;
+        continue;
+      }
+    }
+
+    *out++ = *in;
+  }
+
+  return out;
+}
+
+/// Fields of an `application/x-www-form-urlencoded` body, or of a query
+/// string. The text is copied once and decoded in place, names and values
+/// are views into it; fields without escapes are not even moved.
+///
+///   eagle::url_form form{req};
+///   auto name = form.get("name").value_or("anonymous");
+class url_form final {
+ public:
+  using field = std::pair<std::string_view, std::string_view>;
+
+  explicit url_form(std::string text) : text_(std::move(text)) { parse_(); }
+
+  /// The body of `req`, gathered from its buffers.
+  explicit url_form(const request& req) {
+    text_.reserve(req.body_size());
+    for (auto buffer : beast::buffers_range_ref(req.body())) {
+      text_.append(static_cast<const char*>(buffer.data()), buffer.size());
+    }
+    parse_();
+  }
+
+  // The fields point into the text, which a move could relocate
+  url_form(const url_form&) = delete;
+  url_form& operator=(const url_form&) = delete;
+
+  /// Value of the first field named `name`.
+  std::optional<std::string_view> get(std::string_view name) const {
+    for (const auto& [key, value] : fields_) {
+      if (key == name) {
+        return value;
+      }
+    }
+    return std::nullopt;
+  }
+
+  const std::vector<field>& fields() const { return fields_; }
+
+  size_t size() const { return fields_.size(); }
+
+ private:
+  void parse_() {
+    auto* pos = text_.data();
+    auto* end = pos + text_.size();
+
+    while (pos != end) {
+      auto* amp = std::find(pos, end, '&');
+      auto* equal = std::find(pos, amp, '=');
+
+      if (pos != amp) {
+        auto* name_end = url_decode_in_place(pos, equal);
+        std::string_view name{pos, static_cast<size_t>(name_end - pos)};
+
+        std::string_view value;
+        if (equal != amp) {
+          auto* value_end = url_decode_in_place(equal + 1, amp);
+          value = {equal + 1, static_cast<size_t>(value_end - equal - 1)};
+        }
+
+        fields_.emplace_back(name, value);
+      }
+
+      pos = amp == end ? end : amp + 1;
+    }
+  }
+
+ private:
+  std::string text_;
+  std::vector<field> fields_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_URLENCODED_HPP
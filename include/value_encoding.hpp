@@ -0,0 +1,787 @@
+#ifndef EAGLE_VALUE_ENCODING_HPP
+#define EAGLE_VALUE_ENCODING_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace eagle {
+
+/// Encodings of the structured bodies.
+enum class body_format { json = 0, msgpack, cbor };
+
+inline std::string_view content_type_of(body_format format) {
+  switch (format) {
+    case body_format::msgpack:
+      return "application/msgpack";
+    case body_format::cbor:
+      return "application/cbor";
+    default:
+      return "application/json";
+  }
+}
+
+/// The format the `Accept` header of a request prefers, by quality then
+/// order. JSON when it accepts none of them, or anything.
+inline body_format negotiate_format(std::string_view accept) {
+  auto trim = [](std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+      text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+      text.remove_suffix(1);
+    }
+    return text;
+  };
+  auto iequals = [](std::string_view lhs, std::string_view rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char l, char r) {
+             return (l | 0x20) == (r | 0x20);
+           });
+  };
+  auto matches = [&](std::string_view range, body_format format) {
+    if (range == "*/*" || iequals(range, "application/*")) {
+      return true;
+    }
+    if (format == body_format::msgpack) {
+      return iequals(range, "application/msgpack") ||
+             iequals(range, "application/x-msgpack") ||
+             iequals(range, "application/vnd.msgpack");
+    }
+    return iequals(range, content_type_of(format));
+  };
+
+  auto best = body_format::json;
+  double best_quality = 0;
+  size_t best_position = std::numeric_limits<size_t>::max();
+  size_t position = 0;
+  while (!accept.empty()) {
+    auto end = accept.find(',');
+    auto element = accept.substr(0, end);
+    accept.remove_prefix(end == std::string_view::npos ? accept.size()
+                                                       : end + 1);
+    position++;
+
+    auto params = element.find(';');
+    auto range = trim(element.substr(0, params));
+    double quality = 1;
+    while (params != std::string_view::npos) {
+      element.remove_prefix(params + 1);
+      params = element.find(';');
+      auto param = trim(element.substr(0, params));
+      if (param.size() > 2 && (param[0] | 0x20) == 'q' && param[1] == '=') {
+        quality = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+      }
+    }
+
+    for (auto format :
+         {body_format::json, body_format::msgpack, body_format::cbor}) {
+      if (quality > 0 && matches(range, format) &&
+          (quality > best_quality ||
+           (quality == best_quality && position < best_position))) {
+        best = format;
+        best_quality = quality;
+        best_position = position;
+      }
+    }
+  }
+
+  return best;
+}
+
+/// Starts an array of `size_` values.
+struct array_of {
+  size_t size_;
+};
+
+/// Starts a map of `size_` entries, each a key then its value.
+struct map_of {
+  size_t size_;
+};
+
+/// A binary string. JSON has none, it is written as a string.
+struct bytes_of {
+  std::string_view bytes_;
+};
+
+/// Streams values into a body in one of the `body_format`s:
+///
+///   encoder << eagle::map_of{2} << "id" << 7 << "tags"
+///           << eagle::array_of{2} << "a" << "b";
+///
+/// Containers are announced with their size, which keeps MessagePack and
+/// CBOR single pass. JSON needs the encoder for the whole value, keys of
+/// maps are strings.
+class value_encoder final {
+ public:
+  value_encoder(body_format format, std::streambuf& out)
+      : format_(format), out_(out) {}
+
+  body_format format() const { return format_; }
+
+  value_encoder& operator<<(std::nullptr_t) {
+    switch (format_) {
+      case body_format::msgpack:
+        put_(0xc0);
+        break;
+      case body_format::cbor:
+        put_(0xf6);
+        break;
+      default:
+        json_scalar_("null");
+    }
+    return *this;
+  }
+
+  value_encoder& operator<<(bool value) {
+    switch (format_) {
+      case body_format::msgpack:
+        put_(value ? 0xc3 : 0xc2);
+        break;
+      case body_format::cbor:
+        put_(value ? 0xf5 : 0xf4);
+        break;
+      default:
+        json_scalar_(value ? "true" : "false");
+    }
+    return *this;
+  }
+
+  template <typename Integer,
+            typename = std::enable_if_t<std::is_integral_v<Integer>>>
+  value_encoder& operator<<(Integer value) {
+    if constexpr (std::is_signed_v<Integer>) {
+      if (value < 0) {
+        return signed_(value);
+      }
+    }
+    return unsigned_(static_cast<uint64_t>(value));
+  }
+
+  value_encoder& operator<<(double value) {
+    // Single precision when it is exact
+    bool narrow = !std::isfinite(value) ||
+                  (std::fabs(value) <= std::numeric_limits<float>::max() &&
+                   static_cast<double>(static_cast<float>(value)) == value);
+    switch (format_) {
+      case body_format::msgpack:
+        narrow ? (put_(0xca), big_endian_(float_bits_(value), 4))
+               : (put_(0xcb), big_endian_(double_bits_(value), 8));
+        break;
+      case body_format::cbor:
+        narrow ? (put_(0xfa), big_endian_(float_bits_(value), 4))
+               : (put_(0xfb), big_endian_(double_bits_(value), 8));
+        break;
+      default: {
+        if (!std::isfinite(value)) {
+          json_scalar_("null");
+          break;
+        }
+        char digits[32];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        json_scalar_({digits, static_cast<size_t>(result.ptr - digits)});
+      }
+    }
+    return *this;
+  }
+
+  value_encoder& operator<<(float value) {
+    return *this << static_cast<double>(value);
+  }
+
+  value_encoder& operator<<(std::string_view value) {
+    switch (format_) {
+      case body_format::msgpack:
+        msgpack_head_(value.size(), 0xa0, 31, 0xd9);
+        put_(value.data(), value.size());
+        break;
+      case body_format::cbor:
+        cbor_head_(3, value.size());
+        put_(value.data(), value.size());
+        break;
+      default:
+        json_string_(value);
+    }
+    return *this;
+  }
+
+  value_encoder& operator<<(const char* value) {
+    return *this << std::string_view{value};
+  }
+
+  value_encoder& operator<<(const std::string& value) {
+    return *this << std::string_view{value};
+  }
+
+  value_encoder& operator<<(bytes_of value) {
+    auto bytes = value.bytes_;
+    switch (format_) {
+      case body_format::msgpack:
+        // bin 8 / 16 / 32, there's no fixed size form
+        msgpack_head_(bytes.size(), 0, 0, 0xc4);
+        put_(bytes.data(), bytes.size());
+        break;
+      case body_format::cbor:
+        cbor_head_(2, bytes.size());
+        put_(bytes.data(), bytes.size());
+        break;
+      default:
+        json_string_(bytes);
+    }
+    return *this;
+  }
+
+  value_encoder& operator<<(array_of array) {
+    switch (format_) {
+      case body_format::msgpack:
+        msgpack_head_(array.size_, 0x90, 15, 0xdc, false);
+        break;
+      case body_format::cbor:
+        cbor_head_(4, array.size_);
+        break;
+      default:
+        json_open_(array.size_, false);
+    }
+    return *this;
+  }
+
+  value_encoder& operator<<(map_of map) {
+    switch (format_) {
+      case body_format::msgpack:
+        msgpack_head_(map.size_, 0x80, 15, 0xde, false);
+        break;
+      case body_format::cbor:
+        cbor_head_(5, map.size_);
+        break;
+      default:
+        json_open_(map.size_ * 2, true);
+    }
+    return *this;
+  }
+
+ private:
+  value_encoder& unsigned_(uint64_t value) {
+    switch (format_) {
+      case body_format::msgpack:
+        if (value <= 0x7f) {
+          put_(static_cast<uint8_t>(value));
+        } else {
+          sized_(value, 0xcc);
+        }
+        break;
+      case body_format::cbor:
+        cbor_head_(0, value);
+        break;
+      default:
+        json_number_(value, false);
+    }
+    return *this;
+  }
+
+  value_encoder& signed_(int64_t value) {
+    // -1 - value, without overflowing on the minimum
+    auto magnitude = static_cast<uint64_t>(-(value + 1));
+    switch (format_) {
+      case body_format::msgpack:
+        if (value >= -32) {
+          put_(static_cast<uint8_t>(value));
+        } else if (value >= std::numeric_limits<int8_t>::min()) {
+          put_(0xd0);
+          big_endian_(static_cast<uint8_t>(value), 1);
+        } else if (value >= std::numeric_limits<int16_t>::min()) {
+          put_(0xd1);
+          big_endian_(static_cast<uint16_t>(value), 2);
+        } else if (value >= std::numeric_limits<int32_t>::min()) {
+          put_(0xd2);
+          big_endian_(static_cast<uint32_t>(value), 4);
+        } else {
+          put_(0xd3);
+          big_endian_(static_cast<uint64_t>(value), 8);
+        }
+        break;
+      case body_format::cbor:
+        cbor_head_(1, magnitude);
+        break;
+      default:
+        json_number_(magnitude + 1, true);
+    }
+    return *this;
+  }
+
+  // The 1, 2, 4 or 8 bytes form of `value`, the types following `type`
+  void sized_(uint64_t value, uint8_t type) {
+    if (value <= 0xff) {
+      put_(type);
+      big_endian_(value, 1);
+    } else if (value <= 0xffff) {
+      put_(type + 1);
+      big_endian_(value, 2);
+    } else if (value <= 0xffffffff) {
+      put_(type + 2);
+      big_endian_(value, 4);
+    } else {
+      put_(type + 3);
+      big_endian_(value, 8);
+    }
+  }
+
+  // A fixed form up to `fixed_max`, then the sized types from `type`, 8 bits
+  // ones only for strings
+  void msgpack_head_(size_t size,
+                     uint8_t fixed,
+                     size_t fixed_max,
+                     uint8_t type,
+                     bool has_8_bits = true) {
+    if (fixed && size <= fixed_max) {
+      put_(static_cast<uint8_t>(fixed | size));
+    } else if (has_8_bits && size <= 0xff) {
+      put_(type);
+      big_endian_(size, 1);
+    } else if (size <= 0xffff) {
+      put_(type + has_8_bits);
+      big_endian_(size, 2);
+    } else {
+      put_(type + has_8_bits + 1);
+      big_endian_(size, 4);
+    }
+  }
+
+  void cbor_head_(uint8_t major, uint64_t value) {
+    if (value < 24) {
+      put_(static_cast<uint8_t>(major << 5 | value));
+    } else {
+      sized_(value, static_cast<uint8_t>(major << 5 | 24));
+    }
+  }
+
+  static uint64_t float_bits_(double value) {
+    auto narrow = static_cast<float>(value);
+    uint32_t bits;
+    std::memcpy(&bits, &narrow, sizeof(bits));
+    return bits;
+  }
+
+  static uint64_t double_bits_(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  void big_endian_(uint64_t value, size_t size) {
+    char bytes[8];
+    for (size_t idx = size; idx > 0; idx--, value >>= 8) {
+      bytes[idx - 1] = static_cast<char>(value & 0xff);
+    }
+    put_(bytes, size);
+  }
+
+  void put_(uint8_t byte) { out_.sputc(static_cast<char>(byte)); }
+
+  void put_(const char* data, size_t size) {
+    out_.sputn(data, static_cast<std::streamsize>(size));
+  }
+
+  // JSON has no sizes but separators and closing brackets, the containers
+  // being written count their values down to know where they go
+  struct json_frame {
+    size_t remaining_;
+    bool map_;
+    bool started_{false};
+    // The value of a key is next
+    bool value_next_{false};
+  };
+
+  void json_value_() {
+    if (frames_.empty()) {
+      return;
+    }
+
+    auto& frame = frames_.back();
+    if (frame.value_next_) {
+      put_(':');
+    } else if (frame.started_) {
+      put_(',');
+    }
+  }
+
+  void json_scalar_(std::string_view text) {
+    json_value_();
+    put_(text.data(), text.size());
+    json_done_();
+  }
+
+  void json_number_(uint64_t magnitude, bool negative) {
+    char digits[21];
+    auto result = std::to_chars(digits, digits + sizeof(digits), magnitude);
+    json_value_();
+    if (negative) {
+      put_('-');
+    }
+    put_(digits, result.ptr - digits);
+    json_done_();
+  }
+
+  void json_string_(std::string_view text) {
+    json_value_();
+    put_('"');
+    size_t start = 0;
+    for (size_t idx = 0; idx < text.size(); idx++) {
+      auto c = static_cast<unsigned char>(text[idx]);
+      if (c != '"' && c != '\\' && c >= 0x20) {
+        continue;
+      }
+
+      put_(text.data() + start, idx - start);
+      start = idx + 1;
+      if (c == '"' || c == '\\') {
+        put_('\\');
+        put_(c);
+      } else {
+        static constexpr char hex[] = "0123456789abcdef";
+        char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        put_(escaped, sizeof(escaped));
+      }
+    }
+    put_(text.data() + start, text.size() - start);
+    put_('"');
+    json_done_();
+  }
+
+  void json_open_(size_t values, bool map) {
+    json_value_();
+    put_(map ? '{' : '[');
+    frames_.push_back({values, map});
+    // Closed right away when empty
+    json_done_(false);
+  }
+
+  // A value is complete, closing the containers it completes
+  void json_done_(bool counted = true) {
+    while (!frames_.empty()) {
+      auto& frame = frames_.back();
+      if (counted) {
+        frame.remaining_--;
+        frame.value_next_ = frame.map_ && !frame.value_next_;
+        frame.started_ = true;
+      }
+
+      if (frame.remaining_ > 0) {
+        return;
+      }
+
+      put_(frame.map_ ? '}' : ']');
+      frames_.pop_back();
+      counted = true;
+    }
+  }
+
+  body_format format_;
+  std::streambuf& out_;
+  std::vector<json_frame> frames_;
+};
+
+/// A value read by a `value_reader`, strings view the body.
+struct decoded_value {
+  enum class kind {
+    null,
+    boolean,
+    integer,
+    unsigned_integer,
+    floating,
+    string,
+    bytes,
+    array,
+    map
+  };
+
+  kind kind_{kind::null};
+  bool boolean_{false};
+  // Integers which fit, the larger unsigned ones are in `unsigned_`
+  int64_t integer_{0};
+  uint64_t unsigned_{0};
+  double floating_{0};
+  std::string_view string_;
+  // Values of an array, entries of a map, which follow it
+  size_t size_{0};
+};
+
+/// Reads the values of a MessagePack or CBOR body one after the other,
+/// in the order the `value_encoder` writes them, without copying them.
+class value_reader final {
+ public:
+  value_reader(body_format format, std::string_view bytes)
+      : format_(format), bytes_(bytes) {}
+
+  /// The next value, std::nullopt at the end of the body or if it is
+  /// malformed, see `failed()`.
+  std::optional<decoded_value> next() {
+    if (failed_ || pos_ == bytes_.size()) {
+      return std::nullopt;
+    }
+
+    auto value =
+        format_ == body_format::cbor ? next_cbor_() : next_msgpack_();
+    failed_ = !value.has_value();
+    return value;
+  }
+
+  bool failed() const { return failed_; }
+
+  /// Everything was read.
+  bool done() const { return !failed_ && pos_ == bytes_.size(); }
+
+ private:
+  using kind = decoded_value::kind;
+
+  std::optional<decoded_value> next_msgpack_() {
+    auto type = static_cast<uint8_t>(bytes_[pos_++]);
+    decoded_value value;
+    if (type <= 0x7f || type >= 0xe0) {
+      value.kind_ = kind::integer;
+      value.integer_ = static_cast<int8_t>(type);
+      return value;
+    }
+
+    if ((type & 0xe0) == 0xa0) {
+      return text_(kind::string, type & 0x1f);
+    }
+
+    if ((type & 0xf0) == 0x90 || (type & 0xf0) == 0x80) {
+      value.kind_ = (type & 0xf0) == 0x90 ? kind::array : kind::map;
+      value.size_ = type & 0x0f;
+      return value;
+    }
+
+    std::optional<uint64_t> size;
+    switch (type) {
+      case 0xc0:
+        return value;
+      case 0xc2:
+      case 0xc3:
+        value.kind_ = kind::boolean;
+        value.boolean_ = type == 0xc3;
+        return value;
+      case 0xc4:
+      case 0xc5:
+      case 0xc6:
+        size = read_(size_t{1} << (type - 0xc4));
+        return size ? text_(kind::bytes, *size) : std::nullopt;
+      case 0xca:
+        return floating_(4);
+      case 0xcb:
+        return floating_(8);
+      case 0xcc:
+      case 0xcd:
+      case 0xce:
+      case 0xcf:
+        size = read_(size_t{1} << (type - 0xcc));
+        return size ? unsigned_(*size) : std::nullopt;
+      case 0xd0:
+      case 0xd1:
+      case 0xd2:
+      case 0xd3: {
+        auto width = size_t{1} << (type - 0xd0);
+        size = read_(width);
+        if (!size) {
+          return std::nullopt;
+        }
+        // Sign extended from its width
+        auto shift = 64 - width * 8;
+        value.kind_ = kind::integer;
+        value.integer_ = static_cast<int64_t>(*size << shift) >> shift;
+        return value;
+      }
+      case 0xd9:
+      case 0xda:
+      case 0xdb:
+        size = read_(size_t{1} << (type - 0xd9));
+        return size ? text_(kind::string, *size) : std::nullopt;
+      case 0xdc:
+      case 0xdd:
+      case 0xde:
+      case 0xdf:
+        size = read_(type & 1 ? 4 : 2);
+        if (!size) {
+          return std::nullopt;
+        }
+        value.kind_ = type < 0xde ? kind::array : kind::map;
+        value.size_ = *size;
+        return value;
+      default:
+        // Extensions aren't supported
+        return std::nullopt;
+    }
+  }
+
+  std::optional<decoded_value> next_cbor_() {
+    auto initial = static_cast<uint8_t>(bytes_[pos_++]);
+    // Tags are skipped, in a loop as a body can nest any number of them
+    while (initial >> 5 == 6) {
+      auto info = initial & 0x1f;
+      if (info > 27 || (info >= 24 && !read_(size_t{1} << (info - 24))) ||
+          pos_ == bytes_.size()) {
+        return std::nullopt;
+      }
+      initial = static_cast<uint8_t>(bytes_[pos_++]);
+    }
+
+    auto major = initial >> 5;
+    auto info = initial & 0x1f;
+
+    decoded_value value;
+    if (major == 7) {
+      switch (info) {
+        case 20:
+        case 21:
+          value.kind_ = kind::boolean;
+          value.boolean_ = info == 21;
+          return value;
+        case 22:
+        case 23:
+          return value;
+        case 25:
+          return half_();
+        case 26:
+          return floating_(4);
+        case 27:
+          return floating_(8);
+        default:
+          return std::nullopt;
+      }
+    }
+
+    // Indefinite lengths aren't supported
+    std::optional<uint64_t> argument = info;
+    if (info >= 24 && info <= 27) {
+      argument = read_(size_t{1} << (info - 24));
+    } else if (info > 27) {
+      return std::nullopt;
+    }
+    if (!argument) {
+      return std::nullopt;
+    }
+
+    switch (major) {
+      case 0:
+        return unsigned_(*argument);
+      case 1:
+        if (*argument > static_cast<uint64_t>(
+                            std::numeric_limits<int64_t>::max())) {
+          return std::nullopt;
+        }
+        value.kind_ = kind::integer;
+        value.integer_ = -1 - static_cast<int64_t>(*argument);
+        return value;
+      case 2:
+        return text_(kind::bytes, *argument);
+      case 3:
+        return text_(kind::string, *argument);
+      case 4:
+      case 5:
+        value.kind_ = major == 4 ? kind::array : kind::map;
+        value.size_ = *argument;
+        return value;
+      default:
+        return std::nullopt;
+    }
+  }
+
+  std::optional<uint64_t> read_(size_t size) {
+    if (bytes_.size() - pos_ < size) {
+      return std::nullopt;
+    }
+
+    uint64_t value = 0;
+    for (size_t idx = 0; idx < size; idx++) {
+      value = value << 8 | static_cast<uint8_t>(bytes_[pos_++]);
+    }
+    return value;
+  }
+
+  std::optional<decoded_value> text_(kind text_kind, uint64_t size) {
+    if (bytes_.size() - pos_ < size) {
+      return std::nullopt;
+    }
+
+    decoded_value value;
+    value.kind_ = text_kind;
+    value.string_ = bytes_.substr(pos_, size);
+    pos_ += size;
+    return value;
+  }
+
+  std::optional<decoded_value> unsigned_(uint64_t number) {
+    decoded_value value;
+    if (number > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+      value.kind_ = kind::unsigned_integer;
+      value.unsigned_ = number;
+    } else {
+      value.kind_ = kind::integer;
+      value.integer_ = static_cast<int64_t>(number);
+    }
+    return value;
+  }
+
+  std::optional<decoded_value> floating_(size_t size) {
+    auto bits = read_(size);
+    if (!bits) {
+      return std::nullopt;
+    }
+
+    decoded_value value;
+    value.kind_ = kind::floating;
+    if (size == 4) {
+      auto narrow_bits = static_cast<uint32_t>(*bits);
+      float narrow;
+      std::memcpy(&narrow, &narrow_bits, sizeof(narrow));
+      value.floating_ = narrow;
+    } else {
+      std::memcpy(&value.floating_, &*bits, sizeof(value.floating_));
+    }
+    return value;
+  }
+
+  // IEEE 754 half precision, which CBOR encoders use for small values
+  std::optional<decoded_value> half_() {
+    auto bits = read_(2);
+    if (!bits) {
+      return std::nullopt;
+    }
+
+    auto exponent = static_cast<int>((*bits >> 10) & 0x1f);
+    auto mantissa = static_cast<double>(*bits & 0x3ff);
+    double magnitude;
+    if (exponent == 0) {
+      magnitude = std::ldexp(mantissa, -24);
+    } else if (exponent == 31) {
+      magnitude = mantissa == 0 ? std::numeric_limits<double>::infinity()
+                                : std::numeric_limits<double>::quiet_NaN();
+    } else {
+      magnitude = std::ldexp(mantissa + 1024, exponent - 25);
+    }
+
+    decoded_value value;
+    value.kind_ = kind::floating;
+    value.floating_ = *bits & 0x8000 ? -magnitude : magnitude;
+    return value;
+  }
+
+  body_format format_;
+  std::string_view bytes_;
+  size_t pos_{0};
+  bool failed_{false};
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_VALUE_ENCODING_HPP
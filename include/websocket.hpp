@@ -0,0 +1,395 @@
+#ifndef EAGLE_WEBSOCKET_HPP
+#define EAGLE_WEBSOCKET_HPP
+
+#include <boost/beast/websocket.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+namespace websocket = boost::beast::websocket;
+
+namespace eagle {
+
+/// What a session does when a message is sent while its queue is full, i.e.
+/// when the peer reads slower than messages are published.
+enum class websocket_overflow {
+  // Drop the oldest queued message, the peer only misses messages
+  drop_oldest = 0,
+  // Close the connection
+  disconnect
+};
+
+struct websocket_options {
+  // Messages queued per session, on top of the one being written.
+  size_t max_queue_{1024};
+  websocket_overflow overflow_{websocket_overflow::drop_oldest};
+  // Larger incoming messages close the connection.
+  size_t max_message_size_{1 << 20};
+};
+
+/// An immutable message. It is built once and shared by every session it is
+/// sent to, see `websocket_hub::publish`.
+struct websocket_message {
+  std::string payload_;
+  bool binary_{false};
+};
+
+using websocket_frame = std::shared_ptr<const websocket_message>;
+
+inline websocket_frame make_websocket_frame(std::string payload,
+                                            bool binary = false) {
+  return std::make_shared<const websocket_message>(
+      websocket_message{std::move(payload), binary});
+}
+
+/// An upgraded connection. `send` and `close` are safe to call from any
+/// thread.
+class websocket_session {
+ public:
+  websocket_session(std::string peer, std::string target)
+      : peer_(std::move(peer)), target_(std::move(target)) {}
+
+  virtual ~websocket_session() = default;
+
+  /// Queues `frame`, returns false if the session is closing or the frame
+  /// was rejected by the overflow policy.
+  virtual bool send(websocket_frame frame) = 0;
+
+  bool send(std::string payload, bool binary = false) {
+    return send(make_websocket_frame(std::move(payload), binary));
+  }
+
+  virtual void close() = 0;
+
+  std::string_view peer() const { return peer_; }
+
+  std::string_view target() const { return target_; }
+
+  /// The headers of the upgrade request, e.g. to authenticate the session
+  /// in `on_open_`.
+  virtual const http::fields& headers() const = 0;
+
+  /// Value of the header `name` of the upgrade request, empty when it
+  /// doesn't have it.
+  std::string_view header(http::field name) const {
+    auto itr = headers().find(name);
+    if (itr == headers().end()) {
+      return {};
+    }
+
+    return std::string_view{itr->value().data(), itr->value().size()};
+  }
+
+  std::string_view header(std::string_view name) const {
+    auto itr = headers().find(beast::string_view{name.data(), name.size()});
+    if (itr == headers().end()) {
+      return {};
+    }
+
+    return std::string_view{itr->value().data(), itr->value().size()};
+  }
+
+  /// Messages dropped because the queue was full.
+  uint64_t dropped() const { return dropped_; }
+
+ protected:
+  std::atomic<uint64_t> dropped_{0};
+
+ private:
+  std::string peer_;
+  std::string target_;
+};
+
+using websocket_session_ptr = std::shared_ptr<websocket_session>;
+
+/// Callbacks of a websocket endpoint, all of them are optional and run on the
+/// thread serving the session.
+struct websocket_handler {
+  std::function<void(const websocket_session_ptr&)> on_open_;
+  std::function<void(const websocket_session_ptr&, std::string_view, bool)>
+      on_message_;
+  std::function<void(const websocket_session_ptr&)> on_close_;
+  websocket_options options_;
+};
+
+template <typename Stream>
+class basic_websocket_session final
+    : public websocket_session,
+      public std::enable_shared_from_this<basic_websocket_session<Stream>> {
+ public:
+  basic_websocket_session(Stream&& stream,
+                          const websocket_handler& handler,
+                          std::string peer,
+                          std::string target)
+      : websocket_session(std::move(peer), std::move(target)),
+        ws_(std::move(stream)),
+        handler_(handler) {
+    ws_.set_option(
+        websocket::stream_base::timeout::suggested(beast::role_type::server));
+    ws_.read_message_max(handler_.options_.max_message_size_);
+  }
+
+  /// Completes the upgrade `req` asked for.
+  void accept(http::request<http::dynamic_body> req) {
+    upgrade_request_ = std::move(req);
+    ws_.async_accept(upgrade_request_, [self = this->shared_from_this()](
+                                           beast::error_code ec) {
+      if (ec) {
+        LOG(ERROR) << "Websocket upgrade failed: " << ec.message()
+                   << std::endl;
+        return;
+      }
+
+      if (self->handler_.on_open_) {
+        self->handler_.on_open_(self);
+      }
+      self->read_();
+    });
+  }
+
+  const http::fields& headers() const override { return upgrade_request_; }
+
+  bool send(websocket_frame frame) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (closing_) {
+      return false;
+    }
+
+    if (queue_.size() >= handler_.options_.max_queue_) {
+      dropped_++;
+      if (handler_.options_.overflow_ == websocket_overflow::disconnect) {
+        close_locked_();
+        return false;
+      }
+
+      queue_.pop_front();
+    }
+
+    queue_.push_back(std::move(frame));
+    if (!writing_) {
+      writing_ = true;
+      net::post(ws_.get_executor(),
+                [self = this->shared_from_this()] { self->write_(); });
+    }
+
+    return true;
+  }
+
+  using websocket_session::send;
+
+  void close() override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!closing_) {
+      close_locked_();
+    }
+  }
+
+ private:
+  void read_() {
+    ws_.async_read(buffer_, [self = this->shared_from_this()](
+                                beast::error_code ec, std::size_t) {
+      if (ec) {
+        self->closed_();
+        return;
+      }
+
+      if (self->handler_.on_message_) {
+        auto data = self->buffer_.cdata();
+        self->handler_.on_message_(
+            self,
+            std::string_view{static_cast<const char*>(data.data()),
+                             data.size()},
+            self->ws_.got_binary());
+      }
+
+      self->buffer_.consume(self->buffer_.size());
+      self->read_();
+    });
+  }
+
+  void write_() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (queue_.empty() || closing_) {
+        writing_ = false;
+        return;
+      }
+
+      current_ = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    // The payload is written straight from the shared message, server
+    // frames are not masked.
+    ws_.binary(current_->binary_);
+    ws_.async_write(net::buffer(current_->payload_),
+                    [self = this->shared_from_this()](beast::error_code ec,
+                                                      std::size_t) {
+                      self->current_.reset();
+                      if (ec) {
+                        std::lock_guard<std::mutex> guard(self->mutex_);
+                        self->closing_ = true;
+                        self->writing_ = false;
+                        self->queue_.clear();
+                        return;
+                      }
+
+                      self->write_();
+                    });
+  }
+
+  // Must be called with `mutex_` held. The close frame is sent once the
+  // message being written, if any, is done.
+  void close_locked_() {
+    closing_ = true;
+    queue_.clear();
+    net::post(ws_.get_executor(), [self = this->shared_from_this()] {
+      self->ws_.async_close(websocket::close_code::normal,
+                            [self](beast::error_code) {});
+    });
+  }
+
+  void closed_() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      closing_ = true;
+      queue_.clear();
+    }
+
+    if (handler_.on_close_) {
+      handler_.on_close_(this->shared_from_this());
+    }
+  }
+
+ private:
+  websocket::stream<Stream> ws_;
+  const websocket_handler& handler_;
+  http::request<http::dynamic_body> upgrade_request_;
+  beast::flat_buffer buffer_;
+
+  std::mutex mutex_;
+  std::deque<websocket_frame> queue_;
+  websocket_frame current_;
+  bool writing_{false};
+  bool closing_{false};
+};
+
+/// Topic based fan-out. A published message is built once and queued, as a
+/// shared pointer, to every subscriber of the topic. Sessions are held
+/// weakly, closed sessions are pruned on the next publish.
+///
+/// Every member function is safe to call from any thread.
+class websocket_hub final {
+ public:
+  websocket_hub() = default;
+
+  websocket_hub(const websocket_hub&) = delete;
+  websocket_hub& operator=(const websocket_hub&) = delete;
+
+  void subscribe(const std::string& topic,
+                 const websocket_session_ptr& session) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    topics_[topic].push_back(session);
+  }
+
+  void unsubscribe(const std::string& topic, const websocket_session* session) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto itr = topics_.find(topic);
+    if (itr == topics_.end()) {
+      return;
+    }
+
+    auto& subscribers = itr->second;
+    subscribers.erase(
+        std::remove_if(subscribers.begin(), subscribers.end(),
+                       [session](const auto& weak) {
+                         auto subscriber = weak.lock();
+                         return !subscriber || subscriber.get() == session;
+                       }),
+        subscribers.end());
+
+    if (subscribers.empty()) {
+      topics_.erase(itr);
+    }
+  }
+
+  /// Queues `frame` to every subscriber of `topic`, returns how many
+  /// accepted it.
+  size_t publish(const std::string& topic, const websocket_frame& frame) {
+    size_t queued = 0;
+    size_t expired = 0;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+      auto itr = topics_.find(topic);
+      if (itr == topics_.end()) {
+        return 0;
+      }
+
+      for (const auto& weak : itr->second) {
+        if (auto subscriber = weak.lock()) {
+          queued += subscriber->send(frame);
+        } else {
+          expired++;
+        }
+      }
+    }
+
+    if (expired > 0) {
+      prune_(topic);
+    }
+
+    return queued;
+  }
+
+  size_t publish(const std::string& topic,
+                 std::string payload,
+                 bool binary = false) {
+    return publish(topic, make_websocket_frame(std::move(payload), binary));
+  }
+
+  size_t subscribers(const std::string& topic) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto itr = topics_.find(topic);
+    return itr == topics_.end() ? 0 : itr->second.size();
+  }
+
+ private:
+  void prune_(const std::string& topic) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto itr = topics_.find(topic);
+    if (itr == topics_.end()) {
+      return;
+    }
+
+    auto& subscribers = itr->second;
+    subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+                                     [](const auto& weak) {
+                                       return weak.expired();
+                                     }),
+                      subscribers.end());
+
+    if (subscribers.empty()) {
+      topics_.erase(itr);
+    }
+  }
+
+ private:
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<std::string, std::vector<std::weak_ptr<websocket_session>>>
+      topics_;
+};
+
+}  // namespace eagle
+
+#endif  // EAGLE_WEBSOCKET_HPP
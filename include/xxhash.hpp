@@ -0,0 +1,115 @@
+#ifndef EAGLE_XXHASH_HPP
+#define EAGLE_XXHASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace eagle {
+
+namespace detail {
+
+inline constexpr uint64_t xxh_prime64_1 = 0x9E3779B185EBCA87ULL;
+inline constexpr uint64_t xxh_prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr uint64_t xxh_prime64_3 = 0x165667B19E3779F9ULL;
+inline constexpr uint64_t xxh_prime64_4 = 0x85EBCA77C2B2AE63ULL;
+inline constexpr uint64_t xxh_prime64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t xxh_rotl(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// Little endian loads, which is what every supported target is
+inline uint64_t xxh_read64(const unsigned char* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline uint32_t xxh_read32(const unsigned char* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * xxh_prime64_2;
+  acc = xxh_rotl(acc, 31);
+  return acc * xxh_prime64_1;
+}
+
+inline uint64_t xxh_merge_round(uint64_t acc, uint64_t value) {
+  acc ^= xxh_round(0, value);
+  return acc * xxh_prime64_1 + xxh_prime64_4;
+}
+
+}  // namespace detail
+
+/// XXH64 of `size` bytes: a fast non-cryptographic hash, processing 32 bytes
+/// per iteration in four independent lanes.
+inline uint64_t xxh64(const void* data, size_t size, uint64_t seed = 0) {
+  using namespace detail;
+
+  auto* input = static_cast<const unsigned char*>(data);
+  const auto* end = input + size;
+  uint64_t hash;
+
+  if (size >= 32) {
+    const auto* limit = end - 32;
+    uint64_t v1 = seed + xxh_prime64_1 + xxh_prime64_2;
+    uint64_t v2 = seed + xxh_prime64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - xxh_prime64_1;
+
+    do {
+      v1 = xxh_round(v1, xxh_read64(input));
+      v2 = xxh_round(v2, xxh_read64(input + 8));
+      v3 = xxh_round(v3, xxh_read64(input + 16));
+      v4 = xxh_round(v4, xxh_read64(input + 24));
+      input += 32;
+    } while (input <= limit);
+
+    hash = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) +
+           xxh_rotl(v4, 18);
+    hash = xxh_merge_round(hash, v1);
+    hash = xxh_merge_round(hash, v2);
+    hash = xxh_merge_round(hash, v3);
+    hash = xxh_merge_round(hash, v4);
+  } else {
+    hash = seed + xxh_prime64_5;
+  }
+
+  hash += static_cast<uint64_t>(size);
+
+  for (; input + 8 <= end; input += 8) {
+    hash ^= xxh_round(0, xxh_read64(input));
+    hash = xxh_rotl(hash, 27) * xxh_prime64_1 + xxh_prime64_4;
+  }
+
+  if (input + 4 <= end) {
+    hash ^= static_cast<uint64_t>(xxh_read32(input)) * xxh_prime64_1;
+    hash = xxh_rotl(hash, 23) * xxh_prime64_2 + xxh_prime64_3;
+    input += 4;
+  }
+
+  for (; input < end; input++) {
+    hash ^= *input * xxh_prime64_5;
+    hash = xxh_rotl(hash, 11) * xxh_prime64_1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= xxh_prime64_2;
+  hash ^= hash >> 29;
+  hash *= xxh_prime64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+inline uint64_t xxh64(std::string_view data, uint64_t seed = 0) {
+  return xxh64(data.data(), data.size(), seed);
+}
+
+}  // namespace eagle
+
+#endif  // EAGLE_XXHASH_HPP
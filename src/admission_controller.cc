@@ -0,0 +1 @@
+#include "admission_controller.hpp"
@@ -0,0 +1,92 @@
+#include "alloc_accounting.hpp"
+
+#ifdef EAGLE_ALLOC_ACCOUNTING
+
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocation functions of the process so that
+// `alloc_scope` sees every allocation. Outside of a scope they cost one
+// thread local read over malloc.
+
+namespace {
+
+void count_allocation(std::size_t size) {
+  if (auto* counters = eagle::detail::current_alloc_counters()) {
+    counters->count_++;
+    counters->bytes_ += size;
+  }
+}
+
+void* allocate(std::size_t size) {
+  count_allocation(size);
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* allocate(std::size_t size, std::align_val_t alignment) {
+  count_allocation(size);
+  auto align = static_cast<std::size_t>(alignment);
+  // aligned_alloc wants a multiple of the alignment
+  auto rounded = (std::max<std::size_t>(size, 1) + align - 1) & ~(align - 1);
+  if (void* ptr = std::aligned_alloc(align, rounded)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) { return allocate(size); }
+
+void* operator new[](std::size_t size) { return allocate(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocate(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+#endif  // EAGLE_ALLOC_ACCOUNTING
@@ -0,0 +1 @@
+#include "batch.hpp"
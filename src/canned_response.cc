@@ -0,0 +1 @@
+#include "canned_response.hpp"
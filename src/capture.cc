@@ -0,0 +1 @@
+#include "capture.hpp"
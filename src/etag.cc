@@ -0,0 +1 @@
+#include "etag.hpp"
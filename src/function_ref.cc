@@ -0,0 +1 @@
+#include "function_ref.hpp"
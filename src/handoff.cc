@@ -0,0 +1 @@
+#include "handoff.hpp"
@@ -0,0 +1 @@
+#include "multipart.hpp"
@@ -0,0 +1 @@
+#include "per_thread.hpp"
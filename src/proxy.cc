@@ -0,0 +1 @@
+#include "proxy.hpp"
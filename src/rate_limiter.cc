@@ -0,0 +1 @@
+#include "rate_limiter.hpp"
@@ -0,0 +1 @@
+#include "replay.hpp"
@@ -0,0 +1 @@
+#include "single_flight.hpp"
@@ -0,0 +1 @@
+#include "sse.hpp"
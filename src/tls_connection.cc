@@ -0,0 +1 @@
+#include "tls_connection.hpp"
@@ -0,0 +1 @@
+#include "trace.hpp"
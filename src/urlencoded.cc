@@ -0,0 +1 @@
+#include "urlencoded.hpp"
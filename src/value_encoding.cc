@@ -0,0 +1 @@
+#include "value_encoding.hpp"
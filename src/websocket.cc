@@ -0,0 +1 @@
+#include "websocket.hpp"
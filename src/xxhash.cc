@@ -0,0 +1 @@
+#include "xxhash.hpp"
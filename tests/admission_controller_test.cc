@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "admission_controller.hpp"
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+TEST(AdmissionControllerTest, DisabledByDefault) {
+  eagle::admission_controller controller;
+  EXPECT_FALSE(controller.enabled());
+}
+
+TEST(AdmissionControllerTest, HardLimit) {
+  eagle::admission_options options;
+  options.max_in_flight_ = 2;
+  eagle::admission_controller controller{options};
+
+  EXPECT_TRUE(controller.try_admit());
+  EXPECT_TRUE(controller.try_admit());
+  EXPECT_FALSE(controller.try_admit());
+  EXPECT_EQ(controller.in_flight(), 2);
+  EXPECT_EQ(controller.shed(), 1);
+
+  controller.release(1ms);
+  EXPECT_TRUE(controller.try_admit());
+}
+
+TEST(AdmissionControllerTest, AdaptiveLimitShrinksWhenLatencyGrows) {
+  eagle::admission_options options;
+  options.adaptive_ = true;
+  options.initial_limit_ = 100;
+  options.min_limit_ = 10;
+  options.max_limit_ = 200;
+  eagle::admission_controller controller{options};
+
+  auto saturate_with_latency = [&](std::chrono::microseconds latency,
+                                   int rounds) {
+    for (int round = 0; round < rounds; round++) {
+      size_t admitted = 0;
+      while (controller.try_admit()) {
+        admitted++;
+      }
+      for (size_t idx = 0; idx < admitted; idx++) {
+        controller.release(latency);
+      }
+    }
+  };
+
+  saturate_with_latency(100us, 50);
+  auto baseline_limit = controller.limit();
+  EXPECT_EQ(baseline_limit, options.max_limit_);
+
+  // Requests now queue: latency is ten times the baseline
+  saturate_with_latency(1000us, 2);
+  EXPECT_LT(controller.limit(), baseline_limit);
+  EXPECT_GE(controller.limit(), options.min_limit_);
+  EXPECT_GT(controller.shed(), 0);
+}
+
+namespace {
+
+// One slot, taken for 200ms by each request of /slow, without blocking the
+// thread of the app
+void limit_to_one_slow_request(eagle::app<>& app,
+                               std::atomic<int>& handled) {
+  eagle::admission_options options;
+  options.max_in_flight_ = 1;
+  app.admission().configure(options);
+  app.handle(http::verb::get, "/slow", [&handled](const auto& req,
+                                                  auto& resp) {
+    handled++;
+    auto completion = resp.defer();
+    auto timer = std::make_shared<net::steady_timer>(req.executor(), 200ms);
+    timer->async_wait([timer, completion, &resp](beast::error_code) {
+      resp.html() << "slow";
+      completion->complete();
+    });
+    return true;
+  });
+}
+
+void send_slow(tcp::socket& socket) {
+  http::request<http::empty_body> req{http::verb::get, "/slow", 11};
+  http::write(socket, req);
+}
+
+http::response<http::string_body> receive(tcp::socket& socket) {
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  beast::error_code ec;
+  http::read(socket, buffer, resp, ec);
+  return resp;
+}
+
+}  // namespace
+
+TEST(AdmissionControllerTest, AppShedsOverTheLimit) {
+  loopback_server server;
+  std::atomic<int> handled{0};
+  limit_to_one_slow_request(server.app(), handled);
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket served{ioc};
+  served.connect(server.endpoint());
+  send_slow(served);
+  while (handled == 0) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  // The first request is being handled, it holds the only slot
+  tcp::socket shed{ioc};
+  shed.connect(server.endpoint());
+  send_slow(shed);
+  EXPECT_EQ(receive(shed).result(), http::status::service_unavailable);
+  EXPECT_EQ(server.app().admission().shed(), 1);
+
+  auto resp = receive(served);
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp.body(), "slow");
+  EXPECT_EQ(handled, 1);
+}
+
+TEST(AdmissionControllerTest, ShedConnectionsReadTheirAnswer) {
+  loopback_server server;
+  std::atomic<int> handled{0};
+  limit_to_one_slow_request(server.app(), handled);
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket served{ioc};
+  served.connect(server.endpoint());
+  send_slow(served);
+  while (handled == 0) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  // A body larger than the socket buffers, still being sent after the 503:
+  // closing over it would reset the connection
+  tcp::socket shed{ioc};
+  shed.connect(server.endpoint());
+  http::request<http::string_body> req{http::verb::post, "/slow", 11};
+  req.body() = std::string(8 * 1024 * 1024, 'x');
+  req.prepare_payload();
+  beast::error_code ec;
+  http::write(shed, req, ec);
+  EXPECT_FALSE(ec) << ec.message();
+  EXPECT_EQ(receive(shed).result(), http::status::service_unavailable);
+  EXPECT_EQ(receive(served).result(), http::status::ok);
+}
+
+TEST(AdmissionControllerTest, IdleConnectionsLoseTheirSlot) {
+  loopback_server server;
+  std::atomic<int> handled{0};
+  limit_to_one_slow_request(server.app(), handled);
+  server.app().header_timeout(100ms);
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket idle{ioc};
+  idle.connect(server.endpoint());
+  auto connected = std::chrono::steady_clock::now();
+
+  // Closed once its header is late, which frees the slot
+  char byte;
+  beast::error_code ec;
+  idle.read_some(net::buffer(&byte, 1), ec);
+  EXPECT_EQ(ec, net::error::eof);
+  EXPECT_GE(std::chrono::steady_clock::now() - connected, 90ms);
+  while (server.app().admission().in_flight() != 0) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  tcp::socket served{ioc};
+  served.connect(server.endpoint());
+  send_slow(served);
+  EXPECT_EQ(receive(served).result(), http::status::ok);
+  EXPECT_EQ(server.app().admission().shed(), 0);
+}
+
+namespace {
+
+// A POST of 10 bytes, of which the header and `sent` bytes are written
+void send_upload(tcp::socket& socket, std::string_view sent) {
+  std::string head =
+      "POST /upload HTTP/1.1\r\nHost: eagle\r\nContent-Length: 10\r\n\r\n";
+  net::write(socket, net::buffer(head + std::string(sent)));
+}
+
+void handle_uploads(eagle::app<>& app) {
+  app.handle(http::verb::post, "/upload", [](const auto& req, auto& resp) {
+    resp.html() << req.body_size();
+    return true;
+  });
+}
+
+}  // namespace
+
+TEST(AdmissionControllerTest, SlowBodiesOutliveTheHeaderTimeout) {
+  loopback_server server;
+  handle_uploads(server.app());
+  server.app().header_timeout(100ms);
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect(server.endpoint());
+  send_upload(socket, "");
+  // Each piece in time, the whole body well past the header timeout
+  for (int i = 0; i != 5; ++i) {
+    std::this_thread::sleep_for(50ms);
+    net::write(socket, net::buffer("xx", 2));
+  }
+
+  auto resp = receive(socket);
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp.body(), "10");
+}
+
+TEST(AdmissionControllerTest, StalledBodiesAreClosed) {
+  loopback_server server;
+  handle_uploads(server.app());
+  server.app().body_timeout(100ms);
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect(server.endpoint());
+  send_upload(socket, "xx");
+  auto sent = std::chrono::steady_clock::now();
+
+  char byte;
+  beast::error_code ec;
+  socket.read_some(net::buffer(&byte, 1), ec);
+  EXPECT_EQ(ec, net::error::eof);
+  EXPECT_GE(std::chrono::steady_clock::now() - sent, 90ms);
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "dispatcher.hpp"
+
+TEST(AllocationAccountingTest, TotalsTheRequestsOfEveryRoute) {
+  eagle::allocation_accounting accounting;
+  accounting.budget("/users/{integer:id}", 10);
+
+  accounting.record("/users/{integer:id}", {8, 800});
+  accounting.record("/users/{integer:id}", {12, 1000});
+  accounting.record("/health", {1, 16});
+  accounting.record("", {3, 48});
+
+  auto routes = accounting.by_route();
+  ASSERT_EQ(routes.size(), 3);
+  EXPECT_EQ(routes[0].route_, "/users/{integer:id}");
+  EXPECT_EQ(routes[0].requests_, 2);
+  EXPECT_EQ(routes[0].allocations_, 20);
+  EXPECT_EQ(routes[0].bytes_, 1800);
+  EXPECT_EQ(routes[0].max_allocations_, 12);
+  EXPECT_EQ(routes[0].over_budget_, 1);
+  EXPECT_EQ(routes[1].route_, "");
+  EXPECT_EQ(routes[2].route_, "/health");
+
+  auto over = accounting.over_budget();
+  ASSERT_EQ(over.size(), 1);
+  EXPECT_EQ(over[0].route_, "/users/{integer:id}");
+
+  auto report = accounting.report();
+  EXPECT_NE(report.find("/users/{integer:id}"), std::string::npos);
+  EXPECT_NE(report.find("(unrouted)"), std::string::npos);
+}
+
+TEST(AllocationAccountingTest, MeasuresTheAllocationsOfAScope) {
+  if (!eagle::allocation_accounting::available()) {
+    GTEST_SKIP() << "Built without alloc_accounting";
+  }
+
+  eagle::alloc_counters inner;
+  auto counters = eagle::measure_allocations([&inner] {
+    std::vector<int> numbers;
+    numbers.reserve(100);
+
+    // Counted by the innermost scope only
+    eagle::alloc_scope scope{&inner};
+    std::string text(64, 'x');
+  });
+  EXPECT_EQ(counters.count_, 1);
+  EXPECT_GE(counters.bytes_, 100 * sizeof(int));
+  EXPECT_EQ(inner.count_, 1);
+
+  // Nothing is counted outside of a scope
+  auto* leaked = new int(42);
+  delete leaked;
+  EXPECT_EQ(counters.count_, 1);
+}
+
+TEST(AllocationAccountingTest, CountsTheAllocationsOfTheDispatchedRequests) {
+  if (!eagle::allocation_accounting::available()) {
+    GTEST_SKIP() << "Built without alloc_accounting";
+  }
+
+  eagle::dispatcher dispatcher;
+  eagle::allocation_accounting accounting;
+  accounting.budget("/users/{integer:id}", 50);
+  accounting.budget("/empty", 1000);
+  dispatcher.allocations(&accounting);
+
+  dispatcher.add_handler(http::verb::get, "/users/{integer:id}",
+                         [](const auto&, auto& resp) {
+                           std::vector<std::string> names;
+                           for (int idx = 0; idx < 100; idx++) {
+                             names.push_back(std::string(32, 'a'));
+                           }
+                           resp.json() << names.size();
+                           return true;
+                         });
+  dispatcher.add_handler(http::verb::get, "/empty",
+                         [](const auto&, auto&) { return true; });
+
+  for (auto target : {"/users/1", "/users/2", "/empty", "/missing"}) {
+    eagle::request req;
+    eagle::response resp;
+    req.method(http::verb::get);
+    req.target(target);
+    dispatcher.dispatch(req, resp);
+    EXPECT_GT(req.allocations().count_, 0) << target;
+  }
+
+  auto routes = accounting.by_route();
+  ASSERT_EQ(routes.size(), 3);
+  EXPECT_EQ(routes[0].route_, "/users/{integer:id}");
+  EXPECT_EQ(routes[0].requests_, 2);
+  EXPECT_GE(routes[0].allocations_, 200);
+  EXPECT_GE(routes[0].bytes_, 2 * 100 * 32);
+
+  // The budget of /users/{integer:id} is exceeded, the one of /empty isn't
+  auto over = accounting.over_budget();
+  ASSERT_EQ(over.size(), 1);
+  EXPECT_EQ(over[0].route_, "/users/{integer:id}");
+  EXPECT_EQ(over[0].over_budget_, 2);
+}
@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+class batch_server {
+ public:
+  explicit batch_server(eagle::batch_options options) {
+    auto& app = server_.app();
+    app.batch("/batch", std::move(options));
+    app.handle(http::verb::get, "/users/{integer:id}",
+               [](const eagle::request& req, eagle::response& resp) {
+                 resp.json() << "{\"id\":" << req.args().get<int>("id")
+                             << ",\"token\":\""
+                             << req.header(http::field::authorization)
+                             << "\"}";
+                 return true;
+               });
+    app.handle(http::verb::post, "/echo", [](const auto& req, auto& resp) {
+      resp.result(http::status::created);
+      resp.html() << beast::buffers_to_string(req.body());
+      return true;
+    });
+    app.handle(http::verb::get, "/later", [](const auto& req, auto& resp) {
+      auto completion = resp.defer();
+      net::post(req.executor(), [completion, &resp] {
+        resp.html() << "later";
+        completion->complete();
+      });
+      return true;
+    });
+    app.handle(http::verb::get, "/slow", [](const auto& req, auto& resp) {
+      auto completion = resp.defer();
+      auto timer = std::make_shared<net::steady_timer>(req.executor(), 100ms);
+      timer->async_wait([timer, completion, &resp](beast::error_code) {
+        resp.html() << "slow";
+        completion->complete();
+      });
+      return true;
+    });
+    app.handle(http::verb::get, "/bytes", [](const auto&, auto& resp) {
+      resp.html() << std::string("\x00\xff\x10", 3);
+      return true;
+    });
+    server_.start();
+  }
+
+  http::response<http::string_body> post(const std::string& body) {
+    net::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect(server_.endpoint());
+
+    http::request<http::string_body> req{http::verb::post, "/batch", 11};
+    req.set(http::field::authorization, "Bearer abc");
+    req.set(http::field::content_type, "application/json");
+    req.body() = body;
+    req.prepare_payload();
+    http::write(socket, req);
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> resp;
+    http::read(socket, buffer, resp);
+    return resp;
+  }
+
+ private:
+  loopback_server server_;
+};
+
+}  // namespace
+
+TEST(BatchTest, ReadsTheItems) {
+  auto items = eagle::detail::batch_json_reader{
+      R"( [ {"method": "POST", "path": "/a", "body": "café 😀",
+            "headers": {"X-Tag": "a\"b"}}, {"path": "/b"} ] )"}
+                   .items();
+  ASSERT_TRUE(items);
+  ASSERT_EQ(items->size(), 2);
+  EXPECT_EQ((*items)[0].method_, http::verb::post);
+  EXPECT_EQ((*items)[0].path_, "/a");
+  EXPECT_EQ((*items)[0].body_, "caf\xc3\xa9 \xf0\x9f\x98\x80");
+  ASSERT_EQ((*items)[0].headers_.size(), 1);
+  EXPECT_EQ((*items)[0].headers_[0].second, "a\"b");
+  EXPECT_EQ((*items)[1].method_, http::verb::get);
+
+  for (auto invalid : {R"({"path": "/a"})", R"([{"path": "a"}])",
+                       R"([{"method": "FETCH", "path": "/a"}])",
+                       R"([{"path": "/a"}] x)", R"([{"path": "/\ud83d"}])",
+                       R"([{"path": "/a"},])"}) {
+    EXPECT_FALSE(eagle::detail::batch_json_reader{invalid}.items()) << invalid;
+  }
+}
+
+TEST(BatchTest, AnswersEverySubRequestInOrder) {
+  batch_server server{{}};
+  auto resp = server.post(R"([
+      {"method": "GET", "path": "/users/7"},
+      {"method": "POST", "path": "/echo", "body": "hi \"there\""},
+      {"method": "GET", "path": "/later"},
+      {"method": "GET", "path": "/missing"}])");
+
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp[http::field::content_type], "application/json");
+  auto& body = resp.body();
+  auto user = body.find(R"({"status":200,)");
+  auto echo = body.find(R"({"status":201,)");
+  auto later = body.find(R"("body":"later")");
+  auto missing = body.find(R"({"status":404,)");
+  ASSERT_NE(user, std::string::npos) << body;
+  ASSERT_NE(echo, std::string::npos) << body;
+  ASSERT_NE(later, std::string::npos) << body;
+  ASSERT_NE(missing, std::string::npos) << body;
+  EXPECT_LT(user, echo);
+  EXPECT_LT(echo, later);
+  EXPECT_LT(later, missing);
+
+  // The sub-requests carry the headers of the batch
+  EXPECT_NE(body.find(R"("body":"{\"id\":7,\"token\":\"Bearer abc\"}")"),
+            std::string::npos)
+      << body;
+  EXPECT_NE(body.find(R"("body":"hi \"there\"")"), std::string::npos) << body;
+  EXPECT_EQ(body.find("Content-Length"), std::string::npos) << body;
+}
+
+TEST(BatchTest, RunsTheSubRequestsInParallel) {
+  batch_server server{{50, 4, true}};
+  auto start = std::chrono::steady_clock::now();
+  auto resp = server.post(R"([
+      {"path": "/slow"}, {"path": "/slow"}, {"path": "/users/1"},
+      {"path": "/slow"}])");
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_TRUE(resp.chunked());
+  EXPECT_LT(elapsed, 300ms);
+
+  auto& body = resp.body();
+  EXPECT_EQ(body.front(), '[');
+  EXPECT_EQ(body.back(), ']');
+  auto user = body.find(R"({\"id\":1,)");
+  ASSERT_NE(user, std::string::npos) << body;
+  size_t slow = 0;
+  for (auto pos = body.find("\"slow\""); pos != std::string::npos;
+       pos = body.find("\"slow\"", pos + 1)) {
+    slow++;
+  }
+  EXPECT_EQ(slow, 3);
+  // The third result, after two slow ones
+  EXPECT_LT(body.find("\"slow\"", body.find("\"slow\"") + 1), user);
+  EXPECT_GT(body.rfind("\"slow\""), user);
+}
+
+TEST(BatchTest, EncodesBinaryBodies) {
+  EXPECT_TRUE(eagle::detail::is_utf8("caf\xc3\xa9 \xf0\x9f\x98\x80"));
+  for (auto invalid : {"\xff", "\xc3", "\xc0\xaf", "\xed\xa0\x80",
+                       "\xf4\x90\x80\x80"}) {
+    EXPECT_FALSE(eagle::detail::is_utf8(invalid)) << invalid;
+  }
+
+  batch_server server{{}};
+  auto body = server.post(R"([{"path": "/bytes"}])").body();
+  EXPECT_NE(body.find(R"("body":"AP8Q","encoding":"base64")"),
+            std::string::npos)
+      << body;
+}
+
+TEST(BatchTest, AnswersWithoutExecutor) {
+  eagle::dispatcher dispatcher;
+  dispatcher.add_handler(http::verb::get, "/users/{integer:id}",
+                         [](const auto& req, auto& resp) {
+                           resp.json() << req.args().template get<int>("id");
+                           return true;
+                         });
+  eagle::batch_handler batch{dispatcher, "/batch", {}};
+
+  eagle::request req;
+  req.method(http::verb::post);
+  req.target("/batch");
+  beast::ostream(req.buffer().body()) << R"([{"path": "/users/3"}])";
+  eagle::response resp;
+  EXPECT_TRUE(batch(req, resp));
+  ASSERT_TRUE(resp.deferred());
+
+  bool completed = false;
+  resp.deferred()->on_complete([&completed] { completed = true; });
+  EXPECT_TRUE(completed);
+}
+
+TEST(BatchTest, LimitsTheBatches) {
+  batch_server server{{2, 0, false}};
+
+  EXPECT_EQ(server.post("{\"path\": \"/users/1\"}").result(),
+            http::status::bad_request);
+  EXPECT_EQ(server.post(R"([{"path": "/slow"}, {"path": "/slow"},
+                            {"path": "/slow"}])")
+                .result(),
+            http::status::payload_too_large);
+
+  auto nested = server.post(R"([{"method": "POST", "path": "/batch"}])");
+  EXPECT_EQ(nested.result(), http::status::ok);
+  EXPECT_EQ(nested.body().rfind(R"([{"status":400,)", 0), 0) << nested.body();
+
+  EXPECT_EQ(server.post("[]").body(), "[]");
+}
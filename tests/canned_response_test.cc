@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "app.hpp"
+#include "canned_response.hpp"
+#include "test_utils.hpp"
+
+namespace {
+
+std::string exchange(uint16_t port, std::string_view request) {
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect({net::ip::make_address("127.0.0.1"), port});
+  net::write(socket, net::buffer(request.data(), request.size()));
+
+  std::string received;
+  char buffer[1024];
+  beast::error_code ec;
+  while (!ec) {
+    auto bytes = socket.read_some(net::buffer(buffer), ec);
+    received.append(buffer, bytes);
+  }
+
+  return received;
+}
+
+}  // namespace
+
+TEST(HttpDateTest, FormatsTheDateHeader) {
+  const auto& date = eagle::http_date::now();
+  auto value = date.value();
+  ASSERT_EQ(value.size(), 29);
+  EXPECT_EQ(value.substr(3, 2), ", ");
+  EXPECT_EQ(value.substr(25), " GMT");
+  EXPECT_EQ(date.line().substr(0, 6), "Date: ");
+  EXPECT_EQ(date.line().substr(35), "\r\n");
+}
+
+TEST(CannedResponseTest, SerializedOnce) {
+  const auto& not_found = eagle::canned_responses::not_found();
+  EXPECT_EQ(not_found.head(),
+            "HTTP/1.1 404 Not Found\r\n"
+            "Content-Type: text/html\r\n"
+            "Content-Length: 24\r\n");
+  EXPECT_EQ(not_found.tail(), "\r\n<h2>404 - Not Found</h2>");
+  EXPECT_EQ(&not_found, &eagle::canned_responses::not_found());
+
+  EXPECT_EQ(eagle::canned_responses::method_not_allowed().extra_name(),
+            "Allow: ");
+}
+
+TEST(CannedResponseTest, ChangingItMakesARegularResponse) {
+  eagle::response resp;
+  resp.canned(eagle::canned_responses::method_not_allowed(), "GET");
+  EXPECT_EQ(resp.result(), http::status::method_not_allowed);
+  EXPECT_EQ(resp.header(http::field::allow), "GET");
+
+  resp.set(http::field::cache_control, "no-store");
+  EXPECT_EQ(resp.canned(), nullptr);
+
+  resp.prepare_response();
+  EXPECT_EQ(resp.result(), http::status::method_not_allowed);
+  EXPECT_EQ(resp.buffer()[http::field::allow], "GET");
+  EXPECT_EQ(resp.buffer()[http::field::cache_control], "no-store");
+  EXPECT_EQ(resp.buffer().count(http::field::date), 1);
+}
+
+TEST(CannedResponseTest, KeepsItsHeadersAsARegularResponse) {
+  eagle::response resp;
+  resp.canned(eagle::canned_responses::service_unavailable());
+  EXPECT_EQ(resp.header(http::field::retry_after), "1");
+
+  resp.set(http::field::cache_control, "no-store");
+  resp.prepare_response();
+  EXPECT_EQ(resp.buffer()[http::field::retry_after], "1");
+  EXPECT_EQ(resp.buffer()[http::field::connection], "close");
+}
+
+TEST(CannedResponseTest, BufferMaterializesIt) {
+  eagle::response resp;
+  resp.canned(eagle::canned_responses::not_found());
+  resp.prepare_response();
+  EXPECT_NE(resp.canned(), nullptr);
+
+  const auto& message = resp.buffer();
+  EXPECT_EQ(resp.canned(), nullptr);
+  EXPECT_EQ(message.result(), http::status::not_found);
+  EXPECT_EQ(message[http::field::content_type], "text/html");
+  EXPECT_EQ(message.count(http::field::date), 1);
+  EXPECT_EQ(beast::buffers_to_string(message.body().data()),
+            "<h2>404 - Not Found</h2>");
+}
+
+TEST(CannedResponseTest, WrittenAsIs) {
+  loopback_server server;
+  auto& app = server.app();
+  auto port = server.port();
+  app.health_check("/health");
+  app.handle(http::verb::post, "/items", [](const auto&, auto& resp) {
+    return true;
+  });
+  server.start();
+
+  auto not_found = exchange(port, "GET /missing HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(not_found.find("HTTP/1.1 404 Not Found\r\n"), 0);
+  EXPECT_NE(not_found.find("\r\nDate: "), std::string::npos);
+  EXPECT_NE(not_found.find("\r\n\r\n<h2>404 - Not Found</h2>"),
+            std::string::npos);
+
+  auto not_allowed = exchange(port, "GET /items HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(not_allowed.find("HTTP/1.1 405 Method Not Allowed\r\n"), 0);
+  EXPECT_NE(not_allowed.find("\r\nAllow: POST, OPTIONS\r\n"),
+            std::string::npos);
+
+  auto health = exchange(port, "GET /health HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(health.find("HTTP/1.1 200 OK\r\n"), 0);
+  EXPECT_EQ(health.substr(health.size() - 6), "\r\n\r\nOK");
+
+  auto head = exchange(port, "HEAD /health HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(head.find("HTTP/1.1 200 OK\r\n"), 0);
+  EXPECT_NE(head.find("Content-Length: 2\r\n"), std::string::npos);
+  EXPECT_EQ(head.substr(head.size() - 4), "\r\n\r\n");
+}
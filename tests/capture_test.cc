@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+std::string temp_path(const char* name) {
+  auto path = ::testing::TempDir() + name;
+  std::remove(path.c_str());
+  return path;
+}
+
+void add_routes(eagle::app<>& app) {
+  app.handle(http::verb::get, "/items/{integer:id}",
+             [](const auto& req, auto& resp) {
+               resp.html() << req.args().template get<int>("id");
+               return true;
+             });
+  app.handle(http::verb::post, "/items", [](const auto& req, auto& resp) {
+    resp.result(http::status::created);
+    resp.html() << req.body_size();
+    return true;
+  });
+  app.handle(http::verb::get, "/later", [](const auto& req, auto& resp) {
+    auto completion = resp.defer();
+    net::post(req.executor(), [completion, &resp] {
+      resp.html() << "later";
+      completion->complete();
+    });
+    return true;
+  });
+}
+
+class captured_server {
+ public:
+  explicit captured_server(eagle::capture_options options)
+      : capture_(server_.app().capture(std::move(options))) {
+    add_routes(server_.app());
+    server_.start();
+  }
+
+  http::response<http::string_body> send(http::request<http::string_body> req) {
+    net::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect(endpoint());
+    req.prepare_payload();
+    http::write(socket, req);
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> resp;
+    http::read(socket, buffer, resp);
+    return resp;
+  }
+
+  tcp::endpoint endpoint() const { return server_.endpoint(); }
+
+  eagle::traffic_capture& capture() { return capture_; }
+
+ private:
+  loopback_server server_;
+  eagle::traffic_capture& capture_;
+};
+
+std::vector<eagle::captured_request> sample_requests() {
+  std::vector<eagle::captured_request> requests;
+  for (int idx = 0; idx < 20; idx++) {
+    eagle::captured_request captured;
+    captured.offset_ = idx * 5ms;
+    captured.target_ = "/items/" + std::to_string(idx);
+    captured.headers_ = {{"Host", "localhost"}};
+    requests.push_back(std::move(captured));
+  }
+  requests[3].target_ = "/missing";
+  requests[5].target_ = "/later";
+  requests[7].method_ = http::verb::post;
+  requests[7].target_ = "/items";
+  requests[7].body_ = "abc";
+  return requests;
+}
+
+}  // namespace
+
+TEST(CaptureTest, RecordsTheRequests) {
+  auto path = temp_path("capture_records");
+  {
+    captured_server server{{path}};
+    http::request<http::string_body> get{http::verb::get, "/items/1", 11};
+    get.set(http::field::host, "localhost");
+    get.set("X-Tag", "a");
+    get.set(http::field::authorization, "Bearer secret");
+    EXPECT_EQ(server.send(get).result(), http::status::ok);
+
+    std::this_thread::sleep_for(20ms);
+    http::request<http::string_body> post{http::verb::post, "/items", 11};
+    post.body() = std::string("\x00\xff\x01", 3);
+    EXPECT_EQ(server.send(post).result(), http::status::created);
+
+    server.capture().flush();
+    EXPECT_EQ(server.capture().captured(), 2);
+    EXPECT_EQ(server.capture().dropped(), 0);
+  }
+
+  auto requests = eagle::load_capture(path);
+  ASSERT_TRUE(requests);
+  ASSERT_EQ(requests->size(), 2);
+
+  const auto& get = (*requests)[0];
+  EXPECT_EQ(get.method_, http::verb::get);
+  EXPECT_EQ(get.target_, "/items/1");
+  ASSERT_EQ(get.headers_.size(), 3);
+  EXPECT_EQ(get.headers_[1].first, "X-Tag");
+  EXPECT_EQ(get.headers_[1].second, "a");
+  EXPECT_EQ(get.headers_[2].first, "Authorization");
+  EXPECT_EQ(get.headers_[2].second, "[redacted]");
+  EXPECT_TRUE(get.body_.empty());
+
+  const auto& post = (*requests)[1];
+  EXPECT_EQ(post.method_, http::verb::post);
+  EXPECT_EQ(post.body_, std::string("\x00\xff\x01", 3));
+  EXPECT_GE(post.offset_ - get.offset_, 20ms);
+}
+
+TEST(CaptureTest, LoadsTheRecordsBeforeABadOne) {
+  auto path = temp_path("capture_truncated");
+  {
+    captured_server server{{path}};
+    for (auto target : {"/items/1", "/items/2"}) {
+      http::request<http::string_body> get{http::verb::get, target, 11};
+      server.send(get);
+    }
+    server.capture().flush();
+  }
+
+  // A record cut short, as by a crash while it was written
+  {
+    std::ofstream file{path, std::ios::binary | std::ios::app};
+    file.write("\x95\xcd\x01", 3);
+  }
+
+  auto requests = eagle::load_capture(path);
+  ASSERT_TRUE(requests);
+  ASSERT_EQ(requests->size(), 2);
+  EXPECT_EQ((*requests)[1].target_, "/items/2");
+}
+
+TEST(CaptureTest, SamplesTheRequests) {
+  auto path = temp_path("capture_samples");
+  {
+    captured_server server{{path, 0.0}};
+    http::request<http::string_body> get{http::verb::get, "/items/1", 11};
+    EXPECT_EQ(server.send(get).result(), http::status::ok);
+    server.capture().flush();
+    EXPECT_EQ(server.capture().captured(), 0);
+  }
+
+  auto requests = eagle::load_capture(path);
+  ASSERT_TRUE(requests);
+  EXPECT_TRUE(requests->empty());
+}
+
+TEST(CaptureTest, ReplaysInProcess) {
+  eagle::app<> app;
+  add_routes(app);
+
+  auto report = app.replay(sample_requests(), {0, 2});
+  EXPECT_EQ(report.requests(), 20);
+  EXPECT_EQ(report.failures(), 0);
+  EXPECT_EQ(report.statuses().at(200), 18);
+  EXPECT_EQ(report.statuses().at(201), 1);
+  EXPECT_EQ(report.statuses().at(404), 1);
+  EXPECT_LE(report.percentile(0.5), report.percentile(1));
+}
+
+TEST(CaptureTest, ReplaysOverLoopbackAtTheCapturedPace) {
+  captured_server server{{temp_path("capture_replay"), 0.0}};
+
+  // 95ms of traffic played twice as fast
+  auto report = eagle::replay(server.endpoint(), sample_requests(), {2, 3});
+  EXPECT_EQ(report.requests(), 20);
+  EXPECT_EQ(report.failures(), 0);
+  EXPECT_EQ(report.statuses().at(200), 18);
+  EXPECT_GE(report.duration(), 45ms);
+  EXPECT_LT(report.duration(), 500ms);
+  EXPECT_NE(report.summary().find("20 requests in"), std::string::npos)
+      << report.summary();
+}
@@ -6,6 +6,30 @@
 
 using ::testing::_;
 
+namespace {
+
+// Not a handler_interface, only the methods it has are routed
+struct users_resource {
+  bool get(const eagle::request&, eagle::response& resp) {
+    resp.result(http::status::ok);
+    return true;
+  }
+
+  bool del(const eagle::request&, eagle::response& resp) {
+    resp.result(http::status::no_content);
+    return true;
+  }
+};
+
+struct counter_handler final : eagle::stateful_handler_base {
+  bool post(const eagle::request&, eagle::response& resp) override {
+    resp.result(http::status::created);
+    return true;
+  }
+};
+
+}  // namespace
+
 class DispatcherTest : public ::testing::Test {
  protected:
   void SetUp() override {
@@ -255,6 +279,25 @@ TEST_F(DispatcherTest, AddInterceptorBefore) {
   EXPECT_EQ(response_.result(), http::status::bad_request);
 }
 
+TEST_F(DispatcherTest, InterceptorFinishesResponse) {
+  dispatcher_.add_interceptor(eagle::intercept_policy_before::value,
+                              [](const auto& req, auto& resp) {
+                                resp.result(http::status::forbidden);
+                                resp.finish();
+                              });
+  auto result = dispatcher_.add_handler(
+      http::verb::get, "/endpoint", [](const auto& req, auto& resp) {
+        ADD_FAILURE() << "The handler should be skipped";
+        return true;
+      });
+  EXPECT_TRUE(result);
+
+  result = dispatcher_.dispatch(request_, response_);
+  EXPECT_TRUE(result);
+
+  EXPECT_EQ(response_.result(), http::status::forbidden);
+}
+
 TEST_F(DispatcherTest, UnsupportedMethod) {
   HandlerMock mockHandler;
   auto result = dispatcher_.add_handler("/endpoint", mockHandler);
@@ -264,3 +307,121 @@ TEST_F(DispatcherTest, UnsupportedMethod) {
   result = dispatcher_.dispatch(request_, response_);
   EXPECT_FALSE(result);
 }
+
+TEST_F(DispatcherTest, StaticHandlerRoutesImplementedMethods) {
+  static_assert(eagle::is_static_handler_v<users_resource>);
+  static_assert(eagle::is_static_handler_v<counter_handler>);
+  static_assert(!eagle::is_static_handler_v<eagle::stateful_handler_base>);
+  static_assert(!eagle::is_static_handler_v<eagle::handler_interface>);
+
+  users_resource users;
+  EXPECT_TRUE(dispatcher_.add_static_handler("/endpoint", users));
+
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::ok);
+
+  eagle::response deleted;
+  request_.method(http::verb::delete_);
+  EXPECT_TRUE(dispatcher_.dispatch(request_, deleted));
+  EXPECT_EQ(deleted.result(), http::status::no_content);
+
+  eagle::response not_allowed;
+  request_.method(http::verb::put);
+  EXPECT_TRUE(dispatcher_.dispatch(request_, not_allowed));
+  EXPECT_EQ(not_allowed.result(), http::status::method_not_allowed);
+  EXPECT_EQ(not_allowed.buffer()[http::field::allow],
+            "GET, HEAD, DELETE, OPTIONS");
+}
+
+TEST_F(DispatcherTest, StaticHandlerSkipsBaseDefaults) {
+  counter_handler counter;
+  EXPECT_TRUE(dispatcher_.add_static_handler("/endpoint", counter));
+
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::method_not_allowed);
+  EXPECT_EQ(response_.buffer()[http::field::allow], "POST, OPTIONS");
+
+  // The methods are function handlers, an object can't take the endpoint
+  HandlerMock mockHandler;
+  EXPECT_FALSE(dispatcher_.add_handler("/endpoint", mockHandler));
+}
+
+TEST_F(DispatcherTest, HeadRunsTheGetHandlerWithoutBody) {
+  auto result = dispatcher_.add_handler(
+      http::verb::get, "/endpoint", [](const auto& req, auto& resp) {
+        resp.html() << "<h1>Hello</h1>";
+        return true;
+      });
+  EXPECT_TRUE(result);
+
+  request_.method(http::verb::head);
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::ok);
+  EXPECT_EQ(response_.buffer()[http::field::content_length], "14");
+  EXPECT_EQ(response_.buffer().body().size(), 0);
+}
+
+TEST_F(DispatcherTest, HeadHandlerCanSkipTheBody) {
+  auto result = dispatcher_.add_handler(
+      http::verb::get, "/endpoint", [](const auto& req, auto& resp) {
+        if (!resp.omits_body()) {
+          resp.json() << "{}";
+        }
+        return true;
+      });
+  EXPECT_TRUE(result);
+
+  request_.method(http::verb::head);
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::ok);
+  EXPECT_EQ(response_.buffer().count(http::field::content_length), 0);
+}
+
+TEST_F(DispatcherTest, OptionsIsAnsweredFromTheRoutes) {
+  EXPECT_TRUE(dispatcher_.add_handler(
+      http::verb::patch, "/endpoint/{integer:id}",
+      [](const auto& req, auto& resp) {
+        ADD_FAILURE() << "OPTIONS doesn't run the handlers";
+        return true;
+      }));
+  EXPECT_TRUE(dispatcher_.add_handler(
+      http::verb::get, "/endpoint/{integer:id}",
+      [](const auto& req, auto& resp) { return true; }));
+
+  request_.method(http::verb::options);
+  request_.target("/endpoint/7");
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::ok);
+  EXPECT_EQ(response_.buffer()[http::field::allow], "GET, HEAD, PATCH, OPTIONS");
+
+  eagle::response not_found;
+  request_.target("/elsewhere");
+  EXPECT_TRUE(dispatcher_.dispatch(request_, not_found));
+  EXPECT_EQ(not_found.result(), http::status::not_found);
+}
+
+TEST_F(DispatcherTest, DispatchPatchHandlerFn) {
+  EXPECT_TRUE(dispatcher_.add_handler(
+      http::verb::patch, "/endpoint", [](const auto& req, auto& resp) {
+        resp.result(http::status::no_content);
+        return true;
+      }));
+  EXPECT_FALSE(dispatcher_.add_handler(
+      http::verb::head, "/endpoint",
+      [](const auto& req, auto& resp) { return true; }));
+
+  request_.method(http::verb::patch);
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::no_content);
+}
+
+TEST_F(DispatcherTest, ObjectHandlerRefusesPatchByDefault) {
+  HandlerMock mockHandler;
+  EXPECT_TRUE(dispatcher_.add_handler("/endpoint", mockHandler));
+
+  request_.method(http::verb::patch);
+  EXPECT_TRUE(dispatcher_.dispatch(request_, response_));
+  EXPECT_EQ(response_.result(), http::status::method_not_allowed);
+  EXPECT_EQ(response_.buffer()[http::field::allow],
+            "GET, HEAD, POST, PUT, DELETE, OPTIONS");
+}
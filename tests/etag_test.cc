@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include "dispatcher.hpp"
+#include "etag.hpp"
+#include "xxhash.hpp"
+
+namespace {
+
+class EtagTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    request_.method(http::verb::get);
+    request_.peer("localhost");
+    request_.target("/users");
+
+    dispatcher_.add_handler(http::verb::get, "/users",
+                            eagle::etag([](const auto&, auto& resp) {
+                              resp.json() << "[\"ada\", \"grace\"]";
+                              return true;
+                            }));
+  }
+
+  eagle::request request_;
+  eagle::dispatcher dispatcher_;
+};
+
+}  // namespace
+
+TEST(XxhashTest, ReferenceValues) {
+  EXPECT_EQ(eagle::xxh64(""), 0xEF46DB3751D8E999ULL);
+  EXPECT_EQ(eagle::xxh64("abc"), 0x44BC2CF5AD770999ULL);
+
+  // 32 bytes and more go through the 4 lanes, then the 8, 4 and 1 byte tail
+  EXPECT_EQ(eagle::xxh64("Nobody inspects the spammish repetition"),
+            0xFBCEA83C8A378BF1ULL);
+  EXPECT_EQ(eagle::xxh64("The quick brown fox jumps over the lazy dog"),
+            0x0B242D361FDA71BCULL);
+  EXPECT_EQ(eagle::xxh64(std::string(32, 'x')), 0xE2DF261FC2EC30EBULL);
+
+  std::string long_input(100, 'x');
+  EXPECT_EQ(eagle::xxh64(long_input), 0x92F0DE5A88A3C094ULL);
+  EXPECT_EQ(eagle::xxh64(long_input, 1), 0xA27AEC103FA2BDAEULL);
+}
+
+TEST(EtagMatchTest, ComparesTheListWeakly) {
+  EXPECT_TRUE(eagle::etag_matches("\"a\"", "\"a\""));
+  EXPECT_TRUE(eagle::etag_matches("\"b\", W/\"a\"", "\"a\""));
+  EXPECT_TRUE(eagle::etag_matches("*", "\"a\""));
+  EXPECT_FALSE(eagle::etag_matches("\"b\"", "\"a\""));
+  EXPECT_FALSE(eagle::etag_matches("", "\"a\""));
+}
+
+TEST_F(EtagTest, HashesTheBody) {
+  eagle::response resp;
+  EXPECT_TRUE(dispatcher_.dispatch(request_, resp));
+
+  EXPECT_EQ(resp.result(), http::status::ok);
+  auto tag = resp.buffer()[http::field::etag];
+  EXPECT_EQ(tag, eagle::format_etag(eagle::xxh64("[\"ada\", \"grace\"]")));
+  EXPECT_EQ(resp.buffer().body().size(), 16);
+}
+
+TEST_F(EtagTest, NotModifiedWithoutBody) {
+  eagle::response first;
+  dispatcher_.dispatch(request_, first);
+  auto tag = first.buffer()[http::field::etag];
+
+  request_.buffer().set(http::field::if_none_match, tag);
+  eagle::response second;
+  EXPECT_TRUE(dispatcher_.dispatch(request_, second));
+
+  EXPECT_EQ(second.result(), http::status::not_modified);
+  EXPECT_EQ(second.buffer()[http::field::etag], tag);
+  EXPECT_EQ(second.buffer().body().size(), 0);
+  EXPECT_EQ(second.buffer().count(http::field::content_length), 0);
+}
+
+TEST_F(EtagTest, ChangedBodyIsSentAgain) {
+  request_.buffer().set(http::field::if_none_match, "\"0000000000000000\"");
+  eagle::response resp;
+  dispatcher_.dispatch(request_, resp);
+
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp.buffer().body().size(), 16);
+}
+
+TEST(FreshTest, KnownVersionSkipsRendering) {
+  eagle::request req;
+  eagle::response resp;
+  EXPECT_FALSE(eagle::fresh(req, resp, "v42"));
+  EXPECT_EQ(resp.buffer()[http::field::etag], "\"v42\"");
+
+  req.buffer().set(http::field::if_none_match, "\"v42\"");
+  eagle::response cached;
+  EXPECT_TRUE(eagle::fresh(req, cached, "v42"));
+  cached.prepare_response();
+  EXPECT_EQ(cached.result(), http::status::not_modified);
+  EXPECT_EQ(cached.buffer().count(http::field::content_length), 0);
+}
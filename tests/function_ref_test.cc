@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+
+#include "function_ref.hpp"
+
+namespace {
+
+using small_fn = eagle::small_function<int(int)>;
+
+}  // namespace
+
+TEST(FunctionRefTest, CallsTheReferencedCallable) {
+  int calls = 0;
+  auto add = [&calls](int value) {
+    calls++;
+    return value + 1;
+  };
+
+  eagle::function_ref<int(int)> ref{add};
+  EXPECT_EQ(ref(1), 2);
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(SmallFunctionTest, EmptyByDefault) {
+  small_fn fn;
+  EXPECT_FALSE(fn);
+  EXPECT_THROW(fn(1), std::bad_function_call);
+
+  small_fn from_empty{std::function<int(int)>{}};
+  EXPECT_FALSE(from_empty);
+}
+
+TEST(SmallFunctionTest, CopiesAndMovesInlineCallables) {
+  auto counter = std::make_shared<int>(0);
+  small_fn fn = [counter](int value) { return ++*counter + value; };
+
+  auto copy = fn;
+  EXPECT_EQ(counter.use_count(), 3);
+  EXPECT_EQ(copy(10), 11);
+
+  auto moved = std::move(fn);
+  EXPECT_FALSE(fn);
+  EXPECT_EQ(moved(10), 12);
+  EXPECT_EQ(moved.ref()(10), 13);
+
+  moved = nullptr;
+  copy = small_fn{};
+  EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(SmallFunctionTest, LargeCallablesGoToTheHeap) {
+  std::array<int, 64> values{};
+  values[63] = 7;
+  small_fn fn = [values](int idx) { return values[idx]; };
+
+  auto copy = fn;
+  auto moved = std::move(fn);
+  EXPECT_EQ(copy(63), 7);
+  EXPECT_EQ(moved(63), 7);
+  EXPECT_EQ(moved.ref()(63), 7);
+}
@@ -214,3 +214,62 @@ TEST(HandlerRegistryTest, RegisterWithDynamicPathUnsupportedValueType) {
       [](const auto&, auto&) -> bool { return true; });
   EXPECT_FALSE(result);
 }
+
+TEST(HandlerRegistryTest, KeepsACopyOfTheEndpoint) {
+  eagle::handler_registry<eagle::handler_fn_type> registry;
+  {
+    std::string endpoint{"/some/{integer:id}/temporary-endpoint"};
+    EXPECT_TRUE(registry.register_handler(
+        http::verb::get, endpoint,
+        [](const auto&, auto&) -> bool { return true; }));
+  }
+
+  eagle::request_arguments p;
+  auto [handler, status] = registry.get_handler_for(
+      http::verb::get, "/some/12/temporary-endpoint", p);
+  EXPECT_TRUE(status);
+}
+
+TEST(HandlerRegistryTest, MatchesTheStaticSegments) {
+  eagle::handler_registry<eagle::handler_fn_type> registry;
+  EXPECT_TRUE(registry.register_handler(
+      http::verb::get, "/users/{integer:id}/posts/{string:slug}",
+      [](const auto&, auto&) -> bool { return true; }));
+
+  eagle::request_arguments p;
+  {
+    auto [handler, status] =
+        registry.get_handler_for(http::verb::get, "/users/42/posts/hello", p);
+    EXPECT_TRUE(status);
+    EXPECT_EQ(p.get<int>("id"), 42);
+    EXPECT_EQ(p.get<std::string_view>("slug"), "hello");
+  }
+  {
+    auto [handler, status] =
+        registry.get_handler_for(http::verb::get, "/users/42/likes/hello", p);
+    EXPECT_FALSE(status);
+  }
+  {
+    auto [handler, status] =
+        registry.get_handler_for(http::verb::get, "/users/42x/posts/hello", p);
+    EXPECT_FALSE(status);
+  }
+}
+
+TEST(HandlerRegistryTest, StaticEndpointsTakePrecedence) {
+  eagle::handler_registry<eagle::handler_fn_type> registry;
+  EXPECT_TRUE(registry.register_handler(
+      http::verb::get, "/users/{string:name}",
+      [](const auto&, auto&) -> bool { return false; }));
+  EXPECT_TRUE(registry.register_handler(
+      http::verb::get, "/users/me",
+      [](const auto&, auto&) -> bool { return true; }));
+
+  eagle::request_arguments p;
+  eagle::request req;
+  eagle::response resp;
+  auto [handler, status] =
+      registry.get_handler_for(http::verb::get, "/users/me", p);
+  ASSERT_TRUE(status);
+  EXPECT_TRUE((*handler)(req, resp));
+}
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "app.hpp"
+#include "handoff.hpp"
+#include "test_utils.hpp"
+
+namespace {
+
+std::string get(uint16_t port, std::string_view target) {
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect({net::ip::make_address("127.0.0.1"), port});
+
+  http::request<http::empty_body> req{http::verb::get,
+                                      beast::string_view{target.data(),
+                                                         target.size()},
+                                      11};
+  http::write(socket, req);
+
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  beast::error_code ec;
+  http::read(socket, buffer, resp, ec);
+  return resp.body();
+}
+
+uint16_t port_of(int fd) {
+  sockaddr_in addr{};
+  socklen_t length = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length);
+  return ntohs(addr.sin_port);
+}
+
+}  // namespace
+
+TEST(HandoffTest, SendAndReceiveFds) {
+  int channel[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, channel), 0);
+
+  uint16_t port;
+  auto listener = listen_on_loopback(port);
+  EXPECT_TRUE(eagle::send_fds(channel[0], {listener}));
+
+  auto fds = eagle::receive_fds(channel[1], 1);
+  ASSERT_EQ(fds.size(), 1);
+  EXPECT_NE(fds.front(), listener);
+  EXPECT_EQ(port_of(fds.front()), port);
+
+  close(fds.front());
+  close(listener);
+  close(channel[0]);
+  close(channel[1]);
+}
+
+TEST(HandoffTest, ReceiveListenerWithoutServer) {
+  EXPECT_FALSE(eagle::receive_listener("/tmp/eagle-handoff-nobody.sock"));
+}
+
+TEST(HandoffTest, HandoffListenerToNewApp) {
+  const std::string path = "/tmp/eagle-handoff-test.sock";
+  uint16_t port;
+  auto listener = listen_on_loopback(port);
+
+  eagle::app old_app;
+  old_app.handle(http::verb::get, "/version", [](const auto&, auto& resp) {
+    resp.html() << "old";
+    return true;
+  });
+  ASSERT_TRUE(old_app.adopt(listener));
+  ASSERT_TRUE(old_app.enable_handoff(path, std::chrono::seconds(1)));
+  std::thread old_thread([&] { old_app.start(); });
+
+  EXPECT_EQ(get(port, "/version"), "old");
+
+  auto inherited = eagle::receive_listener(path);
+  ASSERT_TRUE(inherited);
+
+  // The old app returns from start() once it is drained
+  old_thread.join();
+  EXPECT_EQ(old_app.active_connections(), 0);
+
+  eagle::app new_app;
+  new_app.handle(http::verb::get, "/version", [](const auto&, auto& resp) {
+    resp.html() << "new";
+    return true;
+  });
+  ASSERT_TRUE(new_app.adopt(*inherited));
+  std::thread new_thread([&] { new_app.start(); });
+
+  EXPECT_EQ(get(port, "/version"), "new");
+
+  new_app.drain(std::chrono::milliseconds(100));
+  new_thread.join();
+}
+
+TEST(HandoffTest, FailedHandoffKeepsServing) {
+  const std::string path = "/tmp/eagle-handoff-failed-test.sock";
+  uint16_t port;
+  auto listener = listen_on_loopback(port);
+
+  eagle::app old_app;
+  old_app.handle(http::verb::get, "/version", [](const auto&, auto& resp) {
+    resp.html() << "old";
+    return true;
+  });
+  ASSERT_TRUE(old_app.adopt(listener));
+  ASSERT_TRUE(old_app.enable_handoff(path, std::chrono::seconds(1)));
+
+  // Gone before the app accepts it, the socket can't be sent to it
+  {
+    net::io_context ioc;
+    net::local::stream_protocol::socket quitter{ioc};
+    quitter.connect({path});
+  }
+  std::thread old_thread([&] { old_app.start(); });
+
+  EXPECT_EQ(get(port, "/version"), "old");
+
+  auto inherited = eagle::receive_listener(path);
+  ASSERT_TRUE(inherited);
+  old_thread.join();
+  close(*inherited);
+}
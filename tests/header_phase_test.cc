@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Uploads need an Authorization header, checked before their body is read
+class upload_server {
+ public:
+  upload_server() {
+    auto& app = server_.app();
+    app.intercept<eagle::intercept_policy_header>(
+        [](const eagle::request& req, eagle::response& resp) {
+          if (req.header(http::field::authorization).empty()) {
+            resp.result(http::status::unauthorized);
+            resp.finish();
+          }
+        });
+    app.body_limit("/avatar", 16);
+    for (auto endpoint : {"/upload", "/avatar"}) {
+      app.handle(http::verb::post, endpoint, [this](const auto& req,
+                                                    auto& resp) {
+        handled_++;
+        resp.html() << req.body_size();
+        return true;
+      });
+    }
+    server_.start();
+  }
+
+  tcp::socket connect(net::io_context& ioc) {
+    tcp::socket socket{ioc};
+    socket.connect(server_.endpoint());
+    return socket;
+  }
+
+  size_t handled() const { return handled_; }
+
+ private:
+  std::atomic<size_t> handled_{0};
+  // Last, it stops before what its handlers use is destroyed
+  loopback_server server_;
+};
+
+void send(tcp::socket& socket, const std::string& data) {
+  net::write(socket, net::buffer(data));
+}
+
+// The head of the next response, interim ones included
+std::string read_head(tcp::socket& socket, std::string& buffer) {
+  auto end = net::read_until(socket, net::dynamic_buffer(buffer), "\r\n\r\n");
+  auto head = buffer.substr(0, end);
+  buffer.erase(0, end);
+  return head;
+}
+
+std::string upload_header(std::string_view target,
+                          size_t length,
+                          std::string_view extra) {
+  return "POST " + std::string(target) +
+         " HTTP/1.1\r\nHost: localhost\r\nContent-Length: " +
+         std::to_string(length) + "\r\n" + std::string(extra) + "\r\n";
+}
+
+}  // namespace
+
+TEST(HeaderPhaseTest, RejectsBeforeReadingTheBody) {
+  upload_server server;
+  net::io_context ioc;
+  auto socket = server.connect(ioc);
+
+  // 500MB announced, none of it sent: the answer can't wait for the body
+  send(socket, upload_header("/upload", 500 * 1024 * 1024,
+                             "Expect: 100-continue\r\n"));
+  std::string buffer;
+  auto head = read_head(socket, buffer);
+  EXPECT_EQ(head.rfind("HTTP/1.1 401 Unauthorized\r\n", 0), 0) << head;
+  EXPECT_EQ(server.handled(), 0);
+}
+
+TEST(HeaderPhaseTest, ContinuesOnceTheHeaderIsAccepted) {
+  upload_server server;
+  net::io_context ioc;
+  auto socket = server.connect(ioc);
+
+  send(socket, upload_header("/upload", 5,
+                             "Authorization: Bearer x\r\n"
+                             "Expect: 100-continue\r\n"));
+  std::string buffer;
+  auto interim = read_head(socket, buffer);
+  EXPECT_EQ(interim, "HTTP/1.1 100 Continue\r\n\r\n");
+
+  send(socket, "hello");
+  auto head = read_head(socket, buffer);
+  EXPECT_EQ(head.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << head;
+  EXPECT_EQ(server.handled(), 1);
+}
+
+TEST(HeaderPhaseTest, LimitsTheBodiesOfARoute) {
+  upload_server server;
+  net::io_context ioc;
+
+  auto large = server.connect(ioc);
+  send(large, upload_header("/avatar", 17, "Authorization: Bearer x\r\n") +
+                  std::string(17, 'a'));
+  std::string buffer;
+  auto head = read_head(large, buffer);
+  EXPECT_EQ(head.rfind("HTTP/1.1 413 Payload Too Large\r\n", 0), 0) << head;
+
+  // Only that route is limited
+  auto other = server.connect(ioc);
+  send(other, upload_header("/upload", 17, "Authorization: Bearer x\r\n") +
+                  std::string(17, 'a'));
+  buffer.clear();
+  head = read_head(other, buffer);
+  EXPECT_EQ(head.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << head;
+  EXPECT_EQ(server.handled(), 1);
+}
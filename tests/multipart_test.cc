@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "app.hpp"
+#include "multipart.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Records the callbacks as text
+class recorder : public eagle::multipart_handler {
+ public:
+  bool on_part_begin(const eagle::multipart_part& part) override {
+    events_ += "begin(" + std::string(part.name_) + "," +
+               std::string(part.filename_) + "," +
+               std::string(part.content_type_) + ")";
+    return true;
+  }
+
+  bool on_part_data(std::string_view data) override {
+    events_ += data;
+    return true;
+  }
+
+  bool on_part_end() override {
+    events_ += "end;";
+    return true;
+  }
+
+  std::string events_;
+};
+
+const std::string body =
+    "preamble\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"title\"\r\n"
+    "\r\n"
+    "a\r\n-- -XyZ not a delimiter\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "line\r\n\r\n"
+    "--XyZ--\r\n"
+    "epilogue";
+
+const std::string expected =
+    "begin(title,,)a\r\n-- -XyZ not a delimiterend;"
+    "begin(file,a.txt,text/plain)line\r\nend;";
+
+}  // namespace
+
+TEST(MultipartTest, Boundary) {
+  EXPECT_EQ(eagle::multipart_boundary("multipart/form-data; boundary=XyZ"),
+            "XyZ");
+  EXPECT_EQ(
+      eagle::multipart_boundary("Multipart/Form-Data; boundary=\"a b\"; x=y"),
+      "a b");
+  EXPECT_FALSE(eagle::multipart_boundary("text/plain; boundary=XyZ"));
+  EXPECT_FALSE(eagle::multipart_boundary("multipart/form-data"));
+}
+
+TEST(MultipartTest, WholeBody) {
+  recorder handler;
+  eagle::multipart_parser parser{"XyZ", handler};
+
+  EXPECT_TRUE(parser.feed(body));
+  EXPECT_TRUE(parser.done());
+  EXPECT_EQ(parser.parts(), 2);
+  EXPECT_EQ(handler.events_, expected);
+}
+
+TEST(MultipartTest, AnySplitOfTheBody) {
+  for (size_t piece = 1; piece < body.size(); piece++) {
+    recorder handler;
+    eagle::multipart_parser parser{"XyZ", handler};
+
+    for (size_t pos = 0; pos < body.size(); pos += piece) {
+      ASSERT_TRUE(parser.feed(std::string_view(body).substr(pos, piece)));
+    }
+
+    EXPECT_TRUE(parser.done()) << piece;
+    EXPECT_EQ(handler.events_, expected) << piece;
+  }
+}
+
+TEST(MultipartTest, PartWithoutHeaders) {
+  recorder handler;
+  eagle::multipart_parser parser{"b", handler};
+
+  EXPECT_TRUE(parser.feed("--b\r\n\r\nvalue\r\n--b--"));
+  EXPECT_TRUE(parser.done());
+  EXPECT_EQ(handler.events_, "begin(,,)valueend;");
+}
+
+TEST(MultipartTest, Limits) {
+  recorder handler;
+  eagle::multipart_limits limits;
+  limits.max_header_size_ = 16;
+  eagle::multipart_parser parser{"b", handler, limits};
+
+  EXPECT_FALSE(parser.feed("--b\r\nContent-Disposition: form-data\r\n\r\n"));
+  EXPECT_TRUE(parser.failed());
+}
+
+TEST(MultipartTest, InvalidDelimiter) {
+  recorder handler;
+  eagle::multipart_parser parser{"b", handler};
+
+  EXPECT_FALSE(parser.feed("--bxx\r\n"));
+}
+
+TEST(MultipartTest, BufferedRequestBody) {
+  eagle::request req;
+  req.buffer().set(http::field::content_type,
+                   "multipart/form-data; boundary=XyZ");
+  auto& request_body = req.buffer().body();
+  auto buffers = request_body.prepare(body.size());
+  net::buffer_copy(buffers, net::buffer(body));
+  request_body.commit(body.size());
+
+  recorder handler;
+  EXPECT_TRUE(eagle::parse_multipart(req, handler));
+  EXPECT_EQ(handler.events_, expected);
+}
+
+TEST(MultipartTest, UploadIsWrittenToDisk) {
+  eagle::app<> app;
+  uint16_t port;
+  app.adopt(listen_on_loopback(port));
+
+  std::string content;
+  std::string field;
+  size_t files = 0;
+  app.body_reader("/upload", eagle::multipart_upload::open);
+  app.handle(http::verb::post, "/upload", [&](const auto& req, auto& resp) {
+    auto* upload = req.template body_reader<eagle::multipart_upload>();
+    if (!upload || !upload->complete()) {
+      resp.result(http::status::bad_request);
+      return true;
+    }
+
+    files = upload->files().size();
+    field = upload->find("title")->value_;
+    std::ifstream in{upload->files().front().path_, std::ios::binary};
+    content.assign(std::istreambuf_iterator<char>(in), {});
+    resp.result(http::status::created);
+    return true;
+  });
+  std::thread server([&app] { app.start(); });
+
+  // Larger than anything the connection buffers
+  std::string file(3 * 1024 * 1024, '\0');
+  for (size_t idx = 0; idx < file.size(); idx++) {
+    file[idx] = static_cast<char>("\r\n-XyZ"[idx % 6]);
+  }
+
+  http::request<http::string_body> req{http::verb::post, "/upload", 11};
+  req.set(http::field::content_type, "multipart/form-data; boundary=XyZ");
+  req.body() =
+      "--XyZ\r\n"
+      "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+      "holidays\r\n"
+      "--XyZ\r\n"
+      "Content-Disposition: form-data; name=\"photo\"; filename=\"a.bin\"\r\n"
+      "\r\n" +
+      file + "\r\n--XyZ--\r\n";
+  req.prepare_payload();
+
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect({net::ip::make_address("127.0.0.1"), port});
+  http::write(socket, req);
+
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  http::read(socket, buffer, resp);
+
+  app.drain(100ms);
+  server.join();
+
+  EXPECT_EQ(resp.result(), http::status::created);
+  EXPECT_EQ(files, 1);
+  EXPECT_EQ(field, "holidays");
+  EXPECT_TRUE(content == file);
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "common.hpp"
+#include "object_pool.hpp"
+
+namespace {
+
+struct counted {
+  counted() { alive++; }
+  ~counted() { alive--; }
+
+  static inline int alive = 0;
+};
+
+}  // namespace
+
+TEST(ObjectPoolTest, ReusesReleasedObjects) {
+  eagle::object_pool<counted> pool{1};
+  EXPECT_EQ(pool.acquire(), nullptr);
+
+  auto* first = new counted;
+  auto* second = new counted;
+  pool.release(first);
+  // Over capacity, deleted right away
+  pool.release(second);
+  EXPECT_EQ(counted::alive, 1);
+  EXPECT_EQ(pool.size(), 1);
+
+  EXPECT_EQ(pool.acquire(), first);
+  EXPECT_EQ(pool.acquire(), nullptr);
+  delete first;
+}
+
+TEST(ObjectPoolTest, ClosedPoolDeletes) {
+  eagle::object_pool<counted> pool;
+  pool.release(new counted);
+  pool.close();
+  EXPECT_EQ(counted::alive, 0);
+
+  pool.release(new counted);
+  EXPECT_EQ(counted::alive, 0);
+  EXPECT_EQ(pool.acquire(), nullptr);
+}
+
+TEST(ObjectPoolTest, BlockCacheRecyclesBlocks) {
+  eagle::block_cache cache;
+  auto* block = cache.allocate(48);
+  cache.deallocate(block, 48);
+  EXPECT_EQ(cache.allocate(48), block);
+
+  // Other sizes are not cached
+  auto* other = cache.allocate(96);
+  cache.deallocate(other, 96);
+  cache.deallocate(block, 48);
+  EXPECT_EQ(cache.allocate(48), block);
+  cache.deallocate(block, 48);
+}
+
+TEST(ObjectPoolTest, SharedPointerControlBlocks) {
+  eagle::block_cache cache;
+  eagle::recycling_allocator<counted> allocator{cache};
+  auto deleter = [](counted* c) { delete c; };
+
+  auto first = std::shared_ptr<counted>(new counted, deleter, allocator);
+  EXPECT_EQ(cache.size(), 0);
+  first.reset();
+  // The control block went back to the cache, the next one is drawn from it
+  EXPECT_EQ(cache.size(), 1);
+  auto second = std::shared_ptr<counted>(new counted, deleter, allocator);
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(counted::alive, 1);
+}
+
+TEST(ObjectPoolTest, HandlerMemoryServesAsioOperations) {
+  eagle::handler_memory memory;
+  net::io_context ioc;
+  net::steady_timer timer{ioc};
+
+  bool called = false;
+  timer.expires_after(std::chrono::milliseconds(0));
+  timer.async_wait(eagle::bind_handler_memory(
+      memory, [&called](beast::error_code) { called = true; }));
+  ioc.run();
+  EXPECT_TRUE(called);
+
+  // The operation was released, its slot is free again
+  auto* first = memory.allocate(64);
+  auto* second = memory.allocate(64);
+  EXPECT_NE(first, second);
+  memory.deallocate(second);
+  memory.deallocate(first);
+  EXPECT_EQ(memory.allocate(64), first);
+  memory.deallocate(first);
+}
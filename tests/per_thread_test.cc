@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "dispatcher.hpp"
+#include "per_thread.hpp"
+
+namespace {
+
+struct hit_counter {
+  bool get(const eagle::request&, eagle::response& resp) {
+    hits_.store(hits_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    resp.html() << hits_.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  std::atomic<size_t> hits_{0};
+};
+
+size_t total_hits(const eagle::per_thread<hit_counter>& counters) {
+  return counters.aggregate(size_t{0}, [](size_t total, const auto& counter) {
+    return total + counter.hits_.load(std::memory_order_relaxed);
+  });
+}
+
+}  // namespace
+
+TEST(PerThreadTest, OneInstancePerThread) {
+  std::atomic<int> made{0};
+  eagle::per_thread<int> values{[&made] { return ++made; }};
+  EXPECT_EQ(values.size(), 0);
+
+  auto& local = values.local();
+  EXPECT_EQ(local, 1);
+  EXPECT_EQ(&values.local(), &local);
+
+  // Copies share the instances
+  auto copy = values;
+  int other = 0;
+  std::thread([&] { other = copy.local(); }).join();
+  EXPECT_EQ(other, 2);
+  EXPECT_EQ(&copy.local(), &local);
+  EXPECT_EQ(values.size(), 2);
+  EXPECT_EQ(values.aggregate(0, [](int sum, int value) { return sum + value; }),
+            3);
+}
+
+TEST(PerThreadTest, DistinctObjectsHaveDistinctSlots) {
+  eagle::per_thread first{[] { return 1; }};
+  eagle::per_thread second{[] { return 2; }};
+  EXPECT_EQ(first.local(), 1);
+  EXPECT_EQ(second.local(), 2);
+}
+
+TEST(PerThreadTest, DispatchesToTheInstanceOfTheThread) {
+  eagle::dispatcher dispatcher;
+  eagle::per_thread counters{[] { return hit_counter{}; }};
+  ASSERT_TRUE(dispatcher.add_per_thread_handler("/hits", counters));
+
+  auto serve = [&dispatcher](size_t requests) {
+    for (size_t idx = 0; idx < requests; idx++) {
+      eagle::request req;
+      req.method(http::verb::get);
+      req.target("/hits");
+      eagle::response resp;
+      dispatcher.dispatch(req, resp);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t idx = 0; idx < 4; idx++) {
+    threads.emplace_back(serve, 100);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(counters.size(), 4);
+  EXPECT_EQ(total_hits(counters), 400);
+  counters.for_each([](const hit_counter& counter) {
+    EXPECT_EQ(counter.hits_.load(std::memory_order_relaxed), 100);
+  });
+
+  // Methods the handler lacks are still answered 405
+  eagle::request req;
+  req.method(http::verb::post);
+  req.target("/hits");
+  eagle::response resp;
+  dispatcher.dispatch(req, resp);
+  EXPECT_EQ(resp.result(), http::status::method_not_allowed);
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+#ifdef EAGLE_USDT
+
+namespace {
+
+// Serving a request instantiates every probe in this binary
+void serve_one_request() {
+  loopback_server server;
+  server.app().handle(http::verb::get, "/probed", [](const auto&, auto& resp) {
+    resp.html() << "probed";
+    return true;
+  });
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect(server.endpoint());
+  http::request<http::empty_body> req{http::verb::get, "/probed", 11};
+  http::write(socket, req);
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  http::read(socket, buffer, resp);
+  EXPECT_EQ(resp.body(), "probed");
+}
+
+}  // namespace
+
+// The .note.stapsdt entries hold the provider and the probe name, each NUL
+// terminated, which is what bpftrace and perf list.
+TEST(ProbesTest, ProbesAreInTheBinary) {
+  serve_one_request();
+
+  std::ifstream exe{"/proc/self/exe", std::ios::binary};
+  std::string binary{std::istreambuf_iterator<char>(exe), {}};
+  ASSERT_FALSE(binary.empty());
+
+  for (std::string probe :
+       {"connection_accepted", "request_parsed", "route_resolved",
+        "handler_entered", "handler_exited", "response_written",
+        "connection_closed"}) {
+    auto note = std::string("eagle") + '\0' + probe + '\0';
+    EXPECT_NE(binary.find(note), std::string::npos) << probe;
+  }
+}
+
+#else
+
+TEST(ProbesTest, ProbesAreInTheBinary) {
+  GTEST_SKIP() << "Built without the usdt option";
+}
+
+#endif
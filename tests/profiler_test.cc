@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+class profiled_server {
+ public:
+  profiled_server() {
+    auto& app = server_.app();
+    app.profiler();
+    app.handle(http::verb::get, "/spin/{integer:n}", [](const auto&,
+                                                        auto& resp) {
+      // Burns CPU, which is what SIGPROF samples
+      auto until = std::chrono::steady_clock::now() + 400ms;
+      volatile uint64_t sum = 0;
+      while (std::chrono::steady_clock::now() < until) {
+        sum = sum + 1;
+      }
+      resp.html() << "spun";
+      return true;
+    });
+    server_.start();
+  }
+
+  tcp::socket send(std::string_view target) {
+    tcp::socket socket{ioc_};
+    socket.connect(server_.endpoint());
+    http::request<http::empty_body> req{
+        http::verb::get, beast::string_view{target.data(), target.size()}, 11};
+    http::write(socket, req);
+    return socket;
+  }
+
+  static http::response<http::string_body> receive(tcp::socket& socket) {
+    beast::flat_buffer buffer;
+    http::response<http::string_body> resp;
+    http::read(socket, buffer, resp);
+    return resp;
+  }
+
+ private:
+  net::io_context ioc_;
+  loopback_server server_;
+};
+
+}  // namespace
+
+TEST(ProfilerTest, ReturnsFoldedStacksTaggedWithTheRoute) {
+  profiled_server server;
+
+  auto profile = server.send("/debug/pprof/profile?seconds=1");
+  // Only one profile at a time
+  std::this_thread::sleep_for(50ms);
+  auto second = server.send("/debug/pprof/profile?seconds=1");
+  EXPECT_EQ(server.receive(second).result(), http::status::conflict);
+
+  auto spin = server.send("/spin/1");
+  EXPECT_EQ(server.receive(spin).body(), "spun");
+
+  auto resp = server.receive(profile);
+  ASSERT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp[http::field::content_type], "text/plain");
+
+  // "/spin/{integer:n};outer;...;inner count" lines
+  const auto& folded = resp.body();
+  EXPECT_EQ(folded.back(), '\n');
+  EXPECT_EQ(folded.find("/spin/1"), std::string::npos);
+
+  constexpr std::string_view tag = "/spin/{integer:n};";
+  size_t spin_samples = 0;
+  for (size_t pos = folded.find(tag); pos != std::string::npos;
+       pos = folded.find(tag, pos + 1)) {
+    auto line_end = folded.find('\n', pos);
+    auto space = folded.rfind(' ', line_end);
+    spin_samples += std::stoul(folded.substr(space + 1, line_end - space - 1));
+  }
+  // 400ms at 99Hz, give or take the scheduler
+  EXPECT_GT(spin_samples, 10);
+
+  EXPECT_FALSE(eagle::sampling_profiler::instance().running());
+}
+
+TEST(ProfilerTest, RejectsInvalidRequests) {
+  profiled_server server;
+
+  for (auto target : {"/debug/pprof/profile?seconds=0",
+                      "/debug/pprof/profile?seconds=61",
+                      "/debug/pprof/profile?seconds=ten"}) {
+    auto socket = server.send(target);
+    EXPECT_EQ(server.receive(socket).result(), http::status::bad_request)
+        << target;
+  }
+
+  auto below = server.send("/debug/pprof/profile/heap");
+  EXPECT_EQ(server.receive(below).result(), http::status::not_found);
+  EXPECT_FALSE(eagle::sampling_profiler::instance().running());
+}
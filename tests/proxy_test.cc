@@ -0,0 +1,267 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <list>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Keep-alive HTTP server answering "<name> <method> <target> <body>", a
+// megabyte on /big, late on /slow and after a 100 Continue on /continue.
+class backend {
+ public:
+  explicit backend(std::string name) : name_(std::move(name)) {
+    acceptor_.open(tcp::v4());
+    acceptor_.bind({net::ip::make_address("127.0.0.1"), 0});
+    acceptor_.listen();
+    thread_ = std::thread([this] { accept_(); });
+  }
+
+  ~backend() {
+    ::shutdown(acceptor_.native_handle(), SHUT_RDWR);
+    thread_.join();
+    for (auto& thread : connections_threads_) {
+      thread.join();
+    }
+  }
+
+  std::string address() const {
+    return "127.0.0.1:" + std::to_string(acceptor_.local_endpoint().port());
+  }
+
+  std::atomic<int> connections_{0};
+
+ private:
+  void accept_() {
+    while (true) {
+      beast::error_code ec;
+      auto socket = acceptor_.accept(ec);
+      if (ec) {
+        return;
+      }
+
+      connections_++;
+      connections_threads_.emplace_back(
+          [this, socket = std::move(socket)]() mutable { serve_(socket); });
+    }
+  }
+
+  void serve_(tcp::socket& socket) {
+    beast::flat_buffer buffer;
+    while (true) {
+      http::request<http::string_body> req;
+      beast::error_code ec;
+      http::read(socket, buffer, req, ec);
+      if (ec) {
+        return;
+      }
+
+      if (req.target() == "/continue") {
+        http::response<http::empty_body> interim{http::status::continue_, 11};
+        http::write(socket, interim, ec);
+      }
+
+      http::response<http::string_body> resp{http::status::ok, 11};
+      resp.set("X-Forwarded-For-Seen", req["X-Forwarded-For"]);
+      resp.set("X-Expect-Seen", req[http::field::expect]);
+      if (req.target() == "/big") {
+        resp.body().assign(1024 * 1024, 'x');
+      } else {
+        if (req.target() == "/slow") {
+          std::this_thread::sleep_for(300ms);
+        }
+        resp.body() = name_ + " " + std::string(req.method_string()) + " " +
+                      std::string(req.target()) + " " + req.body();
+      }
+      resp.keep_alive(true);
+      resp.prepare_payload();
+      http::write(socket, resp, ec);
+      if (ec) {
+        return;
+      }
+    }
+  }
+
+ private:
+  std::string name_;
+  net::io_context ioc_;
+  tcp::acceptor acceptor_{ioc_};
+  std::thread thread_;
+  std::list<std::thread> connections_threads_;
+};
+
+class proxy_server {
+ public:
+  explicit proxy_server(eagle::proxy_options options) {
+    auto& app = server_.app();
+    app.proxy("/legacy", std::move(options));
+    app.handle(http::verb::get, "/legacy/local", [](const auto&, auto& resp) {
+      resp.html() << "local";
+      return true;
+    });
+    server_.start();
+  }
+
+  http::response<http::string_body> fetch(http::verb method,
+                                          std::string_view target,
+                                          std::string body = {},
+                                          bool expect_continue = false) {
+    net::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect(server_.endpoint());
+
+    http::request<http::string_body> req{
+        method, beast::string_view{target.data(), target.size()}, 11};
+    req.body() = std::move(body);
+    req.prepare_payload();
+    beast::flat_buffer buffer;
+    if (expect_continue) {
+      req.set(http::field::expect, "100-continue");
+      http::request_serializer<http::string_body> serializer{req};
+      http::write_header(socket, serializer);
+      http::response<http::empty_body> interim;
+      http::read(socket, buffer, interim);
+      http::write(socket, serializer);
+    } else {
+      http::write(socket, req);
+    }
+
+    http::response_parser<http::string_body> parser;
+    parser.body_limit(4 * 1024 * 1024);
+    http::read(socket, buffer, parser);
+    return parser.release();
+  }
+
+ private:
+  loopback_server server_;
+};
+
+eagle::proxy_options options_for(std::vector<std::string> upstreams) {
+  eagle::proxy_options options;
+  options.upstreams_ = std::move(upstreams);
+  options.strip_prefix_ = "/legacy";
+  return options;
+}
+
+}  // namespace
+
+TEST(ProxyTest, ForwardsTheRequest) {
+  backend b1{"b1"};
+  proxy_server proxy{options_for({b1.address()})};
+
+  auto resp = proxy.fetch(http::verb::post, "/legacy/users?page=2", "ada");
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp.body(), "b1 POST /users?page=2 ada");
+  EXPECT_EQ(resp["X-Forwarded-For-Seen"], "127.0.0.1");
+
+  // Routes of the app take precedence over the prefix
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy/local").body(), "local");
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacyx").result(),
+            http::status::not_found);
+}
+
+TEST(ProxyTest, RelaysTheFinalAnswerOnly) {
+  backend b1{"b1"};
+  proxy_server proxy{options_for({b1.address()})};
+
+  // The body is read before forwarding, the upstream isn't asked to wait
+  // for it, and its interim 100 Continue is skipped
+  auto resp =
+      proxy.fetch(http::verb::post, "/legacy/continue", "ada", true);
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_EQ(resp.body(), "b1 POST /continue ada");
+  EXPECT_EQ(resp["X-Expect-Seen"], "");
+}
+
+TEST(ProxyTest, ReusesUpstreamConnections) {
+  backend b1{"b1"};
+  proxy_server proxy{options_for({b1.address()})};
+
+  for (int idx = 0; idx < 3; idx++) {
+    EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy/").body(), "b1 GET / ");
+  }
+  EXPECT_EQ(b1.connections_, 1);
+}
+
+TEST(ProxyTest, RoundRobin) {
+  backend b1{"b1"};
+  backend b2{"b2"};
+  proxy_server proxy{options_for({b1.address(), b2.address()})};
+
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy").body(), "b1 GET / ");
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy").body(), "b2 GET / ");
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy").body(), "b1 GET / ");
+}
+
+TEST(ProxyTest, StreamsTheResponseBody) {
+  backend b1{"b1"};
+  proxy_server proxy{options_for({b1.address()})};
+
+  auto resp = proxy.fetch(http::verb::get, "/legacy/big");
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_TRUE(resp.chunked());
+  EXPECT_EQ(resp.body(), std::string(1024 * 1024, 'x'));
+}
+
+TEST(ProxyTest, Timeout) {
+  backend b1{"b1"};
+  auto options = options_for({b1.address()});
+  options.response_timeout_ = 100ms;
+  proxy_server proxy{std::move(options)};
+
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy/slow").result(),
+            http::status::gateway_timeout);
+}
+
+TEST(ProxyTest, CircuitBreaker) {
+  uint16_t port;
+  ::close(listen_on_loopback(port));
+
+  auto options = options_for({"127.0.0.1:" + std::to_string(port)});
+  options.failure_threshold_ = 2;
+  proxy_server proxy{std::move(options)};
+
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy").result(),
+            http::status::bad_gateway);
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy").result(),
+            http::status::bad_gateway);
+  // Open: not even tried
+  EXPECT_EQ(proxy.fetch(http::verb::get, "/legacy").result(),
+            http::status::service_unavailable);
+}
+
+TEST(ProxyTest, ThreadsShareTheCircuitBreakers) {
+  eagle::proxy_config config;
+  config.options_.failure_threshold_ = 2;
+  config.endpoints_.resize(1);
+  config.breakers_ = std::make_unique<eagle::circuit_breaker[]>(1);
+  auto shared = std::make_shared<const eagle::proxy_config>(std::move(config));
+  eagle::upstream_pool first{shared};
+  eagle::upstream_pool second{shared};
+
+  first.failed(*first.pick());
+  second.failed(*second.pick());
+  EXPECT_EQ(first.pick(), nullptr);
+  EXPECT_EQ(second.pick(), nullptr);
+}
+
+TEST(ProxyTest, LeastOutstanding) {
+  eagle::proxy_config config;
+  config.options_.balancing_ = eagle::load_balancing::least_outstanding;
+  config.endpoints_.resize(2);
+  config.breakers_ = std::make_unique<eagle::circuit_breaker[]>(2);
+  eagle::upstream_pool pool{
+      std::make_shared<const eagle::proxy_config>(std::move(config))};
+
+  auto* first = pool.pick();
+  first->outstanding_++;
+  auto* second = pool.pick();
+  EXPECT_NE(first, second);
+  second->outstanding_ += 2;
+  EXPECT_EQ(pool.pick(), first);
+}
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include "dispatcher.hpp"
+#include "rate_limiter.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+eagle::rate_limit_options options_for(double rate, double burst) {
+  eagle::rate_limit_options options;
+  options.rate_ = rate;
+  options.burst_ = burst;
+  options.eviction_interval_ = 0s;
+  return options;
+}
+
+}  // namespace
+
+TEST(RateLimiterTest, AllowsBurstThenLimits) {
+  eagle::rate_limiter limiter{options_for(10, 3)};
+  auto now = eagle::rate_limiter::clock::now();
+
+  EXPECT_TRUE(limiter.allow("client", now).allowed);
+  EXPECT_TRUE(limiter.allow("client", now).allowed);
+  EXPECT_TRUE(limiter.allow("client", now).allowed);
+
+  auto denied = limiter.allow("client", now);
+  EXPECT_FALSE(denied.allowed);
+  EXPECT_EQ(denied.retry_after, 100ms);
+
+  // Other keys have their own budget
+  EXPECT_TRUE(limiter.allow("other", now).allowed);
+}
+
+TEST(RateLimiterTest, RefillsLazily) {
+  eagle::rate_limiter limiter{options_for(10, 1)};
+  auto now = eagle::rate_limiter::clock::now();
+
+  EXPECT_TRUE(limiter.allow("client", now).allowed);
+  EXPECT_FALSE(limiter.allow("client", now + 50ms).allowed);
+  EXPECT_TRUE(limiter.allow("client", now + 100ms).allowed);
+}
+
+TEST(RateLimiterTest, EvictsIdleKeys) {
+  auto options = options_for(10, 1);
+  options.idle_timeout_ = 1s;
+  eagle::rate_limiter limiter{options};
+  auto now = eagle::rate_limiter::clock::now();
+
+  for (int idx = 0; idx < 1000; idx++) {
+    limiter.allow("client-" + std::to_string(idx), now);
+  }
+  limiter.allow("active", now + 5s);
+  EXPECT_EQ(limiter.size(), 1001);
+
+  EXPECT_EQ(limiter.evict_idle(now + 5s), 1000);
+  EXPECT_EQ(limiter.size(), 1);
+  EXPECT_FALSE(limiter.allow("active", now + 5s).allowed);
+}
+
+TEST(RateLimiterTest, KeepsTheKeysAroundTheEvictedOnes) {
+  auto options = options_for(10, 1);
+  options.idle_timeout_ = 1s;
+  options.shards_ = 1;
+  eagle::rate_limiter limiter{options};
+  auto now = eagle::rate_limiter::clock::now();
+
+  // Interleaved in the clusters of the table
+  for (int idx = 0; idx < 3000; idx++) {
+    limiter.allow("client-" + std::to_string(idx),
+                  idx % 3 ? now : now + 5s);
+  }
+
+  EXPECT_EQ(limiter.evict_idle(now + 5s), 2000);
+  EXPECT_EQ(limiter.size(), 1000);
+  for (int idx = 0; idx < 3000; idx++) {
+    // The survivors spent their budget, the evicted keys start afresh
+    EXPECT_EQ(limiter.allow("client-" + std::to_string(idx), now + 5s).allowed,
+              idx % 3 != 0);
+  }
+}
+
+TEST(RateLimiterTest, RejectsANullRate) {
+  EXPECT_THROW(eagle::rate_limiter{options_for(0, 1)}, std::invalid_argument);
+}
+
+TEST(RateLimiterTest, InterceptorAnswersTooManyRequests) {
+  auto limiter =
+      std::make_shared<eagle::rate_limiter>(options_for(1, 1));
+
+  eagle::dispatcher dispatcher;
+  dispatcher.add_interceptor(
+      eagle::intercept_policy_before::value,
+      eagle::rate_limit(limiter, eagle::rate_limit_key::header("X-Api-Key")));
+
+  size_t calls = 0;
+  dispatcher.add_handler(http::verb::get, "/endpoint",
+                         [&calls](const auto&, auto&) {
+                           calls++;
+                           return true;
+                         });
+
+  auto dispatch = [&dispatcher](std::string_view api_key,
+                                std::string* retry_after = nullptr) {
+    eagle::request req;
+    req.method(http::verb::get);
+    req.target("/endpoint");
+    req.buffer().set("X-Api-Key",
+                     beast::string_view{api_key.data(), api_key.size()});
+
+    eagle::response resp;
+    dispatcher.dispatch(req, resp);
+    if (retry_after) {
+      *retry_after = std::string(resp.buffer()[http::field::retry_after]);
+    }
+    return resp.result();
+  };
+
+  EXPECT_EQ(dispatch("key"), http::status::ok);
+
+  std::string retry_after;
+  EXPECT_EQ(dispatch("key", &retry_after), http::status::too_many_requests);
+  EXPECT_EQ(retry_after, "1");
+  EXPECT_EQ(calls, 1);
+
+  EXPECT_EQ(dispatch("other-key"), http::status::ok);
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(RateLimiterTest, RouteKeySharesTheBudgetOfARoute) {
+  auto limiter =
+      std::make_shared<eagle::rate_limiter>(options_for(1, 1));
+
+  eagle::dispatcher dispatcher;
+  dispatcher.add_interceptor(
+      eagle::intercept_policy_before::value,
+      eagle::rate_limit(limiter, eagle::rate_limit_key::route(dispatcher)));
+  dispatcher.add_handler(http::verb::get, "/users/{integer:id}",
+                         [](const auto&, auto&) { return true; });
+
+  auto dispatch = [&dispatcher](std::string_view target) {
+    eagle::request req;
+    req.method(http::verb::get);
+    req.target(std::string_view(target));
+
+    eagle::response resp;
+    dispatcher.dispatch(req, resp);
+    return resp.result();
+  };
+
+  EXPECT_EQ(dispatch("/users/1"), http::status::ok);
+  EXPECT_EQ(dispatch("/users/2?page=2"), http::status::too_many_requests);
+
+  // Unrouted, keyed by their path
+  EXPECT_EQ(dispatch("/other"), http::status::not_found);
+  EXPECT_EQ(dispatch("/other?page=2"), http::status::too_many_requests);
+}
@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+
+#include "request.hpp"
+
+TEST(RequestTest, PeerIsFormattedFromTheAddress) {
+  eagle::request req;
+  EXPECT_EQ(req.peer(), "");
+
+  req.peer(boost::asio::ip::make_address("192.168.1.20"));
+  EXPECT_EQ(req.peer(), "192.168.1.20");
+
+  req.peer(boost::asio::ip::make_address("2001:db8::1"));
+  EXPECT_EQ(req.peer(), "2001:db8::1");
+  EXPECT_TRUE(req.peer_address().is_v6());
+}
+
+TEST(RequestTest, PeerCanBeSetAsText) {
+  eagle::request req;
+  req.peer(boost::asio::ip::make_address("10.0.0.1"));
+
+  std::string text = "localhost";
+  req.peer(text);
+  text = "changed";
+  EXPECT_EQ(req.peer(), "localhost");
+}
+
+TEST(RequestTest, Reset) {
+  eagle::request req;
+  req.peer(boost::asio::ip::make_address("10.0.0.1"));
+  req.target("/path");
+  req.method(http::verb::post);
+  req.buffer().set(http::field::host, "localhost");
+  beast::ostream(req.buffer().body()) << std::string(4096, 'a');
+
+  req.reset();
+  EXPECT_EQ(req.peer(), "");
+  EXPECT_EQ(req.target(), "");
+  EXPECT_EQ(req.method(), http::verb::unknown);
+  EXPECT_EQ(req.header(http::field::host), "");
+  EXPECT_EQ(req.body_size(), 0);
+  // The body keeps its storage for the next request
+  EXPECT_GE(req.buffer().body().capacity(), 4096);
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "app.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+std::string get(uint16_t port, std::string_view target) {
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect({net::ip::make_address("127.0.0.1"), port});
+
+  http::request<http::empty_body> req{
+      http::verb::get, beast::string_view{target.data(), target.size()}, 11};
+  http::write(socket, req);
+
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  beast::error_code ec;
+  http::read(socket, buffer, resp, ec);
+  return resp.body();
+}
+
+}  // namespace
+
+TEST(ShardTest, SingleShardByDefault) {
+  eagle::app app;
+  auto stats = app.shard_stats();
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats.front().accepted_, 0);
+}
+
+TEST(ShardTest, ShardsShareTheListeningPort) {
+  // The other shards bind the adopted listener's port, it needs SO_REUSEPORT
+  net::io_context ioc;
+  tcp::acceptor listener{ioc};
+  listener.open(tcp::v4());
+  listener.set_option(
+      net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+  listener.bind({net::ip::make_address("127.0.0.1"), 0});
+  listener.listen();
+  auto port = listener.local_endpoint().port();
+
+  eagle::app app;
+  app.handle(http::verb::get, "/shard", [](const auto&, auto& resp) {
+    resp.html() << "ok";
+    return true;
+  });
+  ASSERT_TRUE(app.adopt(listener.release()));
+
+  eagle::option options;
+  options.shard_per_core_ = true;
+  options.shards_ = 2;
+  std::thread server([&] { app.start(options); });
+
+  const size_t requests = 64;
+  for (size_t idx = 0; idx < requests; idx++) {
+    EXPECT_EQ(get(port, "/shard"), "ok");
+  }
+
+  app.drain(1s);
+  server.join();
+
+  auto stats = app.shard_stats();
+  ASSERT_EQ(stats.size(), 2);
+  EXPECT_EQ(stats[0].accepted_ + stats[1].accepted_, requests);
+  // The kernel hashes the connections over both acceptors
+  EXPECT_GT(stats[0].accepted_, 0);
+  EXPECT_GT(stats[1].accepted_, 0);
+  EXPECT_EQ(app.active_connections(), 0);
+}
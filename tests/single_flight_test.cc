@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <list>
+#include <set>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+#include "single_flight.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Answers "<call> <target>" after `delay`, with `status`
+struct slow_handler {
+  std::shared_ptr<std::atomic<int>> calls_;
+  std::chrono::milliseconds delay_;
+  http::status status_{http::status::ok};
+
+  bool operator()(const eagle::request& req, eagle::response& resp) {
+    auto call = ++*calls_;
+    auto completion = resp.defer();
+    auto timer = std::make_shared<net::steady_timer>(req.executor(), delay_);
+    timer->async_wait([timer, completion, call, status = status_,
+                       target = std::string(req.target()),
+                       &resp](beast::error_code) {
+      resp.result(status);
+      resp.html() << call << " " << target;
+      completion->complete();
+    });
+    return true;
+  }
+};
+
+class server {
+ public:
+  template <typename Handler>
+  explicit server(Handler handler, eagle::interceptor_type after = nullptr) {
+    server_.app().handle(http::verb::get, "/{string:name}",
+                         std::move(handler));
+    if (after) {
+      server_.app().intercept<eagle::intercept_policy_after>(after);
+    }
+    server_.start();
+  }
+
+  // Sends all the requests before reading any response
+  std::vector<http::response<http::string_body>> fetch_all(
+      const std::vector<std::string>& targets) {
+    net::io_context ioc;
+    std::list<tcp::socket> sockets;
+    for (const auto& target : targets) {
+      auto& socket = sockets.emplace_back(ioc);
+      socket.connect(server_.endpoint());
+      http::request<http::empty_body> req{http::verb::get, target, 11};
+      http::write(socket, req);
+    }
+
+    std::vector<http::response<http::string_body>> responses;
+    for (auto& socket : sockets) {
+      beast::flat_buffer buffer;
+      http::read(socket, buffer, responses.emplace_back());
+    }
+    return responses;
+  }
+
+ private:
+  loopback_server server_;
+};
+
+}  // namespace
+
+TEST(SingleFlightTest, CoalescesIdenticalRequests) {
+  auto calls = std::make_shared<std::atomic<int>>(0);
+  server srv{eagle::single_flight(slow_handler{calls, 200ms})};
+
+  auto responses = srv.fetch_all({"/a", "/a", "/a", "/b"});
+  EXPECT_EQ(*calls, 2);
+  for (int idx = 0; idx < 3; idx++) {
+    EXPECT_EQ(responses[idx].result(), http::status::ok);
+    EXPECT_EQ(responses[idx].body(), "1 /a");
+  }
+  EXPECT_EQ(responses[3].body(), "2 /b");
+
+  // Once answered, the same request runs again
+  EXPECT_EQ(srv.fetch_all({"/a"})[0].body(), "3 /a");
+}
+
+TEST(SingleFlightTest, WaitersKeepTheirOwnHeaders) {
+  auto calls = std::make_shared<std::atomic<int>>(0);
+  auto tagged = std::make_shared<std::atomic<int>>(0);
+  server srv{eagle::single_flight(slow_handler{calls, 200ms}),
+             [tagged](const auto&, auto& resp) {
+               auto tag = std::to_string(++*tagged);
+               resp.set("X-Request-Id", tag);
+               resp.insert("Set-Cookie", "session=" + tag);
+               resp.set(http::field::cache_control, "max-age=60");
+             }};
+
+  auto responses = srv.fetch_all({"/a", "/a", "/a"});
+  EXPECT_EQ(*calls, 1);
+  std::set<std::string> ids;
+  for (auto& resp : responses) {
+    EXPECT_EQ(resp.body(), "1 /a");
+    EXPECT_EQ(resp[http::field::content_type], "text/html");
+    EXPECT_EQ(resp[http::field::cache_control], "max-age=60");
+    EXPECT_EQ(resp.count(http::field::set_cookie), 1);
+    auto id = std::string(resp["X-Request-Id"]);
+    EXPECT_EQ(resp["Set-Cookie"], "session=" + id);
+    ids.insert(id);
+  }
+  EXPECT_EQ(ids.size(), 3);
+}
+
+TEST(SingleFlightTest, DoesNotShareErrors) {
+  auto calls = std::make_shared<std::atomic<int>>(0);
+  server srv{eagle::single_flight(
+      slow_handler{calls, 100ms, http::status::service_unavailable})};
+
+  auto responses = srv.fetch_all({"/a", "/a", "/a"});
+  EXPECT_EQ(*calls, 3);
+  for (auto& resp : responses) {
+    EXPECT_EQ(resp.result(), http::status::service_unavailable);
+  }
+  EXPECT_EQ(responses[0].body(), "1 /a");
+}
+
+TEST(SingleFlightTest, WaitersTimeOut) {
+  auto calls = std::make_shared<std::atomic<int>>(0);
+  eagle::single_flight_options options;
+  options.timeout_ = 50ms;
+  server srv{eagle::single_flight(slow_handler{calls, 300ms}, options)};
+
+  auto responses = srv.fetch_all({"/a", "/a"});
+  EXPECT_EQ(*calls, 2);
+  EXPECT_EQ(responses[0].body(), "1 /a");
+  EXPECT_EQ(responses[1].body(), "2 /a");
+}
+
+TEST(SingleFlightTest, WaitersDoNotWaitForAnUnpreparedResponse) {
+  net::io_context ioc;
+  auto calls = std::make_shared<std::atomic<int>>(0);
+  auto handler = eagle::single_flight(
+      [calls](const eagle::request&, eagle::response& resp) {
+        // The first response is never completed
+        if (++*calls == 1) {
+          resp.defer();
+        } else {
+          resp.html() << "answered";
+        }
+        return true;
+      });
+
+  eagle::request first_req;
+  eagle::request second_req;
+  for (auto* req : {&first_req, &second_req}) {
+    req->method(http::verb::get);
+    req->target("/a");
+    req->executor(ioc.get_executor());
+  }
+
+  eagle::response first;
+  eagle::response second;
+  handler(first_req, first);
+  handler(second_req, second);
+  ASSERT_TRUE(second.deferred());
+  bool completed = false;
+  second.deferred()->on_complete([&completed] { completed = true; });
+
+  // e.g. its connection went away
+  first.reset();
+  auto start = std::chrono::steady_clock::now();
+  ioc.run();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 1s);
+  EXPECT_TRUE(completed);
+  EXPECT_EQ(*calls, 2);
+}
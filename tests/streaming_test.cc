@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+#include "sse.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+class streaming_server : public loopback_server {
+ public:
+  tcp::socket get(std::string_view target) {
+    tcp::socket socket{ioc_};
+    socket.connect(endpoint());
+
+    http::request<http::empty_body> req{
+        http::verb::get, beast::string_view{target.data(), target.size()}, 11};
+    http::write(socket, req);
+    return socket;
+  }
+
+ private:
+  net::io_context ioc_;
+};
+
+// Reads from `socket` until `expected` shows up in what was received
+std::string read_until(tcp::socket& socket, std::string_view expected) {
+  std::string received;
+  char buffer[4096];
+  while (received.find(expected) == std::string::npos) {
+    beast::error_code ec;
+    auto bytes = socket.read_some(net::buffer(buffer), ec);
+    if (ec) {
+      break;
+    }
+    received.append(buffer, bytes);
+  }
+
+  return received;
+}
+
+}  // namespace
+
+TEST(StreamingTest, GeneratorStream) {
+  int produced = 0;
+  eagle::generator_stream stream([&produced](std::string& chunk) {
+    chunk = "chunk" + std::to_string(produced);
+    return ++produced < 2;
+  });
+
+  std::string chunk;
+  EXPECT_EQ(stream.next(chunk), eagle::response_stream::status::ready);
+  EXPECT_EQ(chunk, "chunk0");
+  EXPECT_EQ(stream.next(chunk), eagle::response_stream::status::ready);
+  EXPECT_EQ(chunk, "chunk1");
+  EXPECT_EQ(stream.next(chunk), eagle::response_stream::status::done);
+}
+
+TEST(StreamingTest, StreamIsAWriter) {
+  eagle::response resp;
+  resp.stream([](std::string&) { return false; });
+
+  EXPECT_EQ(resp.writer_type(), eagle::writer_type::kstream);
+  EXPECT_THROW(resp.html(), eagle::invalid_writer_operation);
+
+  resp.prepare_response();
+  EXPECT_TRUE(resp.buffer().chunked());
+}
+
+TEST(StreamingTest, ChunkedResponse) {
+  streaming_server server;
+  server.app().handle(http::verb::get, "/export", [](const auto&, auto& resp) {
+    auto row = std::make_shared<int>(0);
+    resp.stream([row](std::string& chunk) {
+      chunk = "row " + std::to_string(*row) + "\n";
+      return ++*row < 1000;
+    });
+    return true;
+  });
+  server.start();
+
+  auto socket = server.get("/export");
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  http::read(socket, buffer, resp);
+
+  EXPECT_EQ(resp.result(), http::status::ok);
+  EXPECT_TRUE(resp.chunked());
+  EXPECT_EQ(resp.body().find("row 0\nrow 1\n"), 0);
+  EXPECT_NE(resp.body().find("row 999\n"), std::string::npos);
+}
+
+TEST(StreamingTest, ServerSentEvents) {
+  streaming_server server;
+  std::promise<std::shared_ptr<eagle::sse_channel>> opened;
+  server.app().handle(http::verb::get, "/events", [&](const auto&, auto& resp) {
+    opened.set_value(eagle::event_stream(resp));
+    return true;
+  });
+  server.start();
+
+  auto socket = server.get("/events");
+  auto channel = opened.get_future().get();
+
+  EXPECT_TRUE(channel->send("first\nsecond", "update", "1"));
+  auto received = read_until(socket, "\n\n");
+  EXPECT_NE(received.find("Content-Type: text/event-stream"),
+            std::string::npos);
+  EXPECT_NE(received.find("Transfer-Encoding: chunked"), std::string::npos);
+  EXPECT_NE(
+      received.find("event: update\nid: 1\ndata: first\ndata: second\n\n"),
+      std::string::npos);
+
+  channel->close();
+  received = read_until(socket, "0\r\n\r\n");
+  EXPECT_NE(received.find("0\r\n\r\n"), std::string::npos);
+  EXPECT_FALSE(channel->send("late"));
+}
+
+TEST(StreamingTest, ServerSentEventsSplitEveryLineBreak) {
+  eagle::sse_channel channel;
+  EXPECT_TRUE(channel.send("cr\rlf\ncrlf\r\nlast"));
+  EXPECT_TRUE(channel.comment("one\r\ntwo"));
+
+  std::string chunk;
+  EXPECT_EQ(channel.next(chunk), eagle::response_stream::status::ready);
+  EXPECT_EQ(chunk,
+            "data: cr\ndata: lf\ndata: crlf\ndata: last\n\n"
+            ": one\n: two\n\n");
+}
+
+TEST(StreamingTest, ServerSentEventsRejectMultilineFields) {
+  eagle::sse_channel channel;
+  EXPECT_FALSE(channel.send("data", "update\ndata: injected"));
+  EXPECT_FALSE(channel.send("data", "update", "1\r"));
+  EXPECT_TRUE(channel.send("data", "update", "1"));
+
+  std::string chunk;
+  EXPECT_EQ(channel.next(chunk), eagle::response_stream::status::ready);
+  EXPECT_EQ(chunk, "event: update\nid: 1\ndata: data\n\n");
+}
+
+TEST(StreamingTest, HeartbeatDetectsClosedClients) {
+  streaming_server server;
+  std::promise<std::shared_ptr<eagle::sse_channel>> opened;
+  server.app().handle(http::verb::get, "/events", [&](const auto&, auto& resp) {
+    eagle::sse_options options;
+    options.heartbeat_ = 20ms;
+    opened.set_value(eagle::event_stream(resp, options));
+    return true;
+  });
+  server.start();
+
+  auto socket = server.get("/events");
+  auto channel = opened.get_future().get();
+  EXPECT_NE(read_until(socket, ":\n\n").find(":\n\n"), std::string::npos);
+
+  socket.close();
+  auto deadline = std::chrono::steady_clock::now() + 5s;
+  while (!channel->closed() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(5ms);
+  }
+  EXPECT_TRUE(channel->closed());
+  EXPECT_FALSE(channel->send("nobody listens"));
+}
@@ -3,6 +3,11 @@
 
 #include <gmock/gmock.h>
 
+#include <chrono>
+#include <thread>
+
+#include "app.hpp"
+
 class HandlerMock : public eagle::handler_type {
  public:
   MOCK_METHOD(bool, get, (const eagle::request&, eagle::response&), (override));
@@ -14,4 +19,46 @@ class HandlerMock : public eagle::handler_type {
   MOCK_METHOD(bool, del, (const eagle::request&, eagle::response&), (override));
 };
 
+/// A listening socket on a free port of 127.0.0.1.
+inline int listen_on_loopback(uint16_t& port) {
+  net::io_context ioc;
+  tcp::acceptor acceptor{ioc, {net::ip::make_address("127.0.0.1"), 0}};
+  port = acceptor.local_endpoint().port();
+  return acceptor.release();
+}
+
+/// Runs an app on a loopback port, on a thread of its own, from start()
+/// until it is destroyed.
+class loopback_server {
+ public:
+  loopback_server() { app_.adopt(listen_on_loopback(port_)); }
+
+  ~loopback_server() {
+    if (thread_.joinable()) {
+      app_.drain(std::chrono::milliseconds(100));
+      thread_.join();
+    }
+  }
+
+  loopback_server(const loopback_server&) = delete;
+  loopback_server& operator=(const loopback_server&) = delete;
+
+  eagle::app<>& app() { return app_; }
+
+  void start() {
+    thread_ = std::thread([this] { app_.start(); });
+  }
+
+  uint16_t port() const { return port_; }
+
+  tcp::endpoint endpoint() const {
+    return {net::ip::make_address("127.0.0.1"), port_};
+  }
+
+ private:
+  eagle::app<> app_;
+  uint16_t port_{0};
+  std::thread thread_;
+};
+
 #endif
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "tls_connection.hpp"
+
+namespace {
+
+// Serves every accepted connection with `ConnectionType` on a loopback port
+// until the test is over.
+template <typename ConnectionType>
+class tls_server {
+ public:
+  tls_server() {
+    context_.use_self_signed_certificate();
+    dispatcher_.add_handler(http::verb::get, "/tls",
+                            [](const auto&, auto& resp) {
+                              resp.html() << "secure";
+                              return true;
+                            });
+    accept_();
+    thread_ = std::thread([this] { ioc_.run(); });
+  }
+
+  ~tls_server() {
+    ioc_.stop();
+    thread_.join();
+  }
+
+  uint16_t port() const { return acceptor_.local_endpoint().port(); }
+
+ private:
+  void accept_() {
+    acceptor_.async_accept([this](beast::error_code ec, tcp::socket socket) {
+      if (!ec) {
+        std::make_shared<ConnectionType>(dispatcher_, std::move(socket),
+                                         context_)
+            ->handle_data();
+      }
+      accept_();
+    });
+  }
+
+ private:
+  net::io_context ioc_{1};
+  tcp::acceptor acceptor_{ioc_, {net::ip::make_address("127.0.0.1"), 0}};
+  eagle::dispatcher dispatcher_;
+  eagle::tls_context context_;
+  std::thread thread_;
+};
+
+struct client_result {
+  bool reused{false};
+  std::string alpn;
+  std::string response;
+};
+
+// Blocking OpenSSL client issuing a single GET /tls, optionally resuming
+// `session`. On return `session` holds the session to resume next time.
+client_result fetch(uint16_t port, SSL_CTX* client_ctx, SSL_SESSION*& session) {
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect({net::ip::make_address("127.0.0.1"), port});
+
+  client_result result;
+  auto ssl = SSL_new(client_ctx);
+  SSL_set_fd(ssl, static_cast<int>(socket.native_handle()));
+  if (session) {
+    SSL_set_session(ssl, session);
+  }
+
+  if (SSL_connect(ssl) == 1) {
+    std::string request = "GET /tls HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    SSL_write(ssl, request.data(), static_cast<int>(request.size()));
+
+    char buffer[1024];
+    int read = 0;
+    while ((read = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+      result.response.append(buffer, read);
+    }
+
+    const unsigned char* alpn = nullptr;
+    unsigned int alpn_length = 0;
+    SSL_get0_alpn_selected(ssl, &alpn, &alpn_length);
+    result.alpn.assign(reinterpret_cast<const char*>(alpn), alpn_length);
+    result.reused = SSL_session_reused(ssl);
+
+    if (session) {
+      SSL_SESSION_free(session);
+    }
+    session = SSL_get1_session(ssl);
+
+    // OpenSSL invalidates the sessions of connections that are not shut down
+    SSL_shutdown(ssl);
+  }
+
+  SSL_free(ssl);
+  return result;
+}
+
+template <typename ConnectionType>
+void expect_session_resumption() {
+  tls_server<ConnectionType> server;
+
+  auto client_ctx = SSL_CTX_new(TLS_client_method());
+  static const unsigned char alpn[] = "\x08http/1.1";
+  SSL_CTX_set_alpn_protos(client_ctx, alpn, sizeof(alpn) - 1);
+
+  SSL_SESSION* session = nullptr;
+  auto full = fetch(server.port(), client_ctx, session);
+  EXPECT_FALSE(full.reused);
+  EXPECT_EQ(full.alpn, "http/1.1");
+  EXPECT_NE(full.response.find("200 OK"), std::string::npos);
+  EXPECT_NE(full.response.find("secure"), std::string::npos);
+
+  auto resumed = fetch(server.port(), client_ctx, session);
+  EXPECT_TRUE(resumed.reused);
+  EXPECT_NE(resumed.response.find("secure"), std::string::npos);
+
+  SSL_SESSION_free(session);
+  SSL_CTX_free(client_ctx);
+}
+
+}  // namespace
+
+TEST(TlsConnectionTest, SelectAlpnProtocol) {
+  static const unsigned char offered[] = "\x02h2\x08http/1.1";
+  const unsigned char* out = nullptr;
+  unsigned char outlen = 0;
+
+  EXPECT_TRUE(eagle::select_alpn_protocol({"http/1.1"}, offered,
+                                          sizeof(offered) - 1, &out, &outlen));
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(out), outlen),
+            "http/1.1");
+
+  EXPECT_FALSE(eagle::select_alpn_protocol({"spdy/3"}, offered,
+                                           sizeof(offered) - 1, &out, &outlen));
+
+  // A truncated list must not be read past its end
+  EXPECT_FALSE(eagle::select_alpn_protocol({"http/1.1"}, offered, 6, &out,
+                                           &outlen));
+}
+
+TEST(TlsConnectionTest, TicketKeysSize) {
+  eagle::tls_context context;
+  EXPECT_FALSE(context.set_ticket_keys("too short"));
+  EXPECT_TRUE(
+      context.set_ticket_keys(std::string(context.ticket_keys_size(), 'k')));
+}
+
+TEST(TlsConnectionTest, SessionResumption) {
+  expect_session_resumption<eagle::tls_connection>();
+}
+
+TEST(TlsConnectionTest, KtlsSessionResumption) {
+  expect_session_resumption<eagle::ktls_connection>();
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+size_t occurrences(const std::string& text, std::string_view pattern) {
+  size_t found = 0;
+  for (auto pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    found++;
+  }
+  return found;
+}
+
+class traced_server {
+ public:
+  explicit traced_server(eagle::trace_options options)
+      : tracer_(server_.app().enable_tracing(std::move(options))) {
+    auto& app = server_.app();
+    app.handle(http::verb::get, "/fast", [](const auto&, auto& resp) {
+      resp.html() << "fast";
+      return true;
+    });
+    app.handle(http::verb::get, "/slow", [](const auto&, auto& resp) {
+      std::this_thread::sleep_for(60ms);
+      resp.html() << "slow";
+      return true;
+    });
+    server_.start();
+  }
+
+  http::response<http::string_body> fetch(std::string_view target,
+                                          std::string_view request_id = {}) {
+    net::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect(server_.endpoint());
+
+    http::request<http::empty_body> req{
+        http::verb::get, beast::string_view{target.data(), target.size()}, 11};
+    if (!request_id.empty()) {
+      req.set("X-Request-Id",
+              beast::string_view{request_id.data(), request_id.size()});
+    }
+    http::write(socket, req);
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> resp;
+    http::read(socket, buffer, resp);
+    // The trace ends before the server shuts the connection down
+    char rest;
+    beast::error_code ec;
+    socket.read_some(net::buffer(&rest, 1), ec);
+    return resp;
+  }
+
+  eagle::tracer& tracer() { return tracer_; }
+
+ private:
+  loopback_server server_;
+  eagle::tracer& tracer_;
+};
+
+}  // namespace
+
+TEST(TraceTest, ExportsThePhasesOfTheRequests) {
+  traced_server server{{}};
+
+  auto resp = server.fetch("/fast", "req-42");
+  EXPECT_EQ(resp.body(), "fast");
+  EXPECT_EQ(resp["X-Request-Id"], "req-42");
+
+  // Generated when the client sent none
+  auto generated = server.fetch("/fast");
+  EXPECT_EQ(generated["X-Request-Id"].size(), 32);
+
+  auto json = server.tracer().chrome_trace();
+  EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0);
+  EXPECT_EQ(occurrences(json, "\"name\":\"GET /fast\""), 2);
+  EXPECT_NE(json.find("\"request_id\":\"req-42\",\"status\":200"),
+            std::string::npos);
+  for (auto phase :
+       {"accept", "read_header", "route", "handler", "prepare", "write"}) {
+    EXPECT_EQ(occurrences(json, "\"name\":\"" + std::string(phase) + "\""),
+              2)
+        << phase;
+  }
+  // Before and after the handler
+  EXPECT_EQ(occurrences(json, "\"name\":\"interceptors\""), 4);
+
+  auto path = ::testing::TempDir() + "eagle_trace.json";
+  ASSERT_TRUE(server.tracer().write_chrome_trace(path));
+  std::ifstream file{path};
+  std::stringstream written;
+  written << file.rdbuf();
+  EXPECT_EQ(written.str(), json);
+  std::remove(path.c_str());
+}
+
+TEST(TraceTest, SamplesOneRequestInN) {
+  eagle::trace_options options;
+  options.sample_every_ = 2;
+  traced_server server{options};
+
+  for (int idx = 0; idx < 4; idx++) {
+    server.fetch("/fast");
+  }
+  EXPECT_EQ(occurrences(server.tracer().chrome_trace(), "GET /fast"), 2);
+}
+
+TEST(TraceTest, KeepsOnlySlowRequests) {
+  eagle::trace_options options;
+  options.slow_threshold_ = 30ms;
+  traced_server server{options};
+
+  server.fetch("/fast");
+  server.fetch("/slow");
+  server.fetch("/fast");
+
+  auto json = server.tracer().chrome_trace();
+  EXPECT_EQ(occurrences(json, "GET /fast"), 0);
+  EXPECT_EQ(occurrences(json, "GET /slow"), 1);
+}
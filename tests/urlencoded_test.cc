@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+
+#include "urlencoded.hpp"
+
+TEST(UrlencodedTest, DecodesInPlace) {
+  std::string text = "a%20b+c%2";
+  auto* end =
+      eagle::url_decode_in_place(text.data(), text.data() + text.size());
+  EXPECT_EQ(std::string_view(text.data(), end - text.data()), "a b c%2");
+}
+
+TEST(UrlencodedTest, Fields) {
+  eagle::url_form form{"name=Ada+Lovelace&lang=en%2Dgb&flag&=x&&empty="};
+
+  EXPECT_EQ(form.size(), 5);
+  EXPECT_EQ(form.get("name"), "Ada Lovelace");
+  EXPECT_EQ(form.get("lang"), "en-gb");
+  EXPECT_EQ(form.get("flag"), "");
+  EXPECT_EQ(form.get("empty"), "");
+  EXPECT_EQ(form.get(""), "x");
+  EXPECT_FALSE(form.get("missing"));
+}
+
+TEST(UrlencodedTest, RequestBody) {
+  eagle::request req;
+  std::string body = "q=eagle%21&page=2";
+  auto& request_body = req.buffer().body();
+  request_body.commit(boost::asio::buffer_copy(
+      request_body.prepare(body.size()), boost::asio::buffer(body)));
+
+  eagle::url_form form{req};
+  EXPECT_EQ(form.get("q"), "eagle!");
+  EXPECT_EQ(form.get("page"), "2");
+}
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include "request.hpp"
+#include "response.hpp"
+#include "value_encoding.hpp"
+
+namespace {
+
+template <typename Value>
+std::string encode(eagle::body_format format, const Value& value) {
+  std::stringbuf out;
+  eagle::value_encoder{format, out} << value;
+  return out.str();
+}
+
+std::string hex(const std::string& bytes) {
+  static constexpr char digits[] = "0123456789abcdef";
+  std::string text;
+  for (unsigned char c : bytes) {
+    text += digits[c >> 4];
+    text += digits[c & 0xf];
+  }
+  return text;
+}
+
+}  // namespace
+
+TEST(ValueEncodingTest, EncodesMessagePack) {
+  auto msgpack = eagle::body_format::msgpack;
+  EXPECT_EQ(hex(encode(msgpack, 0)), "00");
+  EXPECT_EQ(hex(encode(msgpack, 127)), "7f");
+  EXPECT_EQ(hex(encode(msgpack, 128)), "cc80");
+  EXPECT_EQ(hex(encode(msgpack, 65536)), "ce00010000");
+  EXPECT_EQ(hex(encode(msgpack, -1)), "ff");
+  EXPECT_EQ(hex(encode(msgpack, -33)), "d0df");
+  EXPECT_EQ(hex(encode(msgpack, -1000)), "d1fc18");
+  EXPECT_EQ(hex(encode(msgpack, std::numeric_limits<int64_t>::min())),
+            "d38000000000000000");
+  EXPECT_EQ(hex(encode(msgpack, 1.5)), "ca3fc00000");
+  EXPECT_EQ(hex(encode(msgpack, 0.1)), "cb3fb999999999999a");
+  EXPECT_EQ(hex(encode(msgpack, true)), "c3");
+  EXPECT_EQ(hex(encode(msgpack, nullptr)), "c0");
+  EXPECT_EQ(hex(encode(msgpack, "abc")), "a3616263");
+  EXPECT_EQ(hex(encode(msgpack, std::string(32, 'a'))).substr(0, 4), "d920");
+  EXPECT_EQ(hex(encode(msgpack, eagle::bytes_of{"\x01"})), "c40101");
+  EXPECT_EQ(hex(encode(msgpack, eagle::array_of{16})), "dc0010");
+
+  std::stringbuf out;
+  eagle::value_encoder{msgpack, out} << eagle::map_of{1} << "a"
+                                     << eagle::array_of{2} << 1 << 2;
+  EXPECT_EQ(hex(out.str()), "81a161920102");
+}
+
+TEST(ValueEncodingTest, EncodesCbor) {
+  // The examples of RFC 8949, appendix A
+  auto cbor = eagle::body_format::cbor;
+  EXPECT_EQ(hex(encode(cbor, 23)), "17");
+  EXPECT_EQ(hex(encode(cbor, 24)), "1818");
+  EXPECT_EQ(hex(encode(cbor, 1000)), "1903e8");
+  EXPECT_EQ(hex(encode(cbor, 1000000000000)), "1b000000e8d4a51000");
+  EXPECT_EQ(hex(encode(cbor, -1)), "20");
+  EXPECT_EQ(hex(encode(cbor, -1000)), "3903e7");
+  EXPECT_EQ(hex(encode(cbor, 100000.0)), "fa47c35000");
+  EXPECT_EQ(hex(encode(cbor, 1.1)), "fb3ff199999999999a");
+  EXPECT_EQ(hex(encode(cbor, false)), "f4");
+  EXPECT_EQ(hex(encode(cbor, nullptr)), "f6");
+  EXPECT_EQ(hex(encode(cbor, "IETF")), "6449455446");
+  EXPECT_EQ(hex(encode(cbor, eagle::bytes_of{"\x01\x02"})), "420102");
+
+  std::stringbuf out;
+  eagle::value_encoder{cbor, out} << eagle::map_of{2} << "a" << 1 << "b"
+                                  << eagle::array_of{2} << 2 << 3;
+  EXPECT_EQ(hex(out.str()), "a26161016162820203");
+}
+
+TEST(ValueEncodingTest, EncodesJson) {
+  std::stringbuf out;
+  eagle::value_encoder{eagle::body_format::json, out}
+      << eagle::map_of{4} << "id" << -7 << "name" << "a \"b\"\n"
+      << "tags" << eagle::array_of{3} << 1.5 << nullptr << eagle::array_of{0}
+      << "ok" << true;
+  EXPECT_EQ(out.str(), R"({"id":-7,"name":"a \"b\"\u000a",)"
+                       R"("tags":[1.5,null,[]],"ok":true})");
+}
+
+TEST(ValueEncodingTest, ReadsWhatItEncodes) {
+  for (auto format : {eagle::body_format::msgpack, eagle::body_format::cbor}) {
+    std::stringbuf out;
+    eagle::value_encoder{format, out}
+        << eagle::array_of{7} << -300 << std::numeric_limits<uint64_t>::max()
+        << 0.1 << "name" << eagle::bytes_of{{"\x00\x01", 2}}
+        << eagle::map_of{0} << false;
+    auto bytes = out.str();
+
+    using kind = eagle::decoded_value::kind;
+    eagle::value_reader reader{format, bytes};
+    auto array = reader.next();
+    ASSERT_TRUE(array);
+    EXPECT_EQ(array->kind_, kind::array);
+    EXPECT_EQ(array->size_, 7);
+    EXPECT_EQ(reader.next()->integer_, -300);
+    EXPECT_EQ(reader.next()->unsigned_, std::numeric_limits<uint64_t>::max());
+    EXPECT_EQ(reader.next()->floating_, 0.1);
+
+    // Views of the body, not copies
+    auto name = reader.next();
+    EXPECT_EQ(name->kind_, kind::string);
+    EXPECT_EQ(name->string_, "name");
+    EXPECT_GE(name->string_.data(), bytes.data());
+    EXPECT_LT(name->string_.data(), bytes.data() + bytes.size());
+
+    EXPECT_EQ(reader.next()->kind_, kind::bytes);
+    EXPECT_EQ(reader.next()->kind_, kind::map);
+    EXPECT_EQ(reader.next()->kind_, kind::boolean);
+    EXPECT_FALSE(reader.next());
+    EXPECT_TRUE(reader.done());
+
+    auto cut = std::string_view{bytes}.substr(0, bytes.size() - 12);
+    eagle::value_reader truncated{format, cut};
+    while (truncated.next()) {
+    }
+    EXPECT_TRUE(truncated.failed());
+  }
+}
+
+TEST(ValueEncodingTest, ReadsHalfPrecisionCbor) {
+  std::string half{"\xf9\x3e\x00", 3};
+  auto value = eagle::value_reader{eagle::body_format::cbor, half}.next();
+  ASSERT_TRUE(value);
+  EXPECT_EQ(value->floating_, 1.5);
+}
+
+TEST(ValueEncodingTest, SkipsCborTags) {
+  // Tag 1 (epoch time) on 7, then a million nested tags on nothing
+  std::string tagged{"\xc1\x07", 2};
+  auto value = eagle::value_reader{eagle::body_format::cbor, tagged}.next();
+  ASSERT_TRUE(value);
+  EXPECT_EQ(value->integer_, 7);
+
+  std::string deep(1000000, '\xc6');
+  eagle::value_reader reader{eagle::body_format::cbor, deep};
+  EXPECT_FALSE(reader.next());
+  EXPECT_TRUE(reader.failed());
+
+  deep += '\x01';
+  value = eagle::value_reader{eagle::body_format::cbor, deep}.next();
+  ASSERT_TRUE(value);
+  EXPECT_EQ(value->integer_, 1);
+}
+
+TEST(ValueEncodingTest, NegotiatesTheFormat) {
+  using eagle::body_format;
+  EXPECT_EQ(eagle::negotiate_format(""), body_format::json);
+  EXPECT_EQ(eagle::negotiate_format("*/*"), body_format::json);
+  EXPECT_EQ(eagle::negotiate_format("application/msgpack"),
+            body_format::msgpack);
+  EXPECT_EQ(eagle::negotiate_format("application/x-msgpack"),
+            body_format::msgpack);
+  EXPECT_EQ(eagle::negotiate_format("application/cbor, application/json"),
+            body_format::cbor);
+  EXPECT_EQ(eagle::negotiate_format(
+                "application/json;q=0.5, application/CBOR;q=0.9, */*;q=0.1"),
+            body_format::cbor);
+  EXPECT_EQ(eagle::negotiate_format("application/cbor;q=0, text/html"),
+            body_format::json);
+}
+
+TEST(ValueEncodingTest, WritesTheBodies) {
+  eagle::response resp;
+  resp.msgpack() << eagle::map_of{1} << "id" << 1;
+  EXPECT_EQ(resp.writer_type(), eagle::writer_type::kmsgpack);
+  EXPECT_THROW(resp.json(), eagle::invalid_writer_operation);
+  resp.prepare_response();
+  EXPECT_EQ(resp.buffer()[http::field::content_type], "application/msgpack");
+  EXPECT_EQ(hex(beast::buffers_to_string(resp.buffer().body().data())),
+            "81a2696401");
+
+  eagle::response negotiated;
+  auto encoder = negotiated.encoder("application/json");
+  encoder << eagle::array_of{2} << 1 << 2;
+  EXPECT_EQ(negotiated.writer_type(), eagle::writer_type::kjson);
+  EXPECT_EQ(negotiated.buffer()[http::field::vary], "Accept");
+  negotiated.prepare_response();
+  EXPECT_EQ(beast::buffers_to_string(negotiated.buffer().body().data()),
+            "[1,2]");
+
+  eagle::request req;
+  beast::ostream(req.buffer().body()) << "\x92\x01\xa1x";
+  auto reader = req.msgpack();
+  EXPECT_EQ(reader.next()->size_, 2);
+  EXPECT_EQ(reader.next()->integer_, 1);
+  EXPECT_EQ(reader.next()->string_, "x");
+  EXPECT_TRUE(reader.done());
+}
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <thread>
+
+#include "app.hpp"
+#include "test_utils.hpp"
+#include "websocket.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+class websocket_server {
+ public:
+  explicit websocket_server(eagle::websocket_handler handler) {
+    auto& app = server_.app();
+    app.websocket("/ws", std::move(handler));
+    app.handle(http::verb::get, "/ws", [](const auto&, auto& resp) {
+      resp.html() << "plain";
+      return true;
+    });
+    server_.start();
+  }
+
+  websocket::stream<tcp::socket> connect(std::string_view target = "/ws") {
+    websocket::stream<tcp::socket> ws{ioc_};
+    ws.next_layer().connect(server_.endpoint());
+    ws.handshake("127.0.0.1", beast::string_view{target.data(), target.size()});
+    return ws;
+  }
+
+  uint16_t port() const { return server_.port(); }
+
+ private:
+  net::io_context ioc_;
+  loopback_server server_;
+};
+
+std::string read_message(websocket::stream<tcp::socket>& ws) {
+  beast::flat_buffer buffer;
+  ws.read(buffer);
+  return beast::buffers_to_string(buffer.data());
+}
+
+}  // namespace
+
+TEST(WebsocketTest, Echo) {
+  eagle::websocket_handler handler;
+  handler.on_message_ = [](const auto& session, std::string_view message,
+                           bool binary) {
+    session->send(std::string(message), binary);
+  };
+  websocket_server server{std::move(handler)};
+
+  auto ws = server.connect("/ws?client=1");
+  ws.write(net::buffer(std::string("hello")));
+  EXPECT_EQ(read_message(ws), "hello");
+  EXPECT_FALSE(ws.got_binary());
+
+  ws.binary(true);
+  ws.write(net::buffer(std::string("\x01\x02", 2)));
+  EXPECT_EQ(read_message(ws), std::string("\x01\x02", 2));
+  EXPECT_TRUE(ws.got_binary());
+
+  ws.close(websocket::close_code::normal);
+}
+
+TEST(WebsocketTest, PlainRequestsStillReachHandlers) {
+  websocket_server server{eagle::websocket_handler{}};
+
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  socket.connect({net::ip::make_address("127.0.0.1"), server.port()});
+  http::request<http::empty_body> req{http::verb::get, "/ws", 11};
+  http::write(socket, req);
+
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  http::read(socket, buffer, resp);
+  EXPECT_EQ(resp.body(), "plain");
+}
+
+TEST(WebsocketTest, InterceptorsCanRefuseTheUpgrade) {
+  loopback_server server;
+  auto& app = server.app();
+  app.intercept([](const auto& req, auto& resp) {
+    if (req.header(http::field::authorization).empty()) {
+      resp.result(http::status::unauthorized);
+      resp.finish();
+    }
+  });
+  std::promise<std::string> opened;
+  eagle::websocket_handler handler;
+  handler.on_open_ = [&](const auto& session) {
+    opened.set_value(std::string(session->header("Authorization")));
+  };
+  app.websocket("/ws", std::move(handler));
+  server.start();
+
+  net::io_context ioc;
+  tcp::socket refused{ioc};
+  refused.connect(server.endpoint());
+  http::request<http::empty_body> req{http::verb::get, "/ws", 11};
+  req.set(http::field::upgrade, "websocket");
+  req.set(http::field::connection, "Upgrade");
+  req.set(http::field::sec_websocket_key, "dGhlIHNhbXBsZSBub25jZQ==");
+  req.set(http::field::sec_websocket_version, "13");
+  http::write(refused, req);
+  beast::flat_buffer buffer;
+  http::response<http::string_body> resp;
+  http::read(refused, buffer, resp);
+  EXPECT_EQ(resp.result(), http::status::unauthorized);
+
+  websocket::stream<tcp::socket> accepted{ioc};
+  accepted.next_layer().connect(server.endpoint());
+  accepted.set_option(websocket::stream_base::decorator(
+      [](websocket::request_type& req) {
+        req.set(http::field::authorization, "Bearer token");
+      }));
+  accepted.handshake("127.0.0.1", "/ws");
+  EXPECT_EQ(opened.get_future().get(), "Bearer token");
+  accepted.close(websocket::close_code::normal);
+}
+
+TEST(WebsocketTest, HubBroadcastsToSubscribers) {
+  eagle::websocket_hub hub;
+  std::atomic<int> opened{0};
+  std::atomic<int> closed{0};
+
+  eagle::websocket_handler handler;
+  handler.on_open_ = [&](const auto& session) {
+    hub.subscribe("news", session);
+    opened++;
+  };
+  handler.on_close_ = [&](const auto& session) {
+    hub.unsubscribe("news", session.get());
+    closed++;
+  };
+  websocket_server server{std::move(handler)};
+
+  std::vector<websocket::stream<tcp::socket>> clients;
+  for (int idx = 0; idx < 3; idx++) {
+    clients.push_back(server.connect());
+  }
+  while (opened < 3) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  EXPECT_EQ(hub.subscribers("news"), 3);
+  EXPECT_EQ(hub.publish("news", "breaking"), 3);
+  EXPECT_EQ(hub.publish("sports", "goal"), 0);
+
+  for (auto& client : clients) {
+    EXPECT_EQ(read_message(client), "breaking");
+  }
+
+  clients.front().close(websocket::close_code::normal);
+  while (closed < 1) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_EQ(hub.subscribers("news"), 2);
+}
+
+TEST(WebsocketTest, SlowSubscriberDropsOldest) {
+  std::promise<eagle::websocket_session_ptr> opened;
+
+  eagle::websocket_handler handler;
+  handler.options_.max_queue_ = 4;
+  handler.on_open_ = [&](const auto& session) { opened.set_value(session); };
+  websocket_server server{std::move(handler)};
+
+  // The client never reads, the socket buffers fill up then the queue
+  auto client = server.connect();
+  auto session = opened.get_future().get();
+
+  auto frame = eagle::make_websocket_frame(std::string(256 * 1024, 'x'));
+  for (int idx = 0; idx < 200; idx++) {
+    EXPECT_TRUE(session->send(frame));
+  }
+
+  EXPECT_GT(session->dropped(), 0);
+}
+
+TEST(WebsocketTest, SlowSubscriberDisconnects) {
+  std::promise<eagle::websocket_session_ptr> opened;
+
+  eagle::websocket_handler handler;
+  handler.options_.max_queue_ = 4;
+  handler.options_.overflow_ = eagle::websocket_overflow::disconnect;
+  handler.on_open_ = [&](const auto& session) { opened.set_value(session); };
+  websocket_server server{std::move(handler)};
+
+  auto client = server.connect();
+  auto session = opened.get_future().get();
+
+  auto frame = eagle::make_websocket_frame(std::string(256 * 1024, 'x'));
+  bool rejected = false;
+  for (int idx = 0; idx < 200 && !rejected; idx++) {
+    rejected = !session->send(frame);
+  }
+
+  EXPECT_TRUE(rejected);
+  EXPECT_EQ(session->dropped(), 1);
+  EXPECT_FALSE(session->send(frame));
+}